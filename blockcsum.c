@@ -0,0 +1,151 @@
+// Block checksummed storage format
+//
+// Verification hashes four blocks at a time with spooky_hash128_x4, which
+// keeps the four independent hash chains in the lanes of vector registers
+// instead of waiting on one chain per block.
+
+#include <stdlib.h>
+#include <string.h>
+#include "spooky-c.h"
+#include "util.h"
+#include "blockcsum.h"
+
+static inline const uint8_t *block_at(const void *blocks, size_t i)
+{
+	return (const uint8_t *)blocks + i * BC_BLOCK;
+}
+
+static inline uint64_t stored_sum(const uint8_t *b)
+{
+	uint64_t v;
+
+	memcpy(&v, b + BC_PAYLOAD, sizeof(uint64_t));
+	return v;
+}
+
+uint64_t bc_checksum(const void *block, uint64_t blockno, uint64_t fileid)
+{
+	uint64_t h1 = blockno, h2 = fileid;
+
+	spooky_hash128(block, BC_PAYLOAD, &h1, &h2);
+	return h1;
+}
+
+void bc_seal(void *blocks, size_t n, uint64_t first, uint64_t fileid)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		uint8_t *b = (uint8_t *)blocks + i * BC_BLOCK;
+		uint64_t sum = bc_checksum(b, first + i, fileid);
+
+		memcpy(b + BC_PAYLOAD, &sum, sizeof(uint64_t));
+	}
+}
+
+size_t bc_verify(const void *blocks, size_t n, uint64_t first, uint64_t fileid,
+		 size_t *bad, size_t maxbad)
+{
+	size_t i, nbad = 0;
+	int k;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		const void *msg[4];
+		uint64_t h1[4], h2[4];
+
+		for (k = 0; k < 4; k++) {
+			msg[k] = block_at(blocks, i + k);
+			h1[k] = first + i + k;
+			h2[k] = fileid;
+		}
+		spooky_hash128_x4(msg, BC_PAYLOAD, h1, h2);
+		for (k = 0; k < 4; k++) {
+			if (h1[k] == stored_sum(msg[k]))
+				continue;
+			if (nbad < maxbad)
+				bad[nbad] = i + k;
+			nbad++;
+		}
+	}
+	for (; i < n; i++) {
+		const uint8_t *b = block_at(blocks, i);
+
+		if (bc_checksum(b, first + i, fileid) == stored_sum(b))
+			continue;
+		if (nbad < maxbad)
+			bad[nbad] = i;
+		nbad++;
+	}
+	return nbad;
+}
+
+struct verify_job
+{
+	const void *blocks;
+	size_t n;
+	uint64_t first;
+	uint64_t fileid;
+	size_t *bad;
+	size_t maxbad;
+	size_t nbad;
+};
+
+static void *verify_worker(void *arg)
+{
+	struct verify_job *j = arg;
+
+	j->nbad = bc_verify(j->blocks, j->n, j->first, j->fileid, j->bad,
+			    j->maxbad);
+	return NULL;
+}
+
+size_t bc_verify_parallel(const void *blocks, size_t n, uint64_t first,
+			  uint64_t fileid, int nthreads,
+			  size_t *bad, size_t maxbad)
+{
+	struct verify_job job[nthreads > 0 ? nthreads : 1];
+	size_t per, start = 0, nbad = 0;
+	int i, nomem = 0;
+
+	if (nthreads <= 1 || n < 4 * (size_t)nthreads)
+		return bc_verify(blocks, n, first, fileid, bad, maxbad);
+
+	// multiples of four blocks per thread keep every thread on the x4 path
+	per = ((n / nthreads) + 3) & ~(size_t)3;
+	for (i = 0; i < nthreads; i++) {
+		size_t cnt = start < n ? n - start : 0;
+
+		if (cnt > per && i < nthreads - 1)
+			cnt = per;
+		job[i].blocks = block_at(blocks, start);
+		job[i].n = cnt;
+		job[i].first = first + start;
+		job[i].fileid = fileid;
+		job[i].bad = maxbad ? malloc(maxbad * sizeof(size_t)) : NULL;
+		job[i].maxbad = maxbad;
+		if (maxbad && !job[i].bad)
+			nomem = 1;
+		start += cnt;
+	}
+	// without room for every thread's failures, verify on this thread
+	if (nomem) {
+		for (i = 0; i < nthreads; i++)
+			free(job[i].bad);
+		return bc_verify(blocks, n, first, fileid, bad, maxbad);
+	}
+	run_jobs(job, sizeof(job[0]), nthreads, verify_worker);
+
+	start = 0;
+	for (i = 0; i < nthreads; i++) {
+		size_t k;
+
+		for (k = 0; k < job[i].nbad && k < job[i].maxbad; k++) {
+			if (nbad + k < maxbad)
+				bad[nbad + k] = job[i].bad[k] + start;
+		}
+		nbad += job[i].nbad;
+		start += job[i].n;
+		free(job[i].bad);
+	}
+	return nbad;
+}
@@ -0,0 +1,30 @@
+// Block checksummed storage format
+//
+// Data is stored in BC_BLOCK byte blocks.  The last 8 bytes of every block
+// hold a little endian spooky hash of the payload before it.  The hash is
+// seeded with the block number and a file id, so a block written to the
+// wrong place or into the wrong file fails verification even though its
+// contents are intact.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BC_BLOCK	4096
+#define BC_PAYLOAD	(BC_BLOCK - sizeof(uint64_t))
+
+uint64_t bc_checksum(const void *block, uint64_t blockno, uint64_t fileid);
+
+// fill in the checksums of n consecutive blocks starting at block number first
+void bc_seal(void *blocks, size_t n, uint64_t first, uint64_t fileid);
+
+// Check n consecutive blocks starting at block number first.  Indexes
+// (relative to blocks) of up to maxbad failing blocks are stored in bad,
+// in ascending order.  Returns the number of failing blocks.
+size_t bc_verify(const void *blocks, size_t n, uint64_t first, uint64_t fileid,
+		 size_t *bad, size_t maxbad);
+
+// the same split over nthreads threads
+size_t bc_verify_parallel(const void *blocks, size_t n, uint64_t first,
+			  uint64_t fileid, int nthreads,
+			  size_t *bad, size_t maxbad);
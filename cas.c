@@ -0,0 +1,680 @@
+// Content addressed object store
+//
+// Inserts are split into a serial step, which checks the filter and the
+// indexes and reserves space in the open pack, and the copying of the
+// data, which in a batch runs on all threads with pwrite at the reserved
+// offsets.  The open pack's entries are found through a small open
+// addressing table until the pack is sealed.
+
+#define _GNU_SOURCE 1
+#include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "spooky-c.h"
+#include "map.h"
+#include "util.h"
+#include "cas.h"
+
+#define CAS_MAGIC 0x31736163796b6f6fULL	// "ookycas1"
+#define RBITS 8
+#define MIN_QBITS 10
+#define WRITE_BUF (1 << 20)
+
+#define OP_HASH 0
+#define OP_WRITE 1
+#define OP_SIZE 2
+
+struct job
+{
+	struct cas *c;
+	int op;
+	int err;
+	size_t begin;
+	size_t end;
+	const void *const *data;
+	const size_t *sizes;
+	uint64_t (*ids)[2];
+	const uint64_t *offset;	// where to write, or UINT64_MAX
+	int64_t *out;
+};
+
+void cas_id(const void *data, size_t size, uint64_t id[2])
+{
+	id[0] = id[1] = 0;
+	spooky_hash128(data, size, &id[0], &id[1]);
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+	const struct cas_entry *x = a, *y = b;
+
+	if (x->id[0] != y->id[0])
+		return x->id[0] < y->id[0] ? -1 : 1;
+	return (x->id[1] > y->id[1]) - (x->id[1] < y->id[1]);
+}
+
+static void pack_path(const struct cas *c, unsigned n, const char *ext,
+		      char *path, size_t size)
+{
+	snprintf(path, size, "%s/pack-%06u.%s", c->dir, n, ext);
+}
+
+static const struct cas_entry *find_sealed(const struct cas_pack *p,
+					   const uint64_t id[2])
+{
+	unsigned b = id[0] >> 56;
+	size_t lo = b ? p->idx->fanout[b - 1] : 0, hi = p->idx->fanout[b];
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct cas_entry *e = &p->e[mid];
+
+		if (e->id[0] == id[0] && e->id[1] == id[1])
+			return e;
+		if (e->id[0] < id[0] || (e->id[0] == id[0] && e->id[1] < id[1]))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+static const struct cas_entry *find_pending(const struct cas *c,
+					    const uint64_t id[2])
+{
+	size_t i;
+
+	if (!c->slot)
+		return NULL;
+	for (i = id[0] & c->mask; c->slot[i]; i = (i + 1) & c->mask) {
+		const struct cas_entry *e = &c->pending[c->slot[i] - 1];
+
+		if (e->id[0] == id[0] && e->id[1] == id[1])
+			return e;
+	}
+	return NULL;
+}
+
+// the entry of id and whether it is in the open pack
+static const struct cas_entry *find(const struct cas *c, const uint64_t id[2],
+				    const struct cas_pack **pack)
+{
+	const struct cas_entry *e = find_pending(c, id);
+	int i;
+
+	*pack = NULL;
+	if (e)
+		return e;
+	for (i = c->npacks - 1; i >= 0; i--) {
+		e = find_sealed(&c->pack[i], id);
+		if (e) {
+			*pack = &c->pack[i];
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static inline uint64_t fingerprint(const struct cas *c, const uint64_t id[2])
+{
+	unsigned bits = c->filter.h->qbits + c->filter.h->rbits;
+
+	return id[0] & (bits == 64 ? ~0ULL : (1ULL << bits) - 1);
+}
+
+static int build_filter(struct cas *c, unsigned qbits)
+{
+	struct cqf qf;
+	size_t i, k;
+	int p;
+
+	if (cqf_init(&qf, qbits, RBITS, 0) < 0)
+		return -1;
+	if (c->filter.h)
+		cqf_free(&c->filter);
+	c->filter = qf;
+	for (p = 0; p < c->npacks; p++)
+		for (k = 0; k < c->pack[p].idx->n; k++)
+			if (cqf_insert_fp(&c->filter,
+					  fingerprint(c, c->pack[p].e[k].id), 1) < 0)
+				return -1;
+	for (i = 0; i < c->npending; i++)
+		if (cqf_insert_fp(&c->filter,
+				  fingerprint(c, c->pending[i].id), 1) < 0)
+			return -1;
+	return 0;
+}
+
+// grow the filter once for n more ids instead of doubling repeatedly
+static int filter_reserve(struct cas *c, uint64_t n)
+{
+	unsigned qbits = c->filter.h->qbits;
+
+	while ((3ULL << qbits) / 4 < c->filter.h->ndistinct + n)
+		qbits++;
+	return qbits == c->filter.h->qbits ? 0 : build_filter(c, qbits);
+}
+
+static int filter_add(struct cas *c, const uint64_t id[2])
+{
+	unsigned qbits = c->filter.h->qbits;
+
+	// stay below 3/4 of the home slots, where the filter is still fast
+	if (c->filter.h->ndistinct + 1 > (3ULL << qbits) / 4) {
+		if (build_filter(c, ++qbits) < 0)
+			return -1;
+	}
+	if (cqf_insert_fp(&c->filter, fingerprint(c, id), 1) == 0)
+		return 0;
+	// clustered so badly that the overflow slots ran out
+	if (build_filter(c, qbits + 1) < 0)
+		return -1;
+	return cqf_insert_fp(&c->filter, fingerprint(c, id), 1);
+}
+
+// fill the slot table from the pending entries, in their current order
+static void rebuild_slots(struct cas *c)
+{
+	size_t i;
+
+	memset(c->slot, 0, (c->mask + 1) * sizeof(uint64_t));
+	for (i = 0; i < c->npending; i++) {
+		size_t k = c->pending[i].id[0] & c->mask;
+
+		while (c->slot[k])
+			k = (k + 1) & c->mask;
+		c->slot[k] = i + 1;
+	}
+}
+
+static int pending_add(struct cas *c, const uint64_t id[2], uint64_t offset,
+		       uint64_t size)
+{
+	size_t i;
+
+	if (c->npending == c->cap) {
+		size_t cap = c->cap ? 2 * c->cap : 1024;
+		struct cas_entry *n = realloc(c->pending, cap * sizeof(*n));
+
+		if (!n)
+			return -1;
+		c->pending = n;
+		c->cap = cap;
+	}
+	if (!c->slot || 2 * (c->npending + 1) > c->mask + 1) {
+		size_t nslots = c->slot ? 2 * (c->mask + 1) : 2048;
+		uint64_t *s = calloc(nslots, sizeof(uint64_t));
+
+		if (!s)
+			return -1;
+		free(c->slot);
+		c->slot = s;
+		c->mask = nslots - 1;
+		rebuild_slots(c);
+	}
+	c->pending[c->npending].id[0] = id[0];
+	c->pending[c->npending].id[1] = id[1];
+	c->pending[c->npending].offset = offset;
+	c->pending[c->npending].size = size;
+	for (i = id[0] & c->mask; c->slot[i]; i = (i + 1) & c->mask)
+		;
+	c->slot[i] = ++c->npending;
+	return 0;
+}
+
+// 1 and the offset to write to for a new object, 0 for a known one
+static int reserve(struct cas *c, const uint64_t id[2], uint64_t size,
+		   uint64_t *offset)
+{
+	const struct cas_pack *pack;
+
+	if (cqf_count_fp(&c->filter, fingerprint(c, id)) == 0)
+		c->nfiltered++;
+	else if (find(c, id, &pack))
+		return 0;
+	if (c->fd < 0) {
+		char path[strlen(c->dir) + 32];
+
+		pack_path(c, c->next, "pack", path, sizeof(path));
+		c->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (c->fd < 0)
+			return -1;
+		c->pack_size = 0;
+	}
+	if (pending_add(c, id, c->pack_size, size) < 0 || filter_add(c, id) < 0)
+		return -1;
+	*offset = c->pack_size;
+	c->pack_size += size;
+	return 1;
+}
+
+// drop the open pack after a failed write
+static void discard(struct cas *c)
+{
+	char path[strlen(c->dir) + 32];
+
+	if (c->fd < 0)
+		return;
+	close(c->fd);
+	c->fd = -1;
+	pack_path(c, c->next, "pack", path, sizeof(path));
+	unlink(path);
+	c->npending = 0;
+	if (c->slot)
+		memset(c->slot, 0, (c->mask + 1) * sizeof(uint64_t));
+	build_filter(c, c->filter.h->qbits);
+}
+
+static int add_pack(struct cas *c, unsigned n)
+{
+	char path[strlen(c->dir) + 32];
+	struct cas_pack p, *np;
+
+	memset(&p, 0, sizeof(p));
+	pack_path(c, n, "idx", path, sizeof(path));
+	p.idx = (struct cas_idx_header *)mapfile(path, O_RDONLY, &p.idx_size);
+	if (!p.idx)
+		return -1;
+	if (p.idx_size < sizeof(struct cas_idx_header) ||
+	    p.idx->magic != CAS_MAGIC ||
+	    p.idx_size != sizeof(struct cas_idx_header) +
+			  p.idx->n * sizeof(struct cas_entry) ||
+	    p.idx->fanout[255] != p.idx->n)
+		goto bad;
+	p.e = (struct cas_entry *)(p.idx + 1);
+	if (p.idx->pack_size > 0) {
+		pack_path(c, n, "pack", path, sizeof(path));
+		p.map = mapfile(path, O_RDONLY, &p.size);
+		if (!p.map || p.size != p.idx->pack_size)
+			goto bad;
+	}
+	np = realloc(c->pack, (c->npacks + 1) * sizeof(*np));
+	if (!np)
+		goto bad;
+	c->pack = np;
+	c->pack[c->npacks++] = p;
+	return 0;
+
+bad:
+	if (p.map)
+		unmap_file(p.map, p.size);
+	unmap_file((char *)p.idx, p.idx_size);
+	errno = EINVAL;
+	return -1;
+}
+
+int cas_flush(struct cas *c)
+{
+	char path[strlen(c->dir) + 32], tmp[strlen(c->dir) + 32];
+	struct cas_idx_header h;
+	size_t i;
+	int fd;
+
+	if (c->fd < 0)
+		return 0;
+	if (fdatasync(c->fd) < 0) {
+		discard(c);
+		return -1;
+	}
+	close(c->fd);
+	c->fd = -1;
+
+	qsort(c->pending, c->npending, sizeof(struct cas_entry), cmp_entry);
+	memset(&h, 0, sizeof(h));
+	h.magic = CAS_MAGIC;
+	h.n = c->npending;
+	h.pack_size = c->pack_size;
+	for (i = 0; i < c->npending; i++)
+		h.fanout[c->pending[i].id[0] >> 56]++;
+	for (i = 1; i < 256; i++)
+		h.fanout[i] += h.fanout[i - 1];
+
+	// the index appears under its name only once it is complete
+	pack_path(c, c->next, "idx", path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto fail;
+	if (write_all(fd, &h, sizeof(h), 0) < 0 ||
+	    write_all(fd, c->pending, c->npending * sizeof(struct cas_entry),
+		      sizeof(h)) < 0 ||
+	    fdatasync(fd) < 0) {
+		close(fd);
+		unlink(tmp);
+		goto fail;
+	}
+	close(fd);
+	if (rename(tmp, path) < 0) {
+		unlink(tmp);
+		goto fail;
+	}
+	c->npending = 0;
+	if (c->slot)
+		memset(c->slot, 0, (c->mask + 1) * sizeof(uint64_t));
+	return add_pack(c, c->next++);
+
+fail:
+	// reopen the pack so its objects are not lost; they were sorted for
+	// the index, so the slots have to follow
+	pack_path(c, c->next, "pack", path, sizeof(path));
+	c->fd = open(path, O_RDWR);
+	if (c->fd < 0)
+		discard(c);
+	else if (c->slot)
+		rebuild_slots(c);
+	return -1;
+}
+
+static int add_number(unsigned **v, size_t *n, size_t *cap, unsigned x)
+{
+	if (*n == *cap) {
+		size_t ncap = *cap ? 2 * *cap : 16;
+		unsigned *nv = realloc(*v, ncap * sizeof(unsigned));
+
+		if (!nv)
+			return -1;
+		*v = nv;
+		*cap = ncap;
+	}
+	(*v)[(*n)++] = x;
+	return 0;
+}
+
+static int cmp_unsigned(const void *a, const void *b)
+{
+	const unsigned *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+int cas_open(struct cas *c, const char *dir, uint64_t pack_max)
+{
+	unsigned *idx = NULL, n;
+	size_t nidx = 0, cap = 0, i;
+	struct dirent *de;
+	uint64_t total = 0;
+	unsigned qbits = MIN_QBITS;
+	DIR *d;
+	char ext[8];
+	int p;
+
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+	c->pack_max = pack_max;
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+		return -1;
+	c->dir = strdup(dir);
+	d = opendir(dir);
+	if (!c->dir || !d)
+		goto fail;
+	while ((de = readdir(d)) != NULL) {
+		if (sscanf(de->d_name, "pack-%u.%7s", &n, ext) != 2)
+			continue;
+		if (n >= c->next)
+			c->next = n + 1;
+		if (strcmp(ext, "idx") == 0 && add_number(&idx, &nidx, &cap, n) < 0)
+			goto fail;
+	}
+
+	// oldest first, so lookups can search the newest first
+	qsort(idx, nidx, sizeof(unsigned), cmp_unsigned);
+	for (i = 0; i < nidx; i++)
+		if (add_pack(c, idx[i]) < 0)
+			goto fail;
+
+	// packs without an index, and half written indexes, were never
+	// finished
+	rewinddir(d);
+	while ((de = readdir(d)) != NULL) {
+		char path[strlen(dir) + strlen(de->d_name) + 2];
+
+		if (sscanf(de->d_name, "pack-%u.%7s", &n, ext) != 2 ||
+		    strcmp(ext, "idx") == 0 ||
+		    (strcmp(ext, "pack") == 0 &&
+		     bsearch(&n, idx, nidx, sizeof(unsigned), cmp_unsigned)))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		unlink(path);
+	}
+	closedir(d);
+	d = NULL;
+	free(idx);
+	idx = NULL;
+
+	for (p = 0; p < c->npacks; p++)
+		total += c->pack[p].idx->n;
+	while ((3ULL << qbits) / 4 < 2 * total)
+		qbits++;
+	if (build_filter(c, qbits) < 0)
+		goto fail;
+	return 0;
+
+fail:
+	if (d)
+		closedir(d);
+	free(idx);
+	cas_close(c);
+	return -1;
+}
+
+int cas_close(struct cas *c)
+{
+	int ret = 0, i;
+
+	if (c->dir && c->fd >= 0)
+		ret = cas_flush(c);
+	if (c->fd >= 0)
+		close(c->fd);
+	for (i = 0; i < c->npacks; i++) {
+		if (c->pack[i].map)
+			unmap_file(c->pack[i].map, c->pack[i].size);
+		unmap_file((char *)c->pack[i].idx, c->pack[i].idx_size);
+	}
+	free(c->pack);
+	free(c->pending);
+	free(c->slot);
+	free(c->dir);
+	if (c->filter.h)
+		cqf_free(&c->filter);
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+	return ret;
+}
+
+int cas_put(struct cas *c, const void *data, size_t size, uint64_t id[2])
+{
+	uint64_t offset;
+	int r;
+
+	cas_id(data, size, id);
+	r = reserve(c, id, size, &offset);
+	if (r <= 0) {
+		if (r < 0)
+			discard(c);
+		return r;
+	}
+	if (write_all(c->fd, data, size, offset) < 0) {
+		discard(c);
+		return -1;
+	}
+	if (c->pack_size >= c->pack_max && cas_flush(c) < 0)
+		return -1;
+	return 1;
+}
+
+int64_t cas_size(const struct cas *c, const uint64_t id[2])
+{
+	const struct cas_pack *pack;
+	const struct cas_entry *e = find(c, id, &pack);
+
+	return e ? (int64_t)e->size : -1;
+}
+
+int64_t cas_read(const struct cas *c, const uint64_t id[2], void *buf,
+		 size_t bufsize)
+{
+	const struct cas_pack *pack;
+	const struct cas_entry *e = find(c, id, &pack);
+	size_t n;
+
+	if (!e)
+		return -1;
+	n = e->size < bufsize ? e->size : bufsize;
+	if (pack) {
+		memcpy(buf, pack->map + e->offset, n);
+	} else {
+		size_t done = 0;
+
+		while (done < n) {
+			ssize_t r = pread(c->fd, (char *)buf + done, n - done,
+					  e->offset + done);
+
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r <= 0)
+				return -1;
+			done += r;
+		}
+	}
+	return e->size;
+}
+
+// The new objects of a range were reserved back to back, so they are
+// gathered into large writes instead of one system call per object.
+static void write_objects(struct job *j)
+{
+	char *buf = malloc(WRITE_BUF);
+	uint64_t start = 0;
+	size_t fill = 0, i;
+
+	for (i = j->begin; i < j->end; i++) {
+		if (j->offset[i] == UINT64_MAX)
+			continue;
+		if (buf && fill + j->sizes[i] <= WRITE_BUF) {
+			if (fill == 0)
+				start = j->offset[i];
+			memcpy(buf + fill, j->data[i], j->sizes[i]);
+			fill += j->sizes[i];
+			continue;
+		}
+		if (fill && write_all(j->c->fd, buf, fill, start) < 0)
+			j->err = 1;
+		fill = 0;
+		if (buf && j->sizes[i] <= WRITE_BUF) {
+			start = j->offset[i];
+			memcpy(buf, j->data[i], j->sizes[i]);
+			fill = j->sizes[i];
+		} else if (write_all(j->c->fd, j->data[i], j->sizes[i],
+				     j->offset[i]) < 0) {
+			j->err = 1;
+		}
+	}
+	if (fill && write_all(j->c->fd, buf, fill, start) < 0)
+		j->err = 1;
+	free(buf);
+}
+
+static void *worker(void *arg)
+{
+	struct job *j = arg;
+	size_t i;
+
+	if (j->op == OP_WRITE) {
+		write_objects(j);
+		return NULL;
+	}
+	for (i = j->begin; i < j->end; i++) {
+		if (j->op == OP_HASH)
+			cas_id(j->data[i], j->sizes[i], j->ids[i]);
+		else
+			j->out[i] = cas_size(j->c, j->ids[i]);
+	}
+	return NULL;
+}
+
+// run op over n items with nthreads threads, returns whether any failed
+static int run_op(struct job *proto, size_t n, int nthreads)
+{
+	int i, err = 0;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if ((size_t)nthreads > n / 64 + 1)
+		nthreads = n / 64 + 1;
+	{
+		struct job job[nthreads];
+
+		for (i = 0; i < nthreads; i++) {
+			job[i] = *proto;
+			job[i].begin = n * i / nthreads;
+			job[i].end = n * (i + 1) / nthreads;
+		}
+		run_jobs(job, sizeof(job[0]), nthreads, worker);
+		for (i = 0; i < nthreads; i++)
+			err |= job[i].err;
+	}
+	return err;
+}
+
+ssize_t cas_put_batch(struct cas *c, const void *const *data,
+		      const size_t *sizes, size_t n, uint64_t (*ids)[2],
+		      int nthreads)
+{
+	uint64_t *offset = malloc((n ? n : 1) * sizeof(uint64_t));
+	struct job j;
+	ssize_t added = 0;
+	size_t i;
+
+	if (!offset)
+		return -1;
+	memset(&j, 0, sizeof(j));
+	j.c = c;
+	j.data = data;
+	j.sizes = sizes;
+	j.ids = ids;
+	j.offset = offset;
+	j.op = OP_HASH;
+	run_op(&j, n, nthreads);
+	if (filter_reserve(c, n) < 0)
+		goto fail;
+
+	for (i = 0; i < n; i++) {
+		int r = reserve(c, ids[i], sizes[i], &offset[i]);
+
+		if (r < 0)
+			goto fail;
+		if (r == 0)
+			offset[i] = UINT64_MAX;
+		added += r;
+	}
+	j.op = OP_WRITE;
+	if (added && run_op(&j, n, nthreads))
+		goto fail;
+	free(offset);
+	if (c->pack_size >= c->pack_max && cas_flush(c) < 0)
+		return -1;
+	return added;
+
+fail:
+	discard(c);
+	free(offset);
+	return -1;
+}
+
+void cas_size_batch(const struct cas *c, const uint64_t (*ids)[2], size_t n,
+		    int64_t *sizes, int nthreads)
+{
+	struct job j;
+
+	memset(&j, 0, sizeof(j));
+	j.c = (struct cas *)c;
+	j.ids = (uint64_t (*)[2])ids;
+	j.out = sizes;
+	j.op = OP_SIZE;
+	run_op(&j, n, nthreads);
+}
@@ -0,0 +1,96 @@
+// Content addressed object store
+//
+// Objects are named by the spooky_hash128 of their contents (seeds 0, 0),
+// so storing the same bytes twice stores them once.  A store is a
+// directory of numbered pack files.  Objects are appended to the open
+// pack back to back; when it grows past pack_max, or on cas_flush, the
+// pack is sealed by writing its index next to it: a header with a 256
+// entry fanout on the top byte of id[0], followed by the entries sorted
+// by id.  Sealed packs and their indexes are only read, through file
+// mappings, so opening a store costs one mapping per pack.
+//
+// Every id is also kept in a counting quotient filter (cqf.h), which is
+// rebuilt from the indexes on open.  An insert of a new object, the
+// common case for build artifacts, usually learns from the filter alone
+// that it has to be stored, without searching any index.
+//
+// A pack without an index was left by a writer that did not finish; its
+// objects were never visible and it is removed on open.  Objects are
+// found by searching the open pack's table and then every index, newest
+// first, so lookups get slower as packs accumulate.
+//
+// When writing an object fails, the open pack is dropped, and with it
+// the objects stored since the last seal.  Lookups may run concurrently
+// with each other, but not with inserts.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "cqf.h"
+
+struct cas_idx_header
+{
+	uint64_t magic;
+	uint64_t n;
+	uint64_t pack_size;
+	uint64_t fanout[256];	// entries with a top byte <= i
+};
+
+struct cas_entry
+{
+	uint64_t id[2];
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct cas_pack
+{
+	char *map;
+	size_t size;
+	struct cas_idx_header *idx;
+	size_t idx_size;
+	struct cas_entry *e;
+};
+
+struct cas
+{
+	char *dir;
+	uint64_t pack_max;
+	struct cas_pack *pack;	// sealed packs, oldest first
+	int npacks;
+	unsigned next;		// number of the next pack file
+	int fd;			// open pack, or -1
+	uint64_t pack_size;
+	struct cas_entry *pending;	// objects in the open pack
+	size_t npending;
+	size_t cap;
+	uint64_t *slot;		// pending index + 1, by id
+	size_t mask;
+	struct cqf filter;
+	uint64_t nfiltered;	// inserts the filter answered alone
+};
+
+int cas_open(struct cas *c, const char *dir, uint64_t pack_max);
+// seals the open pack
+int cas_close(struct cas *c);
+int cas_flush(struct cas *c);
+
+void cas_id(const void *data, size_t size, uint64_t id[2]);
+
+// 1 when stored, 0 when the store had it already, -1 on error
+int cas_put(struct cas *c, const void *data, size_t size, uint64_t id[2]);
+// size of the object, or -1 when it is not in the store
+int64_t cas_size(const struct cas *c, const uint64_t id[2]);
+// copies up to bufsize bytes, returns the object size or -1
+int64_t cas_read(const struct cas *c, const uint64_t id[2], void *buf,
+		 size_t bufsize);
+
+// The same as n calls, with ids, hashing and writing spread over
+// nthreads threads.  Returns the number of new objects or -1.
+ssize_t cas_put_batch(struct cas *c, const void *const *data,
+		      const size_t *sizes, size_t n, uint64_t (*ids)[2],
+		      int nthreads);
+// sizes[i] is -1 for ids not in the store
+void cas_size_batch(const struct cas *c, const uint64_t (*ids)[2], size_t n,
+		    int64_t *sizes, int nthreads);
@@ -0,0 +1,483 @@
+// Counting quotient filter on spooky fingerprints
+//
+// Slots use the classic quotient filter metadata (occupied, continuation,
+// shifted) plus a counter bit.  A run holds the entries of one quotient
+// sorted by remainder; each entry is a remainder slot followed by zero or
+// more counter slots that store count - 1 in base 2^rbits, least
+// significant digit first.  The table does not wrap around; instead there
+// are some slack slots past the last home slot for runs to spill into.
+
+#include <sys/fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spooky-c.h"
+#include "map.h"
+#include "cqf.h"
+
+#define CQF_MAGIC 0x31667163796b6f6fULL	// "ookycqf1"
+
+#define BITWORDS(n) (((n) + 63) / 64)
+
+static inline int getbit(const uint64_t *map, uint64_t i)
+{
+	return (map[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void setbit(uint64_t *map, uint64_t i, int v)
+{
+	if (v)
+		map[i / 64] |= 1ULL << (i % 64);
+	else
+		map[i / 64] &= ~(1ULL << (i % 64));
+}
+
+static inline uint64_t rmask(unsigned bits)
+{
+	return bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+}
+
+static uint64_t get_rem(const struct cqf *qf, uint64_t i)
+{
+	unsigned r = qf->h->rbits;
+	uint64_t bit = i * r;
+	uint64_t w = bit / 64;
+	unsigned off = bit % 64;
+	uint64_t v = qf->remainders[w] >> off;
+
+	if (off + r > 64)
+		v |= qf->remainders[w + 1] << (64 - off);
+	return v & rmask(r);
+}
+
+static void set_rem(struct cqf *qf, uint64_t i, uint64_t v)
+{
+	unsigned r = qf->h->rbits;
+	uint64_t bit = i * r;
+	uint64_t w = bit / 64;
+	unsigned off = bit % 64;
+	uint64_t m = rmask(r);
+
+	v &= m;
+	qf->remainders[w] = (qf->remainders[w] & ~(m << off)) | (v << off);
+	if (off + r > 64) {
+		unsigned hi = 64 - off;
+		qf->remainders[w + 1] = (qf->remainders[w + 1] & ~(m >> hi)) |
+					(v >> hi);
+	}
+}
+
+static inline int is_empty(const struct cqf *qf, uint64_t i)
+{
+	return !getbit(qf->occupied, i) && !getbit(qf->continuation, i) &&
+	       !getbit(qf->shifted, i);
+}
+
+static uint64_t nslots_for(unsigned qbits)
+{
+	return (1ULL << qbits) + (1ULL << qbits) / 32 + 64;
+}
+
+size_t cqf_size(unsigned qbits, unsigned rbits)
+{
+	uint64_t n = nslots_for(qbits);
+
+	return sizeof(struct cqf_header) +
+	       4 * BITWORDS(n) * sizeof(uint64_t) +
+	       (BITWORDS(n * rbits) + 1) * sizeof(uint64_t);
+}
+
+static void cqf_setup(struct cqf *qf, void *region, size_t size)
+{
+	uint64_t words;
+
+	qf->h = region;
+	qf->size = size;
+	words = BITWORDS(qf->h->nslots);
+	qf->occupied = (uint64_t *)(qf->h + 1);
+	qf->continuation = qf->occupied + words;
+	qf->shifted = qf->continuation + words;
+	qf->counter = qf->shifted + words;
+	qf->remainders = qf->counter + words;
+}
+
+static int valid_geometry(unsigned qbits, unsigned rbits)
+{
+	return qbits >= 1 && qbits <= 40 && rbits >= 2 && qbits + rbits <= 64;
+}
+
+static void init_header(struct cqf_header *h, unsigned qbits, unsigned rbits,
+			uint64_t seed)
+{
+	memset(h, 0, sizeof(struct cqf_header));
+	h->magic = CQF_MAGIC;
+	h->qbits = qbits;
+	h->rbits = rbits;
+	h->nslots = nslots_for(qbits);
+	h->seed = seed;
+}
+
+int cqf_init(struct cqf *qf, unsigned qbits, unsigned rbits, uint64_t seed)
+{
+	size_t size = cqf_size(qbits, rbits);
+	void *region;
+
+	if (!valid_geometry(qbits, rbits))
+		return -1;
+	region = calloc(1, size);
+	if (!region)
+		return -1;
+	init_header(region, qbits, rbits, seed);
+	cqf_setup(qf, region, size);
+	qf->mapped = 0;
+	return 0;
+}
+
+int cqf_create_file(struct cqf *qf, char *file, unsigned qbits, unsigned rbits,
+		    uint64_t seed)
+{
+	size_t size = cqf_size(qbits, rbits);
+	char *map;
+	int fd;
+
+	if (!valid_geometry(qbits, rbits))
+		return -1;
+	fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	map = mapfile(file, O_RDWR, &size);
+	if (!map)
+		return -1;
+	init_header((struct cqf_header *)map, qbits, rbits, seed);
+	cqf_setup(qf, map, size);
+	qf->mapped = 1;
+	return 0;
+}
+
+int cqf_open_file(struct cqf *qf, char *file)
+{
+	struct cqf_header *h;
+	size_t size;
+	char *map = mapfile(file, O_RDWR, &size);
+
+	if (!map)
+		return -1;
+	h = (struct cqf_header *)map;
+	if (size < sizeof(struct cqf_header) || h->magic != CQF_MAGIC ||
+	    !valid_geometry(h->qbits, h->rbits) ||
+	    size < cqf_size(h->qbits, h->rbits)) {
+		unmap_file(map, size);
+		return -1;
+	}
+	cqf_setup(qf, map, size);
+	qf->mapped = 1;
+	return 0;
+}
+
+void cqf_free(struct cqf *qf)
+{
+	if (qf->mapped)
+		unmap_file((char *)qf->h, qf->size);
+	else
+		free(qf->h);
+	qf->h = NULL;
+}
+
+uint64_t cqf_fingerprint(const struct cqf *qf, const void *key, size_t len)
+{
+	uint64_t h1 = qf->h->seed, h2 = qf->h->seed;
+
+	spooky_hash128(key, len, &h1, &h2);
+	return h1 & rmask(qf->h->qbits + qf->h->rbits);
+}
+
+// first slot of the run of quotient fq, whose occupied bit must be set
+static uint64_t run_start(const struct cqf *qf, uint64_t fq)
+{
+	uint64_t b = fq, s;
+
+	while (getbit(qf->shifted, b))
+		b--;
+	s = b;
+	while (b != fq) {
+		do
+			s++;
+		while (getbit(qf->continuation, s));
+		do
+			b++;
+		while (!getbit(qf->occupied, b));
+	}
+	return s;
+}
+
+// put a slot at pos, moving everything up to the next empty slot right
+static int insert_slot(struct cqf *qf, uint64_t pos, uint64_t fq,
+		       uint64_t rem, int cont, int cnt)
+{
+	uint64_t e = pos;
+
+	while (e < qf->h->nslots && !is_empty(qf, e))
+		e++;
+	if (e >= qf->h->nslots)
+		return -1;
+	for (; e > pos; e--) {
+		set_rem(qf, e, get_rem(qf, e - 1));
+		setbit(qf->continuation, e, getbit(qf->continuation, e - 1));
+		setbit(qf->counter, e, getbit(qf->counter, e - 1));
+		setbit(qf->shifted, e, 1);
+	}
+	set_rem(qf, pos, rem);
+	setbit(qf->continuation, pos, cont);
+	setbit(qf->counter, pos, cnt);
+	setbit(qf->shifted, pos, pos != fq);
+	qf->h->nused++;
+	return 0;
+}
+
+// base 2^rbits digits of v, the counter slots it takes
+static unsigned digits(const struct cqf *qf, uint64_t v)
+{
+	unsigned n = 0;
+
+	for (; v; v >>= qf->h->rbits)
+		n++;
+	return n;
+}
+
+// whether need slots can be inserted at or after pos: every insert takes
+// the first empty slot after it, and the table does not wrap around
+static int room(const struct cqf *qf, uint64_t pos, unsigned need)
+{
+	uint64_t i;
+
+	for (i = pos; need && i < qf->h->nslots; i++)
+		if (is_empty(qf, i))
+			need--;
+	return need == 0;
+}
+
+// write count - 1 into the counter slots after the remainder at p,
+// adding slots as needed.  k is the number of counter slots already there.
+static int store_count(struct cqf *qf, uint64_t p, uint64_t fq,
+		       unsigned k, uint64_t count)
+{
+	unsigned r = qf->h->rbits;
+	uint64_t v = count - 1;
+	unsigned j;
+
+	for (j = 0; v; j++, v >>= r) {
+		if (j < k)
+			set_rem(qf, p + 1 + j, v);
+		else if (insert_slot(qf, p + 1 + j, fq, v, 1, 1) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+// decode the counter slots after the remainder at p
+static uint64_t load_count(const struct cqf *qf, uint64_t p, unsigned *k)
+{
+	unsigned r = qf->h->rbits;
+	uint64_t v = 0;
+	unsigned j;
+
+	for (j = 0; p + 1 + j < qf->h->nslots && getbit(qf->counter, p + 1 + j);
+	     j++)
+		v |= get_rem(qf, p + 1 + j) << (j * r);
+	*k = j;
+	return v + 1;
+}
+
+int cqf_insert_fp(struct cqf *qf, uint64_t fp, uint64_t count)
+{
+	unsigned r = qf->h->rbits;
+	uint64_t fq = (fp >> r) & rmask(qf->h->qbits);
+	uint64_t fr = fp & rmask(r);
+	uint64_t s, p;
+	unsigned k;
+
+	if (count == 0)
+		return 0;
+
+	// All the slots an insert needs are checked for before anything is
+	// changed, so a full filter is left as it was.  Then neither
+	// insert_slot nor store_count can fail.
+	if (!getbit(qf->occupied, fq)) {
+		// an empty home slot is simply filled; otherwise the occupied
+		// bit must be set before looking for where the run goes
+		if (is_empty(qf, fq)) {
+			if (!room(qf, fq, 1 + digits(qf, count - 1)))
+				return -1;
+			set_rem(qf, fq, fr);
+			setbit(qf->counter, fq, 0);
+			setbit(qf->occupied, fq, 1);
+			qf->h->nused++;
+			s = fq;
+		} else {
+			setbit(qf->occupied, fq, 1);
+			s = run_start(qf, fq);
+			if (!room(qf, s, 1 + digits(qf, count - 1))) {
+				setbit(qf->occupied, fq, 0);
+				return -1;
+			}
+			insert_slot(qf, s, fq, fr, 0, 0);
+		}
+		store_count(qf, s, fq, 0, count);
+		goto added;
+	}
+
+	s = p = run_start(qf, fq);
+	for (;;) {
+		uint64_t rem = get_rem(qf, p);
+		uint64_t old = load_count(qf, p, &k);
+
+		if (rem == fr) {
+			unsigned need = digits(qf, old + count - 1);
+
+			if (need > k && !room(qf, p, need - k))
+				return -1;
+			store_count(qf, p, fq, k, old + count);
+			qf->h->nelts += count;
+			return 0;
+		}
+		if (rem > fr)
+			break;
+		p += 1 + k;
+		if (p >= qf->h->nslots || !getbit(qf->continuation, p))
+			break;
+	}
+	if (!room(qf, p, 1 + digits(qf, count - 1)))
+		return -1;
+	insert_slot(qf, p, fq, fr, p != s, 0);
+	if (p == s)
+		setbit(qf->continuation, s + 1, 1);
+	store_count(qf, p, fq, 0, count);
+added:
+	qf->h->ndistinct++;
+	qf->h->nelts += count;
+	return 0;
+}
+
+int cqf_insert(struct cqf *qf, const void *key, size_t len, uint64_t count)
+{
+	return cqf_insert_fp(qf, cqf_fingerprint(qf, key, len), count);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// Sorting first turns the inserts into a mostly sequential sweep over
+// the table and lets duplicates go in as a single counted insert.
+int cqf_insert_batch(struct cqf *qf, uint64_t *fps, size_t n)
+{
+	size_t i, j;
+
+	qsort(fps, n, sizeof(uint64_t), cmp_u64);
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && fps[j] == fps[i]; j++)
+			;
+		if (cqf_insert_fp(qf, fps[i], j - i) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+uint64_t cqf_count_fp(const struct cqf *qf, uint64_t fp)
+{
+	unsigned r = qf->h->rbits;
+	uint64_t fq = (fp >> r) & rmask(qf->h->qbits);
+	uint64_t fr = fp & rmask(r);
+	uint64_t p;
+	unsigned k;
+
+	if (!getbit(qf->occupied, fq))
+		return 0;
+	p = run_start(qf, fq);
+	for (;;) {
+		uint64_t rem = get_rem(qf, p);
+		uint64_t count = load_count(qf, p, &k);
+
+		if (rem == fr)
+			return count;
+		if (rem > fr)
+			return 0;
+		p += 1 + k;
+		if (p >= qf->h->nslots || !getbit(qf->continuation, p))
+			return 0;
+	}
+}
+
+uint64_t cqf_count(const struct cqf *qf, const void *key, size_t len)
+{
+	return cqf_count_fp(qf, cqf_fingerprint(qf, key, len));
+}
+
+int cqf_iterate(const struct cqf *qf, cqf_fn fn, void *arg)
+{
+	uint64_t i = 0, q = 0;
+	int started = 0;
+	unsigned k;
+	int ret;
+
+	while (i < qf->h->nslots) {
+		uint64_t rem, count;
+
+		if (is_empty(qf, i)) {
+			i++;
+			continue;
+		}
+		if (!getbit(qf->continuation, i)) {
+			if (started)
+				q++;
+			started = 1;
+			while (!getbit(qf->occupied, q))
+				q++;
+		}
+		rem = get_rem(qf, i);
+		count = load_count(qf, i, &k);
+		ret = fn((q << qf->h->rbits) | rem, count, arg);
+		if (ret)
+			return ret;
+		i += 1 + k;
+	}
+	return 0;
+}
+
+static int insert_cb(uint64_t fp, uint64_t count, void *arg)
+{
+	return cqf_insert_fp(arg, fp, count);
+}
+
+int cqf_resize(struct cqf *dst, const struct cqf *src)
+{
+	if (cqf_init(dst, src->h->qbits + 1, src->h->rbits - 1,
+		     src->h->seed) < 0)
+		return -1;
+	if (cqf_iterate(src, insert_cb, dst)) {
+		cqf_free(dst);
+		return -1;
+	}
+	return 0;
+}
+
+int cqf_merge(struct cqf *dst, const struct cqf *a, const struct cqf *b)
+{
+	unsigned bits = dst->h->qbits + dst->h->rbits;
+
+	if (a->h->qbits + a->h->rbits != bits ||
+	    b->h->qbits + b->h->rbits != bits ||
+	    a->h->seed != dst->h->seed || b->h->seed != dst->h->seed)
+		return -1;
+	if (cqf_iterate(a, insert_cb, dst) || cqf_iterate(b, insert_cb, dst))
+		return -1;
+	return 0;
+}
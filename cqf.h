@@ -0,0 +1,75 @@
+// Counting quotient filter on spooky fingerprints
+//
+// An approximate multiset: every key is reduced to a (qbits + rbits)
+// fingerprint taken from spooky_hash128.  The top qbits select the home
+// slot, the low rbits are stored.  Counts are kept inline after the
+// remainder as a variable number of counter slots, so a key seen once
+// costs one slot and a key seen 2^rbits times costs two.
+//
+// The whole filter is one contiguous region (header, metadata bitmaps,
+// packed remainders) so it can live in a file mapping and be reopened
+// later without any fixups.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct cqf_header
+{
+	uint64_t magic;
+	uint32_t qbits;
+	uint32_t rbits;
+	uint64_t nslots;	// home slots plus overflow slack
+	uint64_t nused;		// slots in use
+	uint64_t ndistinct;	// distinct fingerprints
+	uint64_t nelts;		// sum of all counts
+	uint64_t seed;
+};
+
+struct cqf
+{
+	struct cqf_header *h;
+	uint64_t *occupied;
+	uint64_t *continuation;
+	uint64_t *shifted;
+	uint64_t *counter;
+	uint64_t *remainders;
+	size_t size;		// bytes of the region
+	int mapped;		// region is a file mapping
+};
+
+// callback for cqf_iterate: fingerprint and its count
+typedef int (*cqf_fn)(uint64_t fp, uint64_t count, void *arg);
+
+size_t cqf_size(unsigned qbits, unsigned rbits);
+
+int cqf_init(struct cqf *qf, unsigned qbits, unsigned rbits, uint64_t seed);
+int cqf_create_file(struct cqf *qf, char *file, unsigned qbits, unsigned rbits,
+		    uint64_t seed);
+int cqf_open_file(struct cqf *qf, char *file);
+void cqf_free(struct cqf *qf);
+
+uint64_t cqf_fingerprint(const struct cqf *qf, const void *key, size_t len);
+
+// all inserts return 0, or -1 when the filter is full, which they leave
+// unchanged
+int cqf_insert_fp(struct cqf *qf, uint64_t fp, uint64_t count);
+int cqf_insert(struct cqf *qf, const void *key, size_t len, uint64_t count);
+// Insert n fingerprints with a count of one each, in ascending order so
+// that neighbouring inserts touch the same slots.  fps is sorted in
+// place.  When the filter fills up, the fingerprints before the one that
+// did not fit stay inserted.
+int cqf_insert_batch(struct cqf *qf, uint64_t *fps, size_t n);
+
+uint64_t cqf_count_fp(const struct cqf *qf, uint64_t fp);
+uint64_t cqf_count(const struct cqf *qf, const void *key, size_t len);
+
+// walk all fingerprints in ascending order
+int cqf_iterate(const struct cqf *qf, cqf_fn fn, void *arg);
+
+// grow to twice the home slots, giving up one remainder bit
+int cqf_resize(struct cqf *dst, const struct cqf *src);
+
+// add the counts of a and b into dst, which must use the same fingerprint
+// width and seed
+int cqf_merge(struct cqf *dst, const struct cqf *a, const struct cqf *b);
@@ -0,0 +1,329 @@
+// rsync style delta encoding
+//
+// The weak checksum is the rsync one: two 16 bit sums, a of the bytes
+// and b of the running a values, which can be rolled forward by one
+// byte in constant time.  Weak checksums are looked up first in a bit
+// filter with 32 to 64 bits per block, so the common miss costs a
+// single cache line, and then in an open addressing table whose slots
+// hold the weak checksum next to the block number.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "spooky-c.h"
+#include "delta.h"
+
+struct rolling
+{
+	uint32_t a;
+	uint32_t b;
+};
+
+static inline void roll_init(struct rolling *r, const uint8_t *p, uint32_t n)
+{
+	uint32_t i, a = 0, b = 0;
+
+	for (i = 0; i < n; i++) {
+		a += p[i];
+		b += a;
+	}
+	r->a = a;
+	r->b = b;
+}
+
+// slide the window one byte: drop out, append in
+static inline void roll(struct rolling *r, uint32_t n, uint8_t out, uint8_t in)
+{
+	r->a += in - out;
+	r->b += r->a - n * out;
+}
+
+static inline uint32_t weak_sum(const struct rolling *r)
+{
+	return (r->a & 0xffff) | (r->b << 16);
+}
+
+static inline uint64_t weak_mix(uint32_t weak)
+{
+	return weak * 0x9e3779b97f4a7c15ULL;
+}
+
+static inline int filter_test(const struct delta_sig *s, uint32_t weak)
+{
+	uint64_t bit = weak_mix(weak) >> s->filter_shift;
+
+	return (s->filter[bit / 8] >> (bit % 8)) & 1;
+}
+
+int delta_signature(struct delta_sig *s, const void *old, uint64_t size,
+		    uint32_t block_size, uint64_t seed)
+{
+	const uint8_t *p = old;
+	uint64_t i, cap = 2;
+	unsigned order = 1;
+
+	if (block_size == 0 || size / block_size >= UINT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(s, 0, sizeof(*s));
+	s->block_size = block_size;
+	s->nblocks = size / block_size;
+	s->seed = seed;
+	while (cap < 2 * s->nblocks) {
+		cap *= 2;
+		order++;
+	}
+	s->mask = cap - 1;
+	// 16 filter bits per table slot, 32 to 64 per block
+	s->filter_shift = 64 - (order + 4);
+	s->blk = malloc(s->nblocks * sizeof(struct delta_block) + 1);
+	s->table = calloc(cap, sizeof(uint64_t));
+	s->filter = calloc(cap, 2);
+	if (!s->blk || !s->table || !s->filter) {
+		delta_sig_free(s);
+		return -1;
+	}
+
+	for (i = 0; i < s->nblocks; i++) {
+		const uint8_t *b = p + i * block_size;
+		struct rolling r;
+		uint64_t slot, bit;
+
+		roll_init(&r, b, block_size);
+		s->blk[i].weak = weak_sum(&r);
+		s->blk[i].strong = spooky_hash64(b, block_size, seed);
+
+		bit = weak_mix(s->blk[i].weak) >> s->filter_shift;
+		s->filter[bit / 8] |= 1 << (bit % 8);
+		slot = (weak_mix(s->blk[i].weak) >> 32) & s->mask;
+		while (s->table[slot])
+			slot = (slot + 1) & s->mask;
+		s->table[slot] = ((uint64_t)s->blk[i].weak << 32) | (i + 1);
+	}
+	return 0;
+}
+
+void delta_sig_free(struct delta_sig *s)
+{
+	free(s->blk);
+	free(s->table);
+	free(s->filter);
+	s->blk = NULL;
+	s->table = NULL;
+	s->filter = NULL;
+}
+
+static int reserve(struct delta_buf *b, size_t n)
+{
+	if (b->len + n > b->cap) {
+		size_t cap = b->cap ? b->cap : 4096;
+		uint8_t *p;
+
+		while (cap < b->len + n)
+			cap *= 2;
+		p = realloc(b->p, cap);
+		if (!p)
+			return -1;
+		b->p = p;
+		b->cap = cap;
+	}
+	return 0;
+}
+
+static inline void put_varint(struct delta_buf *b, uint64_t v)
+{
+	while (v >= 0x80) {
+		b->p[b->len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	b->p[b->len++] = v;
+}
+
+static int emit_literal(struct delta_buf *out, const uint8_t *p, uint64_t n)
+{
+	if (n == 0)
+		return 0;
+	if (reserve(out, 1 + 10 + n) < 0)
+		return -1;
+	out->p[out->len++] = 'L';
+	put_varint(out, n);
+	memcpy(out->p + out->len, p, n);
+	out->len += n;
+	return 0;
+}
+
+static int emit_copy(struct delta_buf *out, uint64_t first, uint64_t n)
+{
+	if (n == 0)
+		return 0;
+	if (reserve(out, 1 + 20) < 0)
+		return -1;
+	out->p[out->len++] = 'C';
+	put_varint(out, first);
+	put_varint(out, n);
+	return 0;
+}
+
+// block of the signature matching the window at p, or -1
+static inline int64_t find_block(const struct delta_sig *s, uint32_t weak,
+				 const uint8_t *p)
+{
+	uint64_t slot = (weak_mix(weak) >> 32) & s->mask;
+	uint64_t strong = 0;
+	int have_strong = 0;
+
+	for (; s->table[slot]; slot = (slot + 1) & s->mask) {
+		uint64_t i = (uint32_t)s->table[slot] - 1;
+
+		if (s->table[slot] >> 32 != weak)
+			continue;
+		if (!have_strong) {
+			strong = spooky_hash64(p, s->block_size, s->seed);
+			have_strong = 1;
+		}
+		if (s->blk[i].strong == strong)
+			return i;
+	}
+	return -1;
+}
+
+int delta_compute(const struct delta_sig *s, const void *new, uint64_t size,
+		  struct delta_buf *out)
+{
+	const uint8_t *p = new;
+	uint64_t bs = s->block_size;
+	uint64_t pos = 0, lit = 0;	// window start, start of pending literal
+	uint64_t copy_first = 0, copy_n = 0;
+	uint64_t digest;
+	struct rolling r;
+
+	if (reserve(out, 10) < 0)
+		return -1;
+	put_varint(out, size);
+
+	if (s->nblocks > 0 && size >= bs) {
+		roll_init(&r, p, bs);
+		for (;;) {
+			uint32_t weak = weak_sum(&r);
+			int64_t blk = -1;
+
+			if (filter_test(s, weak))
+				blk = find_block(s, weak, p + pos);
+			if (blk >= 0) {
+				// extend a run of consecutive blocks
+				if (copy_n > 0 && pos == lit &&
+				    (uint64_t)blk == copy_first + copy_n) {
+					copy_n++;
+				} else {
+					if (emit_copy(out, copy_first, copy_n) < 0 ||
+					    emit_literal(out, p + lit, pos - lit) < 0)
+						return -1;
+					copy_first = blk;
+					copy_n = 1;
+				}
+				pos += bs;
+				lit = pos;
+				if (pos + bs > size)
+					break;
+				roll_init(&r, p + pos, bs);
+				continue;
+			}
+			if (pos + bs >= size)
+				break;
+			roll(&r, bs, p[pos], p[pos + bs]);
+			pos++;
+		}
+	}
+	if (emit_copy(out, copy_first, copy_n) < 0 ||
+	    emit_literal(out, p + lit, size - lit) < 0)
+		return -1;
+
+	digest = spooky_hash64(new, size, 0);
+	if (reserve(out, 9) < 0)
+		return -1;
+	out->p[out->len++] = 'E';
+	memcpy(out->p + out->len, &digest, 8);
+	out->len += 8;
+	return 0;
+}
+
+void delta_buf_free(struct delta_buf *b)
+{
+	free(b->p);
+	b->p = NULL;
+	b->len = b->cap = 0;
+}
+
+static int get_varint(const uint8_t **pp, const uint8_t *end, uint64_t *v)
+{
+	const uint8_t *p = *pp;
+	unsigned shift = 0;
+
+	*v = 0;
+	while (p < end && shift < 64) {
+		*v |= (uint64_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*pp = p;
+			return 0;
+		}
+		shift += 7;
+	}
+	return -1;
+}
+
+int64_t delta_new_size(const void *delta, size_t len)
+{
+	const uint8_t *p = delta;
+	uint64_t size;
+
+	if (get_varint(&p, p + len, &size) < 0 || size > INT64_MAX)
+		return -1;
+	return size;
+}
+
+int delta_apply(const void *old, uint64_t oldsize, uint32_t block_size,
+		const void *delta, size_t len, void *out)
+{
+	const uint8_t *p = delta, *end = p + len;
+	uint8_t *o = out;
+	uint64_t size, done = 0, a, n, digest;
+
+	if (block_size == 0 || get_varint(&p, end, &size) < 0)
+		goto bad;
+	while (p < end) {
+		switch (*p++) {
+		case 'C':
+			if (get_varint(&p, end, &a) < 0 ||
+			    get_varint(&p, end, &n) < 0 ||
+			    a > oldsize / block_size ||
+			    n > oldsize / block_size - a ||
+			    n * block_size > size - done)
+				goto bad;
+			memcpy(o + done, (const uint8_t *)old + a * block_size,
+			       n * block_size);
+			done += n * block_size;
+			break;
+		case 'L':
+			if (get_varint(&p, end, &n) < 0 ||
+			    n > (uint64_t)(end - p) || n > size - done)
+				goto bad;
+			memcpy(o + done, p, n);
+			p += n;
+			done += n;
+			break;
+		case 'E':
+			if (end - p != 8 || done != size)
+				goto bad;
+			memcpy(&digest, p, 8);
+			if (spooky_hash64(out, size, 0) != digest)
+				goto bad;
+			return 0;
+		default:
+			goto bad;
+		}
+	}
+bad:
+	errno = EINVAL;
+	return -1;
+}
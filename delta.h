@@ -0,0 +1,68 @@
+// rsync style delta encoding
+//
+// The receiver cuts its old copy into fixed size blocks and sends a
+// signature: for each block a rolling weak checksum and a spooky_hash64
+// strong hash.  The sender slides a window over its new copy, looks up
+// the weak checksum at every byte position and confirms candidates with
+// the strong hash.  Matched blocks become copy instructions, everything
+// in between is sent as literals.  The receiver applies the delta to its
+// old copy to get the new one.
+//
+// Only full blocks of the old copy are in the signature; a short tail
+// block is always resent as a literal.
+//
+// Delta format: varint new size, then a stream of instructions:
+//	'C' varint first block, varint number of blocks
+//	'L' varint length, literal bytes
+//	'E' 8 byte spooky_hash64 of the whole new copy
+// Varints are little endian base 128.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct delta_block
+{
+	uint32_t weak;
+	uint64_t strong;
+};
+
+struct delta_sig
+{
+	uint32_t block_size;
+	uint64_t nblocks;
+	uint64_t seed;		// strong hash seed
+	struct delta_block *blk;
+	// lookup by weak checksum
+	uint64_t *table;	// weak << 32 | block index + 1, 0 is empty
+	uint64_t mask;
+	uint8_t *filter;	// one bit per weak checksum bucket
+	unsigned filter_shift;
+};
+
+struct delta_buf
+{
+	uint8_t *p;
+	size_t len;
+	size_t cap;
+};
+
+int delta_signature(struct delta_sig *s, const void *old, uint64_t size,
+		    uint32_t block_size, uint64_t seed);
+void delta_sig_free(struct delta_sig *s);
+
+// Append the delta that turns the signed old copy into new to out, which
+// must be zeroed or hold an earlier result.
+int delta_compute(const struct delta_sig *s, const void *new, uint64_t size,
+		  struct delta_buf *out);
+void delta_buf_free(struct delta_buf *b);
+
+// size of the new copy a delta produces, or -1 when it is malformed
+int64_t delta_new_size(const void *delta, size_t len);
+
+// Apply a delta to old, writing the new copy to out, which must have
+// room for delta_new_size bytes.  block_size must match the signature.
+// Returns -1 for malformed deltas or when the result does not match the
+// sender's hash.
+int delta_apply(const void *old, uint64_t oldsize, uint32_t block_size,
+		const void *delta, size_t len, void *out);
@@ -0,0 +1,245 @@
+// Key-affinity dispatch to worker threads
+//
+// A sticky table slot is tag:24 worker:8 inflight:16 fallback:16, from
+// the most to the least significant bits.  Both counters are bounded by
+// refusing requests that would overflow them, so done can simply
+// subtract without a compare and swap.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "spooky-c.h"
+#include "dispatch.h"
+
+#define TAG_SHIFT	40
+#define WORKER_SHIFT	32
+#define INFLIGHT_SHIFT	16
+#define COUNT_MASK	0xffffULL
+
+#define KIND_NONE	0
+#define KIND_STICKY	1
+#define KIND_FALLBACK	2
+
+static unsigned roundup_pow2(unsigned n)
+{
+	unsigned p = 1;
+
+	while (p < n)
+		p *= 2;
+	return p;
+}
+
+static inline int range(uint64_t h, int n)
+{
+	return ((unsigned __int128)h * n) >> 64;
+}
+
+static void candidates(int n, uint64_t h1, uint64_t h2, int *w1, int *w2)
+{
+	*w1 = range(h1, n);
+	*w2 = range(h2, n);
+	if (*w2 == *w1 && n > 1)
+		*w2 = *w1 + 1 == n ? 0 : *w1 + 1;
+}
+
+void dispatch_candidates(const struct dispatch *d, const void *key,
+			 size_t len, int *w1, int *w2)
+{
+	uint64_t h1 = d->seed, h2 = d->seed;
+
+	spooky_hash128(key, len, &h1, &h2);
+	candidates(d->nworkers, h1, h2, w1, w2);
+}
+
+int dispatch_init(struct dispatch *d, int nworkers, unsigned entries,
+		  unsigned table_size, uint64_t seed, int flags)
+{
+	int i;
+	unsigned k;
+
+	if (nworkers < 1 || nworkers > DP_MAXWORKERS || entries == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(d, 0, sizeof(*d));
+	d->nworkers = nworkers;
+	d->flags = flags;
+	d->seed = seed;
+	if (!(flags & DP_MODULO)) {
+		table_size = roundup_pow2(table_size ? table_size : 1);
+		d->table = calloc(table_size, sizeof(uint64_t));
+		if (!d->table)
+			return -1;
+		d->tmask = table_size - 1;
+	}
+	if (posix_memalign((void **)&d->queues, 64,
+			   nworkers * sizeof(struct dp_queue)))
+		goto fail;
+	memset(d->queues, 0, nworkers * sizeof(struct dp_queue));
+	entries = roundup_pow2(entries);
+	for (i = 0; i < nworkers; i++) {
+		struct dp_queue *q = &d->queues[i];
+
+		q->q = malloc(entries * sizeof(struct dp_entry));
+		if (!q->q)
+			goto fail;
+		q->mask = entries - 1;
+		for (k = 0; k < entries; k++)
+			q->q[k].seq = k;
+	}
+	return 0;
+
+fail:
+	dispatch_free(d);
+	errno = ENOMEM;
+	return -1;
+}
+
+void dispatch_free(struct dispatch *d)
+{
+	int i;
+
+	if (d->queues)
+		for (i = 0; i < d->nworkers; i++)
+			free(d->queues[i].q);
+	free(d->queues);
+	free(d->table);
+	d->queues = NULL;
+	d->table = NULL;
+}
+
+static int push(struct dp_queue *q, const struct dp_task *t)
+{
+	uint64_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	struct dp_entry *e;
+
+	for (;;) {
+		int64_t diff;
+
+		e = &q->q[pos & q->mask];
+		diff = (int64_t)(__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+	e->task = *t;
+	__atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int dispatch_next(struct dispatch *d, int worker, struct dp_task *t)
+{
+	struct dp_queue *q = &d->queues[worker];
+	struct dp_entry *e = &q->q[q->head & q->mask];
+
+	if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != q->head + 1)
+		return 0;
+	*t = e->task;
+	__atomic_store_n(&e->seq, q->head + q->mask + 1, __ATOMIC_RELEASE);
+	q->head++;
+	return 1;
+}
+
+void dispatch_done(struct dispatch *d, const struct dp_task *t)
+{
+	if (t->kind == KIND_STICKY)
+		__atomic_fetch_sub(&d->table[t->slot], 1ULL << INFLIGHT_SHIFT,
+				   __ATOMIC_RELEASE);
+	else if (t->kind == KIND_FALLBACK)
+		__atomic_fetch_sub(&d->table[t->slot], 1, __ATOMIC_RELEASE);
+	__atomic_fetch_sub(&d->queues[t->worker].load, 1, __ATOMIC_RELAXED);
+}
+
+// pick a worker for the key and account for the request in its slot
+static int route(struct dispatch *d, struct dp_task *t)
+{
+	uint64_t *slot = &d->table[t->hash1 & d->tmask];
+	uint64_t tag = t->hash2 >> TAG_SHIFT;
+	uint64_t v = __atomic_load_n(slot, __ATOMIC_ACQUIRE), nv;
+	int w1, w2, w;
+
+	candidates(d->nworkers, t->hash1, t->hash2, &w1, &w2);
+	t->slot = t->hash1 & d->tmask;
+	for (;;) {
+		uint64_t inflight = (v >> INFLIGHT_SHIFT) & COUNT_MASK;
+		uint64_t fallback = v & COUNT_MASK;
+
+		if (v && v >> TAG_SHIFT == tag) {
+			// our entry
+			if (inflight == COUNT_MASK)
+				return -1;
+			w = (v >> WORKER_SHIFT) & 0xff;
+			nv = v + (1ULL << INFLIGHT_SHIFT);
+			t->kind = KIND_STICKY;
+		} else if (inflight == 0) {
+			// free or idle: (re)place the key
+			if (fallback)
+				w = w1;
+			else
+				w = dispatch_load(d, w2) < dispatch_load(d, w1) ?
+					w2 : w1;
+			nv = tag << TAG_SHIFT | (uint64_t)w << WORKER_SHIFT |
+				1ULL << INFLIGHT_SHIFT | fallback;
+			t->kind = KIND_STICKY;
+		} else {
+			// another key is in flight here
+			if (fallback == COUNT_MASK)
+				return -1;
+			w = w1;
+			nv = v + 1;
+			t->kind = KIND_FALLBACK;
+		}
+		if (__atomic_compare_exchange_n(slot, &v, nv, 1,
+						__ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE))
+			break;
+	}
+	if (t->kind == KIND_FALLBACK)
+		__atomic_fetch_add(&d->nfallback, 1, __ATOMIC_RELAXED);
+	return w;
+}
+
+int dispatch_submit_hash(struct dispatch *d, uint64_t hash1, uint64_t hash2,
+			 void *arg)
+{
+	struct dp_task t;
+	int w;
+
+	t.arg = arg;
+	t.hash1 = hash1;
+	t.hash2 = hash2;
+	t.slot = 0;
+	t.kind = KIND_NONE;
+	if (d->flags & DP_MODULO)
+		w = hash1 % d->nworkers;
+	else
+		w = route(d, &t);
+	if (w < 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	t.worker = w;
+	__atomic_fetch_add(&d->queues[w].load, 1, __ATOMIC_RELAXED);
+	if (push(&d->queues[w], &t) < 0) {
+		dispatch_done(d, &t);
+		errno = EAGAIN;
+		return -1;
+	}
+	return w;
+}
+
+int dispatch_submit(struct dispatch *d, const void *key, size_t len,
+		    void *arg)
+{
+	uint64_t h1 = d->seed, h2 = d->seed;
+
+	spooky_hash128(key, len, &h1, &h2);
+	return dispatch_submit_hash(d, h1, h2, arg);
+}
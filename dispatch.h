@@ -0,0 +1,104 @@
+// Key-affinity dispatch to worker threads
+//
+// Requests carrying a key are routed to one of nworkers queues so that all
+// requests for a key end up on the same worker and per-key state can stay
+// thread-local.  Hashing the key with spooky_hash128 gives two independent
+// 64-bit words, which name two candidate workers.  A new key goes to the
+// less loaded of the two (power of two choices), where the load of a
+// worker is the number of its requests not yet marked done.  Compared to
+// routing by hash modulo nworkers this keeps hot keys from piling up on
+// one worker.
+//
+// The choice is remembered in a sticky table of 64-bit slots indexed by
+// the first hash word.  A slot holds a tag of the second word, the worker
+// and the number of requests for the key in flight, and is updated with a
+// single compare and swap.  An idle entry stays put until another key
+// needs its slot, so a key is only ever moved when it has nothing in
+// flight.  When the slot is busy with another key the request goes to the
+// first candidate and is counted in the slot, and while such requests are
+// in flight new entries of that slot are placed on their first candidate
+// as well.  That keeps requests of one key in order on one worker no
+// matter how the table is contended.
+//
+// The per-worker queues are bounded multi-producer single-consumer rings
+// like the submission rings of hashsvc.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DP_MAXWORKERS	256
+
+// dispatch_init flags
+#define DP_MODULO	1	// plain hash modulo nworkers, for comparison
+
+struct dp_task
+{
+	void *arg;
+	uint64_t hash1;
+	uint64_t hash2;
+	uint32_t slot;
+	uint16_t worker;
+	uint16_t kind;
+};
+
+struct dp_entry
+{
+	uint64_t seq;
+	struct dp_task task;
+};
+
+struct dp_queue
+{
+	// written by producers
+	uint64_t tail __attribute__((aligned(64)));
+	// written by the worker
+	uint64_t head __attribute__((aligned(64)));
+	// submitted and not done
+	uint64_t load __attribute__((aligned(64)));
+	struct dp_entry *q;
+	unsigned mask;
+};
+
+struct dispatch
+{
+	int nworkers;
+	int flags;
+	uint64_t seed;
+	uint64_t *table;
+	uint32_t tmask;
+	struct dp_queue *queues;
+	uint64_t nfallback;	// statistics: requests that found their slot busy
+};
+
+// entries is the size of each worker queue and table_size the number of
+// sticky table slots; both are rounded up to a power of two.  The table
+// should be a good deal larger than the number of keys in flight.
+int dispatch_init(struct dispatch *d, int nworkers, unsigned entries,
+		  unsigned table_size, uint64_t seed, int flags);
+void dispatch_free(struct dispatch *d);
+
+// the two candidate workers of a key
+void dispatch_candidates(const struct dispatch *d, const void *key,
+			 size_t len, int *w1, int *w2);
+
+// Queue arg for the worker owning key.  Returns the worker, or -1 with
+// errno EAGAIN when its queue is full.
+int dispatch_submit(struct dispatch *d, const void *key, size_t len,
+		    void *arg);
+// the same with the spooky_hash128 of the key already computed
+int dispatch_submit_hash(struct dispatch *d, uint64_t hash1, uint64_t hash2,
+			 void *arg);
+
+// Take the next task of a worker; only the worker itself may call this.
+// Returns 0 when the queue is empty.
+int dispatch_next(struct dispatch *d, int worker, struct dp_task *t);
+
+// The task has been handled; its key may move once nothing is in flight.
+void dispatch_done(struct dispatch *d, const struct dp_task *t);
+
+// number of tasks submitted to a worker and not done
+static inline uint64_t dispatch_load(const struct dispatch *d, int worker)
+{
+	return __atomic_load_n(&d->queues[worker].load, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,367 @@
+// Exact distinct counting of spooky fingerprints under a memory budget
+//
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spooky-c.h"
+#include "util.h"
+#include "distinct.h"
+
+#define CHUNK 256
+#define MAXDEPTH 16		// every byte of the fingerprint is a digit
+#define SPILL_MIN 256
+#define SPILL_MAX 8192
+
+static int fpset_init(struct fpset *s, size_t bytes)
+{
+	size_t cap = 64;
+
+	while (cap * 2 * sizeof(s->slot[0]) <= bytes)
+		cap *= 2;
+	s->slot = calloc(cap, sizeof(s->slot[0]));
+	if (!s->slot)
+		return -1;
+	s->mask = cap - 1;
+	s->n = 0;
+	s->zero = 0;
+	return 0;
+}
+
+static void fpset_clear(struct fpset *s)
+{
+	memset(s->slot, 0, (s->mask + 1) * sizeof(s->slot[0]));
+	s->n = 0;
+	s->zero = 0;
+}
+
+static inline int fpset_full(struct fpset *s)
+{
+	return s->n >= (s->mask + 1) / 2;
+}
+
+static inline void fpset_insert(struct fpset *s, uint64_t h1, uint64_t h2)
+{
+	size_t i;
+
+	if ((h1 | h2) == 0) {
+		s->zero = 1;
+		return;
+	}
+	for (i = h2 & s->mask; s->slot[i][0] | s->slot[i][1];
+	     i = (i + 1) & s->mask)
+		if (s->slot[i][0] == h1 && s->slot[i][1] == h2)
+			return;
+	s->slot[i][0] = h1;
+	s->slot[i][1] = h2;
+	s->n++;
+}
+
+static int fpset_walk(struct fpset *s, distinct_fn fn, void *arg)
+{
+	size_t i;
+	int ret;
+
+	if (s->zero && (ret = fn(0, 0, arg)))
+		return ret;
+	for (i = 0; i <= s->mask; i++)
+		if ((s->slot[i][0] | s->slot[i][1]) &&
+		    (ret = fn(s->slot[i][0], s->slot[i][1], arg)))
+			return ret;
+	return 0;
+}
+
+// radix digit of a fingerprint used for partitioning at a recursion
+// depth, from h1 on to h2
+static inline unsigned digit(const uint64_t fp[2], int depth)
+{
+	uint64_t h = depth < 8 ? fp[0] : fp[1];
+
+	return (h >> (56 - 8 * (depth % 8))) & (DISTINCT_FANOUT - 1);
+}
+
+// stdio buffer of every spill or split file, a quarter of the budget
+// for all of them
+static size_t spill_size(size_t budget)
+{
+	size_t n = budget / 4 / DISTINCT_FANOUT & ~(size_t)15;
+
+	return n < SPILL_MIN ? SPILL_MIN : n > SPILL_MAX ? SPILL_MAX : n;
+}
+
+static void part_name(char *buf, size_t len, const struct distinct *d,
+		      unsigned i)
+{
+	snprintf(buf, len, "%s/spooky-distinct.%d.%lx.%u", d->dir, (int)getpid(),
+		 (unsigned long)d, i);
+}
+
+int distinct_init(struct distinct *d, size_t budget, const char *dir,
+		  int nthreads, uint64_t seed)
+{
+	memset(d, 0, sizeof(struct distinct));
+	d->nthreads = nthreads > 0 ? nthreads : 1;
+	if (budget < DISTINCT_MINBUDGET * (size_t)d->nthreads)
+		budget = DISTINCT_MINBUDGET * (size_t)d->nthreads;
+	d->budget = budget;
+	d->dir = dir;
+	d->seed = seed;
+	d->spillsize = spill_size(budget);
+	return fpset_init(&d->set, budget - DISTINCT_FANOUT * d->spillsize);
+}
+
+static int spill(struct distinct *d)
+{
+	uint64_t zero[2] = { 0, 0 };
+	char name[4096];
+	size_t i;
+
+	if (!d->spillbuf) {
+		d->spillbuf = malloc(DISTINCT_FANOUT * d->spillsize);
+		if (!d->spillbuf)
+			return -1;
+	}
+	for (i = 0; i < DISTINCT_FANOUT && !d->spilled; i++) {
+		part_name(name, sizeof name, d, i);
+		d->part[i] = fopen(name, "w+");
+		if (!d->part[i])
+			return -1;
+		setvbuf(d->part[i], d->spillbuf + i * d->spillsize, _IOFBF,
+			d->spillsize);
+	}
+	d->spilled = 1;
+
+	if (d->set.zero && fwrite(zero, sizeof zero, 1, d->part[0]) != 1)
+		return -1;
+	for (i = 0; i <= d->set.mask; i++) {
+		uint64_t *fp = d->set.slot[i];
+
+		if ((fp[0] | fp[1]) &&
+		    fwrite(fp, 2 * sizeof(uint64_t), 1,
+			   d->part[digit(fp, 0)]) != 1)
+			return -1;
+	}
+	fpset_clear(&d->set);
+	return 0;
+}
+
+int distinct_add_fp(struct distinct *d, uint64_t h1, uint64_t h2)
+{
+	if (fpset_full(&d->set) && spill(d) < 0)
+		return -1;
+	fpset_insert(&d->set, h1, h2);
+	return 0;
+}
+
+int distinct_add(struct distinct *d, const void *key, size_t len)
+{
+	uint64_t h1 = d->seed, h2 = d->seed;
+
+	spooky_hash128(key, len, &h1, &h2);
+	return distinct_add_fp(d, h1, h2);
+}
+
+struct job
+{
+	struct distinct *d;
+	size_t wbudget;		// set of one worker, besides its read chunk
+	size_t spillsize;	// buffer of a split file
+	unsigned next;
+	uint64_t count;
+	int err;
+	distinct_fn fn;
+	void *arg;
+	pthread_mutex_t lock;
+};
+
+// Split an oversized partition into children by the next radix digit,
+// marking the ones created in made.  Children are only created when
+// something goes into them.
+static int split_file(struct job *job, FILE *f, const char *name, int depth,
+		      unsigned char *made)
+{
+	FILE *child[DISTINCT_FANOUT] = { NULL };
+	char *cbuf = malloc(DISTINCT_FANOUT * job->spillsize);
+	uint64_t buf[CHUNK][2];
+	char cname[strlen(name) + 8];
+	size_t n, i;
+	int err = cbuf ? 0 : -1;
+
+	while (!err && (n = fread(buf, sizeof(buf[0]), CHUNK, f)) > 0) {
+		for (i = 0; i < n && !err; i++) {
+			unsigned c = digit(buf[i], depth);
+
+			if (!child[c]) {
+				snprintf(cname, sizeof cname, "%s.%u", name, c);
+				child[c] = fopen(cname, "w");
+				made[c] = 1;
+				if (child[c])
+					setvbuf(child[c],
+						cbuf + c * job->spillsize,
+						_IOFBF, job->spillsize);
+			}
+			if (!child[c] ||
+			    fwrite(buf[i], sizeof(buf[0]), 1, child[c]) != 1)
+				err = -1;
+		}
+	}
+	if (ferror(f))
+		err = -1;
+	for (i = 0; i < DISTINCT_FANOUT; i++)
+		if (child[i] && fclose(child[i]) != 0)
+			err = -1;
+	free(cbuf);
+	return err;
+}
+
+// the distinct fingerprints of a partition that fits into a set of need
+// bytes
+static int count_set(struct job *job, FILE *f, size_t need, uint64_t *count)
+{
+	uint64_t buf[CHUNK][2];
+	struct fpset set;
+	size_t n, i;
+	int err = 0;
+
+	if (fpset_init(&set, need) < 0)
+		return -1;
+	while ((n = fread(buf, sizeof(buf[0]), CHUNK, f)) > 0)
+		for (i = 0; i < n; i++)
+			fpset_insert(&set, buf[i][0], buf[i][1]);
+	if (ferror(f))
+		err = -1;
+
+	*count += set.n + set.zero;
+	if (!err && job->fn) {
+		pthread_mutex_lock(&job->lock);
+		err = fpset_walk(&set, job->fn, job->arg);
+		pthread_mutex_unlock(&job->lock);
+	}
+	free(set.slot);
+	return err;
+}
+
+// Count a partition whose fingerprints share their first depth digits.
+// Its file and buffers are released before recursing into the children,
+// so a worker never holds more than one level's memory.
+static int count_file(struct job *job, const char *name, int depth,
+		      uint64_t *count)
+{
+	unsigned char made[DISTINCT_FANOUT] = { 0 };
+	char cname[strlen(name) + 8];
+	struct stat st;
+	size_t need, i;
+	int err = 0;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f)
+		return -1;
+	// reads go straight into the chunk buffer
+	setvbuf(f, NULL, _IONBF, 0);
+	if (fstat(fileno(f), &st) < 0) {
+		fclose(f);
+		return -1;
+	}
+	// at the last depth all fingerprints in the file are the same
+	need = 64;
+	while (depth < MAXDEPTH && need < 2 * (st.st_size / (2 * sizeof(uint64_t))))
+		need *= 2;
+	need *= 2 * sizeof(uint64_t);
+
+	if (need > job->wbudget)
+		err = split_file(job, f, name, depth, made);
+	else
+		err = count_set(job, f, need, count);
+	fclose(f);
+	unlink(name);
+
+	for (i = 0; i < DISTINCT_FANOUT; i++) {
+		if (!made[i])
+			continue;
+		snprintf(cname, sizeof cname, "%s.%zu", name, i);
+		if (!err)
+			err = count_file(job, cname, depth + 1, count);
+		else
+			unlink(cname);
+	}
+	return err;
+}
+
+static void *worker(void *arg)
+{
+	struct job *job = arg;
+	char name[4096];
+	unsigned i;
+
+	while ((i = __sync_fetch_and_add(&job->next, 1)) < DISTINCT_FANOUT) {
+		uint64_t count = 0;
+
+		part_name(name, sizeof name, job->d, i);
+		if (count_file(job, name, 1, &count) < 0)
+			job->err = -1;
+		__sync_fetch_and_add(&job->count, count);
+	}
+	return NULL;
+}
+
+int distinct_count(struct distinct *d, uint64_t *count, distinct_fn fn,
+		   void *arg)
+{
+	struct job job;
+	int i, err = 0;
+
+	if (!d->spilled) {
+		*count = d->set.n + d->set.zero;
+		return fn ? fpset_walk(&d->set, fn, arg) : 0;
+	}
+
+	// flush what is still in memory and give its space to the workers
+	if (spill(d) < 0)
+		err = -1;
+	free(d->set.slot);
+	d->set.slot = NULL;
+	for (i = 0; i < DISTINCT_FANOUT; i++) {
+		if (fclose(d->part[i]) != 0)
+			err = -1;
+		d->part[i] = NULL;
+	}
+	free(d->spillbuf);
+	d->spillbuf = NULL;
+	if (err)
+		return -1;
+
+	memset(&job, 0, sizeof(struct job));
+	job.d = d;
+	job.wbudget = d->budget / d->nthreads - CHUNK * 2 * sizeof(uint64_t);
+	job.spillsize = spill_size(d->budget / d->nthreads);
+	job.fn = fn;
+	job.arg = arg;
+	pthread_mutex_init(&job.lock, NULL);
+	// the workers share the job and take partitions from it in turn
+	run_jobs(&job, 0, d->nthreads, worker);
+	pthread_mutex_destroy(&job.lock);
+
+	*count = job.count;
+	return job.err;
+}
+
+void distinct_free(struct distinct *d)
+{
+	char name[4096];
+	int i;
+
+	for (i = 0; i < DISTINCT_FANOUT; i++) {
+		if (d->part[i]) {
+			fclose(d->part[i]);
+			part_name(name, sizeof name, d, i);
+			unlink(name);
+		}
+	}
+	free(d->set.slot);
+	d->set.slot = NULL;
+	free(d->spillbuf);
+	d->spillbuf = NULL;
+}
@@ -0,0 +1,57 @@
+// Exact distinct counting of spooky fingerprints under a memory budget
+//
+// Keys are reduced to 128-bit spooky_hash128 fingerprints, so "exact"
+// means exact up to 128-bit collisions, which do not happen in practice.
+// Fingerprints are collected in an in-memory open addressing set.  When
+// that set would outgrow the budget it is radix partitioned by the top
+// bits of the fingerprint into spill files.  Counting then dedups every
+// partition in parallel, splitting partitions further by the next bits
+// when one does not fit into a worker's share of the budget.
+//
+// The budget covers the set and the buffers of the spill files while
+// adding, and every worker's set and file buffers while counting.  It is
+// at least DISTINCT_MINBUDGET per thread; smaller budgets are raised.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define DISTINCT_FANOUT 256
+#define DISTINCT_MINBUDGET (128 << 10)
+
+struct fpset
+{
+	uint64_t (*slot)[2];
+	size_t mask;
+	size_t n;
+	int zero;		// the all zero fingerprint, which marks empty slots
+};
+
+struct distinct
+{
+	size_t budget;
+	const char *dir;
+	int nthreads;
+	struct fpset set;
+	FILE *part[DISTINCT_FANOUT];
+	char *spillbuf;		// stdio buffers of part
+	size_t spillsize;
+	int spilled;
+	uint64_t seed;
+};
+
+// called for every distinct fingerprint, possibly from several threads
+// but never concurrently
+typedef int (*distinct_fn)(uint64_t h1, uint64_t h2, void *arg);
+
+int distinct_init(struct distinct *d, size_t budget, const char *dir,
+		  int nthreads, uint64_t seed);
+int distinct_add(struct distinct *d, const void *key, size_t len);
+int distinct_add_fp(struct distinct *d, uint64_t h1, uint64_t h2);
+
+// Finish the stream and count.  fn may be NULL.  After this only
+// distinct_free is allowed.
+int distinct_count(struct distinct *d, uint64_t *count, distinct_fn fn,
+		   void *arg);
+void distinct_free(struct distinct *d);
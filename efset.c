@@ -0,0 +1,434 @@
+// Elias-Fano coded sets of 64-bit spooky fingerprints
+//
+// Construction partitions the fingerprints by their top byte, lets each
+// thread radix sort whole partitions and then has each thread encode a
+// contiguous range of the sorted array.  Ranges of low bits start on
+// multiples of 64 elements, so they never share a word; the high bit
+// vector words at the edges of a range are set atomically.
+
+#include <sys/fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "spooky-c.h"
+#include "map.h"
+#include "util.h"
+#include "efset.h"
+
+#define EFSET_MAGIC 0x31736665796b6f6fULL	// "ookyefs1"
+#define SAMPLE_SHIFT 8
+#define MAXTHREADS 64
+
+static inline unsigned select64(uint64_t w, unsigned k)
+{
+	while (k--)
+		w &= w - 1;
+	return __builtin_ctzll(w);
+}
+
+static inline uint64_t get_low(const struct efset *s, uint64_t i)
+{
+	uint64_t l = s->h->lbits, bit = i * l;
+	uint64_t w = bit / 64, b = bit % 64, v;
+
+	if (l == 0)
+		return 0;
+	v = s->low[w] >> b;
+	if (b + l > 64)
+		v |= s->low[w + 1] << (64 - b);
+	return v & ((1ULL << l) - 1);
+}
+
+// position of the j-th one (j counts from 0) in the high bits
+static uint64_t select1(const struct efset *s, uint64_t j)
+{
+	uint64_t pos = s->osamples[j >> SAMPLE_SHIFT];
+	uint64_t w = pos / 64, left = j & ((1 << SAMPLE_SHIFT) - 1);
+	uint64_t word = s->high[w] & (~0ULL << (pos % 64));
+	unsigned c;
+
+	while ((c = __builtin_popcountll(word)) <= left) {
+		left -= c;
+		word = s->high[++w];
+	}
+	return w * 64 + select64(word, left);
+}
+
+// position of the j-th zero in the high bits
+static uint64_t select0(const struct efset *s, uint64_t j)
+{
+	uint64_t pos = s->zsamples[j >> SAMPLE_SHIFT];
+	uint64_t w = pos / 64, left = j & ((1 << SAMPLE_SHIFT) - 1);
+	uint64_t word = ~s->high[w] & (~0ULL << (pos % 64));
+	unsigned c;
+
+	while ((c = __builtin_popcountll(word)) <= left) {
+		left -= c;
+		word = ~s->high[++w];
+	}
+	return w * 64 + select64(word, left);
+}
+
+static inline int getbit(const uint64_t *map, uint64_t i)
+{
+	return (map[i / 64] >> (i % 64)) & 1;
+}
+
+// Scan the bucket of fp.  Returns the index of the first element >= fp
+// and sets *found when it is equal.
+static uint64_t lookup(const struct efset *s, uint64_t fp, int *found)
+{
+	uint64_t l = s->h->lbits;
+	uint64_t hi = fp >> l, lo = fp & ((1ULL << l) - 1);
+	uint64_t pos, i;
+
+	*found = 0;
+	if (hi >= s->h->nzeros)
+		return s->h->n;
+	pos = hi ? select0(s, hi - 1) + 1 : 0;
+	i = pos - hi;
+	for (; getbit(s->high, pos); pos++, i++) {
+		uint64_t v = get_low(s, i);
+
+		if (v >= lo) {
+			*found = v == lo;
+			break;
+		}
+	}
+	return i;
+}
+
+int efset_contains(const struct efset *s, uint64_t fp)
+{
+	int found;
+
+	if (s->h->n == 0)
+		return 0;
+	lookup(s, fp, &found);
+	return found;
+}
+
+uint64_t efset_rank(const struct efset *s, uint64_t fp)
+{
+	int found;
+
+	if (s->h->n == 0)
+		return 0;
+	return lookup(s, fp, &found);
+}
+
+uint64_t efset_select(const struct efset *s, uint64_t i)
+{
+	return ((select1(s, i) - i) << s->h->lbits) | get_low(s, i);
+}
+
+uint64_t efset_fingerprint(const void *key, size_t len, uint64_t seed)
+{
+	return spooky_hash64(key, len, seed);
+}
+
+static void radix_sort(uint64_t *a, uint64_t *tmp, size_t n)
+{
+	uint64_t *src = a, *dst = tmp, *x;
+	unsigned shift;
+
+	// the top byte is already equal within a partition
+	for (shift = 0; shift < 56; shift += 8) {
+		size_t count[256] = { 0 }, i, sum = 0;
+
+		for (i = 0; i < n; i++)
+			count[(src[i] >> shift) & 0xff]++;
+		for (i = 0; i < 256; i++) {
+			size_t c = count[i];
+
+			count[i] = sum;
+			sum += c;
+		}
+		for (i = 0; i < n; i++)
+			dst[count[(src[i] >> shift) & 0xff]++] = src[i];
+		x = src;
+		src = dst;
+		dst = x;
+	}
+	if (src != a)
+		memcpy(a, src, n * sizeof(uint64_t));
+}
+
+struct build_job
+{
+	struct efset *s;
+	uint64_t *fps;
+	uint64_t *tmp;
+	size_t *start;		// partition boundaries
+	size_t first, end;	// partitions to sort, then elements to encode
+};
+
+static void *sort_worker(void *arg)
+{
+	struct build_job *j = arg;
+	size_t p;
+
+	for (p = j->first; p < j->end; p++)
+		radix_sort(j->fps + j->start[p], j->tmp + j->start[p],
+			   j->start[p + 1] - j->start[p]);
+	return NULL;
+}
+
+static void *encode_worker(void *arg)
+{
+	struct build_job *j = arg;
+	struct efset *s = j->s;
+	uint64_t l = s->h->lbits, i;
+	uint64_t mask = l ? (1ULL << l) - 1 : 0;
+	uint64_t first_w = 0, last_w = 0;
+
+	if (j->first == j->end)
+		return NULL;
+	first_w = (j->first + (j->fps[j->first] >> l)) / 64;
+	last_w = (j->end - 1 + (j->fps[j->end - 1] >> l)) / 64;
+	for (i = j->first; i < j->end; i++) {
+		uint64_t v = j->fps[i], bit = i * l;
+		uint64_t pos = i + (v >> l), w = pos / 64;
+
+		if (l) {
+			s->low[bit / 64] |= (v & mask) << (bit % 64);
+			if (bit % 64 + l > 64)
+				s->low[bit / 64 + 1] |= (v & mask) >>
+							(64 - bit % 64);
+		}
+		if (w == first_w || w == last_w)
+			__sync_fetch_and_or(&s->high[w], 1ULL << (pos % 64));
+		else
+			s->high[w] |= 1ULL << (pos % 64);
+	}
+	return NULL;
+}
+
+static size_t region_size(uint64_t nlow, uint64_t nhigh, uint64_t nz,
+			  uint64_t no)
+{
+	return sizeof(struct efset_header) +
+		(nlow + nhigh + nz + no) * sizeof(uint64_t);
+}
+
+static void setup(struct efset *s, void *map, size_t bytes)
+{
+	s->h = map;
+	s->low = (uint64_t *)(s->h + 1);
+	s->high = s->low + s->h->nlow;
+	s->zsamples = s->high + s->h->nhigh;
+	s->osamples = s->zsamples + s->h->nzsamples;
+	s->bytes = bytes;
+}
+
+static inline int sample(uint64_t *samples, uint64_t nsamples, uint64_t i,
+			 uint64_t pos, int check)
+{
+	if (i >= nsamples)
+		return -1;
+	if (!check)
+		samples[i] = pos;
+	return samples[i] == pos ? 0 : -1;
+}
+
+// Fill in the samples, or with check set compare the stored ones with
+// the high bits and make sure these hold n ones and nzeros zeros before
+// the padding.  There is at most one sample per word, as samples are
+// 256 bits apart.
+static int fill_samples(struct efset *s, int check)
+{
+	uint64_t nbits = s->h->n + s->h->nzeros;
+	uint64_t w, ones = 0, zeros = 0, step = 1 << SAMPLE_SHIFT;
+
+	for (w = 0; w < s->h->nhigh; w++) {
+		uint64_t valid = w * 64 >= nbits ? 0 :
+			nbits - w * 64 >= 64 ? ~0ULL :
+			(1ULL << (nbits - w * 64)) - 1;
+		uint64_t word = s->high[w], zword = ~word & valid;
+		uint64_t next;
+
+		// lookup relies on a zero after the last bucket
+		if (word & ~valid)
+			return -1;
+		next = (ones + step - 1) & ~(step - 1);
+		if (next < ones + __builtin_popcountll(word) &&
+		    sample(s->osamples, s->h->nosamples, next >> SAMPLE_SHIFT,
+			   w * 64 + select64(word, next - ones), check) < 0)
+			return -1;
+		next = (zeros + step - 1) & ~(step - 1);
+		if (next < zeros + __builtin_popcountll(zword) &&
+		    sample(s->zsamples, s->h->nzsamples, next >> SAMPLE_SHIFT,
+			   w * 64 + select64(zword, next - zeros), check) < 0)
+			return -1;
+		ones += __builtin_popcountll(word);
+		zeros += __builtin_popcountll(zword);
+	}
+	return ones == s->h->n && zeros == s->h->nzeros ? 0 : -1;
+}
+
+int efset_build(struct efset *s, uint64_t *fps, size_t n, int nthreads)
+{
+	struct build_job job[MAXTHREADS];
+	size_t start[257] = { 0 }, i, m, per;
+	uint64_t *tmp, l, nz, nlow, nhigh;
+	struct efset_header *h;
+	int t;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > MAXTHREADS)
+		nthreads = MAXTHREADS;
+
+	// partition by the top byte
+	tmp = malloc(n * sizeof(uint64_t) + 1);
+	if (!tmp)
+		return -1;
+	for (i = 0; i < n; i++)
+		start[(fps[i] >> 56) + 1]++;
+	for (i = 1; i <= 256; i++)
+		start[i] += start[i - 1];
+	{
+		size_t pos[256];
+
+		memcpy(pos, start, sizeof(pos));
+		for (i = 0; i < n; i++)
+			tmp[pos[fps[i] >> 56]++] = fps[i];
+		memcpy(fps, tmp, n * sizeof(uint64_t));
+	}
+
+	// give every thread partitions holding about n / nthreads elements
+	for (t = 0, i = 0; t < nthreads; t++) {
+		size_t goal = (n / nthreads) * (t + 1);
+
+		job[t].fps = fps;
+		job[t].tmp = tmp;
+		job[t].start = start;
+		job[t].first = i;
+		while (i < 256 && (start[i + 1] <= goal || t == nthreads - 1))
+			i++;
+		job[t].end = i;
+	}
+	run_jobs(job, sizeof(job[0]), nthreads, sort_worker);
+	free(tmp);
+
+	for (i = 0, m = 0; i < n; i++)
+		if (m == 0 || fps[i] != fps[m - 1])
+			fps[m++] = fps[i];
+	n = m;
+
+	// l = floor(log2(2^64 / n))
+	l = n <= 1 ? 63 : __builtin_clzll(n - 1);
+	nz = n ? (fps[n - 1] >> l) + 1 : 0;
+	nlow = (n * l + 63) / 64 + 1;
+	nhigh = (n + nz + 63) / 64 + 1;
+	h = calloc(1, region_size(nlow, nhigh, (nz >> SAMPLE_SHIFT) + 1,
+				  (n >> SAMPLE_SHIFT) + 1));
+	if (!h)
+		return -1;
+	h->magic = EFSET_MAGIC;
+	h->n = n;
+	h->lbits = l;
+	h->nlow = nlow;
+	h->nhigh = nhigh;
+	h->nzeros = nz;
+	h->nzsamples = (nz >> SAMPLE_SHIFT) + 1;
+	h->nosamples = (n >> SAMPLE_SHIFT) + 1;
+	setup(s, h, region_size(nlow, nhigh, h->nzsamples, h->nosamples));
+	s->mapped = 0;
+
+	per = ((n / nthreads) + 63) & ~(size_t)63;
+	for (t = 0, i = 0; t < nthreads; t++) {
+		job[t].s = s;
+		job[t].first = i;
+		i = t == nthreads - 1 || i + per > n ? n : i + per;
+		job[t].end = i;
+	}
+	run_jobs(job, sizeof(job[0]), nthreads, encode_worker);
+
+	// every bucket up to the last one ends with a zero; the high bits
+	// are zero already, so only the samples need to be filled in
+	fill_samples(s, 0);
+	return 0;
+}
+
+int efset_write(const struct efset *s, char *file)
+{
+	const char *p = (const char *)s->h;
+	size_t left = s->bytes;
+	int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0)
+		return -1;
+	while (left > 0) {
+		ssize_t n = write(fd, p, left);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return -1;
+		}
+		p += n;
+		left -= n;
+	}
+	return close(fd);
+}
+
+// The sizes in the header must match each other and the file before
+// anything else is read, and the high bits and samples must agree, as
+// select and lookup scan them without bounds checks.
+static int check_header(const struct efset_header *h, size_t size)
+{
+	uint64_t words = size / sizeof(uint64_t);
+
+	if (size < sizeof(*h) || h->magic != EFSET_MAGIC || h->lbits > 63 ||
+	    h->nlow > words || h->nhigh > words ||
+	    h->nzsamples > words || h->nosamples > words ||
+	    size != region_size(h->nlow, h->nhigh, h->nzsamples,
+				h->nosamples))
+		return -1;
+	// n and nzeros are bounded by the size of the high bits, which
+	// keeps n * lbits and n + nzeros from wrapping
+	if (h->n > h->nhigh * 64 || h->nzeros > h->nhigh * 64 ||
+	    h->nhigh < (h->n + h->nzeros + 63) / 64 + 1 ||
+	    h->nlow < (h->n * h->lbits + 63) / 64 + 1 ||
+	    h->nzsamples < (h->nzeros >> SAMPLE_SHIFT) + 1 ||
+	    h->nosamples < (h->n >> SAMPLE_SHIFT) + 1)
+		return -1;
+	return 0;
+}
+
+int efset_open_file(struct efset *s, char *file)
+{
+	size_t size;
+	char *map = mapfile(file, O_RDONLY, &size);
+
+	if (!map) {
+		// an empty file is not a set
+		if (!errno)
+			errno = EINVAL;
+		return -1;
+	}
+	if (check_header((struct efset_header *)map, size) < 0)
+		goto bad;
+	setup(s, map, size);
+	if (fill_samples(s, 1) < 0)
+		goto bad;
+	s->mapped = 1;
+	return 0;
+
+bad:
+	unmap_file(map, size);
+	errno = EINVAL;
+	return -1;
+}
+
+void efset_free(struct efset *s)
+{
+	if (s->mapped)
+		unmap_file((char *)s->h, s->bytes);
+	else
+		free(s->h);
+	s->h = NULL;
+}
@@ -0,0 +1,60 @@
+// Elias-Fano coded sets of 64-bit spooky fingerprints
+//
+// The sorted fingerprints are split into l low bits, stored packed, and
+// 64 - l high bits, stored as a unary coded bit vector: element i sets
+// bit i + (high bits of element i).  With l = floor(log2(2^64 / n)) this
+// costs about l + 2 bits per key instead of 64.
+//
+// Every 256th zero and every 256th one of the high bit vector is sampled,
+// which bounds the scan for select to a few words.  Membership and rank
+// use select0 to find the bucket of the high bits and then compare the
+// few low bit entries in it.
+//
+// The set is one contiguous region (header, low bits, high bits,
+// samples) that can be written to a file and used from a mapping.
+// efset_open_file checks the header against the file size and the high
+// bits and samples against the header, so a corrupt file is rejected
+// instead of being read out of bounds; this reads the high bits once.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct efset_header
+{
+	uint64_t magic;
+	uint64_t n;
+	uint64_t lbits;
+	uint64_t nlow;		// words of low bits, including one pad word
+	uint64_t nhigh;		// words of high bits
+	uint64_t nzeros;	// zeros in the high bits: last bucket + 1
+	uint64_t nzsamples;
+	uint64_t nosamples;
+};
+
+struct efset
+{
+	struct efset_header *h;
+	uint64_t *low;
+	uint64_t *high;
+	uint64_t *zsamples;	// position of every 256th zero
+	uint64_t *osamples;	// position of every 256th one
+	size_t bytes;
+	int mapped;
+};
+
+// Build from n fingerprints in any order, which are sorted in place.
+// Duplicates are dropped.
+int efset_build(struct efset *s, uint64_t *fps, size_t n, int nthreads);
+
+int efset_write(const struct efset *s, char *file);
+int efset_open_file(struct efset *s, char *file);
+void efset_free(struct efset *s);
+
+int efset_contains(const struct efset *s, uint64_t fp);
+// number of elements smaller than fp
+uint64_t efset_rank(const struct efset *s, uint64_t fp);
+// the i-th smallest element, i < n
+uint64_t efset_select(const struct efset *s, uint64_t i);
+
+uint64_t efset_fingerprint(const void *key, size_t len, uint64_t seed);
@@ -0,0 +1,436 @@
+// Hash partitioning of graph edge lists
+//
+// Every thread owns one write buffer per partition, sized so that all of
+// them together stay within WBUF_TOTAL.  A full buffer reserves its range
+// of the partition file with an atomic add on the file's length and is
+// written there with pwrite, so the only shared writes are those adds.
+// A text line that doesn't fit into a buffer is written directly.
+
+#include <sys/fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "spooky-c.h"
+#include "map.h"
+#include "util.h"
+#include "graphpart.h"
+
+#define BATCH		256
+#define WBUF_TOTAL	(16 << 20)
+#define WBUF_MIN	4096
+#define WBUF_MAX	(64 << 10)
+
+struct out
+{
+	int *fd;
+	uint64_t *length;	// reserved so far, per partition
+	int error;
+};
+
+struct job
+{
+	const struct graphpart *g;
+	struct out *o;
+	const char *data;
+	size_t begin;
+	size_t end;
+	size_t wsize;
+	char *buf;		// wsize bytes per partition
+	size_t *fill;
+	uint64_t *count;
+	uint64_t bad;
+};
+
+// a batch of parsed edges and where their records are
+struct batch
+{
+	uint64_t src[BATCH];
+	uint64_t dst[BATCH];
+	uint64_t hs[BATCH];
+	uint64_t hd[BATCH];
+	const char *rec[BATCH];
+	size_t len[BATCH];
+	int nl[BATCH];		// a newline has to be added
+};
+
+int graphpart_range(uint64_t h, int n)
+{
+	return ((unsigned __int128)h * n) >> 64;
+}
+
+int graphpart_init(struct graphpart *g, int nparts, int mode, int format,
+		   uint64_t seed)
+{
+	int r;
+
+	if (nparts < 1 || nparts > GP_MAXPARTS ||
+	    (mode != GP_EDGE_CUT && mode != GP_VERTEX_CUT) ||
+	    (format != GP_TEXT && format != GP_BIN32 && format != GP_BIN64)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(g, 0, sizeof(*g));
+	g->seed = seed;
+	g->nparts = nparts;
+	g->mode = mode;
+	g->format = format;
+	// the largest divisor up to the square root, for the squarest grid
+	for (r = 1; (r + 1) * (r + 1) <= nparts; r++)
+		;
+	while (nparts % r)
+		r--;
+	g->rows = r;
+	g->cols = nparts / r;
+	return 0;
+}
+
+uint64_t graphpart_hash(const struct graphpart *g, uint64_t vertex)
+{
+	return spooky_hash64(&vertex, sizeof(vertex), g->seed);
+}
+
+static inline int part(const struct graphpart *g, uint64_t hs, uint64_t hd)
+{
+	if (g->mode == GP_EDGE_CUT)
+		return graphpart_range(hs, g->nparts);
+	return graphpart_range(hs, g->rows) * g->cols +
+		graphpart_range(hd, g->cols);
+}
+
+int graphpart_part(const struct graphpart *g, uint64_t src, uint64_t dst)
+{
+	return part(g, graphpart_hash(g, src), graphpart_hash(g, dst));
+}
+
+// append len bytes and a newline if nl to partition p as one range
+static void append(struct job *j, int p, const char *rec, size_t len, int nl)
+{
+	uint64_t off = __atomic_fetch_add(&j->o->length[p], len + nl,
+					  __ATOMIC_RELAXED);
+
+	if (write_all(j->o->fd[p], rec, len, off) < 0 ||
+	    (nl && write_all(j->o->fd[p], "\n", 1, off + len) < 0))
+		__atomic_store_n(&j->o->error, errno, __ATOMIC_RELAXED);
+}
+
+static void flush(struct job *j, int p)
+{
+	if (j->fill[p] > 0)
+		append(j, p, j->buf + p * j->wsize, j->fill[p], 0);
+	j->fill[p] = 0;
+}
+
+static void put(struct job *j, int p, const char *rec, size_t len, int nl)
+{
+	char *b = j->buf + p * j->wsize;
+
+	j->count[p]++;
+	if (j->fill[p] + len + nl > j->wsize)
+		flush(j, p);
+	if (len + nl > j->wsize) {
+		append(j, p, rec, len, nl);
+		return;
+	}
+	memcpy(b + j->fill[p], rec, len);
+	if (nl)
+		b[j->fill[p] + len] = '\n';
+	j->fill[p] += len + nl;
+}
+
+static const char *parse_u64(const char *p, const char *end, uint64_t *v)
+{
+	uint64_t x = 0;
+	const char *s = p;
+
+	for (; p < end && *p >= '0' && *p <= '9'; p++) {
+		if (x > (UINT64_MAX - (*p - '0')) / 10)
+			return NULL;
+		x = x * 10 + *p - '0';
+	}
+	*v = x;
+	return p > s ? p : NULL;
+}
+
+static inline int blank(char c)
+{
+	return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+// 1 for an edge, 0 for a comment or an empty line, -1 otherwise
+static int parse_line(const char *p, const char *end, uint64_t *src,
+		      uint64_t *dst)
+{
+	while (p < end && blank(*p))
+		p++;
+	if (p == end || *p == '#' || *p == '%')
+		return 0;
+	p = parse_u64(p, end, src);
+	if (!p || p == end || !blank(*p))
+		return -1;
+	while (p < end && blank(*p))
+		p++;
+	p = parse_u64(p, end, dst);
+	// anything after the destination, such as a weight, is kept
+	if (!p || (p < end && !blank(*p)))
+		return -1;
+	return 1;
+}
+
+// parse up to BATCH edges from *pos on
+static int parse(struct job *j, struct batch *b, size_t *pos)
+{
+	const char *end = j->data + j->end;
+	size_t rec = j->g->format == GP_BIN32 ? 8 : 16;
+	int n = 0;
+
+	if (j->g->format != GP_TEXT) {
+		const char *p = j->data + *pos;
+
+		for (; n < BATCH && *pos < j->end; n++, p += rec, *pos += rec) {
+			if (rec == 8) {
+				uint32_t e[2];
+
+				memcpy(e, p, sizeof(e));
+				b->src[n] = e[0];
+				b->dst[n] = e[1];
+			} else {
+				memcpy(&b->src[n], p, 8);
+				memcpy(&b->dst[n], p + 8, 8);
+			}
+			b->rec[n] = p;
+			b->len[n] = rec;
+			b->nl[n] = 0;
+		}
+		return n;
+	}
+	while (n < BATCH && *pos < j->end) {
+		const char *p = j->data + *pos;
+		const char *nl = memchr(p, '\n', end - p);
+		const char *next = nl ? nl + 1 : end;
+		int r = parse_line(p, nl ? nl : end, &b->src[n], &b->dst[n]);
+
+		*pos = next - j->data;
+		if (r < 0)
+			j->bad++;
+		if (r <= 0)
+			continue;
+		b->rec[n] = p;
+		b->len[n] = next - p;
+		b->nl[n] = !nl;
+		n++;
+	}
+	return n;
+}
+
+static void *worker(void *arg)
+{
+	struct job *j = arg;
+	const struct graphpart *g = j->g;
+	struct batch *b = malloc(sizeof(struct batch));
+	size_t pos = j->begin;
+	int i, n;
+
+	j->buf = malloc(g->nparts * j->wsize);
+	j->fill = calloc(g->nparts, sizeof(size_t));
+	if (!b || !j->buf || !j->fill) {
+		__atomic_store_n(&j->o->error, ENOMEM, __ATOMIC_RELAXED);
+		goto out;
+	}
+	while (pos < j->end &&
+	       !__atomic_load_n(&j->o->error, __ATOMIC_RELAXED)) {
+		n = parse(j, b, &pos);
+		spooky_hash64_u64(b->src, n, g->seed, b->hs);
+		// hd is only hashed, and only read, in vertex-cut mode
+		if (g->mode == GP_VERTEX_CUT) {
+			spooky_hash64_u64(b->dst, n, g->seed, b->hd);
+			for (i = 0; i < n; i++)
+				put(j, part(g, b->hs[i], b->hd[i]), b->rec[i],
+				    b->len[i], b->nl[i]);
+		} else {
+			for (i = 0; i < n; i++)
+				put(j, part(g, b->hs[i], 0), b->rec[i],
+				    b->len[i], b->nl[i]);
+		}
+	}
+	for (i = 0; i < g->nparts; i++)
+		flush(j, i);
+out:
+	free(b);
+	free(j->buf);
+	free(j->fill);
+	return NULL;
+}
+
+static int open_parts(struct out *o, const struct graphpart *g,
+		      const char *prefix)
+{
+	size_t len = strlen(prefix) + 16;
+	char name[len];
+	int i;
+
+	o->fd = malloc(g->nparts * sizeof(int));
+	o->length = calloc(g->nparts, sizeof(uint64_t));
+	o->error = ENOMEM;
+	for (i = 0; o->fd && o->length && i < g->nparts; i++) {
+		snprintf(name, len, "%s.%d", prefix, i);
+		o->fd[i] = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (o->fd[i] < 0) {
+			o->error = errno;
+			break;
+		}
+	}
+	if (!o->fd || !o->length || i < g->nparts) {
+		while (o->fd && --i >= 0)
+			close(o->fd[i]);
+		free(o->fd);
+		free(o->length);
+		return -1;
+	}
+	o->error = 0;
+	return 0;
+}
+
+static void close_parts(struct out *o, int nparts)
+{
+	int i;
+
+	for (i = 0; o->fd && i < nparts && !o->error; i++)
+		if (close(o->fd[i]) < 0)
+			o->error = errno;
+	for (; o->fd && i < nparts; i++)
+		close(o->fd[i]);
+	free(o->fd);
+	free(o->length);
+}
+
+int graphpart_split(const struct graphpart *g, const char *data, size_t size,
+		    const char *prefix, int nthreads,
+		    struct graphpart_stats *st)
+{
+	size_t rec = g->format == GP_BIN32 ? 8 : 16;
+	size_t wsize = WBUF_TOTAL / g->nparts;
+	uint64_t *count;
+	struct out o;
+	int i, p;
+
+	memset(st, 0, sizeof(*st));
+	if (g->format != GP_TEXT && size % rec) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (nthreads < 1)
+		nthreads = 1;
+	if ((size_t)nthreads > size / 65536 + 1)
+		nthreads = size / 65536 + 1;
+	st->nparts = g->nparts;
+	st->count = calloc(g->nparts, sizeof(uint64_t));
+	count = calloc((size_t)nthreads * g->nparts, sizeof(uint64_t));
+	if (!st->count || !count) {
+		free(count);
+		graphpart_stats_free(st);
+		errno = ENOMEM;
+		return -1;
+	}
+	if (open_parts(&o, g, prefix) < 0) {
+		free(count);
+		graphpart_stats_free(st);
+		errno = o.error;
+		return -1;
+	}
+	if (wsize < WBUF_MIN)
+		wsize = WBUF_MIN;
+	if (wsize > WBUF_MAX)
+		wsize = WBUF_MAX;
+
+	{
+		struct job job[nthreads];
+
+		for (i = 0; i < nthreads; i++) {
+			size_t begin = size / nthreads * i;
+			size_t end = size / nthreads * (i + 1);
+
+			memset(&job[i], 0, sizeof(job[i]));
+			job[i].g = g;
+			job[i].o = &o;
+			job[i].data = data;
+			job[i].wsize = wsize;
+			job[i].count = count + (size_t)i * g->nparts;
+			if (g->format == GP_TEXT) {
+				job[i].begin = after_newline(data, size, begin);
+				job[i].end = i == nthreads - 1 ? size :
+					after_newline(data, size, end);
+			} else {
+				job[i].begin = begin / rec * rec;
+				job[i].end = i == nthreads - 1 ? size :
+					end / rec * rec;
+			}
+		}
+		run_jobs(job, sizeof(job[0]), nthreads, worker);
+		for (i = 0; i < nthreads; i++) {
+			st->bad += job[i].bad;
+			for (p = 0; p < g->nparts; p++)
+				st->count[p] += job[i].count[p];
+		}
+	}
+	free(count);
+	for (p = 0; p < g->nparts; p++)
+		st->edges += st->count[p];
+	close_parts(&o, g->nparts);
+	if (o.error) {
+		graphpart_stats_free(st);
+		errno = o.error;
+		return -1;
+	}
+	return 0;
+}
+
+int graphpart_split_file(const struct graphpart *g, char *file,
+			 const char *prefix, int nthreads,
+			 struct graphpart_stats *st)
+{
+	size_t size;
+	char *map = mapfile(file, O_RDONLY, &size);
+	int ret;
+
+	memset(st, 0, sizeof(*st));
+	if (!map && errno)
+		return -1;
+	ret = graphpart_split(g, map, size, prefix, nthreads, st);
+	if (map)
+		unmap_file(map, size);
+	return ret;
+}
+
+void graphpart_stats_free(struct graphpart_stats *st)
+{
+	free(st->count);
+	memset(st, 0, sizeof(*st));
+}
+
+int graphpart_stats_write(const struct graphpart *g,
+			  const struct graphpart_stats *st, FILE *f)
+{
+	uint64_t min = st->nparts ? st->count[0] : 0, max = 0;
+	double mean = st->nparts ? (double)st->edges / st->nparts : 0;
+	int p;
+
+	for (p = 0; p < st->nparts; p++) {
+		if (st->count[p] < min)
+			min = st->count[p];
+		if (st->count[p] > max)
+			max = st->count[p];
+		if (fprintf(f, "%d %llu\n", p,
+			    (unsigned long long)st->count[p]) < 0)
+			return -1;
+	}
+	if (g->mode == GP_VERTEX_CUT &&
+	    fprintf(f, "grid %d x %d\n", g->rows, g->cols) < 0)
+		return -1;
+	if (fprintf(f, "%llu edges, %llu bad lines, min %llu max %llu, "
+		    "imbalance %.3f\n", (unsigned long long)st->edges,
+		    (unsigned long long)st->bad, (unsigned long long)min,
+		    (unsigned long long)max, mean > 0 ? max / mean : 1.0) < 0)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,79 @@
+// Hash partitioning of graph edge lists
+//
+// Splits an edge list into nparts partition files by hashing vertex ids.
+// The hash of a vertex is spooky_hash64 of its id as a 64-bit integer,
+// whatever the input format, so text and binary lists of the same graph
+// are partitioned the same way, and the hash is reduced to a partition
+// with a multiply and shift instead of a division.
+//
+// In edge-cut mode an edge goes to the partition of its source, so every
+// vertex has all its out-edges in one place.  In vertex-cut mode the
+// partitions form a rows x cols grid, as close to square as nparts
+// allows, and an edge goes to the row of its source and the column of
+// its destination; a vertex then has edges in at most rows + cols - 1
+// partitions, which bounds the replication of high degree vertices.
+//
+// The input is mapped and cut into one chunk per thread.  Each thread
+// parses and hashes a batch of edges at a time and copies the records as
+// they are into a buffer per partition.  Full buffers are appended to the
+// partition files with pwrite at an offset reserved with an atomic add,
+// so threads never wait for each other.  The order of the edges within a
+// partition file is not preserved.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define GP_EDGE_CUT	0	// by the source vertex
+#define GP_VERTEX_CUT	1	// by the source row and destination column
+
+#define GP_TEXT		0	// lines of "src dst ...", # and % start comments
+#define GP_BIN32	1	// pairs of uint32_t, little endian
+#define GP_BIN64	2	// pairs of uint64_t, little endian
+
+#define GP_MAXPARTS	4096
+
+struct graphpart
+{
+	uint64_t seed;
+	int nparts;
+	int mode;
+	int format;
+	int rows;
+	int cols;
+};
+
+struct graphpart_stats
+{
+	uint64_t edges;		// written to partitions
+	uint64_t bad;		// text lines that are not edges
+	uint64_t *count;	// edges in each partition
+	int nparts;
+};
+
+// -1 with errno EINVAL for an unknown mode or format or a bad nparts
+int graphpart_init(struct graphpart *g, int nparts, int mode, int format,
+		   uint64_t seed);
+uint64_t graphpart_hash(const struct graphpart *g, uint64_t vertex);
+// the partition of h in 0..n-1
+int graphpart_range(uint64_t h, int n);
+int graphpart_part(const struct graphpart *g, uint64_t src, uint64_t dst);
+
+// Partition the edges in data into the files prefix.0 to prefix.<n-1>
+// with nthreads threads.  A binary list that is not a whole number of
+// edges fails with EINVAL.  Text lines are copied with their newline,
+// which is added to a last line that has none.
+int graphpart_split(const struct graphpart *g, const char *data, size_t size,
+		    const char *prefix, int nthreads,
+		    struct graphpart_stats *st);
+// the same for a file, which is read through mapfile
+int graphpart_split_file(const struct graphpart *g, char *file,
+			 const char *prefix, int nthreads,
+			 struct graphpart_stats *st);
+void graphpart_stats_free(struct graphpart_stats *st);
+
+// Write the edges of every partition and a summary line with the total,
+// the smallest and largest partitions and max / mean.
+int graphpart_stats_write(const struct graphpart *g,
+			  const struct graphpart_stats *st, FILE *f);
@@ -0,0 +1,331 @@
+// In-process hashing service
+//
+// The submission rings are bounded multi-producer queues with a sequence
+// number per slot: a producer claims a position with a compare and swap
+// on the tail and publishes the slot by advancing its sequence number,
+// so the single consumer never sees a half written request.
+//
+// A worker going to sleep sets its sleeping flag and then checks the ring
+// once more.  Producers check the flag after publishing, so one of the
+// two always sees the other and no wakeup is lost.
+
+#define _GNU_SOURCE 1
+#include <sys/eventfd.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "spooky-c.h"
+#include "hashsvc.h"
+
+#define SPIN 2000
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ volatile("" ::: "memory")
+#endif
+
+static unsigned roundup_pow2(unsigned n)
+{
+	unsigned p = 1;
+
+	while (p < n)
+		p *= 2;
+	return p;
+}
+
+static void kick(int efd)
+{
+	uint64_t one = 1;
+	ssize_t ret;
+
+	// the counter can only overflow after 2^64 kicks
+	ret = write(efd, &one, sizeof(one));
+	(void)ret;
+}
+
+static int sq_pop(struct hs_worker *w, struct hs_req *req)
+{
+	struct hs_sqe *e = &w->sq[w->head & w->mask];
+
+	if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != w->head + 1)
+		return 0;
+	*req = e->req;
+	__atomic_store_n(&e->seq, w->head + w->mask + 1, __ATOMIC_RELEASE);
+	w->head++;
+	return 1;
+}
+
+static int sq_push(struct hs_worker *w, const struct hs_req *req)
+{
+	uint64_t pos = __atomic_load_n(&w->tail, __ATOMIC_RELAXED);
+	struct hs_sqe *e;
+
+	for (;;) {
+		int64_t diff;
+
+		e = &w->sq[pos & w->mask];
+		diff = (int64_t)(__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&w->tail, &pos, pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n(&w->tail, __ATOMIC_RELAXED);
+		}
+	}
+	e->req = *req;
+	__atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static int cmp_len(const void *a, const void *b)
+{
+	const struct hs_req *x = a, *y = b;
+
+	return (x->len > y->len) - (x->len < y->len);
+}
+
+static inline void complete(struct hs_req *r, uint64_t h1, uint64_t h2)
+{
+	struct hs_client *c = r->client;
+	struct hs_cqe *e = &c->cq[c->tail & c->mask];
+
+	e->user = r->user;
+	e->hash1 = h1;
+	e->hash2 = h2;
+	// the client never has more requests in flight than its ring holds
+	__atomic_store_n(&c->tail, c->tail + 1, __ATOMIC_RELEASE);
+}
+
+static void run_batch(struct hs_req *b, int n)
+{
+	struct hs_client *notify[HS_BATCH];
+	int i, j, k, nnotify = 0;
+
+	qsort(b, n, sizeof(*b), cmp_len);
+	for (i = 0; i < n; ) {
+		if (i + 4 <= n && b[i].len >= SC_BUFSIZE &&
+		    b[i + 3].len == b[i].len) {
+			const void *msg[4];
+			uint64_t h1[4], h2[4];
+
+			for (k = 0; k < 4; k++) {
+				msg[k] = b[i + k].msg;
+				h1[k] = b[i + k].seed1;
+				h2[k] = b[i + k].seed2;
+			}
+			spooky_hash128_x4(msg, b[i].len, h1, h2);
+			for (k = 0; k < 4; k++)
+				complete(&b[i + k], h1[k], h2[k]);
+			i += 4;
+		} else {
+			uint64_t h1 = b[i].seed1, h2 = b[i].seed2;
+
+			spooky_hash128(b[i].msg, b[i].len, &h1, &h2);
+			complete(&b[i], h1, h2);
+			i++;
+		}
+	}
+
+	// one eventfd write per client and batch
+	for (i = 0; i < n; i++) {
+		struct hs_client *c = b[i].client;
+
+		if (c->efd < 0)
+			continue;
+		for (j = 0; j < nnotify; j++)
+			if (notify[j] == c)
+				break;
+		if (j == nnotify) {
+			notify[nnotify++] = c;
+			kick(c->efd);
+		}
+	}
+}
+
+static void *worker_loop(void *arg)
+{
+	struct hs_worker *w = arg;
+	struct hs_req batch[HS_BATCH];
+	int idle = 0;
+
+	if (w->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	while (!w->stop) {
+		int n = 0;
+
+		while (n < HS_BATCH && sq_pop(w, &batch[n]))
+			n++;
+		if (n > 0) {
+			run_batch(batch, n);
+			w->nreq += n;
+			w->nbatch++;
+			idle = 0;
+			continue;
+		}
+		if (++idle < SPIN) {
+			cpu_relax();
+			continue;
+		}
+		if (w->flags & HS_POLL) {
+			// don't starve the clients when the core is shared
+			sched_yield();
+			idle = 0;
+			continue;
+		}
+
+		__atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&w->sq[w->head & w->mask].seq,
+				    __ATOMIC_SEQ_CST) != w->head + 1 &&
+		    !w->stop) {
+			uint64_t cnt;
+
+			if (read(w->efd, &cnt, sizeof(cnt)) < 0 &&
+			    errno != EINTR)
+				break;
+		}
+		__atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+		idle = 0;
+	}
+	return NULL;
+}
+
+static void free_worker(struct hs_worker *w)
+{
+	if (w->efd >= 0)
+		close(w->efd);
+	free(w->sq);
+	free(w);
+}
+
+int hs_init(struct hs_service *s, int nworkers, const int *cpus,
+	    unsigned entries, int flags)
+{
+	unsigned n = roundup_pow2(entries < 2 ? 2 : entries);
+	int i;
+
+	if (nworkers < 1 || nworkers > HS_MAXWORKERS) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(s, 0, sizeof(*s));
+	for (i = 0; i < nworkers; i++) {
+		struct hs_worker *w;
+		unsigned k;
+
+		if (posix_memalign((void **)&w, 64, sizeof(*w)))
+			goto fail;
+		memset(w, 0, sizeof(*w));
+		w->efd = eventfd(0, EFD_CLOEXEC);
+		w->sq = malloc(n * sizeof(struct hs_sqe));
+		if (w->efd < 0 || !w->sq) {
+			free_worker(w);
+			goto fail;
+		}
+		for (k = 0; k < n; k++)
+			w->sq[k].seq = k;
+		w->mask = n - 1;
+		w->cpu = cpus ? cpus[i] : -1;
+		w->flags = flags;
+		if (pthread_create(&w->thread, NULL, worker_loop, w)) {
+			free_worker(w);
+			goto fail;
+		}
+		s->worker[s->nworkers++] = w;
+	}
+	return 0;
+
+fail:
+	hs_free(s);
+	return -1;
+}
+
+void hs_free(struct hs_service *s)
+{
+	int i;
+
+	for (i = 0; i < s->nworkers; i++) {
+		struct hs_worker *w = s->worker[i];
+
+		w->stop = 1;
+		kick(w->efd);
+		pthread_join(w->thread, NULL);
+		free_worker(w);
+	}
+	s->nworkers = 0;
+}
+
+int hs_client_init(struct hs_client *c, struct hs_service *s,
+		   unsigned entries, int flags)
+{
+	unsigned n = roundup_pow2(entries < 1 ? 1 : entries);
+
+	memset(c, 0, sizeof(*c));
+	c->cq = malloc(n * sizeof(struct hs_cqe));
+	if (!c->cq)
+		return -1;
+	c->mask = n - 1;
+	c->efd = -1;
+	if (flags & HS_EVENTFD) {
+		c->efd = eventfd(0, EFD_CLOEXEC);
+		if (c->efd < 0) {
+			free(c->cq);
+			return -1;
+		}
+	}
+	c->worker = s->worker[__sync_fetch_and_add(&s->next, 1) % s->nworkers];
+	return 0;
+}
+
+void hs_client_free(struct hs_client *c)
+{
+	if (c->efd >= 0)
+		close(c->efd);
+	free(c->cq);
+}
+
+int hs_submit(struct hs_client *c, const void *msg, size_t len,
+	      uint64_t seed1, uint64_t seed2, uint64_t user)
+{
+	struct hs_worker *w = c->worker;
+	struct hs_req req = { msg, len, seed1, seed2, user, c };
+
+	if (c->submitted - c->head > c->mask || sq_push(w, &req) < 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	c->submitted++;
+	if (!(w->flags & HS_POLL)) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED))
+			kick(w->efd);
+	}
+	return 0;
+}
+
+unsigned hs_wait(struct hs_client *c, struct hs_cqe *cqe, unsigned max)
+{
+	unsigned n;
+
+	while ((n = hs_reap(c, cqe, max)) == 0) {
+		uint64_t cnt;
+
+		if (c->efd < 0)
+			sched_yield();
+		else if (read(c->efd, &cnt, sizeof(cnt)) < 0 && errno != EINTR)
+			break;
+	}
+	return n;
+}
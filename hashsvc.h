@@ -0,0 +1,140 @@
+// In-process hashing service
+//
+// Hashing is moved off latency critical threads onto one or more worker
+// threads, which can be pinned to dedicated cores.  The interface is
+// modelled after io_uring: clients post requests into a lock-free
+// multi-producer submission ring of a worker and pick up results from
+// their own completion ring.  Each client is bound to one worker, so a
+// completion ring only ever has one producer and one consumer.
+//
+// A worker drains its submission ring in batches and sorts every batch
+// by length, so equally sized long messages can be hashed four at a time
+// with spooky_hash128_x4.
+//
+// Workers either poll their ring all the time (HS_POLL, for a dedicated
+// core) or go to sleep on an eventfd after spinning for a while.  Clients
+// either poll their completion ring with hs_reap or ask for an eventfd
+// (HS_EVENTFD) that is signalled when completions are posted, which can
+// be used with hs_wait or added to an epoll set.
+//
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define HS_MAXWORKERS	64
+#define HS_BATCH	64
+
+// hs_init flags
+#define HS_POLL		1	// workers never sleep
+
+// hs_client_init flags
+#define HS_EVENTFD	1	// signal completions on an eventfd
+
+struct hs_client;
+
+struct hs_req
+{
+	const void *msg;
+	size_t len;
+	uint64_t seed1;
+	uint64_t seed2;
+	uint64_t user;
+	struct hs_client *client;
+};
+
+struct hs_sqe
+{
+	uint64_t seq;
+	struct hs_req req;
+};
+
+// completion: the user value passed to hs_submit and the hash
+struct hs_cqe
+{
+	uint64_t user;
+	uint64_t hash1;
+	uint64_t hash2;
+};
+
+struct hs_worker
+{
+	// written by producers
+	uint64_t tail __attribute__((aligned(64)));
+	// written by the worker
+	uint64_t head __attribute__((aligned(64)));
+	int sleeping;
+	struct hs_sqe *sq;
+	unsigned mask;
+	int efd;
+	int cpu;
+	int flags;
+	volatile int stop;
+	uint64_t nreq;		// statistics
+	uint64_t nbatch;
+	pthread_t thread;
+};
+
+struct hs_service
+{
+	int nworkers;
+	unsigned next;
+	struct hs_worker *worker[HS_MAXWORKERS];
+};
+
+struct hs_client
+{
+	// written by the worker
+	uint64_t tail __attribute__((aligned(64)));
+	// only used by the client
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t submitted;
+	struct hs_cqe *cq;
+	unsigned mask;
+	int efd;
+	struct hs_worker *worker;
+};
+
+// Start nworkers workers.  When cpus is not NULL worker i is pinned to
+// cpus[i].  entries is the size of each submission ring, rounded up to
+// a power of two.
+int hs_init(struct hs_service *s, int nworkers, const int *cpus,
+	    unsigned entries, int flags);
+// stop the workers; all clients must be idle
+void hs_free(struct hs_service *s);
+
+// entries bounds the number of requests the client can have in flight
+int hs_client_init(struct hs_client *c, struct hs_service *s,
+		   unsigned entries, int flags);
+void hs_client_free(struct hs_client *c);
+
+// Queue hashing msg with the seeds.  msg must stay valid until the
+// completion is reaped.  Returns -1 with errno EAGAIN when the client
+// has entries requests in flight or the submission ring is full.
+int hs_submit(struct hs_client *c, const void *msg, size_t len,
+	      uint64_t seed1, uint64_t seed2, uint64_t user);
+
+// copy up to max completions into cqe without blocking; returns the number
+static inline unsigned hs_reap(struct hs_client *c, struct hs_cqe *cqe,
+			       unsigned max)
+{
+	uint64_t tail = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+	unsigned n = 0;
+
+	while (c->head + n != tail && n < max) {
+		cqe[n] = c->cq[(c->head + n) & c->mask];
+		n++;
+	}
+	c->head += n;
+	return n;
+}
+
+// Like hs_reap, but block until there is at least one completion.  Only
+// call this with requests in flight.
+unsigned hs_wait(struct hs_client *c, struct hs_cqe *cqe, unsigned max);
+
+// the eventfd of a HS_EVENTFD client, or -1
+static inline int hs_client_fd(struct hs_client *c)
+{
+	return c->efd;
+}
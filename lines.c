@@ -0,0 +1,210 @@
+// Per-line hashes of newline delimited files
+//
+// Every thread first counts the newlines in its chunk, which runs at
+// memory speed, so that after a prefix sum all threads can write their
+// lines straight into the final arrays.
+
+#include <sys/fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "spooky-c.h"
+#include "map.h"
+#include "util.h"
+#include "lines.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_SCAN_AVX2 1
+#endif
+
+#define BATCH 64
+
+struct job
+{
+	const char *data;
+	size_t begin;
+	size_t end;
+	uint64_t seed;
+	int avx2;
+	int count;		// only count the lines
+	uint64_t n;
+	uint64_t *offset;
+	uint64_t *hash;
+};
+
+#ifdef HAVE_SCAN_AVX2
+// bit i set when p[i] is a newline
+__attribute__((target("avx2")))
+static inline uint64_t newlines64(const char *p)
+{
+	__m256i nl = _mm256_set1_epi8('\n');
+	__m256i a = _mm256_loadu_si256((const __m256i *)p);
+	__m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+	uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl));
+	uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl));
+
+	return (uint64_t)hi << 32 | lo;
+}
+#endif
+
+// hash a batch of lines given by their starts and ends
+static void flush(struct job *j, const uint64_t *start, const uint64_t *end,
+		  int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		j->offset[j->n + i] = start[i];
+		j->hash[j->n + i] = spooky_hash64(j->data + start[i],
+						  end[i] - start[i], j->seed);
+	}
+	j->n += n;
+}
+
+static void count(struct job *j)
+{
+	size_t pos = j->begin;
+
+#ifdef HAVE_SCAN_AVX2
+	if (j->avx2)
+		for (; pos + 64 <= j->end; pos += 64)
+			j->n += __builtin_popcountll(newlines64(j->data + pos));
+#endif
+	for (; pos < j->end; pos++)
+		j->n += j->data[pos] == '\n';
+	// an unterminated last line
+	if (j->end > j->begin && j->data[j->end - 1] != '\n')
+		j->n++;
+}
+
+static void *worker(void *arg)
+{
+	struct job *j = arg;
+	uint64_t start[BATCH], end[BATCH];
+	size_t pos = j->begin, line = j->begin;
+	int n = 0;
+
+	if (j->count) {
+		count(j);
+		return NULL;
+	}
+
+#ifdef HAVE_SCAN_AVX2
+	if (j->avx2) {
+		for (; pos + 64 <= j->end; pos += 64) {
+			uint64_t m = newlines64(j->data + pos);
+
+			while (m) {
+				size_t nl = pos + __builtin_ctzll(m);
+
+				m &= m - 1;
+				start[n] = line;
+				end[n] = nl;
+				line = nl + 1;
+				if (++n == BATCH) {
+					flush(j, start, end, n);
+					n = 0;
+				}
+			}
+		}
+	}
+#endif
+	for (; pos < j->end; pos++) {
+		const char *nl = memchr(j->data + pos, '\n', j->end - pos);
+
+		if (!nl)
+			break;
+		pos = nl - j->data;
+		start[n] = line;
+		end[n] = pos;
+		line = pos + 1;
+		if (++n == BATCH) {
+			flush(j, start, end, n);
+			n = 0;
+		}
+	}
+	// an unterminated last line
+	if (line < j->end) {
+		start[n] = line;
+		end[n] = j->end;
+		n++;
+	}
+	flush(j, start, end, n);
+	return NULL;
+}
+
+int lines_hash(struct lines *l, const char *data, size_t size, uint64_t seed,
+	       int nthreads)
+{
+	int avx2 = 0, i;
+	uint64_t total = 0;
+
+#ifdef HAVE_SCAN_AVX2
+	avx2 = __builtin_cpu_supports("avx2");
+#endif
+	memset(l, 0, sizeof(*l));
+	if (nthreads < 1)
+		nthreads = 1;
+	if ((size_t)nthreads > size / 4096 + 1)
+		nthreads = size / 4096 + 1;
+
+	{
+		struct job job[nthreads];
+
+		for (i = 0; i < nthreads; i++) {
+			memset(&job[i], 0, sizeof(job[i]));
+			job[i].data = data;
+			job[i].seed = seed;
+			job[i].avx2 = avx2;
+			job[i].count = 1;
+			// a chunk starts right after a newline
+			job[i].begin = after_newline(data, size,
+						     size / nthreads * i);
+			job[i].end = i == nthreads - 1 ? size :
+				after_newline(data, size, size / nthreads * (i + 1));
+		}
+		run_jobs(job, sizeof(job[0]), nthreads, worker);
+		for (i = 0; i < nthreads; i++)
+			total += job[i].n;
+
+		l->offset = malloc((total ? total : 1) * sizeof(uint64_t));
+		l->hash = malloc((total ? total : 1) * sizeof(uint64_t));
+		if (!l->offset || !l->hash) {
+			lines_free(l);
+			return -1;
+		}
+		l->n = total;
+		for (i = 0, total = 0; i < nthreads; i++) {
+			job[i].offset = l->offset + total;
+			job[i].hash = l->hash + total;
+			total += job[i].n;
+			job[i].n = 0;
+			job[i].count = 0;
+		}
+		run_jobs(job, sizeof(job[0]), nthreads, worker);
+	}
+	return 0;
+}
+
+int lines_hash_file(struct lines *l, char *file, uint64_t seed, int nthreads)
+{
+	size_t size;
+	char *map = mapfile(file, O_RDONLY, &size);
+	int ret;
+
+	memset(l, 0, sizeof(*l));
+	if (!map && errno)
+		return -1;
+	ret = lines_hash(l, map, size, seed, nthreads);
+	if (map)
+		unmap_file(map, size);
+	return ret;
+}
+
+void lines_free(struct lines *l)
+{
+	free(l->offset);
+	free(l->hash);
+	memset(l, 0, sizeof(*l));
+}
@@ -0,0 +1,31 @@
+// Per-line hashes of newline delimited files
+//
+// Every line of a text file (NDJSON, CSV, logs) gets its starting offset
+// and a 64-bit hash, for deduplication or partitioning of records without
+// reading the file line by line.  The hash of a line, not including its
+// newline, is spooky_hash64(line, len, seed), so it can be stored and
+// compared with hashes computed elsewhere.  For lines shorter than
+// SC_BUFSIZE it is the first word of spooky_shorthash.  A last line
+// without a newline counts as a line when it is not empty.
+//
+// The file is cut into one chunk per thread at newline boundaries.  Each
+// thread finds line ends 64 bytes at a time with AVX2 compares where the
+// CPU has them, and collects a batch of lines before hashing them, so
+// the independent hashes of a batch can overlap in the core instead of
+// waiting on the scan.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct lines
+{
+	uint64_t n;
+	uint64_t *offset;	// start of line i
+	uint64_t *hash;
+};
+
+int lines_hash(struct lines *l, const char *data, size_t size, uint64_t seed,
+	       int nthreads);
+int lines_hash_file(struct lines *l, char *file, uint64_t seed, int nthreads);
+void lines_free(struct lines *l);
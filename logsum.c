@@ -0,0 +1,373 @@
+// Running checksums of append-only files
+//
+// Hashing is split at checkpoint boundaries, so the state can be copied
+// and finalized exactly when a boundary is reached.  Checkpoints are
+// appended to the state file before the header with the stream state is
+// rewritten, so a crash between the two writes only loses checkpoints
+// that are past the persisted length and get recomputed anyway.
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "logsum.h"
+
+#define LOGSUM_MAGIC 0x316d75736b6f6f6cULL	// "looksum1"
+#define CHUNK (1 << 16)
+#define HEAD 4096
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+
+static void reset(struct logsum_file *f, const struct stat *st)
+{
+	f->p.dev = st->st_dev;
+	f->p.ino = st->st_ino;
+	f->p.ncheckpoints = 0;
+	f->p.head_len = 0;
+	f->p.head_hash = 0;
+	spooky_init(&f->p.st, f->p.seed1, f->p.seed2);
+}
+
+static uint64_t head_hash(struct logsum_file *f, uint64_t len)
+{
+	char buf[HEAD];
+
+	if (pread(f->fd, buf, len, 0) != (ssize_t)len)
+		return ~f->p.head_hash;
+	return spooky_hash64(buf, len, f->p.seed1);
+}
+
+// the bytes buffered in the state must still be in the file
+static int tail_matches(struct logsum_file *f, const struct logsum_persist *p)
+{
+	char buf[SC_BUFSIZE];
+	uint64_t r = p->st.m_remainder;
+
+	return r <= p->st.m_length && r <= SC_BUFSIZE &&
+		pread(f->fd, buf, r, p->st.m_length - r) == (ssize_t)r &&
+		memcmp(buf, p->st.m_data, r) == 0;
+}
+
+static int load_state(struct logsum_file *f, const struct stat *st)
+{
+	struct logsum_persist p;
+	ssize_t n = pread(f->sfd, &p, sizeof(p), 0);
+	uint64_t bytes;
+
+	if (n != sizeof(p) || p.magic != LOGSUM_MAGIC || p.interval == 0) {
+		reset(f, st);
+		return 0;
+	}
+	f->p.seed1 = p.seed1;
+	f->p.seed2 = p.seed2;
+	f->p.interval = p.interval;
+	if (p.dev != (uint64_t)st->st_dev || p.ino != (uint64_t)st->st_ino ||
+	    p.st.m_length > (uint64_t)st->st_size ||
+	    p.head_len > HEAD || head_hash(f, p.head_len) != p.head_hash ||
+	    !tail_matches(f, &p)) {
+		// replaced or truncated
+		reset(f, st);
+		return 0;
+	}
+	f->p = p;
+	f->cpcap = p.ncheckpoints + 16;
+	f->cp = malloc(f->cpcap * sizeof(struct logsum_checkpoint));
+	if (!f->cp)
+		return -1;
+	bytes = p.ncheckpoints * sizeof(struct logsum_checkpoint);
+	if (pread(f->sfd, f->cp, bytes, sizeof(p)) != (ssize_t)bytes) {
+		reset(f, st);
+		return 0;
+	}
+	return 0;
+}
+
+static int save_state(struct logsum_file *f, uint64_t first_new)
+{
+	uint64_t n = f->p.ncheckpoints - first_new;
+	ssize_t bytes = n * sizeof(struct logsum_checkpoint);
+
+	if (f->p.head_len < HEAD && f->p.head_len < f->p.st.m_length) {
+		f->p.head_len = f->p.st.m_length < HEAD ? f->p.st.m_length : HEAD;
+		f->p.head_hash = head_hash(f, f->p.head_len);
+	}
+	if (n && pwrite(f->sfd, f->cp + first_new, bytes,
+			sizeof(struct logsum_persist) +
+			first_new * sizeof(struct logsum_checkpoint)) != bytes)
+		return -1;
+	if (pwrite(f->sfd, &f->p, sizeof(f->p), 0) != sizeof(f->p))
+		return -1;
+	return 0;
+}
+
+static int add_checkpoint(struct logsum_file *f)
+{
+	struct logsum_checkpoint *c;
+
+	if (f->p.ncheckpoints == f->cpcap) {
+		uint64_t cap = f->cpcap ? f->cpcap * 2 : 16;
+
+		c = realloc(f->cp, cap * sizeof(*c));
+		if (!c)
+			return -1;
+		f->cp = c;
+		f->cpcap = cap;
+	}
+	c = &f->cp[f->p.ncheckpoints++];
+	c->length = logsum_digest(f, &c->hash1, &c->hash2);
+	return 0;
+}
+
+int logsum_catch_up(struct logsum_file *f)
+{
+	uint64_t first_new, start;
+	struct stat st;
+	char *buf;
+
+	if (fstat(f->fd, &st) < 0)
+		return -1;
+	if ((uint64_t)st.st_size < f->p.st.m_length) {
+		// truncated under us, start over
+		reset(f, &st);
+		if (ftruncate(f->sfd, sizeof(f->p)) < 0 ||
+		    save_state(f, 0) < 0)
+			return -1;
+	}
+	first_new = f->p.ncheckpoints;
+	start = f->p.st.m_length;
+	buf = malloc(CHUNK);
+	if (!buf)
+		return -1;
+	for (;;) {
+		uint64_t len = f->p.st.m_length;
+		uint64_t want = f->p.interval - len % f->p.interval;
+		ssize_t n;
+
+		if (want > CHUNK)
+			want = CHUNK;
+		n = pread(f->fd, buf, want, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		spooky_update(&f->p.st, buf, n);
+		f->bytes_read += n;
+		if (f->p.st.m_length % f->p.interval == 0 &&
+		    add_checkpoint(f) < 0)
+			break;
+	}
+	free(buf);
+	if (f->p.st.m_length == start)
+		return 0;
+	if (save_state(f, first_new) < 0)
+		return -1;
+	return 1;
+}
+
+struct logsum_file *logsum_add(struct logsum *ls, char *path,
+			       char *statepath, uint64_t seed1,
+			       uint64_t seed2, uint64_t interval)
+{
+	struct logsum_file *f, **files;
+	struct stat st;
+
+	if (interval == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	files = realloc(ls->files, (ls->nfiles + 1) * sizeof(*files));
+	if (!files)
+		return NULL;
+	ls->files = files;
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+	f->fd = f->sfd = f->wd = -1;
+	f->path = strdup(path);
+	f->p.magic = LOGSUM_MAGIC;
+	f->p.seed1 = seed1;
+	f->p.seed2 = seed2;
+	f->p.interval = interval;
+	if (!f->path)
+		goto fail;
+	f->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (f->fd < 0 || fstat(f->fd, &st) < 0)
+		goto fail;
+	f->sfd = open(statepath, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (f->sfd < 0 || load_state(f, &st) < 0)
+		goto fail;
+	f->wd = inotify_add_watch(ls->ifd, path, WATCH_MASK);
+	if (f->wd < 0 || logsum_catch_up(f) < 0)
+		goto fail;
+	ls->files[ls->nfiles++] = f;
+	return f;
+
+fail:
+	if (f->wd >= 0)
+		inotify_rm_watch(ls->ifd, f->wd);
+	if (f->sfd >= 0)
+		close(f->sfd);
+	if (f->fd >= 0)
+		close(f->fd);
+	free(f->cp);
+	free(f->path);
+	free(f);
+	return NULL;
+}
+
+// When the path names a new file again, hash that one from the start.
+// Returns 1 if it did, 0 if there is no file at the path yet.
+static int reopen(struct logsum *ls, struct logsum_file *f)
+{
+	struct stat st;
+	int fd, wd;
+
+	// watch first, so appends after the open cannot be missed
+	wd = inotify_add_watch(ls->ifd, f->path, WATCH_MASK);
+	if (wd < 0)
+		return errno == ENOENT ? 0 : -1;
+	fd = open(f->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		if (fd >= 0)
+			close(fd);
+		return errno == ENOENT ? 0 : -1;
+	}
+	if (f->wd != wd)
+		inotify_rm_watch(ls->ifd, f->wd);
+	close(f->fd);
+	f->fd = fd;
+	f->wd = wd;
+	f->gone = 0;
+	if ((uint64_t)st.st_dev == f->p.dev && (uint64_t)st.st_ino == f->p.ino)
+		return 1;	// renamed back
+	reset(f, &st);
+	if (ftruncate(f->sfd, sizeof(f->p)) < 0 || save_state(f, 0) < 0)
+		return -1;
+	return 1;
+}
+
+int logsum_init(struct logsum *ls)
+{
+	memset(ls, 0, sizeof(*ls));
+	ls->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	return ls->ifd < 0 ? -1 : 0;
+}
+
+void logsum_free(struct logsum *ls)
+{
+	int i;
+
+	for (i = 0; i < ls->nfiles; i++) {
+		struct logsum_file *f = ls->files[i];
+
+		close(f->sfd);
+		close(f->fd);
+		free(f->cp);
+		free(f->path);
+		free(f);
+	}
+	free(ls->files);
+	close(ls->ifd);
+	ls->files = NULL;
+	ls->nfiles = 0;
+}
+
+static struct logsum_file *find_wd(struct logsum *ls, int wd)
+{
+	int i;
+
+	for (i = 0; i < ls->nfiles; i++)
+		if (ls->files[i]->wd == wd)
+			return ls->files[i];
+	return NULL;
+}
+
+int logsum_poll(struct logsum *ls, int timeout)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd = { .fd = ls->ifd, .events = POLLIN };
+	int i, updated = 0;
+	ssize_t n;
+
+	if (poll(&pfd, 1, timeout) < 0)
+		return errno == EINTR ? 0 : -1;
+	while ((n = read(ls->ifd, buf, sizeof(buf))) > 0) {
+		char *p;
+
+		for (p = buf; p < buf + n; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			struct logsum_file *f = find_wd(ls, ev->wd);
+			struct stat st;
+
+			// unlinking while we hold the file open only shows up
+			// as an attribute change of the link count
+			if (f && (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF |
+					      IN_IGNORED)))
+				f->gone = 1;
+			if (f && (ev->mask & IN_ATTRIB) &&
+			    fstat(f->fd, &st) == 0 && st.st_nlink == 0)
+				f->gone = 1;
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	if (n < 0 && errno != EAGAIN)
+		return -1;
+
+	// events are coalesced by simply catching up every file once
+	for (i = 0; i < ls->nfiles; i++) {
+		struct logsum_file *f = ls->files[i];
+		int ret = logsum_catch_up(f);
+
+		if (ret < 0)
+			return -1;
+		updated += ret;
+		// the last bytes of a rotated file are in, move on to the
+		// file that took its place
+		if (f->gone) {
+			ret = reopen(ls, f);
+			if (ret > 0)
+				ret = logsum_catch_up(f);
+			if (ret < 0)
+				return -1;
+			updated += ret;
+		}
+	}
+	return updated;
+}
+
+uint64_t logsum_digest(const struct logsum_file *f, uint64_t *hash1,
+		       uint64_t *hash2)
+{
+	struct spooky_state st = f->p.st;
+
+	// spooky_final scribbles over the buffered data
+	spooky_final(&st, hash1, hash2);
+	return f->p.st.m_length;
+}
+
+int logsum_digest_at(const struct logsum_file *f, uint64_t length,
+		     uint64_t *hash1, uint64_t *hash2)
+{
+	uint64_t lo = 0, hi = f->p.ncheckpoints;
+
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (f->cp[mid].length < length)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == f->p.ncheckpoints || f->cp[lo].length != length) {
+		if (length != f->p.st.m_length)
+			return -1;
+		logsum_digest(f, hash1, hash2);
+		return 0;
+	}
+	*hash1 = f->cp[lo].hash1;
+	*hash2 = f->cp[lo].hash2;
+	return 0;
+}
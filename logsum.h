@@ -0,0 +1,95 @@
+// Running checksums of append-only files
+//
+// Every tracked file has a spooky_state that has consumed the file up to
+// some length.  When inotify reports a modification only the bytes
+// appended since then are read and fed into spooky_update.  Whenever the
+// hashed length reaches a multiple of the checkpoint interval the digest
+// of that prefix is recorded, so two replicas can compare the digests of
+// the same prefix without rehashing.
+//
+// The stream state and the checkpoints are persisted in a state file per
+// tracked file, so after a restart hashing resumes where it stopped.  If
+// the file was replaced or truncated in the meantime it is rehashed from
+// the start.  Replacement is detected from the device and inode and from
+// a hash of the first few KB of the file, and by comparing the bytes
+// still buffered in the spooky_state with the file.
+//
+// A tracked path that is deleted or renamed away (log rotation) is
+// marked gone.  The old file is read to its end, and as soon as a file
+// exists at the path again it is tracked instead: the state file is
+// cleared and hashing restarts from its first byte, with fresh
+// checkpoints.  Until then the old file stays open and is still hashed.
+//
+// State file: struct logsum_persist, then ncheckpoints checkpoints.  It
+// is only meant to be read back on the same machine.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include "spooky-c.h"
+
+struct logsum_checkpoint
+{
+	uint64_t length;
+	uint64_t hash1;
+	uint64_t hash2;
+};
+
+struct logsum_persist
+{
+	uint64_t magic;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t seed1;
+	uint64_t seed2;
+	uint64_t interval;
+	uint64_t ncheckpoints;
+	uint64_t head_len;	// hash of the first head_len bytes, to catch
+	uint64_t head_hash;	// files recreated with the same inode
+	struct spooky_state st;
+};
+
+struct logsum_file
+{
+	char *path;
+	int fd;
+	int sfd;		// state file
+	int wd;			// inotify watch
+	int gone;		// deleted or renamed away, no new file yet
+	struct logsum_persist p;
+	struct logsum_checkpoint *cp;
+	uint64_t cpcap;
+	uint64_t bytes_read;	// since logsum_add, for statistics
+};
+
+struct logsum
+{
+	int ifd;
+	int nfiles;
+	struct logsum_file **files;
+};
+
+int logsum_init(struct logsum *ls);
+void logsum_free(struct logsum *ls);
+
+// Track path, keeping its state in statepath.  A new state file starts
+// with the given seeds and checkpoint interval; an existing one keeps
+// its own.  The file is caught up before returning.
+struct logsum_file *logsum_add(struct logsum *ls, char *path,
+			       char *statepath, uint64_t seed1,
+			       uint64_t seed2, uint64_t interval);
+
+// Wait up to timeout ms (-1 forever) for changes and hash what was
+// appended.  Returns the number of files that got new data, or -1.
+int logsum_poll(struct logsum *ls, int timeout);
+
+// hash anything appended to f, without waiting for inotify
+int logsum_catch_up(struct logsum_file *f);
+
+// digest of everything hashed so far; returns the length it covers
+uint64_t logsum_digest(const struct logsum_file *f, uint64_t *hash1,
+		       uint64_t *hash2);
+
+// digest of the first length bytes, when there is a checkpoint for it
+int logsum_digest_at(const struct logsum_file *f, uint64_t length,
+		     uint64_t *hash1, uint64_t *hash2);
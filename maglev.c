@@ -0,0 +1,157 @@
+// Maglev consistent hashing lookup tables
+//
+// The population loop follows the Maglev paper, except that every
+// backend remembers the table position of its next candidate and steps
+// it by adding the skip, instead of recomputing (offset + j * skip) % M.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "spooky-c.h"
+#include "maglev.h"
+
+static int is_prime(uint32_t n)
+{
+	uint32_t d;
+
+	if (n < 2)
+		return 0;
+	for (d = 2; (uint64_t)d * d <= n; d++)
+		if (n % d == 0)
+			return 0;
+	return 1;
+}
+
+int maglev_init(struct maglev *m, uint32_t size)
+{
+	uint32_t i;
+
+	if (!is_prime(size)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(m, 0, sizeof(*m));
+	m->size = size;
+	m->table = malloc(size * sizeof(int32_t));
+	m->spare = malloc(size * sizeof(int32_t));
+	if (!m->table || !m->spare) {
+		maglev_free(m);
+		return -1;
+	}
+	for (i = 0; i < size; i++)
+		m->table[i] = -1;
+	return 0;
+}
+
+void maglev_free(struct maglev *m)
+{
+	free(m->b);
+	free(m->table);
+	free(m->spare);
+	free(m->next);
+	m->b = NULL;
+	m->table = m->spare = NULL;
+	m->next = NULL;
+}
+
+int maglev_add(struct maglev *m, const void *name, size_t len)
+{
+	uint64_t h1 = 0, h2 = 0;
+	uint32_t id;
+
+	for (id = 0; id < m->nbackends; id++)
+		if (!m->b[id].active)
+			break;
+	if (id == m->nbackends) {
+		if (m->nbackends == m->cap) {
+			uint32_t cap = m->cap ? m->cap * 2 : 16;
+			struct maglev_backend *b;
+			uint32_t *next;
+
+			b = realloc(m->b, cap * sizeof(*b));
+			if (!b)
+				return -1;
+			m->b = b;
+			next = realloc(m->next, cap * sizeof(*next));
+			if (!next)
+				return -1;
+			m->next = next;
+			m->cap = cap;
+		}
+		m->nbackends++;
+	}
+	spooky_hash128(name, len, &h1, &h2);
+	m->b[id].offset = h1 % m->size;
+	m->b[id].skip = h2 % (m->size - 1) + 1;
+	m->b[id].active = 1;
+	return id;
+}
+
+int maglev_remove(struct maglev *m, int id)
+{
+	if (id < 0 || (uint32_t)id >= m->nbackends || !m->b[id].active) {
+		errno = ENOENT;
+		return -1;
+	}
+	m->b[id].active = 0;
+	return 0;
+}
+
+int maglev_build(struct maglev *m)
+{
+	uint32_t size = m->size, filled = 0, i, nactive = 0;
+	int32_t *t = m->spare;
+	uint32_t *active;
+
+	active = malloc((m->nbackends + 1) * sizeof(uint32_t));
+	if (!active)
+		return -1;
+	for (i = 0; i < m->nbackends; i++) {
+		if (!m->b[i].active)
+			continue;
+		active[nactive++] = i;
+		m->next[i] = m->b[i].offset;
+	}
+	for (i = 0; i < size; i++)
+		t[i] = -1;
+
+	while (nactive > 0 && filled < size) {
+		for (i = 0; i < nactive && filled < size; i++) {
+			uint32_t id = active[i];
+			uint32_t c = m->next[id], skip = m->b[id].skip;
+
+			while (t[c] >= 0) {
+				c += skip;
+				if (c >= size)
+					c -= size;
+			}
+			t[c] = id;
+			c += skip;
+			if (c >= size)
+				c -= size;
+			m->next[id] = c;
+			filled++;
+		}
+	}
+	free(active);
+
+	m->spare = m->table;
+	__atomic_store_n(&m->table, t, __ATOMIC_RELEASE);
+	return 0;
+}
+
+uint64_t maglev_hash_tuple(const void *saddr, const void *daddr,
+			   size_t addrlen, uint16_t sport, uint16_t dport,
+			   uint8_t proto, uint64_t seed)
+{
+	uint8_t buf[2 * 16 + 5];
+
+	if (addrlen > 16)
+		addrlen = 16;
+	memcpy(buf, saddr, addrlen);
+	memcpy(buf + addrlen, daddr, addrlen);
+	memcpy(buf + 2 * addrlen, &sport, 2);
+	memcpy(buf + 2 * addrlen + 2, &dport, 2);
+	buf[2 * addrlen + 4] = proto;
+	return spooky_hash64(buf, 2 * addrlen + 5, seed);
+}
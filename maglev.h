@@ -0,0 +1,62 @@
+// Maglev consistent hashing lookup tables
+//
+// Every backend gets a permutation of the table entries, given by an
+// offset and a skip taken from the spooky_hash128 of its name.  Building
+// the table lets the backends take turns claiming the next free entry of
+// their permutation until the table is full.  Each backend ends up with
+// nearly the same number of entries, and adding or removing a backend
+// moves few entries of the others.
+//
+// Backends are identified by small integer ids, which stay the same
+// across rebuilds.  Their permutations are computed once when they are
+// added, so a rebuild after a change only repopulates the table.
+//
+// Rebuilds fill a spare table and then switch the table pointer, so
+// lookups can run concurrently with a rebuild.  A lookup must not keep
+// using a table across two rebuilds.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct maglev_backend
+{
+	uint32_t offset;
+	uint32_t skip;
+	int active;
+};
+
+struct maglev
+{
+	uint32_t size;		// prime number of entries
+	uint32_t nbackends;	// ids in use, including removed ones
+	uint32_t cap;
+	struct maglev_backend *b;
+	int32_t *table;		// backend id per entry, -1 when empty
+	int32_t *spare;
+	uint32_t *next;		// build scratch
+};
+
+// size must be a prime, e.g. 65537
+int maglev_init(struct maglev *m, uint32_t size);
+void maglev_free(struct maglev *m);
+
+// returns the id of the new backend or -1; ids of removed backends are
+// reused
+int maglev_add(struct maglev *m, const void *name, size_t len);
+int maglev_remove(struct maglev *m, int id);
+
+// repopulate the table after adds and removes
+int maglev_build(struct maglev *m);
+
+uint64_t maglev_hash_tuple(const void *saddr, const void *daddr,
+			   size_t addrlen, uint16_t sport, uint16_t dport,
+			   uint8_t proto, uint64_t seed);
+
+// backend id for a flow hash, or -1 when there are no backends
+static inline int maglev_lookup(const struct maglev *m, uint64_t hash)
+{
+	const int32_t *t = __atomic_load_n(&m->table, __ATOMIC_ACQUIRE);
+
+	return t[((hash >> 32) * m->size) >> 32];
+}
@@ -0,0 +1,261 @@
+// Piece hash manifests
+//
+// Full pieces all have the same length, so the generator and the
+// verifier hash them four at a time with spooky_hash128_x4.  The
+// generator splits the pieces into contiguous ranges, one per thread.
+
+#include <sys/fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "spooky-c.h"
+#include "map.h"
+#include "util.h"
+#include "manifest.h"
+
+#define MANIFEST_MAGIC 0x31666e6d796b6f6fULL	// "ookymnf1"
+
+static inline uint64_t manifest_bytes(uint64_t npieces)
+{
+	return sizeof(struct manifest_header) + npieces * 2 * sizeof(uint64_t);
+}
+
+static void setup(struct manifest *m, void *map, size_t bytes)
+{
+	m->h = map;
+	m->piece = (uint64_t (*)[2])(m->h + 1);
+	m->bytes = bytes;
+}
+
+static void root_digest(const struct manifest *m, uint64_t root[2])
+{
+	root[0] = m->h->size;
+	root[1] = m->h->piece_size;
+	spooky_hash128(m->piece, m->h->npieces * 2 * sizeof(uint64_t),
+		       &root[0], &root[1]);
+}
+
+struct build_job
+{
+	struct manifest *m;
+	const uint8_t *data;
+	uint64_t first;
+	uint64_t n;
+};
+
+static void *build_worker(void *arg)
+{
+	struct build_job *j = arg;
+	struct manifest *m = j->m;
+	uint64_t ps = m->h->piece_size, seed = m->h->seed;
+	uint64_t i = j->first, end = j->first + j->n;
+	int k;
+
+	for (; i + 4 <= end && manifest_piece_len(m, i + 3) == ps; i += 4) {
+		const void *msg[4];
+		uint64_t h1[4], h2[4];
+
+		for (k = 0; k < 4; k++) {
+			msg[k] = j->data + (i + k) * ps;
+			h1[k] = i + k;
+			h2[k] = seed;
+		}
+		spooky_hash128_x4(msg, ps, h1, h2);
+		for (k = 0; k < 4; k++) {
+			m->piece[i + k][0] = h1[k];
+			m->piece[i + k][1] = h2[k];
+		}
+	}
+	for (; i < end; i++) {
+		m->piece[i][0] = i;
+		m->piece[i][1] = seed;
+		spooky_hash128(j->data + i * ps, manifest_piece_len(m, i),
+			       &m->piece[i][0], &m->piece[i][1]);
+	}
+	return NULL;
+}
+
+int manifest_build(struct manifest *m, const void *data, uint64_t size,
+		   uint64_t piece_size, uint64_t seed, int nthreads)
+{
+	uint64_t npieces, per, start = 0;
+	struct manifest_header *h;
+	int i;
+
+	if (piece_size == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (nthreads < 1)
+		nthreads = 1;
+	npieces = (size + piece_size - 1) / piece_size;
+	h = malloc(manifest_bytes(npieces));
+	if (!h)
+		return -1;
+	h->magic = MANIFEST_MAGIC;
+	h->size = size;
+	h->piece_size = piece_size;
+	h->npieces = npieces;
+	h->seed = seed;
+	setup(m, h, manifest_bytes(npieces));
+	m->mapped = 0;
+
+	{
+		struct build_job job[nthreads];
+
+		// multiples of four pieces per thread keep them on the x4 path
+		per = ((npieces / nthreads) + 3) & ~(uint64_t)3;
+		for (i = 0; i < nthreads; i++) {
+			uint64_t cnt = start < npieces ? npieces - start : 0;
+
+			if (cnt > per && i < nthreads - 1)
+				cnt = per;
+			job[i].m = m;
+			job[i].data = data;
+			job[i].first = start;
+			job[i].n = cnt;
+			start += cnt;
+		}
+		run_jobs(job, sizeof(job[0]), nthreads, build_worker);
+	}
+
+	root_digest(m, h->root);
+	return 0;
+}
+
+int manifest_build_file(struct manifest *m, char *file, uint64_t piece_size,
+			uint64_t seed, int nthreads)
+{
+	size_t size;
+	char *map = mapfile(file, O_RDONLY, &size);
+	int ret;
+
+	if (!map && errno)
+		return -1;
+	ret = manifest_build(m, map, size, piece_size, seed, nthreads);
+	if (map)
+		unmap_file(map, size);
+	return ret;
+}
+
+int manifest_write(const struct manifest *m, char *file)
+{
+	const char *p = (const char *)m->h;
+	size_t left = m->bytes;
+	int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0)
+		return -1;
+	while (left > 0) {
+		ssize_t n = write(fd, p, left);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return -1;
+		}
+		p += n;
+		left -= n;
+	}
+	return close(fd);
+}
+
+int manifest_open_file(struct manifest *m, char *file)
+{
+	struct manifest_header *h;
+	uint64_t root[2];
+	size_t size;
+	char *map = mapfile(file, O_RDONLY, &size);
+
+	if (!map) {
+		// an empty file is not a manifest
+		if (!errno)
+			errno = EINVAL;
+		return -1;
+	}
+	h = (struct manifest_header *)map;
+	// npieces comes from the file, so bound it before manifest_bytes
+	// can wrap around to the size of a short file
+	if (size < sizeof(struct manifest_header) ||
+	    h->magic != MANIFEST_MAGIC || h->piece_size == 0 ||
+	    h->npieces != h->size / h->piece_size +
+			  (h->size % h->piece_size != 0) ||
+	    h->npieces > (SIZE_MAX - sizeof(struct manifest_header)) /
+			 (2 * sizeof(uint64_t)) ||
+	    size != manifest_bytes(h->npieces))
+		goto bad;
+	setup(m, map, size);
+	m->mapped = 1;
+	root_digest(m, root);
+	if (root[0] != h->root[0] || root[1] != h->root[1])
+		goto bad;
+	return 0;
+
+bad:
+	unmap_file(map, size);
+	errno = EINVAL;
+	return -1;
+}
+
+void manifest_free(struct manifest *m)
+{
+	if (m->mapped)
+		unmap_file((char *)m->h, m->bytes);
+	else
+		free(m->h);
+	m->h = NULL;
+}
+
+int manifest_check_piece(const struct manifest *m, uint64_t i,
+			 const void *buf, size_t len)
+{
+	uint64_t h1 = i, h2 = m->h->seed;
+
+	if (i >= m->h->npieces || len != manifest_piece_len(m, i))
+		return -1;
+	spooky_hash128(buf, len, &h1, &h2);
+	return h1 == m->piece[i][0] && h2 == m->piece[i][1] ? 0 : -1;
+}
+
+long manifest_verify(const struct manifest *m, uint64_t offset,
+		     const void *buf, size_t len, uint64_t *bad)
+{
+	uint64_t ps = m->h->piece_size;
+	uint64_t end = offset + len;
+	uint64_t i = (offset + ps - 1) / ps, first = i;
+	int k;
+
+	if (end > m->h->size)
+		end = m->h->size;
+#define PIECE(i) ((const uint8_t *)buf + ((i) * ps - offset))
+	for (; (i + 4) * ps <= end; i += 4) {
+		const void *msg[4];
+		uint64_t h1[4], h2[4];
+
+		for (k = 0; k < 4; k++) {
+			msg[k] = PIECE(i + k);
+			h1[k] = i + k;
+			h2[k] = m->h->seed;
+		}
+		spooky_hash128_x4(msg, ps, h1, h2);
+		for (k = 0; k < 4; k++) {
+			if (h1[k] != m->piece[i + k][0] ||
+			    h2[k] != m->piece[i + k][1]) {
+				*bad = i + k;
+				return -1;
+			}
+		}
+	}
+	for (; i < m->h->npieces && i * ps + manifest_piece_len(m, i) <= end;
+	     i++) {
+		if (manifest_check_piece(m, i, PIECE(i),
+					 manifest_piece_len(m, i))) {
+			*bad = i;
+			return -1;
+		}
+	}
+#undef PIECE
+	return i - first;
+}
@@ -0,0 +1,66 @@
+// Piece hash manifests
+//
+// A manifest splits a file into fixed size pieces and lists the
+// spooky_hash128 of every piece, so a receiver can check each range as
+// it arrives instead of waiting for the whole file.  Piece i is hashed
+// with the seeds (i, seed), which catches pieces delivered at the wrong
+// offset.  The root digest is the spooky_hash128 of the piece hash array
+// seeded with the file size and piece size; it identifies the whole file
+// and protects the manifest itself.
+//
+// On disk a manifest is the header followed by the piece hashes, in
+// native (little) endian, and can be used directly from a file mapping.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct manifest_header
+{
+	uint64_t magic;
+	uint64_t size;		// file size in bytes
+	uint64_t piece_size;
+	uint64_t npieces;
+	uint64_t seed;
+	uint64_t root[2];
+};
+
+struct manifest
+{
+	struct manifest_header *h;
+	uint64_t (*piece)[2];
+	size_t bytes;		// size of header plus pieces
+	int mapped;
+};
+
+// hash size bytes of data with nthreads threads
+int manifest_build(struct manifest *m, const void *data, uint64_t size,
+		   uint64_t piece_size, uint64_t seed, int nthreads);
+// the same for a file, which is read through mapfile
+int manifest_build_file(struct manifest *m, char *file, uint64_t piece_size,
+			uint64_t seed, int nthreads);
+
+int manifest_write(const struct manifest *m, char *file);
+// map a manifest written by manifest_write; fails when the root digest
+// does not match the piece hashes
+int manifest_open_file(struct manifest *m, char *file);
+void manifest_free(struct manifest *m);
+
+// length of piece i; only the last piece can be short
+static inline uint64_t manifest_piece_len(const struct manifest *m, uint64_t i)
+{
+	uint64_t off = i * m->h->piece_size;
+
+	return m->h->size - off < m->h->piece_size ?
+		m->h->size - off : m->h->piece_size;
+}
+
+// 0 when buf holds piece i, otherwise -1
+int manifest_check_piece(const struct manifest *m, uint64_t i,
+			 const void *buf, size_t len);
+
+// Check the pieces that lie completely inside the received range
+// [offset, offset + len), whose data is buf.  Returns the number of
+// pieces checked, or -1 with the first bad piece stored in *bad.
+long manifest_verify(const struct manifest *m, uint64_t offset,
+		     const void *buf, size_t len, uint64_t *bad);
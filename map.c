@@ -3,6 +3,7 @@
 #include <sys/fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <errno.h>
 #include "map.h"
 
 #define roundup(x,y) (((x) + (y) - 1) & ~((y) - 1))
@@ -14,11 +15,15 @@ char *mapfile_flag(char *file, int oflags, size_t *size, int flag)
 		return NULL;
 	
 	struct stat st;
-	if (fstat(fd, &st) >= 0 && (*size = st.st_size) > 0) {
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	if ((*size = st.st_size) > 0) {
 		size_t ps = sysconf(_SC_PAGE_SIZE);
 		*size =  roundup(st.st_size, ps);
 		int prot = PROT_READ;
-		if ((oflags & O_WRONLY) || (flag & MAP_PRIVATE))
+		if ((oflags & O_ACCMODE) != O_RDONLY || (flag & MAP_PRIVATE))
 			prot |= PROT_WRITE;
 		char *map = mmap(NULL, *size, prot,
 				 flag,
@@ -29,7 +34,9 @@ char *mapfile_flag(char *file, int oflags, size_t *size, int flag)
 		*size = st.st_size;
 		return map;		
 	} 
+	// an empty file cannot be mapped
 	close(fd);
+	errno = 0;
 	return NULL;		
 }
 
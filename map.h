@@ -1,4 +1,5 @@
 #include <stddef.h>
+// NULL for an empty file too, with *size 0 and errno 0
 char *mapfile(char *file, int oflags, size_t *size);
 char *mapfile_flag(char *file, int oflags, size_t *size, int flag);
 void unmap_file(char *map, size_t size);
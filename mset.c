@@ -0,0 +1,228 @@
+// Order independent hashes of multisets
+//
+// A batch is summed as limbs: limb i collects bits 32*i to 32*i+31 of
+// every hash, which cannot overflow a 64-bit lane before 2^32 hashes.
+// Batches are cut well below that and the limbs are folded into a
+// 128-bit value once per batch.
+
+#include <string.h>
+#include "spooky-c.h"
+#include "util.h"
+#include "mset.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_SUM_AVX2 1
+#endif
+
+#define MAX_BATCH	(1UL << 30)
+#define HASH_BATCH	256
+
+typedef unsigned __int128 u128;
+
+struct job
+{
+	const void *const *keys;
+	const size_t *lens;
+	size_t n;
+	uint64_t seed;
+	u128 sum;
+};
+
+static int have_avx2(void)
+{
+#ifdef HAVE_SUM_AVX2
+	return __builtin_cpu_supports("avx2");
+#else
+	return 0;
+#endif
+}
+
+static inline u128 join(uint64_t lo, uint64_t hi)
+{
+	return (u128)hi << 64 | lo;
+}
+
+static void add(struct mset *m, u128 v, uint64_t n)
+{
+	u128 s = join(m->lo, m->hi) + v;
+
+	m->lo = s;
+	m->hi = s >> 64;
+	m->n += n;
+}
+
+static void sub(struct mset *m, u128 v, uint64_t n)
+{
+	u128 s = join(m->lo, m->hi) - v;
+
+	m->lo = s;
+	m->hi = s >> 64;
+	m->n -= n;
+}
+
+void mset_init(struct mset *m, uint64_t seed)
+{
+	memset(m, 0, sizeof(*m));
+	m->seed = seed;
+}
+
+void mset_add_hash(struct mset *m, uint64_t h1, uint64_t h2)
+{
+	add(m, join(h1, h2), 1);
+}
+
+void mset_remove_hash(struct mset *m, uint64_t h1, uint64_t h2)
+{
+	sub(m, join(h1, h2), 1);
+}
+
+void mset_add(struct mset *m, const void *key, size_t len)
+{
+	uint64_t h1 = m->seed, h2 = m->seed;
+
+	spooky_hash128(key, len, &h1, &h2);
+	mset_add_hash(m, h1, h2);
+}
+
+void mset_remove(struct mset *m, const void *key, size_t len)
+{
+	uint64_t h1 = m->seed, h2 = m->seed;
+
+	spooky_hash128(key, len, &h1, &h2);
+	mset_remove_hash(m, h1, h2);
+}
+
+#ifdef HAVE_SUM_AVX2
+__attribute__((target("avx2")))
+static u128 sum_avx2(const uint64_t (*h)[2], size_t n)
+{
+	__m256i a = _mm256_setzero_si256(), b = _mm256_setzero_si256();
+	uint64_t limb[4];
+	size_t i;
+
+	// two accumulators, so consecutive adds don't wait on each other
+	for (i = 0; i + 2 <= n; i += 2) {
+		__m128i x = _mm_loadu_si128((const __m128i *)h[i]);
+		__m128i y = _mm_loadu_si128((const __m128i *)h[i + 1]);
+
+		a = _mm256_add_epi64(a, _mm256_cvtepu32_epi64(x));
+		b = _mm256_add_epi64(b, _mm256_cvtepu32_epi64(y));
+	}
+	if (i < n)
+		a = _mm256_add_epi64(a, _mm256_cvtepu32_epi64(
+				_mm_loadu_si128((const __m128i *)h[i])));
+	_mm256_storeu_si256((__m256i *)limb, _mm256_add_epi64(a, b));
+	return (u128)limb[0] + ((u128)limb[1] << 32) + ((u128)limb[2] << 64) +
+		((u128)limb[3] << 96);
+}
+#endif
+
+static u128 sum(const uint64_t (*h)[2], size_t n, int avx2)
+{
+	u128 s = 0;
+	size_t i;
+
+#ifdef HAVE_SUM_AVX2
+	if (avx2) {
+		for (i = 0; i < n; i += MAX_BATCH)
+			s += sum_avx2(h + i, n - i < MAX_BATCH ? n - i : MAX_BATCH);
+		return s;
+	}
+#else
+	(void)avx2;
+#endif
+	for (i = 0; i < n; i++)
+		s += join(h[i][0], h[i][1]);
+	return s;
+}
+
+void mset_add_hashes(struct mset *m, const uint64_t (*h)[2], size_t n)
+{
+	add(m, sum(h, n, have_avx2()), n);
+}
+
+void mset_remove_hashes(struct mset *m, const uint64_t (*h)[2], size_t n)
+{
+	sub(m, sum(h, n, have_avx2()), n);
+}
+
+static void *worker(void *arg)
+{
+	struct job *j = arg;
+	uint64_t h[HASH_BATCH][2];
+	int avx2 = have_avx2();
+	size_t i, k;
+
+	j->sum = 0;
+	for (i = 0; i < j->n; i += HASH_BATCH) {
+		size_t n = j->n - i < HASH_BATCH ? j->n - i : HASH_BATCH;
+
+		for (k = 0; k < n; k++) {
+			h[k][0] = h[k][1] = j->seed;
+			spooky_hash128(j->keys[i + k], j->lens[i + k],
+				       &h[k][0], &h[k][1]);
+		}
+		j->sum += sum(h, n, avx2);
+	}
+	return NULL;
+}
+
+static u128 sum_keys(const struct mset *m, const void *const *keys,
+		     const size_t *lens, size_t n, int nthreads)
+{
+	u128 s = 0;
+	size_t per;
+	int i;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if ((size_t)nthreads > n / HASH_BATCH + 1)
+		nthreads = n / HASH_BATCH + 1;
+	per = (n + nthreads - 1) / nthreads;
+
+	{
+		struct job job[nthreads];
+
+		for (i = 0; i < nthreads; i++) {
+			size_t begin = per * i < n ? per * i : n;
+
+			job[i].keys = keys + begin;
+			job[i].lens = lens + begin;
+			job[i].n = n - begin < per ? n - begin : per;
+			job[i].seed = m->seed;
+		}
+		run_jobs(job, sizeof(job[0]), nthreads, worker);
+		for (i = 0; i < nthreads; i++)
+			s += job[i].sum;
+	}
+	return s;
+}
+
+void mset_add_keys(struct mset *m, const void *const *keys,
+		   const size_t *lens, size_t n, int nthreads)
+{
+	add(m, sum_keys(m, keys, lens, n, nthreads), n);
+}
+
+void mset_remove_keys(struct mset *m, const void *const *keys,
+		      const size_t *lens, size_t n, int nthreads)
+{
+	sub(m, sum_keys(m, keys, lens, n, nthreads), n);
+}
+
+void mset_merge(struct mset *m, const struct mset *o)
+{
+	add(m, join(o->lo, o->hi), o->n);
+}
+
+void mset_subtract(struct mset *m, const struct mset *o)
+{
+	sub(m, join(o->lo, o->hi), o->n);
+}
+
+int mset_equal(const struct mset *a, const struct mset *b)
+{
+	return a->lo == b->lo && a->hi == b->hi && a->n == b->n &&
+		a->seed == b->seed;
+}
@@ -0,0 +1,51 @@
+// Order independent hashes of multisets
+//
+// The digest of a multiset is the sum modulo 2^128 of the spooky_hash128
+// of its elements, with h1 as the low and h2 as the high word, together
+// with the number of elements modulo 2^64.  Adding or removing an
+// element is one 128-bit addition or subtraction, so a replica can keep
+// the digest of its key set up to date as keys come and go, and two
+// replicas compare their sets by comparing 24 bytes, in any order and
+// without sorting.  The digests of two multisets add up to the digest
+// of their sum.
+//
+// A sum of hashes is fine for catching divergence between replicas that
+// trust each other.  It is not a cryptographic set hash: with enough
+// work someone who knows the seed can find different sets with the same
+// sum.
+//
+// Batches of precomputed hashes are summed with AVX2 where the CPU has
+// it, as four 32-bit limbs in 64-bit lanes so that no carries need to be
+// propagated inside the loop.  Batches of keys can be hashed by several
+// threads, each summing its share before the partial digests are added.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct mset
+{
+	uint64_t lo;
+	uint64_t hi;
+	uint64_t n;
+	uint64_t seed;
+};
+
+void mset_init(struct mset *m, uint64_t seed);
+void mset_add(struct mset *m, const void *key, size_t len);
+void mset_remove(struct mset *m, const void *key, size_t len);
+void mset_add_hash(struct mset *m, uint64_t h1, uint64_t h2);
+void mset_remove_hash(struct mset *m, uint64_t h1, uint64_t h2);
+
+// the same as calling mset_add_hash or mset_add for every element
+void mset_add_hashes(struct mset *m, const uint64_t (*h)[2], size_t n);
+void mset_remove_hashes(struct mset *m, const uint64_t (*h)[2], size_t n);
+void mset_add_keys(struct mset *m, const void *const *keys,
+		   const size_t *lens, size_t n, int nthreads);
+void mset_remove_keys(struct mset *m, const void *const *keys,
+		      const size_t *lens, size_t n, int nthreads);
+
+// o must use the same seed as m
+void mset_merge(struct mset *m, const struct mset *o);
+void mset_subtract(struct mset *m, const struct mset *o);
+int mset_equal(const struct mset *a, const struct mset *b);
@@ -0,0 +1,218 @@
+// Hash table for untrusted keys
+//
+// With at most half of the slots used, the chance that an insert into a
+// linear probing table probes more than k slots falls off roughly like
+// e^(-k/5).  The limit of 4 log2(slots) + 32 probes is therefore not hit
+// by random keys even after billions of inserts, while a flood of
+// colliding keys hits it after a few dozen.  Deletion shifts the
+// following entries back, so there are no tombstones to skew the counts.
+
+#define _GNU_SOURCE 1
+#include <sys/random.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spooky-c.h"
+#include "safetab.h"
+
+#define MIN_SLOTS 16
+#define MAX_RESEEDS 4
+
+static int random_seed(uint64_t seed[2])
+{
+	size_t got = 0;
+
+	while (got < 2 * sizeof(uint64_t)) {
+		ssize_t n = getrandom((char *)seed + got,
+				      2 * sizeof(uint64_t) - got, 0);
+
+		if (n < 0)
+			return -1;
+		got += n;
+	}
+	return 0;
+}
+
+static inline uint64_t hash(const struct safetab *t, const void *key,
+			    size_t len)
+{
+	uint64_t h1 = t->seed[0], h2 = t->seed[1];
+
+	spooky_hash128(key, len, &h1, &h2);
+	return h1;
+}
+
+static unsigned probe_limit(size_t nslots)
+{
+	unsigned bits = 0;
+
+	while (((size_t)1 << bits) < nslots)
+		bits++;
+	return 4 * bits + 32;
+}
+
+static int alloc_slots(struct safetab *t, size_t nslots)
+{
+	struct safetab_entry *e = calloc(nslots, sizeof(*e));
+
+	if (!e)
+		return -1;
+	t->e = e;
+	t->mask = nslots - 1;
+	t->limit = probe_limit(nslots);
+	return 0;
+}
+
+int safetab_init(struct safetab *t, size_t size_hint, const uint64_t seed[2],
+		 int flags)
+{
+	size_t nslots = MIN_SLOTS;
+
+	memset(t, 0, sizeof(*t));
+	t->flags = flags;
+	if (seed) {
+		t->seed[0] = seed[0];
+		t->seed[1] = seed[1];
+	} else if (random_seed(t->seed) < 0) {
+		return -1;
+	}
+	while (nslots / 2 < size_hint)
+		nslots *= 2;
+	return alloc_slots(t, nslots);
+}
+
+void safetab_free(struct safetab *t)
+{
+	free(t->e);
+	memset(t, 0, sizeof(*t));
+}
+
+// slot of key, or of the empty slot ending its probe sequence
+static size_t find(const struct safetab *t, const void *key, size_t len,
+		   uint64_t h, unsigned *probes)
+{
+	size_t i = h & t->mask;
+	unsigned n = 1;
+
+	for (; t->e[i].key; i = (i + 1) & t->mask, n++) {
+		if (t->e[i].hash == h && t->e[i].len == len &&
+		    memcmp(t->e[i].key, key, len) == 0)
+			break;
+	}
+	*probes = n;
+	return i;
+}
+
+// move all entries into a table of nslots slots, hashing them again
+// when the seed has changed
+static int rehash(struct safetab *t, size_t nslots, int new_seed)
+{
+	struct safetab_entry *old = t->e;
+	size_t oldslots = t->mask + 1, i;
+
+	if (alloc_slots(t, nslots) < 0) {
+		t->e = old;
+		t->mask = oldslots - 1;
+		t->limit = probe_limit(oldslots);
+		return -1;
+	}
+	for (i = 0; i < oldslots; i++) {
+		size_t k;
+
+		if (!old[i].key)
+			continue;
+		if (new_seed)
+			old[i].hash = hash(t, old[i].key, old[i].len);
+		for (k = old[i].hash & t->mask; t->e[k].key; k = (k + 1) & t->mask)
+			;
+		t->e[k] = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+static int reseed(struct safetab *t)
+{
+	uint64_t seed[2] = { t->seed[0], t->seed[1] };
+
+	if (random_seed(t->seed) < 0)
+		return -1;
+	if (rehash(t, t->mask + 1, 1) < 0) {
+		t->seed[0] = seed[0];
+		t->seed[1] = seed[1];
+		return -1;
+	}
+	t->nreseeds++;
+	return 0;
+}
+
+int safetab_put(struct safetab *t, const void *key, size_t len, void *value)
+{
+	unsigned probes;
+	uint64_t h;
+	size_t i;
+	int tries = 0;
+
+	if (!key)
+		key = "";
+	if (2 * (t->n + 1) > t->mask + 1 && rehash(t, 2 * (t->mask + 1), 0) < 0)
+		return -1;
+	for (;;) {
+		h = hash(t, key, len);
+		i = find(t, key, len, h, &probes);
+		if (t->e[i].key) {
+			t->e[i].value = value;
+			return 1;
+		}
+		if (probes > t->max_probe)
+			t->max_probe = probes;
+		if (probes <= t->limit || (t->flags & SAFETAB_NO_RESEED) ||
+		    tries++ == MAX_RESEEDS || reseed(t) < 0)
+			break;
+	}
+	t->e[i].hash = h;
+	t->e[i].key = key;
+	t->e[i].len = len;
+	t->e[i].value = value;
+	t->n++;
+	return 0;
+}
+
+int safetab_get(const struct safetab *t, const void *key, size_t len,
+		void **value)
+{
+	unsigned probes;
+	size_t i;
+
+	if (!key)
+		key = "";
+	i = find(t, key, len, hash(t, key, len), &probes);
+	if (!t->e[i].key)
+		return 0;
+	if (value)
+		*value = t->e[i].value;
+	return 1;
+}
+
+int safetab_delete(struct safetab *t, const void *key, size_t len)
+{
+	unsigned probes;
+	size_t i, k;
+
+	if (!key)
+		key = "";
+	i = find(t, key, len, hash(t, key, len), &probes);
+	if (!t->e[i].key)
+		return 0;
+	// shift back every later entry of the run that may move into the gap
+	for (k = (i + 1) & t->mask; t->e[k].key; k = (k + 1) & t->mask) {
+		size_t home = t->e[k].hash & t->mask;
+
+		if (((k - home) & t->mask) >= ((k - i) & t->mask)) {
+			t->e[i] = t->e[k];
+			i = k;
+		}
+	}
+	memset(&t->e[i], 0, sizeof(t->e[i]));
+	t->n--;
+	return 1;
+}
@@ -0,0 +1,55 @@
+// Hash table for untrusted keys
+//
+// An in-memory linear probing table meant for keys that come from the
+// outside, such as the member names of parsed requests.  Every table
+// draws its own 128-bit spooky seed from the kernel's random source, so
+// nobody can compute in advance which keys share a slot.  As a second
+// line of defense every insert counts its probes.  If one needs more than
+// a bound that random keys exceed only with negligible probability, the
+// seed is assumed to be known or guessed and the whole table is rehashed
+// under a fresh random seed, which scatters the collisions again.
+//
+// What reseeding can't fix is keys whose full hashes collide under every
+// seed; an insert gives up reseeding after a few attempts and accepts the
+// long probe sequence, so the table still works, only slowly.
+//
+// Keys are not copied.  The caller keeps a key valid while its entry is in
+// the table.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SAFETAB_NO_RESEED	1	// never reseed, for comparisons
+
+struct safetab_entry
+{
+	uint64_t hash;
+	const void *key;	// NULL in empty slots
+	size_t len;
+	void *value;
+};
+
+struct safetab
+{
+	struct safetab_entry *e;
+	size_t mask;
+	size_t n;
+	uint64_t seed[2];
+	unsigned limit;		// most probes an insert may take
+	int flags;
+	uint64_t nreseeds;
+	unsigned max_probe;	// longest probe sequence seen by an insert
+};
+
+// seed is NULL for a random seed
+int safetab_init(struct safetab *t, size_t size_hint, const uint64_t seed[2],
+		 int flags);
+void safetab_free(struct safetab *t);
+
+// 0 for a new key, 1 when the value of a key was replaced, -1 on error
+int safetab_put(struct safetab *t, const void *key, size_t len, void *value);
+// 1 and the value when found, else 0
+int safetab_get(const struct safetab *t, const void *key, size_t len,
+		void **value);
+int safetab_delete(struct safetab *t, const void *key, size_t len);
@@ -0,0 +1,250 @@
+// Persistent hash table in a shared file mapping
+//
+// Probing is linear.  Since tombstones are never turned back into empty
+// slots and a new key only ever takes the first empty slot of its probe
+// sequence, two processes inserting the same key race for the same slot
+// and the loser sees the winner's record there, so a key can not end up
+// in the table twice.  Empty slots stop being handed out at 7/8 load so
+// probe sequences stay short.
+
+#include <sys/mman.h>
+#include <sys/fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "spooky-c.h"
+#include "map.h"
+#include "shtab.h"
+
+#define SHTAB_MAGIC 0x3162617468736f6fULL	// "ooshtab1"
+
+#define TAG_SHIFT	40
+#define OFF_MASK	((1ULL << TAG_SHIFT) - 1)
+#define TOMBSTONE	1ULL	// offset 8 is inside the header
+
+struct record
+{
+	uint64_t hash;
+	uint32_t klen;
+	uint32_t vlen;
+	char data[];
+};
+
+static uint64_t roundup_pow2(uint64_t n)
+{
+	uint64_t p = 1;
+
+	while (p < n)
+		p *= 2;
+	return p;
+}
+
+size_t shtab_size(uint64_t nslots, uint64_t heap_size)
+{
+	return sizeof(struct shtab_header) +
+	       roundup_pow2(nslots) * sizeof(uint64_t) +
+	       ((heap_size + 7) & ~7ULL);
+}
+
+static void shtab_setup(struct shtab *t, char *map, size_t size)
+{
+	t->h = (struct shtab_header *)map;
+	t->size = size;
+	t->slots = (uint64_t *)(t->h + 1);
+	t->heap = (char *)(t->slots + t->h->nslots);
+	t->mask = t->h->nslots - 1;
+	t->max_used = t->h->nslots - t->h->nslots / 8;
+}
+
+int shtab_create_file(struct shtab *t, char *file, uint64_t nslots,
+		      uint64_t heap_size, uint64_t seed)
+{
+	size_t size = shtab_size(nslots, heap_size);
+	struct shtab_header *h;
+	char *map;
+	int fd;
+
+	if (nslots < 2 || size >> 3 > OFF_MASK) {
+		errno = EINVAL;
+		return -1;
+	}
+	fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	map = mapfile(file, O_RDWR, &size);
+	if (!map)
+		return -1;
+	h = (struct shtab_header *)map;
+	h->nslots = roundup_pow2(nslots);
+	h->heap_size = (heap_size + 7) & ~7ULL;
+	h->seed = seed;
+	// openers check the magic, so it goes last
+	__atomic_store_n(&h->magic, SHTAB_MAGIC, __ATOMIC_RELEASE);
+	shtab_setup(t, map, size);
+	return 0;
+}
+
+int shtab_open_file(struct shtab *t, char *file)
+{
+	struct shtab_header *h;
+	size_t size;
+	char *map = mapfile(file, O_RDWR, &size);
+
+	if (!map)
+		return -1;
+	h = (struct shtab_header *)map;
+	if (size < sizeof(struct shtab_header) ||
+	    __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHTAB_MAGIC ||
+	    h->nslots < 2 || (h->nslots & (h->nslots - 1)) ||
+	    size < shtab_size(h->nslots, h->heap_size)) {
+		unmap_file(map, size);
+		errno = EINVAL;
+		return -1;
+	}
+	shtab_setup(t, map, size);
+	return 0;
+}
+
+void shtab_free(struct shtab *t)
+{
+	unmap_file((char *)t->h, t->size);
+	t->h = NULL;
+}
+
+int shtab_sync(struct shtab *t)
+{
+	size_t ps = sysconf(_SC_PAGE_SIZE);
+
+	return msync(t->h, (t->size + ps - 1) & ~(ps - 1), MS_SYNC);
+}
+
+static inline struct record *slot_record(const struct shtab *t, uint64_t v)
+{
+	return (struct record *)((char *)t->h + ((v & OFF_MASK) << 3));
+}
+
+static inline int matches(const struct shtab *t, uint64_t v, uint64_t hash,
+			  const void *key, uint32_t klen)
+{
+	const struct record *r;
+
+	if (v == 0 || v == TOMBSTONE || v >> TAG_SHIFT != hash >> TAG_SHIFT)
+		return 0;
+	r = slot_record(t, v);
+	return r->hash == hash && r->klen == klen &&
+	       memcmp(r->data, key, klen) == 0;
+}
+
+int shtab_put(struct shtab *t, const void *key, uint32_t klen,
+	      const void *val, uint32_t vlen)
+{
+	uint64_t hash = spooky_hash64(key, klen, t->h->seed);
+	uint64_t bytes = (sizeof(struct record) + klen + vlen + 7) & ~7ULL;
+	uint64_t top, i, n, nv;
+	struct record *r;
+
+	top = __atomic_fetch_add(&t->h->heap_top, bytes, __ATOMIC_RELAXED);
+	if (top + bytes > t->h->heap_size) {
+		errno = ENOSPC;
+		return -1;
+	}
+	r = (struct record *)(t->heap + top);
+	r->hash = hash;
+	r->klen = klen;
+	r->vlen = vlen;
+	memcpy(r->data, key, klen);
+	memcpy(r->data + klen, val, vlen);
+	nv = (hash >> TAG_SHIFT) << TAG_SHIFT |
+		(((char *)r - (char *)t->h) >> 3);
+
+	for (i = hash & t->mask, n = 0; n <= t->mask; ) {
+		uint64_t v = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+
+		if (v == 0) {
+			if (__atomic_fetch_add(&t->h->nused, 1,
+					       __ATOMIC_RELAXED) >= t->max_used) {
+				__atomic_fetch_sub(&t->h->nused, 1,
+						   __ATOMIC_RELAXED);
+				break;
+			}
+			// the release publishes the record
+			if (__atomic_compare_exchange_n(&t->slots[i], &v, nv, 0,
+							__ATOMIC_RELEASE,
+							__ATOMIC_RELAXED)) {
+				__atomic_fetch_add(&t->h->nitems, 1,
+						   __ATOMIC_RELAXED);
+				return 0;
+			}
+			__atomic_fetch_sub(&t->h->nused, 1, __ATOMIC_RELAXED);
+			// somebody else took it; look at the slot again
+			continue;
+		}
+		if (matches(t, v, hash, key, klen)) {
+			if (__atomic_compare_exchange_n(&t->slots[i], &v, nv, 0,
+							__ATOMIC_RELEASE,
+							__ATOMIC_RELAXED))
+				return 1;
+			continue;
+		}
+		i = (i + 1) & t->mask;
+		n++;
+	}
+	// the record is lost, like one of a process killed before publishing
+	errno = ENOSPC;
+	return -1;
+}
+
+static uint64_t *find(const struct shtab *t, const void *key, uint32_t klen,
+		      uint64_t *found)
+{
+	uint64_t hash = spooky_hash64(key, klen, t->h->seed);
+	uint64_t i, n;
+
+	for (i = hash & t->mask, n = 0; n <= t->mask; n++) {
+		uint64_t v = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+
+		if (v == 0)
+			break;
+		if (matches(t, v, hash, key, klen)) {
+			*found = v;
+			return &t->slots[i];
+		}
+		i = (i + 1) & t->mask;
+	}
+	return NULL;
+}
+
+const void *shtab_get(const struct shtab *t, const void *key, uint32_t klen,
+		      uint32_t *vlen)
+{
+	struct record *r;
+	uint64_t v;
+
+	if (!find(t, key, klen, &v))
+		return NULL;
+	r = slot_record(t, v);
+	*vlen = r->vlen;
+	return r->data + r->klen;
+}
+
+int shtab_delete(struct shtab *t, const void *key, uint32_t klen)
+{
+	uint64_t *slot, v;
+
+	while ((slot = find(t, key, klen, &v))) {
+		if (__atomic_compare_exchange_n(slot, &v, TOMBSTONE, 0,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED)) {
+			__atomic_fetch_sub(&t->h->nitems, 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+		// replaced or deleted meanwhile, look again
+	}
+	return 0;
+}
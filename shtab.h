@@ -0,0 +1,75 @@
+// Persistent hash table in a shared file mapping
+//
+// The table is one file: a header, an array of 64-bit slots and a heap of
+// records.  It is meant to live on /dev/shm or a local file system and to
+// be mapped MAP_SHARED by any number of processes at once, so that a
+// cache survives restarts of the processes using it.  Attaching only maps
+// the file and checks the header; nothing is read or rebuilt, so it takes
+// the same time for a table of 50 GB as for one of 50 KB.
+//
+// Nothing in the file is a pointer.  A slot holds the offset of a record
+// from the start of the file in units of 8 bytes (40 bits) and the top 24
+// bits of the key's spooky_hash64 as a tag, so most mismatches are
+// rejected without touching the record.  Records (hash, key and value
+// lengths, key, value) are immutable once published.
+//
+// All updates are lock free and work across processes:
+//
+//   - put allocates a record by atomically bumping the heap top, fills
+//     it in, and only then publishes it with a compare and swap on a slot,
+//     either an empty one or the one holding the old record for the key.
+//   - delete swaps the slot to a tombstone.
+//
+// A process killed at any point therefore leaves the table consistent;
+// the worst case is a record that was allocated but never published.  The
+// space of replaced and deleted records and of tombstones is not reused.
+// After a machine crash only what shtab_sync wrote out is reliable.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct shtab_header
+{
+	uint64_t magic;
+	uint64_t nslots;	// power of two
+	uint64_t heap_size;	// bytes
+	uint64_t seed;
+	uint64_t heap_top;	// bytes of the heap allocated
+	uint64_t nused;		// slots that are not empty
+	uint64_t nitems;
+	uint64_t pad;
+};
+
+struct shtab
+{
+	struct shtab_header *h;
+	uint64_t *slots;
+	char *heap;
+	size_t size;
+	uint64_t mask;
+	uint64_t max_used;
+};
+
+size_t shtab_size(uint64_t nslots, uint64_t heap_size);
+
+// Create file with nslots (rounded up to a power of two) slots and
+// heap_size bytes for records.  The file is sparse until used.
+int shtab_create_file(struct shtab *t, char *file, uint64_t nslots,
+		      uint64_t heap_size, uint64_t seed);
+int shtab_open_file(struct shtab *t, char *file);
+void shtab_free(struct shtab *t);
+// write the table out to its file
+int shtab_sync(struct shtab *t);
+
+// Insert or replace.  Returns 0 for a new key, 1 when an old value was
+// replaced, or -1 with errno ENOSPC when the slots or the heap run out.
+int shtab_put(struct shtab *t, const void *key, uint32_t klen,
+	      const void *val, uint32_t vlen);
+// The value of key, pointing into the mapping, or NULL.  Records are
+// never changed, so the value stays valid while the table is mapped even
+// if the key is replaced meanwhile.
+const void *shtab_get(const struct shtab *t, const void *key, uint32_t klen,
+		      uint32_t *vlen);
+// returns 1 when key was deleted, 0 when it was not there
+int shtab_delete(struct shtab *t, const void *key, uint32_t klen);
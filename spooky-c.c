@@ -36,6 +36,8 @@
 //   Apr 27 2012: C version updated by Ziga Zupanec ziga.zupanec@gmail.com (agiz@github)
 //   Update to spooky V2: d = should be d += in short hash, and remove extra mix from long hash
 //   (note results have changed from this change)
+//   End() adds in the last partial block like SpookyV2 does, it was dropped
+//   before for messages of 192 bytes or more (results change again)
 
 //   Assumes little endian ness. Caller has to check this case.
 //   According to Bob it should work on LE too, but just give different results.
@@ -64,6 +66,13 @@
 
 #include <memory.h>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#  include <immintrin.h>
+#  define HAVE_X4_AVX2 1
+#  define HAVE_SCAN_SSE2 1
+#  define HAVE_WORDS_AVX512 1
+#endif
+
 #include "spooky-c.h"
 
 // SC_CONST: a constant which:
@@ -78,6 +87,36 @@ static inline uint64_t rot64(uint64_t x, int k)
 	return (x << k) | (x >> (64 - k));
 }
 
+static inline uint64_t load64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t load32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+//
+// ASCII A-Z to a-z in all eight bytes of a word at once.  The high bit of
+// each byte of the sums tells whether the byte is >= 'A' and > 'Z'; bytes
+// with their own high bit set are left alone.
+//
+static inline uint64_t fold_case(uint64_t x)
+{
+	uint64_t low7 = x & 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t ge_a = low7 + 0x3f3f3f3f3f3f3f3fULL;
+	uint64_t gt_z = low7 + 0x2525252525252525ULL;
+
+	return x | ((ge_a & ~gt_z & ~x & 0x8080808080808080ULL) >> 2);
+}
+
 //
 // This is used if the input is 96 bytes long or longer.
 //
@@ -152,16 +191,41 @@ static inline void endPartial
 
 static inline void end
 (
+	const uint64_t *data,
 	uint64_t *h0,	uint64_t *h1,	uint64_t *h2,	uint64_t *h3,
 	uint64_t *h4,	uint64_t *h5,	uint64_t *h6,	uint64_t *h7,
 	uint64_t *h8,	uint64_t *h9,	uint64_t *h10,	uint64_t *h11
 )
 {
+	*h0 += data[0];		*h1 += data[1];		*h2 += data[2];		*h3 += data[3];
+	*h4 += data[4];		*h5 += data[5];		*h6 += data[6];		*h7 += data[7];
+	*h8 += data[8];		*h9 += data[9];		*h10 += data[10];	*h11 += data[11];
 	endPartial(h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11);
 	endPartial(h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11);
 	endPartial(h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11);
 }
 
+//
+// Shorter end() for spooky_fasthash64, which only reports h0.  Two
+// iterations pass the 1 and 2 bit delta test for all 64 output bits.
+// One is not enough: bits of the last block then leave some output bits
+// always or never flipped.
+//
+static inline void end_fast
+(
+	const uint64_t *data,
+	uint64_t *h0,	uint64_t *h1,	uint64_t *h2,	uint64_t *h3,
+	uint64_t *h4,	uint64_t *h5,	uint64_t *h6,	uint64_t *h7,
+	uint64_t *h8,	uint64_t *h9,	uint64_t *h10,	uint64_t *h11
+)
+{
+	*h0 += data[0];		*h1 += data[1];		*h2 += data[2];		*h3 += data[3];
+	*h4 += data[4];		*h5 += data[5];		*h6 += data[6];		*h7 += data[7];
+	*h8 += data[8];		*h9 += data[9];		*h10 += data[10];	*h11 += data[11];
+	endPartial(h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11);
+	endPartial(h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11);
+}
+
 //
 // The goal is for each bit of the input to expand into 128 bits of
 //   apparent entropy before it is fully overwritten.
@@ -232,6 +296,107 @@ static inline void short_end
 	*h1 ^= *h0;  *h0 = rot64(*h0, 63);  *h1 += *h0;
 }
 
+//
+// Add the last 0..15 bytes of a short message to c and d, reading only
+// those bytes.
+//
+static inline void short_tail_switch
+(
+	const uint8_t *p,
+	size_t remainder,
+	uint64_t *c,
+	uint64_t *d
+)
+{
+	switch (remainder)
+	{
+		case 15:
+			*d += ((uint64_t)p[14]) << 48;
+		case 14:
+			*d += ((uint64_t)p[13]) << 40;
+		case 13:
+			*d += ((uint64_t)p[12]) << 32;
+		case 12:
+			*d += load32(p + 8);
+			*c += load64(p);
+			break;
+		case 11:
+			*d += ((uint64_t)p[10]) << 16;
+		case 10:
+			*d += ((uint64_t)p[9]) << 8;
+		case 9:
+			*d += (uint64_t)p[8];
+		case 8:
+			*c += load64(p);
+			break;
+		case 7:
+			*c += ((uint64_t)p[6]) << 48;
+		case 6:
+			*c += ((uint64_t)p[5]) << 40;
+		case 5:
+			*c += ((uint64_t)p[4]) << 32;
+		case 4:
+			*c += load32(p);
+			break;
+		case 3:
+			*c += ((uint64_t)p[2]) << 16;
+		case 2:
+			*c += ((uint64_t)p[1]) << 8;
+		case 1:
+			*c += (uint64_t)p[0];
+			break;
+		case 0:
+			*c += SC_CONST;
+			*d += SC_CONST;
+	}
+}
+
+#if defined(SPOOKY_BRANCHLESS_TAIL) && ALLOW_UNALIGNED_READS && defined(__SIZEOF_INT128__)
+#define SC_PAGESIZE 4096
+
+//
+// The same as short_tail_switch without branching on the remainder, which
+// mispredicts when key lengths vary.  The tail is one 16 byte load, shifted
+// into place.  A message of 16 bytes or more is read from 16 bytes before
+// its end.  A shorter one is read from its start and masked, as long as
+// those 16 bytes don't reach into the next page; keys that end in the last
+// bytes of a page, and empty keys, which may point anywhere, take the
+// switch.
+//
+// Reading up to 15 bytes past a short key is safe, but it is reported by
+// ASan and valgrind, and it is slower when lengths are predictable, so it
+// is only built with -DSPOOKY_BRANCHLESS_TAIL.
+//
+static inline void short_tail
+(
+	const uint8_t *p,
+	size_t remainder,
+	size_t length,
+	uint64_t *c,
+	uint64_t *d
+)
+{
+	unsigned __int128 v;
+	uint64_t empty = (uint64_t)0 - (remainder == 0);
+	int back = length >= 16;
+
+	if (!back && (length == 0 ||
+		      ((uintptr_t)p & (SC_PAGESIZE-1)) > SC_PAGESIZE-16))
+	{
+		short_tail_switch(p, remainder, c, d);
+		return;
+	}
+	memcpy(&v, back ? p + remainder - 16 : p, sizeof(v));
+	v >>= (back ? (16 - remainder)*8 : 0) & 127;
+	v &= ((unsigned __int128)1 << remainder*8) - 1;
+	*c += (uint64_t)v + (empty & SC_CONST);
+	*d += (uint64_t)(v >> 64) + (empty & SC_CONST);
+}
+#else
+#define short_tail(p, remainder, length, c, d) \
+	short_tail_switch(p, remainder, c, d)
+#endif
+
 void spooky_shorthash
 (
 	const void *message,
@@ -291,52 +456,195 @@ void spooky_shorthash
 
 	// Handle the last 0..15 bytes, and its length
 	d += ((uint64_t)length) << 56;
-	switch (remainder)
+	short_tail(u.p8, remainder, length, &c, &d);
+	short_end(&a, &b, &c, &d);
+	*hash1 = a;
+	*hash2 = b;
+}
+
+//
+// spooky_shorthash of the message with ASCII upper case folded to lower
+// case.  The last 0..15 bytes are read zero padded into two words, which
+// adds the same values as the byte by byte switch in spooky_shorthash.
+//
+static void short_fold
+(
+	const uint8_t *p,
+	size_t length,
+	uint64_t *hash1,
+	uint64_t *hash2
+)
+{
+	size_t remainder = length % 32;
+	uint64_t a = *hash1, b = *hash2, c = SC_CONST, d = SC_CONST;
+	uint64_t tail[2] = { 0, 0 };
+
+	if (length > 15)
 	{
-		case 15:
-			d += ((uint64_t)u.p8[14]) << 48;
-		case 14:
-			d += ((uint64_t)u.p8[13]) << 40;
-		case 13:
-			d += ((uint64_t)u.p8[12]) << 32;
-		case 12:
-			d += u.p32[2];
-			c += u.p64[0];
-			break;
-		case 11:
-			d += ((uint64_t)u.p8[10]) << 16;
-		case 10:
-			d += ((uint64_t)u.p8[9]) << 8;
-		case 9:
-			d += (uint64_t)u.p8[8];
-		case 8:
-			c += u.p64[0];
-			break;
-		case 7:
-			c += ((uint64_t)u.p8[6]) << 48;
-		case 6:
-			c += ((uint64_t)u.p8[5]) << 40;
-		case 5:
-			c += ((uint64_t)u.p8[4]) << 32;
-		case 4:
-			c += u.p32[0];
-			break;
-		case 3:
-			c += ((uint64_t)u.p8[2]) << 16;
-		case 2:
-			c += ((uint64_t)u.p8[1]) << 8;
-		case 1:
-			c += (uint64_t)u.p8[0];
-			break;
-		case 0:
-			c += SC_CONST;
-			d += SC_CONST;
+		const uint8_t *endp = p + (length/32)*32;
+
+		for (; p < endp; p += 32)
+		{
+			c += fold_case(load64(p));
+			d += fold_case(load64(p + 8));
+			short_mix(&a, &b, &c, &d);
+			a += fold_case(load64(p + 16));
+			b += fold_case(load64(p + 24));
+		}
+		if (remainder >= 16)
+		{
+			c += fold_case(load64(p));
+			d += fold_case(load64(p + 8));
+			short_mix(&a, &b, &c, &d);
+			p += 16;
+			remainder -= 16;
+		}
+	}
+
+	d += ((uint64_t)length) << 56;
+	if (remainder == 0)
+	{
+		c += SC_CONST;
+		d += SC_CONST;
+	}
+	else
+	{
+		memcpy(tail, p, remainder);
+		c += fold_case(tail[0]);
+		d += fold_case(tail[1]);
 	}
 	short_end(&a, &b, &c, &d);
 	*hash1 = a;
 	*hash2 = b;
 }
 
+//
+// Bit i set when byte i of the aligned 16 bytes at p is zero.  An aligned
+// load never crosses into the next page, so it may read past the end of
+// a string as long as the terminator is in the same 16 bytes.
+//
+static inline uint32_t zero_mask16(const uint8_t *p)
+{
+#ifdef HAVE_SCAN_SSE2
+	__m128i v = _mm_load_si128((const __m128i *)p);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+#else
+	uint32_t m = 0;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		m |= (uint32_t)(p[i] == 0) << i;
+	return m;
+#endif
+}
+
+#ifdef __GNUC__
+#  define first_bit(m) __builtin_ctz(m)
+#else
+static inline int first_bit(uint32_t m)
+{
+	int i = 0;
+
+	while (!(m & 1))
+	{
+		m >>= 1;
+		i++;
+	}
+	return i;
+}
+#endif
+
+//
+// spooky_hash128 of a NUL terminated string, finding the terminator
+// while the short hash consumes the string 32 bytes at a time.  A block
+// is only mixed in once the scan has shown it holds no terminator, and
+// whole blocks are always mixed the same way, so the length is only
+// needed for the last 0..31 bytes.  Strings of SC_BUFSIZE bytes or more
+// take the long path, which needs the length up front.
+//
+static size_t hash_cstr
+(
+	const char *str,
+	uint64_t *hash1,
+	uint64_t *hash2
+)
+{
+	const uint8_t *s = (const uint8_t *)str, *p = s;
+	const uint8_t *scan = (const uint8_t *)((uintptr_t)s & ~(uintptr_t)15);
+	uint64_t a = *hash1, b = *hash2, c = SC_CONST, d = SC_CONST;
+	size_t length, remainder;
+	uint32_t m;
+
+	// the bytes before the string in its first 16 don't count
+	m = zero_mask16(scan) >> (s - scan);
+	if (m)
+	{
+		length = first_bit(m);
+		goto found;
+	}
+	scan += 16;
+	for (;;)
+	{
+		// bytes before scan are known not to be the terminator
+		while (scan < p + 32)
+		{
+			m = zero_mask16(scan);
+			if (m)
+			{
+				length = scan - s + first_bit(m);
+				goto found;
+			}
+			scan += 16;
+		}
+		if (p - s + 32 >= SC_BUFSIZE)
+		{
+			length = scan - s + strlen((const char *)scan);
+			spooky_hash128(s, length, hash1, hash2);
+			return length;
+		}
+		c += load64(p);
+		d += load64(p + 8);
+		short_mix(&a, &b, &c, &d);
+		a += load64(p + 16);
+		b += load64(p + 24);
+		p += 32;
+	}
+
+found:
+	// the last 16 bytes scanned may reach past the block being checked
+	if (length >= SC_BUFSIZE)
+	{
+		spooky_hash128(s, length, hash1, hash2);
+		return length;
+	}
+	remainder = length - (p - s);
+	if (remainder >= 32)
+	{
+		c += load64(p);
+		d += load64(p + 8);
+		short_mix(&a, &b, &c, &d);
+		a += load64(p + 16);
+		b += load64(p + 24);
+		p += 32;
+		remainder -= 32;
+	}
+	if (remainder >= 16)
+	{
+		c += load64(p);
+		d += load64(p + 8);
+		short_mix(&a, &b, &c, &d);
+		p += 16;
+		remainder -= 16;
+	}
+	d += ((uint64_t)length) << 56;
+	short_tail(p, remainder, length, &c, &d);
+	short_end(&a, &b, &c, &d);
+	*hash1 = a;
+	*hash2 = b;
+	return length;
+}
+
 void spooky_init
 (
 	struct spooky_state *state,
@@ -471,6 +779,8 @@ void spooky_final
 	// init the variables
 	if (state->m_length < SC_BUFSIZE)
 	{
+		*hash1 = state->m_state[0];
+		*hash2 = state->m_state[1];
 		spooky_shorthash(state->m_data, state->m_length, hash1, hash2);
 		return;
 	}
@@ -500,21 +810,26 @@ void spooky_final
 	memset(&((uint8_t *)data)[remainder], 0, (SC_BLOCKSIZE-remainder));
 
 	((uint8_t *)data)[SC_BLOCKSIZE-1] = remainder;
-	mix(data, &h0, &h1, &h2, &h3, &h4, &h5, &h6, &h7, &h8, &h9, &h10, &h11);
 
 	// do some final mixing
-	end(&h0, &h1, &h2, &h3, &h4, &h5, &h6, &h7, &h8, &h9, &h10, &h11);
+	end(data, &h0, &h1, &h2, &h3, &h4, &h5, &h6, &h7, &h8, &h9, &h10, &h11);
 
 	*hash1 = h0;
 	*hash2 = h1;
 }
 
-void spooky_hash128
+//
+// The long message path of spooky_hash128, with the full or the shortened
+// final mixing, optionally folding ASCII upper case while loading.
+//
+static inline void hash_long
 (
 	const void *message,
 	size_t length,
 	uint64_t *hash1,
-	uint64_t *hash2
+	uint64_t *hash2,
+	int fast,
+	int fold
 )
 {
 	uint64_t h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11;
@@ -528,12 +843,6 @@ void spooky_hash128
 	} u;
 	size_t remainder;
 
-	if (length < SC_BUFSIZE)
-	{
-		spooky_shorthash(message, length, hash1, hash2);
-		return;
-	}
-
 	h0 = h3 = h6 = h9  = *hash1;
 	h1 = h4 = h7 = h10 = *hash2;
 	h2 = h5 = h8 = h11 = SC_CONST;
@@ -542,7 +851,19 @@ void spooky_hash128
 	endp = u.p64 + (length/SC_BLOCKSIZE)*SC_NUMVARS;
 
 	// handle all whole blocks of SC_BLOCKSIZE bytes
-	if (ALLOW_UNALIGNED_READS || (u.i & 0x7) == 0)
+	if (fold)
+	{
+		while (u.p64 < endp)
+		{
+			int i;
+
+			for (i = 0; i < SC_NUMVARS; i++)
+				buf[i] = fold_case(load64(u.p8 + 8*i));
+			mix(buf, &h0, &h1, &h2, &h3, &h4, &h5, &h6, &h7, &h8, &h9, &h10, &h11);
+			u.p64 += SC_NUMVARS;
+		}
+	}
+	else if (ALLOW_UNALIGNED_READS || (u.i & 0x7) == 0)
 	{
 		while (u.p64 < endp)
 		{
@@ -564,14 +885,187 @@ void spooky_hash128
 	remainder = (length - ((const uint8_t *)endp-(const uint8_t *)message));
 	memcpy(buf, endp, remainder);
 	memset(((uint8_t *)buf)+remainder, 0, SC_BLOCKSIZE-remainder);
+	if (fold)
+	{
+		int i;
+
+		// before the length byte goes in, it may look like a letter
+		for (i = 0; i < SC_NUMVARS; i++)
+			buf[i] = fold_case(buf[i]);
+	}
 	((uint8_t *)buf)[SC_BLOCKSIZE-1] = remainder;
 
 	// do some final mixing
-	end(&h0, &h1, &h2, &h3, &h4, &h5, &h6, &h7, &h8, &h9, &h10, &h11);
+	if (fast)
+		end_fast(buf, &h0, &h1, &h2, &h3, &h4, &h5, &h6, &h7, &h8, &h9, &h10, &h11);
+	else
+		end(buf, &h0, &h1, &h2, &h3, &h4, &h5, &h6, &h7, &h8, &h9, &h10, &h11);
 	*hash1 = h0;
 	*hash2 = h1;
 }
 
+void spooky_hash128
+(
+	const void *message,
+	size_t length,
+	uint64_t *hash1,
+	uint64_t *hash2
+)
+{
+	if (length < SC_BUFSIZE)
+	{
+		spooky_shorthash(message, length, hash1, hash2);
+		return;
+	}
+	hash_long(message, length, hash1, hash2, 0, 0);
+}
+
+#ifdef HAVE_X4_AVX2
+//
+// Four messages of the same length hashed in the four 64-bit lanes of AVX2
+// registers.  Lane i holds the state of message i, so this computes exactly
+// what four spooky_hash128 calls would.  AVX2 has no 64-bit rotate, it is
+// done with two shifts.
+//
+#define VROT(x, k) _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - (k)))
+
+#define VMIX(d) \
+	s0 = _mm256_add_epi64(s0, d[0]);	s2 = _mm256_xor_si256(s2, s10);	s11 = _mm256_xor_si256(s11, s0);	s0 = VROT(s0, 11);	s11 = _mm256_add_epi64(s11, s1); \
+	s1 = _mm256_add_epi64(s1, d[1]);	s3 = _mm256_xor_si256(s3, s11);	s0 = _mm256_xor_si256(s0, s1);		s1 = VROT(s1, 32);	s0 = _mm256_add_epi64(s0, s2); \
+	s2 = _mm256_add_epi64(s2, d[2]);	s4 = _mm256_xor_si256(s4, s0);	s1 = _mm256_xor_si256(s1, s2);		s2 = VROT(s2, 43);	s1 = _mm256_add_epi64(s1, s3); \
+	s3 = _mm256_add_epi64(s3, d[3]);	s5 = _mm256_xor_si256(s5, s1);	s2 = _mm256_xor_si256(s2, s3);		s3 = VROT(s3, 31);	s2 = _mm256_add_epi64(s2, s4); \
+	s4 = _mm256_add_epi64(s4, d[4]);	s6 = _mm256_xor_si256(s6, s2);	s3 = _mm256_xor_si256(s3, s4);		s4 = VROT(s4, 17);	s3 = _mm256_add_epi64(s3, s5); \
+	s5 = _mm256_add_epi64(s5, d[5]);	s7 = _mm256_xor_si256(s7, s3);	s4 = _mm256_xor_si256(s4, s5);		s5 = VROT(s5, 28);	s4 = _mm256_add_epi64(s4, s6); \
+	s6 = _mm256_add_epi64(s6, d[6]);	s8 = _mm256_xor_si256(s8, s4);	s5 = _mm256_xor_si256(s5, s6);		s6 = VROT(s6, 39);	s5 = _mm256_add_epi64(s5, s7); \
+	s7 = _mm256_add_epi64(s7, d[7]);	s9 = _mm256_xor_si256(s9, s5);	s6 = _mm256_xor_si256(s6, s7);		s7 = VROT(s7, 57);	s6 = _mm256_add_epi64(s6, s8); \
+	s8 = _mm256_add_epi64(s8, d[8]);	s10 = _mm256_xor_si256(s10, s6);	s7 = _mm256_xor_si256(s7, s8);		s8 = VROT(s8, 55);	s7 = _mm256_add_epi64(s7, s9); \
+	s9 = _mm256_add_epi64(s9, d[9]);	s11 = _mm256_xor_si256(s11, s7);	s8 = _mm256_xor_si256(s8, s9);		s9 = VROT(s9, 54);	s8 = _mm256_add_epi64(s8, s10); \
+	s10 = _mm256_add_epi64(s10, d[10]);	s0 = _mm256_xor_si256(s0, s8);	s9 = _mm256_xor_si256(s9, s10);		s10 = VROT(s10, 22);	s9 = _mm256_add_epi64(s9, s11); \
+	s11 = _mm256_add_epi64(s11, d[11]);	s1 = _mm256_xor_si256(s1, s9);	s10 = _mm256_xor_si256(s10, s11);	s11 = VROT(s11, 46);	s10 = _mm256_add_epi64(s10, s0);
+
+#define VEND_PARTIAL \
+	s11 = _mm256_add_epi64(s11, s1);	s2 = _mm256_xor_si256(s2, s11);	s1 = VROT(s1, 44); \
+	s0 = _mm256_add_epi64(s0, s2);		s3 = _mm256_xor_si256(s3, s0);	s2 = VROT(s2, 15); \
+	s1 = _mm256_add_epi64(s1, s3);		s4 = _mm256_xor_si256(s4, s1);	s3 = VROT(s3, 34); \
+	s2 = _mm256_add_epi64(s2, s4);		s5 = _mm256_xor_si256(s5, s2);	s4 = VROT(s4, 21); \
+	s3 = _mm256_add_epi64(s3, s5);		s6 = _mm256_xor_si256(s6, s3);	s5 = VROT(s5, 38); \
+	s4 = _mm256_add_epi64(s4, s6);		s7 = _mm256_xor_si256(s7, s4);	s6 = VROT(s6, 33); \
+	s5 = _mm256_add_epi64(s5, s7);		s8 = _mm256_xor_si256(s8, s5);	s7 = VROT(s7, 10); \
+	s6 = _mm256_add_epi64(s6, s8);		s9 = _mm256_xor_si256(s9, s6);	s8 = VROT(s8, 13); \
+	s7 = _mm256_add_epi64(s7, s9);		s10 = _mm256_xor_si256(s10, s7);	s9 = VROT(s9, 38); \
+	s8 = _mm256_add_epi64(s8, s10);		s11 = _mm256_xor_si256(s11, s8);	s10 = VROT(s10, 53); \
+	s9 = _mm256_add_epi64(s9, s11);		s0 = _mm256_xor_si256(s0, s9);	s11 = VROT(s11, 42); \
+	s10 = _mm256_add_epi64(s10, s0);	s1 = _mm256_xor_si256(s1, s10);	s0 = VROT(s0, 54);
+
+// gather words j..j+3 of four messages into lanes
+__attribute__((target("avx2")))
+static inline void transpose4
+(
+	__m256i *d,
+	const uint64_t *p0, const uint64_t *p1,
+	const uint64_t *p2, const uint64_t *p3
+)
+{
+	__m256i a = _mm256_loadu_si256((const __m256i *)p0);
+	__m256i b = _mm256_loadu_si256((const __m256i *)p1);
+	__m256i c = _mm256_loadu_si256((const __m256i *)p2);
+	__m256i e = _mm256_loadu_si256((const __m256i *)p3);
+	__m256i t0 = _mm256_unpacklo_epi64(a, b);
+	__m256i t1 = _mm256_unpackhi_epi64(a, b);
+	__m256i t2 = _mm256_unpacklo_epi64(c, e);
+	__m256i t3 = _mm256_unpackhi_epi64(c, e);
+
+	d[0] = _mm256_permute2x128_si256(t0, t2, 0x20);
+	d[1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+	d[2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+	d[3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+}
+
+__attribute__((target("avx2")))
+static inline void load_block4(__m256i *d, const uint64_t *p[4])
+{
+	transpose4(&d[0], p[0], p[1], p[2], p[3]);
+	transpose4(&d[4], p[0] + 4, p[1] + 4, p[2] + 4, p[3] + 4);
+	transpose4(&d[8], p[0] + 8, p[1] + 8, p[2] + 8, p[3] + 8);
+}
+
+__attribute__((target("avx2")))
+static void hash128_x4_avx2
+(
+	const void *message[4],
+	size_t length,
+	uint64_t *hash1,
+	uint64_t *hash2
+)
+{
+	__m256i s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11;
+	__m256i d[SC_NUMVARS];
+	uint64_t buf[4][SC_NUMVARS];
+	const uint64_t *p[4];
+	size_t nblocks = length / SC_BLOCKSIZE;
+	size_t remainder = length - nblocks * SC_BLOCKSIZE;
+	size_t i;
+	int k;
+
+	s0 = s3 = s6 = s9 = _mm256_loadu_si256((const __m256i *)hash1);
+	s1 = s4 = s7 = s10 = _mm256_loadu_si256((const __m256i *)hash2);
+	s2 = s5 = s8 = s11 = _mm256_set1_epi64x(SC_CONST);
+
+	for (k = 0; k < 4; k++)
+		p[k] = (const uint64_t *)message[k];
+	for (i = 0; i < nblocks; i++)
+	{
+		load_block4(d, p);
+		VMIX(d)
+		for (k = 0; k < 4; k++)
+			p[k] += SC_NUMVARS;
+	}
+
+	// the last partial block, padded the same way as spooky_hash128
+	for (k = 0; k < 4; k++)
+	{
+		memcpy(buf[k], p[k], remainder);
+		memset(((uint8_t *)buf[k]) + remainder, 0, SC_BLOCKSIZE - remainder);
+		((uint8_t *)buf[k])[SC_BLOCKSIZE-1] = remainder;
+		p[k] = buf[k];
+	}
+	load_block4(d, p);
+	s0 = _mm256_add_epi64(s0, d[0]);	s1 = _mm256_add_epi64(s1, d[1]);
+	s2 = _mm256_add_epi64(s2, d[2]);	s3 = _mm256_add_epi64(s3, d[3]);
+	s4 = _mm256_add_epi64(s4, d[4]);	s5 = _mm256_add_epi64(s5, d[5]);
+	s6 = _mm256_add_epi64(s6, d[6]);	s7 = _mm256_add_epi64(s7, d[7]);
+	s8 = _mm256_add_epi64(s8, d[8]);	s9 = _mm256_add_epi64(s9, d[9]);
+	s10 = _mm256_add_epi64(s10, d[10]);	s11 = _mm256_add_epi64(s11, d[11]);
+	VEND_PARTIAL
+	VEND_PARTIAL
+	VEND_PARTIAL
+
+	_mm256_storeu_si256((__m256i *)hash1, s0);
+	_mm256_storeu_si256((__m256i *)hash2, s1);
+}
+#endif
+
+void spooky_hash128_x4
+(
+	const void *message[4],
+	size_t length,
+	uint64_t *hash1,
+	uint64_t *hash2
+)
+{
+	int i;
+
+#ifdef HAVE_X4_AVX2
+	if (length >= SC_BUFSIZE && __builtin_cpu_supports("avx2"))
+	{
+		hash128_x4_avx2(message, length, hash1, hash2);
+		return;
+	}
+#endif
+	for (i = 0; i < 4; i++)
+		spooky_hash128(message[i], length, &hash1[i], &hash2[i]);
+}
+
 uint64_t spooky_hash64
 (
 	const void *message,
@@ -584,6 +1078,276 @@ uint64_t spooky_hash64
 	return hash1;
 }
 
+//
+// spooky_hash64 of a single word of len (4 or 8) bytes: the short hash with
+// no 16 byte blocks and the word as the whole tail.
+//
+static inline uint64_t hash64_word(uint64_t x, uint64_t len, uint64_t seed)
+{
+	uint64_t a = seed, b = seed;
+	uint64_t c = SC_CONST + x, d = SC_CONST + (len << 56);
+
+	short_end(&a, &b, &c, &d);
+	return a;
+}
+
+#ifdef HAVE_X4_AVX2
+//
+// short_end on vectors of W bits, one word per 64-bit lane.  ROT is VROT
+// for AVX2 and the vprolq rotate for AVX-512.
+//
+#define VSHORT_END(W, ROT, h0, h1, h2, h3) \
+	h3 = _mm##W##_xor_si##W(h3, h2);  h2 = ROT(h2, 15);  h3 = _mm##W##_add_epi64(h3, h2); \
+	h0 = _mm##W##_xor_si##W(h0, h3);  h3 = ROT(h3, 52);  h0 = _mm##W##_add_epi64(h0, h3); \
+	h1 = _mm##W##_xor_si##W(h1, h0);  h0 = ROT(h0, 26);  h1 = _mm##W##_add_epi64(h1, h0); \
+	h2 = _mm##W##_xor_si##W(h2, h1);  h1 = ROT(h1, 51);  h2 = _mm##W##_add_epi64(h2, h1); \
+	h3 = _mm##W##_xor_si##W(h3, h2);  h2 = ROT(h2, 28);  h3 = _mm##W##_add_epi64(h3, h2); \
+	h0 = _mm##W##_xor_si##W(h0, h3);  h3 = ROT(h3, 9);   h0 = _mm##W##_add_epi64(h0, h3); \
+	h1 = _mm##W##_xor_si##W(h1, h0);  h0 = ROT(h0, 47);  h1 = _mm##W##_add_epi64(h1, h0); \
+	h2 = _mm##W##_xor_si##W(h2, h1);  h1 = ROT(h1, 54);  h2 = _mm##W##_add_epi64(h2, h1); \
+	h3 = _mm##W##_xor_si##W(h3, h2);  h2 = ROT(h2, 32);  h3 = _mm##W##_add_epi64(h3, h2); \
+	h0 = _mm##W##_xor_si##W(h0, h3);  h3 = ROT(h3, 25);  h0 = _mm##W##_add_epi64(h0, h3); \
+	h1 = _mm##W##_xor_si##W(h1, h0);  h0 = ROT(h0, 63);  h1 = _mm##W##_add_epi64(h1, h0);
+
+__attribute__((target("avx2")))
+static inline __m256i hash64_word_x4(__m256i x, __m256i d, __m256i seed)
+{
+	__m256i a = seed, b = seed;
+	__m256i c = _mm256_add_epi64(x, _mm256_set1_epi64x(SC_CONST));
+
+	VSHORT_END(256, VROT, a, b, c, d)
+	return a;
+}
+
+// the first n & ~3 words, four at a time
+__attribute__((target("avx2")))
+static size_t hash64_words_avx2
+(
+	const void *v,
+	size_t width,
+	size_t n,
+	uint64_t seed,
+	uint64_t *out
+)
+{
+	__m256i s = _mm256_set1_epi64x(seed);
+	__m256i d = _mm256_set1_epi64x(SC_CONST + ((uint64_t)width << 56));
+	size_t i;
+
+	if (width == 8)
+	{
+		const uint64_t *p = (const uint64_t *)v;
+		for (i = 0; i + 4 <= n; i += 4)
+		{
+			__m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+			_mm256_storeu_si256((__m256i *)(out + i), hash64_word_x4(x, d, s));
+		}
+	}
+	else
+	{
+		const uint32_t *p = (const uint32_t *)v;
+		for (i = 0; i + 4 <= n; i += 4)
+		{
+			__m256i x = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)(p + i)));
+			_mm256_storeu_si256((__m256i *)(out + i), hash64_word_x4(x, d, s));
+		}
+	}
+	return i;
+}
+#endif
+
+#ifdef HAVE_WORDS_AVX512
+#define VROL512(x, k) _mm512_rol_epi64(x, k)
+
+__attribute__((target("avx512f")))
+static inline __m512i hash64_word_x8(__m512i x, __m512i d, __m512i seed)
+{
+	__m512i a = seed, b = seed;
+	__m512i c = _mm512_add_epi64(x, _mm512_set1_epi64(SC_CONST));
+
+	VSHORT_END(512, VROL512, a, b, c, d)
+	return a;
+}
+
+// the first n & ~7 words, eight at a time
+__attribute__((target("avx512f")))
+static size_t hash64_words_avx512
+(
+	const void *v,
+	size_t width,
+	size_t n,
+	uint64_t seed,
+	uint64_t *out
+)
+{
+	__m512i s = _mm512_set1_epi64(seed);
+	__m512i d = _mm512_set1_epi64(SC_CONST + ((uint64_t)width << 56));
+	size_t i;
+
+	if (width == 8)
+	{
+		const uint64_t *p = (const uint64_t *)v;
+		for (i = 0; i + 8 <= n; i += 8)
+		{
+			__m512i x = _mm512_loadu_si512((const void *)(p + i));
+			_mm512_storeu_si512((void *)(out + i), hash64_word_x8(x, d, s));
+		}
+	}
+	else
+	{
+		const uint32_t *p = (const uint32_t *)v;
+		for (i = 0; i + 8 <= n; i += 8)
+		{
+			__m512i x = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i *)(p + i)));
+			_mm512_storeu_si512((void *)(out + i), hash64_word_x8(x, d, s));
+		}
+	}
+	return i;
+}
+#endif
+
+// the words hashed with the widest vectors the CPU has, or 0 of them
+static size_t hash64_words_vec
+(
+	const void *v,
+	size_t width,
+	size_t n,
+	uint64_t seed,
+	uint64_t *out
+)
+{
+#ifdef HAVE_WORDS_AVX512
+	if (__builtin_cpu_supports("avx512f"))
+		return hash64_words_avx512(v, width, n, seed, out);
+#endif
+#ifdef HAVE_X4_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return hash64_words_avx2(v, width, n, seed, out);
+#endif
+	(void)v; (void)width; (void)n; (void)seed; (void)out;
+	return 0;
+}
+
+void spooky_hash64_u64
+(
+	const uint64_t *v,
+	size_t n,
+	uint64_t seed,
+	uint64_t *out
+)
+{
+	size_t i = hash64_words_vec(v, 8, n, seed, out);
+
+	for (; i < n; i++)
+		out[i] = hash64_word(v[i], 8, seed);
+}
+
+void spooky_hash64_u32
+(
+	const uint32_t *v,
+	size_t n,
+	uint64_t seed,
+	uint64_t *out
+)
+{
+	size_t i = hash64_words_vec(v, 4, n, seed, out);
+
+	for (; i < n; i++)
+		out[i] = hash64_word(v[i], 4, seed);
+}
+
+uint64_t spooky_fasthash64
+(
+	const void *message,
+	size_t length,
+	uint64_t seed
+)
+{
+	uint64_t hash1 = seed;
+
+	if (length < SC_BUFSIZE)
+		spooky_shorthash(message, length, &hash1, &seed);
+	else
+		hash_long(message, length, &hash1, &seed, 1, 0);
+	return hash1;
+}
+
+void spooky_hash128_cstr
+(
+	const char *str,
+	uint64_t *hash1,
+	uint64_t *hash2,
+	size_t *length
+)
+{
+	size_t len = hash_cstr(str, hash1, hash2);
+
+	if (length)
+		*length = len;
+}
+
+uint64_t spooky_hash64_cstr
+(
+	const char *str,
+	uint64_t seed,
+	size_t *length
+)
+{
+	uint64_t hash1 = seed;
+	spooky_hash128_cstr(str, &hash1, &seed, length);
+	return hash1;
+}
+
+static inline int fold_space(uint8_t c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+void spooky_hash128_fold
+(
+	const void *message,
+	size_t length,
+	uint64_t *hash1,
+	uint64_t *hash2,
+	int flags
+)
+{
+	const uint8_t *p = (const uint8_t *)message;
+
+	if (flags & SPOOKY_FOLD_TRIM)
+	{
+		while (length > 0 && fold_space(p[0]))
+		{
+			p++;
+			length--;
+		}
+		while (length > 0 && fold_space(p[length-1]))
+			length--;
+	}
+	if ((flags & SPOOKY_FOLD_DOT) && length > 0 && p[length-1] == '.')
+		length--;
+
+	if (!(flags & SPOOKY_FOLD_CASE))
+		spooky_hash128(p, length, hash1, hash2);
+	else if (length < SC_BUFSIZE)
+		short_fold(p, length, hash1, hash2);
+	else
+		hash_long(p, length, hash1, hash2, 0, 1);
+}
+
+uint64_t spooky_hash64_fold
+(
+	const void *message,
+	size_t length,
+	uint64_t seed,
+	int flags
+)
+{
+	uint64_t hash1 = seed;
+	spooky_hash128_fold(message, length, &hash1, &seed, flags);
+	return hash1;
+}
+
 uint32_t spooky_hash32
 (
 	const void *message,
@@ -26,6 +26,9 @@
 // slower than MD5.
 //
 
+#ifndef SPOOKY_C_H
+#define SPOOKY_C_H 1
+
 #include <stdint.h>
 #include <stddef.h>
 
@@ -79,6 +82,17 @@ void spooky_hash128
 	uint64_t *hash2
 );
 
+// hash four messages of the same length at once, with the same results
+// as four spooky_hash128 calls.  hash1/hash2 are arrays of four seeds in
+// and four hash values out.
+void spooky_hash128_x4
+(
+	const void *message[4],
+	size_t length,
+	uint64_t *hash1,
+	uint64_t *hash2
+);
+
 uint64_t spooky_hash64
 (
 	const void *message,
@@ -86,9 +100,80 @@ uint64_t spooky_hash64
 	uint64_t seed
 );
 
+// out[i] = spooky_hash64(&v[i], sizeof(v[i]), seed) for n integers,
+// hashed 4 or 8 at a time in AVX2 or AVX-512 lanes where the CPU has them.
+void spooky_hash64_u64
+(
+	const uint64_t *v,
+	size_t n,
+	uint64_t seed,
+	uint64_t *out
+);
+
+void spooky_hash64_u32
+(
+	const uint32_t *v,
+	size_t n,
+	uint64_t seed,
+	uint64_t *out
+);
+
+// Like spooky_hash64, but with a shorter final mixing for messages of
+// 192 bytes or more.  The results differ from spooky_hash64 for those
+// lengths and are not meant to be stable across versions.
+uint64_t spooky_fasthash64
+(
+	const void *message,
+	size_t len,
+	uint64_t seed
+);
+
 uint32_t spooky_hash32
 (
 	const void *message,
 	size_t len,
 	uint32_t seed
 );
+
+// The same values as spooky_hash128/spooky_hash64 of str and strlen(str),
+// in one pass over the string.  The length is stored unless it is NULL.
+void spooky_hash128_cstr
+(
+	const char *str,
+	uint64_t *hash1,
+	uint64_t *hash2,
+	size_t *length
+);
+
+uint64_t spooky_hash64_cstr
+(
+	const char *str,
+	uint64_t seed,
+	size_t *length
+);
+
+// flags for the _fold variants
+#define SPOOKY_FOLD_CASE	1	// ASCII A-Z hash like a-z
+#define SPOOKY_FOLD_TRIM	2	// ignore leading and trailing blanks
+#define SPOOKY_FOLD_DOT		4	// ignore one trailing dot, after trimming
+
+// The same values as spooky_hash128/spooky_hash64 of the message after
+// applying flags to a copy of it, without making the copy.
+void spooky_hash128_fold
+(
+	const void *message,
+	size_t length,
+	uint64_t *hash1,
+	uint64_t *hash2,
+	int flags
+);
+
+uint64_t spooky_hash64_fold
+(
+	const void *message,
+	size_t len,
+	uint64_t seed,
+	int flags
+);
+
+#endif
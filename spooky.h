@@ -27,6 +27,7 @@
 //
 
 #include <stddef.h>
+#include <string.h>
 
 #ifdef _MSC_VER
 # define INLINE __forceinline
@@ -36,7 +37,12 @@
   typedef  unsigned __int8  uint8;
 #else
 # include <stdint.h>
-# define INLINE inline
+# ifdef __GNUC__
+   // as __forceinline, so the fixed length hashes come out straight-line
+#  define INLINE inline __attribute__((always_inline))
+# else
+#  define INLINE inline
+# endif
   typedef  uint64_t  uint64;
   typedef  uint32_t  uint32;
   typedef  uint16_t  uint16;
@@ -82,6 +88,57 @@ public:
         return (uint32)hash1;
     }
 
+    //
+    // Hash128<N>: Hash128 of a message whose length N is known at compile
+    // time.  The choice between the short and the long hash, the block
+    // loops and the handling of the last bytes are all decided by the
+    // compiler, which leaves straight-line code for messages of up to
+    // sc_maxUnroll blocks.  The results are the same as Hash128's.
+    //
+    template <size_t N>
+    static INLINE void Hash128(
+        const void *message,  // message of N bytes
+        uint64 *hash1,        // in/out: in seed 1, out hash value 1
+        uint64 *hash2)        // in/out: in seed 2, out hash value 2
+    {
+        Fixed((const uint8 *)message, *hash1, *hash2,
+              Size<N>(), Flag<(N < sc_bufSize)>());
+    }
+
+    //
+    // Hash128<N, Seed1, Seed2>: the same with seeds that are constants too
+    //
+    template <size_t N, uint64 Seed1, uint64 Seed2>
+    static INLINE void Hash128(
+        const void *message,  // message of N bytes
+        uint64 *hash1,        // out only: first 64 bits of hash value
+        uint64 *hash2)        // out only: second 64 bits of hash value
+    {
+        uint64 a = Seed1, b = Seed2;
+        Fixed((const uint8 *)message, a, b, Size<N>(), Flag<(N < sc_bufSize)>());
+        *hash1 = a;
+        *hash2 = b;
+    }
+
+    //
+    // Hash64<N>, Hash64<N, Seed>: Hash64 of a message of N bytes
+    //
+    template <size_t N>
+    static INLINE uint64 Hash64(const void *message, uint64 seed)
+    {
+        uint64 hash1 = seed;
+        Hash128<N>(message, &hash1, &seed);
+        return hash1;
+    }
+
+    template <size_t N, uint64 Seed>
+    static INLINE uint64 Hash64(const void *message)
+    {
+        uint64 hash1, hash2;
+        Hash128<N, Seed, Seed>(message, &hash1, &hash2);
+        return hash1;
+    }
+
     //
     // Init: initialize the context of a SpookyHash
     //
@@ -289,6 +346,133 @@ private:
     //
     static const uint64 sc_const = 0xdeadbeefdeadbeefLL;
 
+    // most blocks of the long hash that Hash128<N> unrolls
+    static const size_t sc_maxUnroll = 16;
+
+    //
+    // Compile time lengths and conditions as types, so that overloading
+    // picks the code for them.  Plain templates, unlike explicit
+    // specializations, are allowed in class scope before C++17.
+    //
+    template <size_t N> struct Size {};
+    template <bool B> struct Flag {};
+
+    // the first n bytes at p, zero extended; n is a constant after inlining
+    static INLINE uint64 Load(const uint8 *p, size_t n)
+    {
+        uint64 x = 0;
+        memcpy(&x, p, n);
+        return x;
+    }
+
+    static INLINE void ShortBlocks(const uint8 *, Size<0>,
+        uint64 &, uint64 &, uint64 &, uint64 &)
+    {
+    }
+
+    // the complete sets of 32 bytes of Short, K of them
+    template <size_t K>
+    static INLINE void ShortBlocks(const uint8 *p, Size<K>,
+        uint64 &a, uint64 &b, uint64 &c, uint64 &d)
+    {
+        c += Load(p, 8);
+        d += Load(p + 8, 8);
+        ShortMix(a,b,c,d);
+        a += Load(p + 16, 8);
+        b += Load(p + 24, 8);
+        ShortBlocks(p + 32, Size<K-1>(), a, b, c, d);
+    }
+
+    // Short for a message of N bytes
+    template <size_t N>
+    static INLINE void Fixed(const uint8 *p, uint64 &hash1, uint64 &hash2,
+        Size<N>, Flag<true>)
+    {
+        const size_t remainder = N % 16;
+        uint64 a = hash1, b = hash2, c = sc_const, d = sc_const;
+
+        ShortBlocks(p, Size<N/32>(), a, b, c, d);
+        p += (N/32)*32;
+        if (N % 32 >= 16)
+        {
+            c += Load(p, 8);
+            d += Load(p + 8, 8);
+            ShortMix(a,b,c,d);
+            p += 16;
+        }
+        d += ((uint64)N) << 56;
+        if (remainder >= 8)
+        {
+            c += Load(p, 8);
+            d += Load(p + 8, remainder - 8);
+        }
+        else if (remainder > 0)
+        {
+            c += Load(p, remainder);
+        }
+        else
+        {
+            c += sc_const;
+            d += sc_const;
+        }
+        ShortEnd(a,b,c,d);
+        hash1 = a;
+        hash2 = b;
+    }
+
+    static INLINE void MixBlocks(const uint8 *, Size<0>,
+        uint64 &, uint64 &, uint64 &, uint64 &,
+        uint64 &, uint64 &, uint64 &, uint64 &,
+        uint64 &, uint64 &, uint64 &, uint64 &)
+    {
+    }
+
+    // K blocks of the long hash
+    template <size_t K>
+    static INLINE void MixBlocks(const uint8 *p, Size<K>,
+        uint64 &h0, uint64 &h1, uint64 &h2, uint64 &h3,
+        uint64 &h4, uint64 &h5, uint64 &h6, uint64 &h7,
+        uint64 &h8, uint64 &h9, uint64 &h10,uint64 &h11)
+    {
+        uint64 buf[sc_numVars];
+        memcpy(buf, p, sc_blockSize);
+        Mix(buf, h0,h1,h2,h3,h4,h5,h6,h7,h8,h9,h10,h11);
+        MixBlocks(p + sc_blockSize, Size<K-1>(),
+                  h0,h1,h2,h3,h4,h5,h6,h7,h8,h9,h10,h11);
+    }
+
+    // the long hash of Hash128 for a message of N bytes
+    template <size_t N>
+    static INLINE void Fixed(const uint8 *p, uint64 &hash1, uint64 &hash2,
+        Size<N>, Flag<false>)
+    {
+        const size_t blocks = N / sc_blockSize;
+        const size_t remainder = N % sc_blockSize;
+        uint64 h0,h1,h2,h3,h4,h5,h6,h7,h8,h9,h10,h11;
+        uint64 buf[sc_numVars];
+
+        h0=h3=h6=h9  = hash1;
+        h1=h4=h7=h10 = hash2;
+        h2=h5=h8=h11 = sc_const;
+
+        // unrolled when short enough, the same loop as Hash128 otherwise
+        MixBlocks(p, Size<(blocks <= sc_maxUnroll ? blocks : 0)>(),
+                  h0,h1,h2,h3,h4,h5,h6,h7,h8,h9,h10,h11);
+        for (size_t i = 0; blocks > sc_maxUnroll && i < blocks; ++i)
+        {
+            memcpy(buf, p + i*sc_blockSize, sc_blockSize);
+            Mix(buf, h0,h1,h2,h3,h4,h5,h6,h7,h8,h9,h10,h11);
+        }
+
+        // the last partial block
+        memcpy(buf, p + blocks*sc_blockSize, remainder);
+        memset(((uint8 *)buf)+remainder, 0, sc_blockSize-remainder);
+        ((uint8 *)buf)[sc_blockSize-1] = remainder;
+        End(buf, h0,h1,h2,h3,h4,h5,h6,h7,h8,h9,h10,h11);
+        hash1 = h0;
+        hash2 = h1;
+    }
+
     uint64 m_data[2*sc_numVars];   // unhashed data, for partial messages
     uint64 m_state[sc_numVars];  // internal state of the hash
     size_t m_length;             // total length of the input so far
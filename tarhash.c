@@ -0,0 +1,411 @@
+// Per-member hashes of tar archives
+//
+// The header walk is sequential, since the position of a header is only
+// known after the one before it.  It is also cheap: it reads one block
+// per member and never touches the data, so the page cache or the disk
+// only sees the hashing threads, which pull member indexes off a shared
+// counter in the order of decreasing size.
+
+#include <sys/fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "spooky-c.h"
+#include "map.h"
+#include "util.h"
+#include "tarhash.h"
+
+#define BLOCK 512
+
+// fields of a ustar header
+#define NAME		0
+#define SIZE		124
+#define CHKSUM		148
+#define TYPEFLAG	156
+#define MAGIC		257
+#define PREFIX		345
+
+static uint64_t blocks(uint64_t size)
+{
+	return (size + BLOCK - 1) / BLOCK * BLOCK;
+}
+
+// an octal field, or a base-256 one as GNU tar writes for large sizes
+static int parse_number(const unsigned char *p, size_t len, uint64_t *val)
+{
+	uint64_t v = 0;
+	size_t i = 0;
+
+	if (p[0] & 0x80) {
+		v = p[0] & 0x7f;
+		for (i = 1; i < len; i++) {
+			if (v >> 56)
+				return -1;
+			v = (v << 8) | p[i];
+		}
+		*val = v;
+		return 0;
+	}
+	while (i < len && p[i] == ' ')
+		i++;
+	for (; i < len && p[i] >= '0' && p[i] <= '7'; i++) {
+		if (v >> 61)
+			return -1;
+		v = v * 8 + p[i] - '0';
+	}
+	if (i < len && p[i] != ' ' && p[i] != 0)
+		return -1;
+	*val = v;
+	return 0;
+}
+
+static int zero_block(const unsigned char *h)
+{
+	int i;
+
+	for (i = 0; i < BLOCK; i++)
+		if (h[i])
+			return 0;
+	return 1;
+}
+
+// old tars summed signed chars, so accept either sum
+static int check_header(const unsigned char *h)
+{
+	uint64_t want, sum = 0;
+	int64_t ssum = 0;
+	int i;
+
+	if (parse_number(h + CHKSUM, 8, &want) < 0)
+		return -1;
+	for (i = 0; i < BLOCK; i++) {
+		unsigned char c = i >= CHKSUM && i < CHKSUM + 8 ? ' ' : h[i];
+
+		sum += c;
+		ssum += (signed char)c;
+	}
+	return sum == want || (uint64_t)ssum == want ? 0 : -1;
+}
+
+// the name of a ustar header, with its prefix.  Only POSIX "ustar\0"
+// headers have one; old GNU "ustar  " headers keep times at PREFIX
+static char *header_name(const unsigned char *h)
+{
+	const char *name = (const char *)h + NAME;
+	const char *prefix = (const char *)h + PREFIX;
+	size_t nl = strnlen(name, 100), pl;
+	char *s;
+
+	if (memcmp(h + MAGIC, "ustar", 6) != 0 || !prefix[0])
+		return strndup(name, nl);
+	pl = strnlen(prefix, 155);
+	s = malloc(pl + nl + 2);
+	if (!s)
+		return NULL;
+	memcpy(s, prefix, pl);
+	s[pl] = '/';
+	memcpy(s + pl + 1, name, nl);
+	s[pl + nl + 1] = 0;
+	return s;
+}
+
+// the path and size records of a pax extended header
+static int parse_pax(const char *p, uint64_t len, char **path,
+		     uint64_t *size, int *have_size)
+{
+	const char *end = p + len;
+
+	while (p < end && *p) {
+		const char *rec = p, *key, *val, *eol;
+		uint64_t rlen = 0;
+
+		while (p < end && *p >= '0' && *p <= '9')
+			rlen = rlen * 10 + (*p++ - '0');
+		if (p == end || *p != ' ' || rlen > (uint64_t)(end - rec) ||
+		    rlen < 5)
+			return -1;
+		key = p + 1;
+		eol = rec + rlen - 1;
+		if (*eol != '\n')
+			return -1;
+		val = memchr(key, '=', eol - key);
+		if (!val)
+			return -1;
+		val++;
+		if (val - key == 5 && memcmp(key, "path=", 5) == 0) {
+			free(*path);
+			*path = strndup(val, eol - val);
+			if (!*path)
+				return -1;
+		} else if (val - key == 5 && memcmp(key, "size=", 5) == 0) {
+			*size = strtoull(val, NULL, 10);
+			*have_size = 1;
+		}
+		p = rec + rlen;
+	}
+	return 0;
+}
+
+// types whose size field doesn't count any data blocks
+static int no_data(char type)
+{
+	return type >= '1' && type <= '6';
+}
+
+// types of headers that describe the next one rather than a member
+static int meta(char type)
+{
+	return type == 'L' || type == 'K' || type == 'x' || type == 'g';
+}
+
+static int add_member(struct tarhash *t, size_t *max, char *name,
+		      uint64_t offset, uint64_t size, char type)
+{
+	if (t->n == *max) {
+		size_t nmax = *max ? 2 * *max : 64;
+		struct tar_member *m = realloc(t->m, nmax * sizeof(*m));
+
+		if (!m)
+			return -1;
+		t->m = m;
+		*max = nmax;
+	}
+	memset(&t->m[t->n], 0, sizeof(t->m[t->n]));
+	t->m[t->n].name = name;
+	t->m[t->n].offset = offset;
+	t->m[t->n].size = size;
+	t->m[t->n].type = type;
+	t->n++;
+	return 0;
+}
+
+static int parse(struct tarhash *t, const unsigned char *data, size_t size)
+{
+	char *long_name = NULL;
+	uint64_t pax_size = 0, off = 0;
+	int have_size = 0, err = EINVAL;
+	size_t max = 0;
+
+	for (;;) {
+		const unsigned char *h = data + off;
+		uint64_t len, skip;
+		char type, *name;
+
+		// the end marker is two zero blocks, but some writers
+		// stop after one or none
+		if (size - off < BLOCK || zero_block(h))
+			break;
+		if (check_header(h) < 0 || parse_number(h + SIZE, 12, &len) < 0)
+			goto fail;
+		type = h[TYPEFLAG] ? h[TYPEFLAG] : '0';
+		if (have_size && !meta(type))
+			len = pax_size;
+		skip = no_data(type) ? 0 : len;
+		off += BLOCK;
+		if (skip > size - off)
+			goto fail;
+
+		switch (type) {
+		case 'L':
+			free(long_name);
+			long_name = strndup((const char *)data + off, len);
+			if (!long_name)
+				goto nomem;
+			break;
+		case 'x':
+			if (parse_pax((const char *)data + off, len, &long_name,
+				      &pax_size, &have_size) < 0)
+				goto fail;
+			break;
+		case 'g':
+		case 'K':
+			break;
+		default:
+			name = long_name ? long_name : header_name(h);
+			if (!name)
+				goto nomem;
+			long_name = NULL;
+			have_size = 0;
+			if (add_member(t, &max, name, off, skip, type) < 0) {
+				free(name);
+				goto nomem;
+			}
+			break;
+		}
+		off += blocks(skip);
+		if (off > size)
+			off = size;
+	}
+	free(long_name);
+	return 0;
+
+nomem:
+	err = ENOMEM;
+fail:
+	free(long_name);
+	errno = err;
+	return -1;
+}
+
+struct job
+{
+	struct tarhash *t;
+	const unsigned char *data;
+	const size_t *order;
+	size_t *next;
+};
+
+static void *worker(void *arg)
+{
+	struct job *j = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(j->next, 1, __ATOMIC_RELAXED)) <
+	       j->t->n) {
+		struct tar_member *m = &j->t->m[j->order[i]];
+
+		m->hash[0] = j->t->seed;
+		m->hash[1] = j->t->seed;
+		spooky_hash128(j->data + m->offset, m->size, &m->hash[0],
+			       &m->hash[1]);
+	}
+	return NULL;
+}
+
+struct by_size
+{
+	uint64_t size;
+	size_t index;
+};
+
+static int cmp_size(const void *a, const void *b)
+{
+	const struct by_size *x = a, *y = b;
+
+	return (x->size < y->size) - (x->size > y->size);
+}
+
+static void archive_digest(struct tarhash *t)
+{
+	struct spooky_state st;
+	size_t i;
+
+	spooky_init(&st, t->seed, t->seed);
+	for (i = 0; i < t->n; i++) {
+		const struct tar_member *m = &t->m[i];
+		uint64_t rec[4] = { m->size, (unsigned char)m->type,
+				    m->hash[0], m->hash[1] };
+
+		spooky_update(&st, rec, sizeof(rec));
+		spooky_update(&st, m->name, strlen(m->name) + 1);
+	}
+	spooky_final(&st, &t->digest[0], &t->digest[1]);
+}
+
+int tarhash_build(struct tarhash *t, const void *data, size_t size,
+		  uint64_t seed, int nthreads)
+{
+	struct by_size *sorted;
+	size_t *order, next = 0, i;
+
+	memset(t, 0, sizeof(*t));
+	t->seed = seed;
+	if (parse(t, data, size) < 0) {
+		tarhash_free(t);
+		return -1;
+	}
+	sorted = malloc((t->n ? t->n : 1) * sizeof(*sorted));
+	order = malloc((t->n ? t->n : 1) * sizeof(size_t));
+	if (!sorted || !order) {
+		free(sorted);
+		free(order);
+		tarhash_free(t);
+		return -1;
+	}
+	for (i = 0; i < t->n; i++) {
+		sorted[i].size = t->m[i].size;
+		sorted[i].index = i;
+	}
+	qsort(sorted, t->n, sizeof(*sorted), cmp_size);
+	for (i = 0; i < t->n; i++)
+		order[i] = sorted[i].index;
+	free(sorted);
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if ((size_t)nthreads > t->n)
+		nthreads = t->n ? t->n : 1;
+	{
+		struct job job[nthreads];
+
+		for (i = 0; i < (size_t)nthreads; i++) {
+			job[i].t = t;
+			job[i].data = data;
+			job[i].order = order;
+			job[i].next = &next;
+		}
+		run_jobs(job, sizeof(job[0]), nthreads, worker);
+	}
+	free(order);
+	archive_digest(t);
+	return 0;
+}
+
+int tarhash_build_file(struct tarhash *t, char *file, uint64_t seed,
+		       int nthreads)
+{
+	size_t size;
+	char *map = mapfile(file, O_RDONLY, &size);
+	int ret;
+
+	if (!map && errno)
+		return -1;
+	ret = tarhash_build(t, map, size, seed, nthreads);
+	if (map)
+		unmap_file(map, size);
+	return ret;
+}
+
+void tarhash_free(struct tarhash *t)
+{
+	size_t i;
+
+	for (i = 0; i < t->n; i++)
+		free(t->m[i].name);
+	free(t->m);
+	memset(t, 0, sizeof(*t));
+}
+
+static int write_name(const char *s, FILE *f)
+{
+	for (; *s; s++) {
+		if (*s == '\\' && fputs("\\\\", f) < 0)
+			return -1;
+		else if (*s == '\n' && fputs("\\n", f) < 0)
+			return -1;
+		else if (*s != '\\' && *s != '\n' && putc(*s, f) == EOF)
+			return -1;
+	}
+	return putc('\n', f) == EOF ? -1 : 0;
+}
+
+int tarhash_write(const struct tarhash *t, FILE *f)
+{
+	size_t i;
+
+	for (i = 0; i < t->n; i++) {
+		const struct tar_member *m = &t->m[i];
+
+		if (fprintf(f, "%016llx%016llx %llu %c ",
+			    (unsigned long long)m->hash[0],
+			    (unsigned long long)m->hash[1],
+			    (unsigned long long)m->size, m->type) < 0 ||
+		    write_name(m->name, f) < 0)
+			return -1;
+	}
+	if (fprintf(f, "%016llx%016llx archive of %zu members\n",
+		    (unsigned long long)t->digest[0],
+		    (unsigned long long)t->digest[1], t->n) < 0)
+		return -1;
+	return 0;
+}
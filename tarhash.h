@@ -0,0 +1,53 @@
+// Per-member hashes of tar archives
+//
+// Computes the spooky_hash128 of every member of a tar archive without
+// extracting it.  The archive is mapped, its headers are walked in order,
+// which touches one 512 byte block per member, and the data ranges of the
+// members are then hashed in place by several threads.  Members are handed
+// out largest first, so one big member doesn't end up last on a thread
+// that is still busy.  A single member is hashed by one thread, so an
+// archive of one huge file doesn't get faster with more threads.
+//
+// ustar names with a prefix, GNU long names and the path and size
+// records of pax extended headers are understood.  Links, directories
+// and devices are listed with no data.
+//
+// The archive digest is the spooky_hash128 of the names, types, sizes
+// and hashes of all members in archive order, so it changes when any
+// member is renamed, reordered, added or removed, but not with the
+// timestamps or owners in the headers.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+struct tar_member
+{
+	char *name;
+	uint64_t offset;	// of the data in the archive
+	uint64_t size;
+	char type;		// tar typeflag, '0' for regular files
+	uint64_t hash[2];
+};
+
+struct tarhash
+{
+	struct tar_member *m;
+	size_t n;
+	uint64_t seed;
+	uint64_t digest[2];
+};
+
+// hash the members of the archive in data with nthreads threads; -1 with
+// errno EINVAL when it is not a valid tar archive
+int tarhash_build(struct tarhash *t, const void *data, size_t size,
+		  uint64_t seed, int nthreads);
+// the same for a file, which is read through mapfile
+int tarhash_build_file(struct tarhash *t, char *file, uint64_t seed,
+		       int nthreads);
+void tarhash_free(struct tarhash *t);
+
+// Write a line of "hash size type name" per member and a last line with
+// the archive digest.  Backslashes and newlines in names are escaped.
+int tarhash_write(const struct tarhash *t, FILE *f);
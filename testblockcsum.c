@@ -0,0 +1,118 @@
+// Tests and benchmark for the block checksummed format
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "blockcsum.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static void expect(const char *what, size_t nbad, const size_t *bad,
+		   size_t want_n, const size_t *want)
+{
+	size_t i;
+
+	if (nbad != want_n) {
+		printf("%s: %zu bad blocks, expected %zu\n", what, nbad, want_n);
+		failures++;
+		return;
+	}
+	for (i = 0; i < nbad; i++) {
+		if (bad[i] != want[i]) {
+			printf("%s: bad block %zu, expected %zu\n", what, bad[i],
+			       want[i]);
+			failures++;
+		}
+	}
+}
+
+#define NBLOCKS 103
+void TestVerify()
+{
+	uint8_t *blocks = malloc(NBLOCKS * BC_BLOCK);
+	size_t bad[NBLOCKS];
+	size_t want[3] = { 5, 9, 102 };
+	size_t nbad;
+	int i;
+
+	printf("\ntesting block verification ...\n");
+
+	for (i = 0; i < NBLOCKS * BC_BLOCK; i++)
+		blocks[i] = rand();
+	bc_seal(blocks, NBLOCKS, 1000, 42);
+
+	nbad = bc_verify(blocks, NBLOCKS, 1000, 42, bad, NBLOCKS);
+	expect("clean", nbad, bad, 0, want);
+	nbad = bc_verify(blocks, NBLOCKS, 1000, 43, bad, NBLOCKS);
+	if (nbad != NBLOCKS) {
+		printf("wrong file id not detected\n");
+		failures++;
+	}
+
+	// a flipped bit, a misdirected write and a torn checksum
+	blocks[5 * BC_BLOCK + 17] ^= 4;
+	memcpy(blocks + 9 * BC_BLOCK, blocks + 8 * BC_BLOCK, BC_BLOCK);
+	blocks[102 * BC_BLOCK + BC_BLOCK - 1] ^= 1;
+
+	nbad = bc_verify(blocks, NBLOCKS, 1000, 42, bad, NBLOCKS);
+	expect("serial", nbad, bad, 3, want);
+	nbad = bc_verify_parallel(blocks, NBLOCKS, 1000, 42, 3, bad, NBLOCKS);
+	expect("parallel", nbad, bad, 3, want);
+	nbad = bc_verify_parallel(blocks, NBLOCKS, 1000, 42, 4, bad, 2);
+	expect("truncated", nbad > 2 ? 2 : 0, bad, 2, want);
+
+	free(blocks);
+}
+#undef NBLOCKS
+
+#define NBLOCKS (64 * 1024)
+void DoTimingVerify()
+{
+	uint8_t *blocks = malloc((size_t)NBLOCKS * BC_BLOCK);
+	struct timespec ts, tp;
+	uint64_t sum = 0, *p;
+	size_t bad[1];
+	double t;
+	int i;
+
+	printf("\ntesting time to verify %d blocks ...\n", NBLOCKS);
+
+	memset(blocks, 0x5a, (size_t)NBLOCKS * BC_BLOCK);
+	bc_seal(blocks, NBLOCKS, 0, 1);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (p = (uint64_t *)blocks; p < (uint64_t *)(blocks + (size_t)NBLOCKS * BC_BLOCK); p++)
+		sum += *p;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("memory read: %lf GB/s (%lx)\n",
+	       (double)NBLOCKS * BC_BLOCK / t / BILLION, (unsigned long)sum);
+
+	for (i = 1; i <= 4; i *= 2) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		bc_verify_parallel(blocks, NBLOCKS, 0, 1, i, bad, 1);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("verify, %d threads: %lf GB/s\n", i,
+		       (double)NBLOCKS * BC_BLOCK / t / BILLION);
+	}
+	free(blocks);
+}
+#undef NBLOCKS
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestVerify();
+	if (argc > 1)
+		DoTimingVerify();
+
+	return failures != 0;
+}
@@ -0,0 +1,307 @@
+// Tests and benchmark for the content addressed object store
+//
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spooky-c.h"
+#include "cas.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failures++;
+	}
+}
+
+static void remove_dir(const char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *de;
+
+	while (d && (de = readdir(d)) != NULL) {
+		char path[strlen(dir) + strlen(de->d_name) + 2];
+
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		unlink(path);
+	}
+	if (d)
+		closedir(d);
+	rmdir(dir);
+}
+
+static int count_files(const char *dir, const char *suffix)
+{
+	DIR *d = opendir(dir);
+	struct dirent *de;
+	int n = 0;
+
+	while (d && (de = readdir(d)) != NULL) {
+		size_t l = strlen(de->d_name);
+
+		if (l > strlen(suffix) &&
+		    strcmp(de->d_name + l - strlen(suffix), suffix) == 0)
+			n++;
+	}
+	if (d)
+		closedir(d);
+	return n;
+}
+
+// object i: i % 1000 + 1 bytes derived from i, so sizes repeat but
+// contents don't
+static size_t make_object(char *buf, size_t i)
+{
+	size_t n = i % 1000 + 1, k;
+
+	for (k = 0; k < n; k++)
+		buf[k] = (char)(i * 131 + k * 7 + (k >> 3));
+	return n;
+}
+
+static int check_object(const struct cas *c, size_t i, const char *what)
+{
+	char want[1000], got[1000];
+	uint64_t id[2];
+	size_t n = make_object(want, i);
+
+	cas_id(want, n, id);
+	if (cas_size(c, id) != (int64_t)n ||
+	    cas_read(c, id, got, sizeof(got)) != (int64_t)n ||
+	    memcmp(want, got, n) != 0) {
+		printf("%s: object %zu wrong\n", what, i);
+		failures++;
+		return -1;
+	}
+	return 0;
+}
+
+#define NOBJ 5000
+void TestCas()
+{
+	char dir[] = "/tmp/spooky-casXXXXXX";
+	static char data[NOBJ][1000];
+	static const void *ptr[NOBJ];
+	static size_t sizes[NOBJ];
+	static uint64_t ids[NOBJ][2];
+	static int64_t got[NOBJ];
+	struct cas c;
+	uint64_t id[2], id2[2];
+	size_t i;
+	int th;
+
+	printf("\ntesting content addressed store ...\n");
+
+	mkdtemp(dir);
+	expect("open failed", cas_open(&c, dir, 1 << 20) == 0);
+	expect("new object not stored", cas_put(&c, "hello", 5, id) == 1);
+	expect("same object stored twice", cas_put(&c, "hello", 5, id2) == 0);
+	expect("ids differ", id[0] == id2[0] && id[1] == id2[1]);
+	expect("empty object not stored", cas_put(&c, "", 0, id2) == 1);
+	expect("empty object lost", cas_size(&c, id2) == 0);
+	id2[0] ^= 1;
+	expect("unknown object found", cas_size(&c, id2) == -1);
+
+	// objects are readable before and after their pack is sealed
+	for (i = 0; i < 1000; i++)
+		cas_put(&c, data[0], make_object(data[0], i), id);
+	for (i = 0; i < 1000; i += 7)
+		check_object(&c, i, "open pack");
+	expect("flush failed", cas_flush(&c) == 0);
+	for (i = 0; i < 1000; i += 7)
+		check_object(&c, i, "sealed pack");
+	expect("close failed", cas_close(&c) == 0);
+
+	// reopened, everything is still there and is not stored again
+	expect("reopen failed", cas_open(&c, dir, 1 << 20) == 0);
+	for (i = 0; i < 1000; i++)
+		if (check_object(&c, i, "reopened"))
+			break;
+	for (i = 0; i < 1000; i += 3) {
+		if (cas_put(&c, data[0], make_object(data[0], i), id) != 0) {
+			printf("object %zu stored again\n", i);
+			failures++;
+			break;
+		}
+	}
+	expect("reopened store not filtered", c.nfiltered == 0);
+
+	// batches on several threads, with duplicates within and across them
+	for (i = 0; i < NOBJ; i++) {
+		sizes[i] = make_object(data[i], i % 3000);
+		ptr[i] = data[i];
+	}
+	for (th = 1; th <= 4; th++) {
+		ssize_t added = cas_put_batch(&c, ptr, sizes, NOBJ, ids, th);
+
+		expect("wrong number of new objects",
+		       added == (th == 1 ? 2000 : 0));
+		for (i = 0; i < NOBJ; i++) {
+			cas_id(data[i], sizes[i], id);
+			if (id[0] != ids[i][0] || id[1] != ids[i][1]) {
+				printf("batch id %zu wrong\n", i);
+				failures++;
+				break;
+			}
+		}
+	}
+	cas_size_batch(&c, (const uint64_t (*)[2])ids, NOBJ, got, 3);
+	for (i = 0; i < NOBJ; i++) {
+		if (got[i] != (int64_t)sizes[i]) {
+			printf("batch size %zu wrong\n", i);
+			failures++;
+			break;
+		}
+	}
+	for (i = 0; i < 3000; i += 11)
+		check_object(&c, i, "batch");
+	cas_close(&c);
+
+	// small packs: many of them, all searched
+	remove_dir(dir);
+	mkdtemp(strcpy(dir, "/tmp/spooky-casXXXXXX"));
+	cas_open(&c, dir, 10000);
+	for (i = 0; i < NOBJ; i++)
+		cas_put(&c, data[0], make_object(data[0], i), id);
+	expect("filter did not help", c.nfiltered > NOBJ * 9 / 10);
+	cas_close(&c);
+	expect("too few packs", count_files(dir, ".idx") > 100);
+	cas_open(&c, dir, 10000);
+	for (i = 0; i < NOBJ; i++)
+		if (check_object(&c, i, "small packs"))
+			break;
+
+	// an unfinished pack disappears on open
+	for (i = NOBJ; i < NOBJ + 3; i++)
+		cas_put(&c, data[0], make_object(data[0], i), id);
+	{
+		char cmd[64];
+
+		snprintf(cmd, sizeof(cmd), "%s/pack-999999.pack", dir);
+		fclose(fopen(cmd, "w"));
+	}
+	c.fd = -1;		// as if the process died
+	cas_close(&c);
+	expect("leftover pack not found", count_files(dir, ".pack") ==
+	       count_files(dir, ".idx") + 2);
+	cas_open(&c, dir, 10000);
+	expect("leftover pack not removed", count_files(dir, ".pack") ==
+	       count_files(dir, ".idx"));
+	cas_id(data[0], make_object(data[0], NOBJ), id);
+	expect("unsealed object visible", cas_size(&c, id) == -1);
+	check_object(&c, NOBJ - 1, "after recovery");
+	cas_close(&c);
+	remove_dir(dir);
+
+	// a seal that fails keeps the open pack's objects findable
+	mkdtemp(strcpy(dir, "/tmp/spooky-casXXXXXX"));
+	cas_open(&c, dir, 1 << 20);
+	for (i = 0; i < 200; i++)
+		cas_put(&c, data[0], make_object(data[0], i), id);
+	{
+		char tmp[64];
+
+		snprintf(tmp, sizeof(tmp), "%s/pack-000000.idx.tmp", dir);
+		mkdir(tmp, 0755);
+		expect("seal did not fail", cas_flush(&c) < 0);
+		for (i = 0; i < 200; i++)
+			if (check_object(&c, i, "failed seal"))
+				break;
+		for (i = 0; i < 200; i++) {
+			if (cas_put(&c, data[0], make_object(data[0], i), id) != 0) {
+				printf("object %zu stored again after a failed seal\n", i);
+				failures++;
+				break;
+			}
+		}
+		rmdir(tmp);
+	}
+	expect("flush after a failed seal failed", cas_flush(&c) == 0);
+	for (i = 0; i < 200; i++)
+		if (check_object(&c, i, "sealed after failure"))
+			break;
+	cas_close(&c);
+	remove_dir(dir);
+}
+
+#define NBENCH 200000
+void DoTimingCas()
+{
+	char dir[] = "/tmp/spooky-casXXXXXX";
+	char *data = malloc((size_t)NBENCH * 256);
+	const void **ptr = malloc(NBENCH * sizeof(void *));
+	size_t *sizes = malloc(NBENCH * sizeof(size_t));
+	uint64_t (*ids)[2] = malloc(NBENCH * sizeof(*ids));
+	int64_t *got = malloc(NBENCH * sizeof(int64_t));
+	struct timespec ts, tp;
+	struct cas c;
+	double t;
+	size_t i;
+	int th;
+
+	printf("\ntesting time to store %d objects of up to 256 bytes ...\n",
+	       NBENCH);
+	for (i = 0; i < (size_t)NBENCH * 256; i++)
+		data[i] = rand();
+	for (i = 0; i < NBENCH; i++) {
+		ptr[i] = data + i * 256;
+		sizes[i] = 1 + rand() % 256;
+	}
+
+	for (th = 1; th <= 4; th *= 2) {
+		mkdtemp(strcpy(dir, "/tmp/spooky-casXXXXXX"));
+		cas_open(&c, dir, 64 << 20);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		cas_put_batch(&c, ptr, sizes, NBENCH, ids, th);
+		cas_flush(&c);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("insert, %d threads: %.0lf ns per object, %.0lf%% decided by the filter\n",
+		       th, t * BILLION / NBENCH, 100.0 * c.nfiltered / NBENCH);
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		cas_put_batch(&c, ptr, sizes, NBENCH, ids, th);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("insert again, %d threads: %.0lf ns per object\n", th,
+		       t * BILLION / NBENCH);
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		cas_size_batch(&c, (const uint64_t (*)[2])ids, NBENCH, got, th);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("lookup, %d threads: %.0lf ns per object\n", th,
+		       t * BILLION / NBENCH);
+		cas_close(&c);
+		remove_dir(dir);
+	}
+	free(data);
+	free(ptr);
+	free(sizes);
+	free(ids);
+	free(got);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestCas();
+	if (argc > 1)
+		DoTimingCas();
+
+	return failures != 0;
+}
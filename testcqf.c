@@ -0,0 +1,291 @@
+// Tests and benchmark for the counting quotient filter
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "spooky-c.h"
+#include "cqf.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static double elapsed(struct timespec *ts, struct timespec *tp)
+{
+	return (tp->tv_sec - ts->tv_sec) + (tp->tv_nsec - ts->tv_nsec) / BILLION;
+}
+
+// key i is inserted (i % 7) + 1 times, with a skew towards a few heavy keys
+static uint64_t true_count(uint64_t i)
+{
+	return (i % 97 == 0) ? 100000 + i : (i % 7) + 1;
+}
+
+#define NKEYS 50000
+void TestCounts()
+{
+	struct cqf qf;
+	uint64_t i;
+
+	printf("\ntesting counts ...\n");
+
+	cqf_init(&qf, 17, 20, 1);
+	for (i = 0; i < NKEYS; i++) {
+		uint64_t c = true_count(i);
+
+		// split the count to exercise growing counters
+		if (cqf_insert(&qf, &i, sizeof(i), c / 2) < 0 ||
+		    cqf_insert(&qf, &i, sizeof(i), c - c / 2) < 0) {
+			printf("insert failed at %"PRIu64"\n", i);
+			failures++;
+			break;
+		}
+	}
+	for (i = 0; i < NKEYS; i++) {
+		uint64_t c = cqf_count(&qf, &i, sizeof(i));
+		if (c < true_count(i)) {
+			printf("undercount %"PRIu64": %"PRIu64" < %"PRIu64"\n",
+			       i, c, true_count(i));
+			failures++;
+		}
+	}
+	for (i = NKEYS; i < 2 * NKEYS; i++) {
+		if (cqf_count(&qf, &i, sizeof(i)) > 0) {
+			printf("false positive %"PRIu64"\n", i);
+			failures++;
+		}
+	}
+	if (qf.h->ndistinct != NKEYS) {
+		printf("distinct %"PRIu64", expected %d\n", qf.h->ndistinct, NKEYS);
+		failures++;
+	}
+	cqf_free(&qf);
+}
+
+// inserts into a filter that is full fail without changing any count
+#define NFP 1024
+void TestFull()
+{
+	static const uint64_t counts[] = { 1, 3, 20, 300, 5000 };
+	static uint64_t want[NFP];
+	struct cqf qf;
+	uint64_t fp, nelts = 0, ndistinct = 0;
+	int fails = 0;
+
+	printf("\ntesting a full filter ...\n");
+
+	// 10 bit fingerprints, so counts are exact
+	cqf_init(&qf, 6, 4, 1);
+	srand(1);
+	while (fails < 500) {
+		uint64_t c = counts[rand() % 5];
+
+		fp = rand() % NFP;
+		if (cqf_insert_fp(&qf, fp, c) < 0) {
+			fails++;
+			continue;
+		}
+		ndistinct += want[fp] == 0;
+		want[fp] += c;
+		nelts += c;
+	}
+	for (fp = 0; fp < NFP; fp++) {
+		if (cqf_count_fp(&qf, fp) != want[fp]) {
+			printf("full filter: %"PRIu64" counted %"PRIu64", want %"PRIu64"\n",
+			       fp, cqf_count_fp(&qf, fp), want[fp]);
+			failures++;
+			break;
+		}
+	}
+	if (qf.h->nelts != nelts || qf.h->ndistinct != ndistinct) {
+		printf("full filter: totals changed by failed inserts\n");
+		failures++;
+	}
+	cqf_free(&qf);
+}
+#undef NFP
+
+void TestResizeMerge()
+{
+	struct cqf a, b, big, m;
+	uint64_t i;
+
+	printf("\ntesting resize and merge ...\n");
+
+	cqf_init(&a, 13, 24, 2);
+	cqf_init(&b, 13, 24, 2);
+	for (i = 0; i < 3000; i++) {
+		if (cqf_insert(&a, &i, sizeof(i), true_count(i)) < 0 ||
+		    cqf_insert(&b, &i, sizeof(i), 1) < 0) {
+			printf("insert failed at %"PRIu64"\n", i);
+			failures++;
+			break;
+		}
+	}
+	if (cqf_resize(&big, &a) < 0) {
+		printf("resize failed\n");
+		failures++;
+		return;
+	}
+	cqf_init(&m, 14, 23, 2);
+	if (cqf_merge(&m, &big, &b) < 0) {
+		printf("merge failed\n");
+		failures++;
+	}
+	for (i = 0; i < 3000; i++) {
+		if (cqf_count(&big, &i, sizeof(i)) != true_count(i) ||
+		    cqf_count(&m, &i, sizeof(i)) != true_count(i) + 1) {
+			printf("wrong count after resize/merge %"PRIu64"\n", i);
+			failures++;
+		}
+	}
+	cqf_free(&a);
+	cqf_free(&b);
+	cqf_free(&big);
+	cqf_free(&m);
+}
+
+void TestBatchFile()
+{
+	char file[] = "/tmp/testcqfXXXXXX";
+	uint64_t fps[4096];
+	struct cqf qf;
+	uint64_t i;
+	int fd;
+
+	printf("\ntesting batch insert and file mapping ...\n");
+
+	fd = mkstemp(file);
+	if (fd < 0) {
+		perror("mkstemp");
+		failures++;
+		return;
+	}
+	close(fd);
+	if (cqf_create_file(&qf, file, 12, 30, 3) < 0) {
+		perror(file);
+		failures++;
+		return;
+	}
+	for (i = 0; i < 4096; i++) {
+		uint64_t k = i % 1024;
+		fps[i] = cqf_fingerprint(&qf, &k, sizeof(k));
+	}
+	if (cqf_insert_batch(&qf, fps, 4096) < 0) {
+		printf("batch insert failed\n");
+		failures++;
+	}
+	cqf_free(&qf);
+
+	if (cqf_open_file(&qf, file) < 0) {
+		printf("reopen failed\n");
+		failures++;
+	} else {
+		for (i = 0; i < 1024; i++) {
+			if (cqf_count(&qf, &i, sizeof(i)) != 4) {
+				printf("wrong count after reopen %"PRIu64"\n", i);
+				failures++;
+			}
+		}
+		cqf_free(&qf);
+	}
+	unlink(file);
+}
+
+// Count-Min sketch baseline with the same hash
+struct cms
+{
+	unsigned depth;
+	uint64_t width;
+	uint32_t *c;
+};
+
+static void cms_add(struct cms *s, const void *key, size_t len, uint32_t n)
+{
+	uint64_t h1 = 0, h2 = 0;
+	unsigned d;
+
+	spooky_hash128(key, len, &h1, &h2);
+	for (d = 0; d < s->depth; d++)
+		s->c[d * s->width + (h1 + d * h2) % s->width] += n;
+}
+
+static uint64_t cms_count(struct cms *s, const void *key, size_t len)
+{
+	uint64_t h1 = 0, h2 = 0, min = ~0ULL;
+	unsigned d;
+
+	spooky_hash128(key, len, &h1, &h2);
+	for (d = 0; d < s->depth; d++) {
+		uint64_t v = s->c[d * s->width + (h1 + d * h2) % s->width];
+		if (v < min)
+			min = v;
+	}
+	return min;
+}
+
+#define NBENCH (1 << 20)
+void DoTimingCMS()
+{
+	struct timespec ts, tp;
+	struct cqf qf;
+	struct cms cms;
+	uint64_t i, err_qf = 0, err_cms = 0;
+
+	printf("\ncomparing with Count-Min for %d keys ...\n", NBENCH);
+
+	cqf_init(&qf, 22, 10, 4);
+	cms.depth = 4;
+	cms.width = qf.size / (cms.depth * sizeof(uint32_t));
+	cms.c = calloc(cms.depth * cms.width, sizeof(uint32_t));
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < NBENCH; i++)
+		cqf_insert(&qf, &i, sizeof(i), true_count(i));
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	printf("cqf insert:       %lf seconds\n", elapsed(&ts, &tp));
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < NBENCH; i++)
+		cms_add(&cms, &i, sizeof(i), true_count(i));
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	printf("count-min insert: %lf seconds\n", elapsed(&ts, &tp));
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < NBENCH; i++)
+		err_qf += cqf_count(&qf, &i, sizeof(i)) - true_count(i);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	printf("cqf query:        %lf seconds\n", elapsed(&ts, &tp));
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < NBENCH; i++)
+		err_cms += cms_count(&cms, &i, sizeof(i)) - true_count(i);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	printf("count-min query:  %lf seconds\n", elapsed(&ts, &tp));
+
+	printf("%zu bytes each, overcount per key cqf %f count-min %f\n",
+	       qf.size, (double)err_qf / NBENCH, (double)err_cms / NBENCH);
+
+	free(cms.c);
+	cqf_free(&qf);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestCounts();
+	TestFull();
+	TestResizeMerge();
+	TestBatchFile();
+	if (argc > 1)
+		DoTimingCMS();
+
+	return failures != 0;
+}
@@ -0,0 +1,192 @@
+// Tests and benchmark for rsync style delta encoding
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "delta.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+// a copy of old with some bytes replaced, inserted and deleted
+static uint8_t *modify(const uint8_t *old, uint64_t size, uint64_t *newsize,
+		       int nedits)
+{
+	uint8_t *new = malloc(size + nedits * 100);
+	uint64_t o = 0, n = 0;
+	int i, k;
+
+	for (i = 0; i < nedits; i++) {
+		uint64_t next = (size / nedits) * (i + 1) - rand() % 50;
+
+		memcpy(new + n, old + o, next - o);
+		n += next - o;
+		o = next;
+		switch (i % 3) {
+		case 0:		// overwrite
+			for (k = 0; k < 10 && o < size; k++, o++)
+				new[n++] = old[o] ^ 0x55;
+			break;
+		case 1:		// insert
+			for (k = 0; k < 37; k++)
+				new[n++] = rand();
+			break;
+		case 2:		// delete
+			o += 23;
+			break;
+		}
+	}
+	if (o < size) {
+		memcpy(new + n, old + o, size - o);
+		n += size - o;
+	}
+	*newsize = n;
+	return new;
+}
+
+static void roundtrip(const char *what, const uint8_t *old, uint64_t oldsize,
+		      const uint8_t *new, uint64_t newsize, uint32_t bs,
+		      uint64_t maxdelta)
+{
+	struct delta_sig s;
+	struct delta_buf d = { 0 };
+	uint8_t *out;
+
+	if (delta_signature(&s, old, oldsize, bs, 42) < 0 ||
+	    delta_compute(&s, new, newsize, &d) < 0) {
+		printf("%s: delta failed\n", what);
+		failures++;
+		return;
+	}
+	if (delta_new_size(d.p, d.len) != (int64_t)newsize) {
+		printf("%s: wrong new size\n", what);
+		failures++;
+	}
+	out = malloc(newsize + 1);
+	if (delta_apply(old, oldsize, bs, d.p, d.len, out) < 0 ||
+	    memcmp(out, new, newsize)) {
+		printf("%s: patched copy differs\n", what);
+		failures++;
+	}
+	if (maxdelta && d.len > maxdelta) {
+		printf("%s: delta is %zu bytes, expected at most %lu\n", what,
+		       d.len, (unsigned long)maxdelta);
+		failures++;
+	}
+
+	// a damaged delta must not produce a wrong copy
+	if (d.len > 20) {
+		d.p[d.len / 2] ^= 1;
+		if (delta_apply(old, oldsize, bs, d.p, d.len, out) == 0 &&
+		    memcmp(out, new, newsize)) {
+			printf("%s: damaged delta accepted\n", what);
+			failures++;
+		}
+	}
+	free(out);
+	delta_buf_free(&d);
+	delta_sig_free(&s);
+}
+
+#define SIZE (1 << 20)
+void TestDelta()
+{
+	uint8_t *old = malloc(SIZE), *new;
+	uint64_t newsize;
+	int i;
+
+	printf("\ntesting delta encoding ...\n");
+
+	for (i = 0; i < SIZE; i++)
+		old[i] = rand();
+
+	roundtrip("identical", old, SIZE, old, SIZE, 700, 800);
+	roundtrip("empty old", old, 0, old, 5000, 512, 0);
+	roundtrip("empty new", old, SIZE, old, 0, 512, 100);
+	roundtrip("short", old, 100, old + 1, 99, 512, 0);
+	roundtrip("shifted", old, SIZE, old + 1, SIZE - 1, 1024, 2048 + 100);
+	new = modify(old, SIZE, &newsize, 40);
+	// every edit costs at most two blocks of literals
+	roundtrip("edited", old, SIZE, new, newsize, 1024, 40 * 2 * 1024);
+	roundtrip("small blocks", old, SIZE, new, newsize, 64, 40 * 2 * 64 + 8192);
+	free(new);
+
+	// repetitive data with many weak and strong collisions
+	memset(old, 'a', SIZE);
+	new = modify(old, SIZE, &newsize, 10);
+	roundtrip("repetitive", old, SIZE, new, newsize, 256, 0);
+	free(new);
+	free(old);
+}
+
+#define NBENCH (256UL << 20)
+void DoTimingDelta()
+{
+	struct timespec ts, tp;
+	uint8_t *old = malloc(NBENCH), *new, *out;
+	uint64_t i, newsize;
+	struct delta_sig s;
+	struct delta_buf d = { 0 };
+	double t;
+
+	for (i = 0; i < NBENCH; i++)
+		old[i] = rand();
+	new = modify(old, NBENCH, &newsize, 1000);
+	printf("\ntesting time for %lu MB with 1000 edits, 2KB blocks ...\n",
+	       NBENCH >> 20);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	delta_signature(&s, old, NBENCH, 2048, 0);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("signature: %.2lf GB/s\n", NBENCH / t / BILLION);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	delta_compute(&s, new, newsize, &d);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("scan: %.2lf GB/s, delta %zu bytes\n", newsize / t / BILLION,
+	       d.len);
+
+	out = malloc(newsize);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (delta_apply(old, NBENCH, 2048, d.p, d.len, out) < 0) {
+		printf("benchmark patch failed\n");
+		failures++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("apply: %.2lf GB/s\n", newsize / t / BILLION);
+
+	// worst case for the scan: nothing matches
+	for (i = 0; i < newsize; i++)
+		new[i] = rand();
+	d.len = 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	delta_compute(&s, new, newsize, &d);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("scan without matches: %.2lf GB/s\n", newsize / t / BILLION);
+
+	delta_buf_free(&d);
+	delta_sig_free(&s);
+	free(out);
+	free(new);
+	free(old);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestDelta();
+	if (argc > 1)
+		DoTimingDelta();
+
+	return failures != 0;
+}
@@ -0,0 +1,287 @@
+// Tests and benchmark for key-affinity dispatch
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "spooky-c.h"
+#include "dispatch.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+#define NKEYS 1000
+void TestRouting()
+{
+	struct dispatch d;
+	struct dp_task t;
+	uint64_t k, a = 1, b = 2, c;
+	int w, w1, w2, first[NKEYS], i;
+
+	printf("\ntesting key-affinity dispatch ...\n");
+
+	dispatch_init(&d, 8, 4096, 1 << 16, 0, 0);
+	for (k = 0; k < NKEYS; k++) {
+		dispatch_candidates(&d, &k, sizeof(k), &w1, &w2);
+		first[k] = dispatch_submit(&d, &k, sizeof(k), NULL);
+		if (w1 == w2 || (first[k] != w1 && first[k] != w2)) {
+			printf("key %lu not on a candidate\n", (unsigned long)k);
+			failures++;
+			break;
+		}
+	}
+	// in flight, then idle: both stick
+	for (i = 0; i < 2; i++) {
+		for (k = 0; k < NKEYS; k++) {
+			if (dispatch_submit(&d, &k, sizeof(k), NULL) != first[k]) {
+				printf("key %lu moved\n", (unsigned long)k);
+				failures++;
+				break;
+			}
+		}
+		for (w = 0; w < 8; w++)
+			while (dispatch_next(&d, w, &t))
+				dispatch_done(&d, &t);
+		for (w = 0; w < 8; w++)
+			if (dispatch_load(&d, w) != 0) {
+				printf("load not back to zero\n");
+				failures++;
+			}
+	}
+	dispatch_free(&d);
+
+	// one slot: a busy slot sends other keys to their first candidate
+	dispatch_init(&d, 8, 4, 1, 0, 0);
+	dispatch_submit(&d, &a, sizeof(a), NULL);
+	dispatch_candidates(&d, &b, sizeof(b), &w1, &w2);
+	if (dispatch_submit(&d, &b, sizeof(b), NULL) != w1 ||
+	    d.nfallback != 1) {
+		printf("fallback not on the first candidate\n");
+		failures++;
+	}
+	dispatch_candidates(&d, &a, sizeof(a), &w1, &w2);
+	w = dispatch_submit(&d, &a, sizeof(a), NULL);
+	while (dispatch_next(&d, w, &t))
+		dispatch_done(&d, &t);
+	// a is idle now, but b is still in flight on its first candidate
+	for (c = 3; c < 100; c++) {
+		dispatch_candidates(&d, &c, sizeof(c), &w1, &w2);
+		if (w1 != w)
+			break;
+	}
+	if (dispatch_submit(&d, &c, sizeof(c), NULL) != w1) {
+		printf("new key placed while a fallback is in flight\n");
+		failures++;
+	}
+
+	// full queue
+	for (i = 0; i < 10; i++)
+		w = dispatch_submit(&d, &c, sizeof(c), NULL);
+	if (w != -1 || errno != EAGAIN || dispatch_load(&d, w1) != 4) {
+		printf("full queue not reported\n");
+		failures++;
+	}
+	dispatch_free(&d);
+}
+
+#define NPROD 2
+#define NWORK 3
+#define NTASK 200000
+static struct dispatch md;
+static uint64_t last[NPROD][NKEYS];
+static volatile int producers_left;
+
+static void *producer(void *arg)
+{
+	uint64_t p = (uintptr_t)arg, seq[NKEYS] = { 0 }, i;
+
+	for (i = 0; i < NTASK; i++) {
+		uint64_t k = spooky_hash64(&i, sizeof(i), p) % 97;
+		// key, producer and sequence number
+		uintptr_t v = (k << 40) | (p << 32) | ++seq[k];
+
+		while (dispatch_submit(&md, &k, sizeof(k), (void *)v) < 0)
+			sched_yield();
+	}
+	__atomic_fetch_sub(&producers_left, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void *worker(void *arg)
+{
+	int w = (uintptr_t)arg;
+	struct dp_task t;
+
+	for (;;) {
+		int done = __atomic_load_n(&producers_left, __ATOMIC_ACQUIRE) == 0;
+		uintptr_t v;
+		uint64_t k, p, seq;
+
+		if (!dispatch_next(&md, w, &t)) {
+			if (done)
+				break;
+			sched_yield();
+			continue;
+		}
+		v = (uintptr_t)t.arg;
+		k = v >> 40;
+		p = (v >> 32) & 0xff;
+		seq = v & 0xffffffff;
+
+		if (__atomic_load_n(&last[p][k], __ATOMIC_RELAXED) + 1 != seq) {
+			printf("key %lu out of order\n", (unsigned long)k);
+			__atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&last[p][k], seq, __ATOMIC_RELAXED);
+		dispatch_done(&md, &t);
+	}
+	return NULL;
+}
+
+void TestThreads()
+{
+	pthread_t p[NPROD], w[NWORK];
+	uint64_t total = 0, k;
+	int i;
+
+	printf("\ntesting dispatch with threads ...\n");
+
+	// small queues and table to exercise full queues and fallbacks
+	dispatch_init(&md, NWORK, 64, 32, 0, 0);
+	producers_left = NPROD;
+	for (i = 0; i < NWORK; i++)
+		pthread_create(&w[i], NULL, worker, (void *)(uintptr_t)i);
+	for (i = 0; i < NPROD; i++)
+		pthread_create(&p[i], NULL, producer, (void *)(uintptr_t)i);
+	for (i = 0; i < NPROD; i++)
+		pthread_join(p[i], NULL);
+	for (i = 0; i < NWORK; i++)
+		pthread_join(w[i], NULL);
+	for (i = 0; i < NPROD; i++)
+		for (k = 0; k < NKEYS; k++)
+			total += last[i][k];
+	if (total != NPROD * NTASK) {
+		printf("%lu tasks handled\n", (unsigned long)total);
+		failures++;
+	}
+	dispatch_free(&md);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+// Simulate workers that each finish one task per tick, with Zipf
+// distributed keys arriving at the given utilization, and report the
+// latency percentiles in ticks.
+#define SIMWORKERS 8
+#define SIMKEYS 100000
+#define TICKS 20000
+static void simulate(const char *name, int flags, const double *cdf,
+		     double util)
+{
+	uint64_t *lat = malloc(SIMWORKERS * TICKS * 2 * sizeof(uint64_t));
+	uint64_t n = 0, tick, maxq = 0;
+	double arrivals = 0;
+	struct dispatch d;
+	struct dp_task t;
+	int w;
+
+	dispatch_init(&d, SIMWORKERS, 1 << 20, 1 << 16, 0, flags);
+	srand(1);
+	for (tick = 0; tick < TICKS; tick++) {
+		for (arrivals += util * SIMWORKERS; arrivals >= 1; arrivals--) {
+			double u = rand() / (RAND_MAX + 1.0);
+			uint64_t lo = 0, hi = SIMKEYS - 1, h1 = 0, h2 = 0;
+
+			while (lo < hi) {
+				uint64_t mid = (lo + hi) / 2;
+
+				if (cdf[mid] < u)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			spooky_hash128(&lo, sizeof(lo), &h1, &h2);
+			dispatch_submit_hash(&d, h1, h2, (void *)(uintptr_t)tick);
+		}
+		for (w = 0; w < SIMWORKERS; w++) {
+			if (dispatch_load(&d, w) > maxq)
+				maxq = dispatch_load(&d, w);
+			if (dispatch_next(&d, w, &t)) {
+				lat[n++] = tick - (uintptr_t)t.arg;
+				dispatch_done(&d, &t);
+			}
+		}
+	}
+	qsort(lat, n, sizeof(uint64_t), cmp_u64);
+	printf("%-12s p50 %5lu  p99 %5lu  p99.9 %5lu ticks, longest queue %lu\n",
+	       name, (unsigned long)lat[n / 2], (unsigned long)lat[n * 99 / 100],
+	       (unsigned long)lat[n * 999 / 1000], (unsigned long)maxq);
+	dispatch_free(&d);
+	free(lat);
+}
+
+#define NBENCH 10000000
+void DoTimingDispatch()
+{
+	double *cdf = malloc(SIMKEYS * sizeof(double)), sum = 0;
+	struct timespec ts, tp;
+	struct dispatch d;
+	struct dp_task t;
+	uint64_t i;
+	double s;
+	int k;
+
+	for (k = 0; k < SIMKEYS; k++)
+		sum += 1.0 / (k + 1);
+	for (k = 0, s = 0; k < SIMKEYS; k++) {
+		s += 1.0 / (k + 1) / sum;
+		cdf[k] = s;
+	}
+	cdf[SIMKEYS - 1] = 1;
+
+	printf("\nsimulated latency, %d workers, Zipf distributed keys out of %d ...\n",
+	       SIMWORKERS, SIMKEYS);
+	simulate("modulo", DP_MODULO, cdf, 0.85);
+	simulate("two choices", 0, cdf, 0.85);
+	simulate("modulo", DP_MODULO, cdf, 0.7);
+	simulate("two choices", 0, cdf, 0.7);
+
+	printf("\ntesting time for %d dispatches ...\n", NBENCH);
+	dispatch_init(&d, 8, 1024, 1 << 16, 0, 0);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < NBENCH; i++) {
+		int w = dispatch_submit(&d, &i, sizeof(i), NULL);
+
+		dispatch_next(&d, w, &t);
+		dispatch_done(&d, &t);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	s = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("submit, next and done: %.1lf ns\n", s * BILLION / NBENCH);
+	dispatch_free(&d);
+	free(cdf);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestRouting();
+	TestThreads();
+	if (argc > 1)
+		DoTimingDispatch();
+
+	return failures != 0;
+}
@@ -0,0 +1,119 @@
+// Tests and benchmark for exact distinct counting
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "distinct.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static int count_cb(uint64_t h1, uint64_t h2, void *arg)
+{
+	(void)h1;
+	(void)h2;
+	(*(uint64_t *)arg)++;
+	return 0;
+}
+
+// ndistinct keys, each added several times in a scattered order
+static void run(size_t budget, int nthreads, uint64_t ndistinct)
+{
+	struct distinct d;
+	uint64_t i, count = 0, seen = 0;
+
+	distinct_init(&d, budget, "/tmp", nthreads, 0);
+	for (i = 0; i < 4 * ndistinct; i++) {
+		uint64_t key = (i * 7919) % ndistinct;
+		if (distinct_add(&d, &key, sizeof(key)) < 0) {
+			perror("distinct_add");
+			failures++;
+			break;
+		}
+	}
+	if (distinct_count(&d, &count, count_cb, &seen) < 0) {
+		perror("distinct_count");
+		failures++;
+	}
+	if (count != ndistinct || seen != ndistinct) {
+		printf("budget %zu threads %d: counted %"PRIu64" walked %"PRIu64
+		       ", expected %"PRIu64"\n",
+		       budget, nthreads, count, seen, ndistinct);
+		failures++;
+	}
+	distinct_free(&d);
+}
+
+// fingerprints that differ only in h2 all go into one partition, which
+// is split past the digits of h1 into those of h2
+static void run_h2(size_t n)
+{
+	struct distinct d;
+	uint64_t i, count = 0, seen = 0;
+	int err = 0;
+
+	distinct_init(&d, DISTINCT_MINBUDGET, "/tmp", 1, 0);
+	for (i = 0; i < 2 * n && !err; i++)
+		err = distinct_add_fp(&d, 7, (i % n) << 48 | i % n) < 0;
+	if (err || distinct_count(&d, &count, count_cb, &seen) < 0) {
+		perror("distinct h2");
+		failures++;
+	}
+	if (count != n || seen != n) {
+		printf("same h1: counted %"PRIu64" walked %"PRIu64
+		       ", expected %zu\n", count, seen, n);
+		failures++;
+	}
+	distinct_free(&d);
+}
+
+void TestDistinct()
+{
+	printf("\ntesting distinct counts ...\n");
+
+	run(64 << 20, 1, 100000);	// fits in memory
+	run(256 << 10, 2, 100000);	// spills
+	run(2 << 10, 4, 300);		// raised to the minimum
+	run_h2(6000);			// spills and splits partitions
+}
+
+#define NBENCH 20000000
+void DoTimingDistinct()
+{
+	struct timespec ts, tp;
+	struct distinct d;
+	uint64_t i, count;
+	double t;
+
+	printf("\ntesting time for %d keys, 1/4 distinct, 32MB budget ...\n",
+	       NBENCH);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	distinct_init(&d, 32 << 20, "/tmp", 4, 0);
+	for (i = 0; i < NBENCH; i++) {
+		uint64_t key = i % (NBENCH / 4);
+		distinct_add(&d, &key, sizeof(key));
+	}
+	distinct_count(&d, &count, NULL, NULL);
+	distinct_free(&d);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("%"PRIu64" distinct, time is %lf seconds\n", count, t);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestDistinct();
+	if (argc > 1)
+		DoTimingDistinct();
+
+	return failures != 0;
+}
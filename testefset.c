@@ -0,0 +1,251 @@
+// Tests and benchmark for Elias-Fano fingerprint sets
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "efset.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+// number of elements of the sorted array a smaller than v
+static size_t lower_bound(const uint64_t *a, size_t n, uint64_t v)
+{
+	size_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (a[mid] < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void check(const char *what, const struct efset *s,
+		  const uint64_t *sorted, size_t n)
+{
+	size_t i;
+
+	if (s->h->n != n) {
+		printf("%s: %lu elements, expected %zu\n", what,
+		       (unsigned long)s->h->n, n);
+		failures++;
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		uint64_t probe = sorted[i] + 1;
+		size_t pos = lower_bound(sorted, n, probe);
+
+		if (efset_select(s, i) != sorted[i] ||
+		    !efset_contains(s, sorted[i]) ||
+		    efset_rank(s, sorted[i]) != i ||
+		    efset_rank(s, probe) != pos ||
+		    efset_contains(s, probe) != (pos < n && sorted[pos] == probe)) {
+			printf("%s: element %zu wrong\n", what, i);
+			failures++;
+			return;
+		}
+	}
+	if (n && efset_rank(s, ~0ULL) != n - (sorted[n - 1] == ~0ULL)) {
+		printf("%s: rank of the maximum wrong\n", what);
+		failures++;
+	}
+}
+
+static void run(const char *what, uint64_t *fps, size_t n, int nthreads)
+{
+	uint64_t *sorted = malloc(n * sizeof(uint64_t) + 1);
+	struct efset s;
+	size_t i, m;
+
+	memcpy(sorted, fps, n * sizeof(uint64_t));
+	qsort(sorted, n, sizeof(uint64_t), cmp_u64);
+	for (i = 0, m = 0; i < n; i++)
+		if (m == 0 || sorted[i] != sorted[m - 1])
+			sorted[m++] = sorted[i];
+
+	if (efset_build(&s, fps, n, nthreads) < 0) {
+		printf("%s: build failed\n", what);
+		failures++;
+	} else {
+		check(what, &s, sorted, m);
+		efset_free(&s);
+	}
+	free(sorted);
+}
+
+// write s to file with one word changed, which must not open
+static void corrupt(const char *what, const struct efset *s, char *file,
+		    size_t word, uint64_t value)
+{
+	uint64_t *copy = malloc(s->bytes);
+	struct efset s2, t;
+
+	memcpy(copy, s->h, s->bytes);
+	copy[word] = value;
+	t = *s;
+	t.h = (struct efset_header *)copy;
+	if (efset_write(&t, file) < 0 || efset_open_file(&s2, file) == 0) {
+		printf("%s: corrupt set accepted\n", what);
+		failures++;
+		efset_free(&s2);
+	}
+	free(copy);
+}
+
+#define N 200000
+void TestEfset()
+{
+	char file[] = "/tmp/spooky-efsetXXXXXX";
+	uint64_t *fps = malloc(N * sizeof(uint64_t)), *copy;
+	struct efset s, s2;
+	size_t i;
+
+	printf("\ntesting Elias-Fano sets ...\n");
+
+	for (i = 0; i < N; i++)
+		fps[i] = efset_fingerprint(&i, sizeof(i), 0);
+	run("hashes", fps, N, 1);
+	for (i = 0; i < N; i++)
+		fps[i] = efset_fingerprint(&i, sizeof(i), 0);
+	run("hashes, 3 threads", fps, N, 3);
+
+	// duplicates, dense values, extremes and tiny sets
+	for (i = 0; i < N; i++)
+		fps[i] = i / 3 * 5;
+	run("dense", fps, N, 2);
+	fps[0] = 0;
+	fps[1] = ~0ULL;
+	fps[2] = 1ULL << 63;
+	run("extremes", fps, 3, 2);
+	fps[0] = 42;
+	run("one", fps, 1, 1);
+	run("empty", fps, 0, 4);
+
+	// round trip through a file
+	for (i = 0; i < N; i++)
+		fps[i] = efset_fingerprint(&i, sizeof(i), 1);
+	copy = malloc(N * sizeof(uint64_t));
+	memcpy(copy, fps, N * sizeof(uint64_t));
+	efset_build(&s, fps, N, 2);
+	close(mkstemp(file));
+	if (efset_write(&s, file) < 0 || efset_open_file(&s2, file) < 0 ||
+	    s2.bytes != s.bytes || memcmp(s.h, s2.h, s.bytes)) {
+		printf("file round trip failed\n");
+		failures++;
+	} else {
+		for (i = 0; i < N; i++) {
+			if (!efset_contains(&s2, copy[i])) {
+				printf("mapped set lost an element\n");
+				failures++;
+				break;
+			}
+		}
+		efset_free(&s2);
+	}
+
+	// headers that do not fit the data, and bits that do not fit the
+	// header or the samples
+	corrupt("n", &s, file, 1, s.h->n + 1);
+	corrupt("huge n", &s, file, 1, ~0ULL);
+	corrupt("nzeros", &s, file, 5, s.h->nzeros * 3);
+	corrupt("lbits", &s, file, 2, s.h->lbits + 1);
+	corrupt("padding", &s, file, s.high + s.h->nhigh - 1 - (uint64_t *)s.h,
+		1);
+	corrupt("zero sample", &s, file, s.zsamples + 1 - (uint64_t *)s.h,
+		s.zsamples[1] + 1);
+	corrupt("one sample", &s, file, s.osamples + 1 - (uint64_t *)s.h, 0);
+	unlink(file);
+	efset_free(&s);
+	free(copy);
+	free(fps);
+}
+
+#define NBENCH 20000000
+#define NLOOKUP 5000000
+void DoTimingEfset()
+{
+	struct timespec ts, tp;
+	uint64_t *fps = malloc(NBENCH * sizeof(uint64_t));
+	uint64_t *sorted = malloc(NBENCH * sizeof(uint64_t));
+	uint64_t *query = malloc(NLOOKUP * sizeof(uint64_t));
+	uint64_t i, found;
+	struct efset s;
+	double t;
+	int th;
+
+	printf("\ntesting time for %d fingerprints ...\n", NBENCH);
+
+	for (th = 1; th <= 4; th *= 2) {
+		for (i = 0; i < NBENCH; i++)
+			fps[i] = efset_fingerprint(&i, sizeof(i), 0);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		efset_build(&s, fps, NBENCH, th);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("build %d threads: %.3lf s\n", th, t);
+		if (th < 4)
+			efset_free(&s);
+	}
+	memcpy(sorted, fps, NBENCH * sizeof(uint64_t));
+	printf("%.2lf bits per key, sorted array 64\n",
+	       s.bytes * 8.0 / s.h->n);
+
+	// half hits, half misses
+	for (i = 0; i < NLOOKUP; i++) {
+		uint64_t k = (i * 7919) % NBENCH;
+
+		query[i] = (i & 1) ? sorted[k] : sorted[k] + 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0, found = 0; i < NLOOKUP; i++)
+		found += efset_contains(&s, query[i]);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("Elias-Fano lookup: %.1lf ns (%lu found)\n",
+	       t * BILLION / NLOOKUP, (unsigned long)found);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0, found = 0; i < NLOOKUP; i++) {
+		size_t pos = lower_bound(sorted, NBENCH, query[i]);
+
+		found += pos < NBENCH && sorted[pos] == query[i];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("sorted array lookup: %.1lf ns (%lu found)\n",
+	       t * BILLION / NLOOKUP, (unsigned long)found);
+
+	efset_free(&s);
+	free(query);
+	free(sorted);
+	free(fps);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestEfset();
+	if (argc > 1)
+		DoTimingEfset();
+
+	return failures != 0;
+}
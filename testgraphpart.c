@@ -0,0 +1,332 @@
+// Tests and benchmark for hash partitioning of graph edge lists
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+
+#include "spooky-c.h"
+#include "map.h"
+#include "graphpart.h"
+
+#define BILLION 1E9
+
+static int failures;
+static char prefix[] = "/tmp/spooky-graphXXXXXX";
+
+// skewed vertex ids, as in graphs with a few high degree vertices
+static uint64_t vertex(void)
+{
+	uint64_t v = rand() % 1000;
+
+	return rand() % 4 ? v : v * 1000003 + rand();
+}
+
+static uint64_t edge_hash(uint64_t src, uint64_t dst)
+{
+	uint64_t e[2] = { src, dst };
+
+	return spooky_hash64(e, sizeof(e), 0);
+}
+
+// parse an edge of a text line the way the partitioner should
+static int text_edge(const char *p, const char *end, uint64_t *src,
+		     uint64_t *dst)
+{
+	char line[128];
+	char tail;
+
+	if (end - p >= (long)sizeof(line))
+		return -1;
+	memcpy(line, p, end - p);
+	line[end - p] = 0;
+	if (sscanf(line, "%" SCNu64 "%*[ \t,]%" SCNu64 "%c", src, dst, &tail) < 2)
+		return -1;
+	return 0;
+}
+
+// the edges of a list with their count and the sum of their hashes
+static void sum_edges(const char *data, size_t size, int format,
+		      uint64_t *n, uint64_t *sum)
+{
+	uint64_t src, dst;
+	size_t pos = 0;
+
+	*n = *sum = 0;
+	while (pos < size) {
+		if (format == GP_BIN32) {
+			uint32_t e[2];
+
+			memcpy(e, data + pos, sizeof(e));
+			src = e[0];
+			dst = e[1];
+			pos += sizeof(e);
+		} else if (format == GP_BIN64) {
+			memcpy(&src, data + pos, 8);
+			memcpy(&dst, data + pos + 8, 8);
+			pos += 16;
+		} else {
+			const char *nl = memchr(data + pos, '\n', size - pos);
+			const char *end = nl ? nl : data + size;
+			int r = text_edge(data + pos, end, &src, &dst);
+
+			pos = end - data + 1;
+			if (r < 0)
+				continue;
+		}
+		(*n)++;
+		*sum += edge_hash(src, dst);
+	}
+}
+
+// a list of edges in format, with comments and bad lines in text
+static char *make_list(int format, size_t nedges, size_t *size)
+{
+	char *buf = malloc(nedges * (format == GP_TEXT ? 48 : 16) + 64);
+	size_t i, pos = 0;
+
+	for (i = 0; i < nedges; i++) {
+		uint64_t src = vertex(), dst = vertex();
+
+		if (format == GP_BIN32) {
+			uint32_t e[2] = { (uint32_t)src, (uint32_t)dst };
+
+			memcpy(buf + pos, e, sizeof(e));
+			pos += sizeof(e);
+		} else if (format == GP_BIN64) {
+			memcpy(buf + pos, &src, 8);
+			memcpy(buf + pos + 8, &dst, 8);
+			pos += 16;
+		} else if (i % 97 == 0) {
+			pos += sprintf(buf + pos, "# comment %zu\n", i);
+		} else if (i % 89 == 0) {
+			pos += sprintf(buf + pos, "%" PRIu64 " x\n", src);
+		} else {
+			static const char *sep[] = { " ", "\t", ",", "  " };
+			static const char *end[] = { "\n", "\r\n", " 1.5\n" };
+
+			pos += sprintf(buf + pos, "%" PRIu64 "%s%" PRIu64 "%s",
+				       src, sep[i % 4], dst, end[i % 3]);
+		}
+	}
+	// a last line without a newline
+	if (format == GP_TEXT)
+		pos += sprintf(buf + pos, "12 34");
+	*size = pos;
+	return buf;
+}
+
+static void check(const char *what, int format, int mode, int nparts,
+		  size_t nedges, int nthreads)
+{
+	struct graphpart g;
+	struct graphpart_stats st;
+	uint64_t n, sum, total = 0, tsum = 0;
+	char name[sizeof(prefix) + 16];
+	size_t size;
+	char *list = make_list(format, nedges, &size);
+	int p;
+
+	graphpart_init(&g, nparts, mode, format, 7);
+	if (graphpart_split(&g, list, size, prefix, nthreads, &st) < 0) {
+		printf("%s: failed\n", what);
+		failures++;
+		free(list);
+		return;
+	}
+	sum_edges(list, size, format, &n, &sum);
+	if (st.edges != n) {
+		printf("%s: %" PRIu64 " edges, expected %" PRIu64 "\n", what,
+		       st.edges, n);
+		failures++;
+	}
+	for (p = 0; p < nparts; p++) {
+		size_t psize = 0;
+		char *map;
+		uint64_t pn = 0, psum = 0;
+
+		snprintf(name, sizeof(name), "%s.%d", prefix, p);
+		map = mapfile(name, O_RDONLY, &psize);
+		if (map) {
+			size_t pos;
+
+			sum_edges(map, psize, format, &pn, &psum);
+			// every edge is where graphpart_part puts it
+			for (pos = 0; format == GP_BIN64 && pos < psize; pos += 16) {
+				uint64_t src, dst;
+
+				memcpy(&src, map + pos, 8);
+				memcpy(&dst, map + pos + 8, 8);
+				if (graphpart_part(&g, src, dst) != p) {
+					printf("%s: edge in partition %d\n", what, p);
+					failures++;
+					break;
+				}
+			}
+			if (format == GP_TEXT && map[psize - 1] != '\n') {
+				printf("%s: partition %d lacks a newline\n", what, p);
+				failures++;
+			}
+			unmap_file(map, psize);
+		}
+		unlink(name);
+		if (pn != st.count[p]) {
+			printf("%s: partition %d has %" PRIu64 " edges, counted %" PRIu64 "\n",
+			       what, p, pn, st.count[p]);
+			failures++;
+		}
+		total += pn;
+		tsum += psum;
+	}
+	if (total != n || tsum != sum) {
+		printf("%s: partitions differ from the input\n", what);
+		failures++;
+	}
+	if (format == GP_TEXT &&
+	    st.bad != (nedges + 88) / 89 - (nedges + 8632) / 8633) {
+		printf("%s: %" PRIu64 " bad lines\n", what, st.bad);
+		failures++;
+	}
+	graphpart_stats_free(&st);
+	free(list);
+}
+
+void TestGraphpart()
+{
+	char file[] = "/tmp/spooky-graphXXXXXX";
+	struct graphpart g, g2;
+	struct graphpart_stats st;
+	int i, p;
+
+	printf("\ntesting graph partitioning ...\n");
+
+	close(mkstemp(prefix));
+	unlink(prefix);
+
+	check("binary 64 edge-cut", GP_BIN64, GP_EDGE_CUT, 7, 100000, 3);
+	check("binary 64 vertex-cut", GP_BIN64, GP_VERTEX_CUT, 12, 100000, 4);
+	check("binary 32 edge-cut", GP_BIN32, GP_EDGE_CUT, 16, 100000, 2);
+	check("binary 32 vertex-cut", GP_BIN32, GP_VERTEX_CUT, 9, 100000, 1);
+	check("text edge-cut", GP_TEXT, GP_EDGE_CUT, 5, 100000, 4);
+	check("text vertex-cut", GP_TEXT, GP_VERTEX_CUT, 6, 100000, 3);
+	check("one partition", GP_BIN64, GP_EDGE_CUT, 1, 1000, 2);
+	check("many partitions", GP_BIN64, GP_VERTEX_CUT, 1000, 200000, 4);
+	check("empty", GP_BIN64, GP_EDGE_CUT, 3, 0, 2);
+
+	// an empty file has no edges, and its partitions are empty files
+	close(mkstemp(file));
+	graphpart_init(&g, 3, GP_EDGE_CUT, GP_TEXT, 0);
+	if (graphpart_split_file(&g, file, prefix, 2, &st) < 0 ||
+	    st.edges != 0) {
+		printf("empty file: failed\n");
+		failures++;
+	}
+	graphpart_stats_free(&st);
+	for (p = 0; p < g.nparts; p++) {
+		char name[sizeof(prefix) + 16];
+
+		snprintf(name, sizeof(name), "%s.%d", prefix, p);
+		if (unlink(name) < 0) {
+			printf("empty file: partition %d missing\n", p);
+			failures++;
+		}
+	}
+	unlink(file);
+
+	// a vertex has all its out-edges in one partition, and in vertex-cut
+	// mode all its edges in one row and one column of the grid
+	graphpart_init(&g, 8, GP_EDGE_CUT, GP_BIN64, 1);
+	graphpart_init(&g2, 12, GP_VERTEX_CUT, GP_BIN64, 1);
+	if (g2.rows != 3 || g2.cols != 4) {
+		printf("grid %d x %d\n", g2.rows, g2.cols);
+		failures++;
+	}
+	for (i = 0; i < 1000; i++) {
+		if (graphpart_part(&g, 42, i) != graphpart_part(&g, 42, i + 1)) {
+			printf("out-edges split\n");
+			failures++;
+			break;
+		}
+		p = graphpart_part(&g2, 42, i);
+		if (p / g2.cols != graphpart_part(&g2, 42, 0) / g2.cols ||
+		    graphpart_part(&g2, i, 42) % g2.cols !=
+		    graphpart_part(&g2, 0, 42) % g2.cols) {
+			printf("vertex outside of its row or column\n");
+			failures++;
+			break;
+		}
+	}
+	if (graphpart_range(~0ULL, 10) != 9 || graphpart_range(0, 10) != 0 ||
+	    graphpart_range(1ULL << 63, 10) != 5) {
+		printf("range reduction wrong\n");
+		failures++;
+	}
+	if (graphpart_init(&g, 0, GP_EDGE_CUT, GP_TEXT, 0) == 0 ||
+	    graphpart_init(&g, 4, 2, GP_TEXT, 0) == 0 ||
+	    graphpart_init(&g, 4, GP_EDGE_CUT, 3, 0) == 0) {
+		printf("bad parameters accepted\n");
+		failures++;
+	}
+}
+
+#define BENCH_EDGES (32 << 20)
+void DoTimingGraphpart()
+{
+	char file[] = "/tmp/spooky-graphXXXXXX";
+	struct graphpart g;
+	struct graphpart_stats st;
+	struct timespec ts, tp;
+	size_t size;
+	char *list = make_list(GP_BIN64, BENCH_EDGES, &size);
+	double t;
+	int th, p;
+	FILE *f;
+
+	printf("\ntesting time to partition %d M edges ...\n", BENCH_EDGES >> 20);
+
+	close(mkstemp(file));
+	f = fopen(file, "w");
+	fwrite(list, 1, size, f);
+	fclose(f);
+	free(list);
+
+	graphpart_init(&g, 64, GP_VERTEX_CUT, GP_BIN64, 0);
+	for (th = 1; th <= 8; th *= 2) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (graphpart_split_file(&g, file, prefix, th, &st) < 0) {
+			printf("failed\n");
+			failures++;
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("%d threads: %.2lf GB/s, %.1lf M edges/s\n", th,
+		       size / t / 1e9, st.edges / t / 1e6);
+		if (th == 8)
+			graphpart_stats_write(&g, &st, stdout);
+		graphpart_stats_free(&st);
+	}
+	for (p = 0; p < g.nparts; p++) {
+		char name[sizeof(prefix) + 16];
+
+		snprintf(name, sizeof(name), "%s.%d", prefix, p);
+		unlink(name);
+	}
+	unlink(file);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestGraphpart();
+	if (argc > 1)
+		DoTimingGraphpart();
+
+	return failures != 0;
+}
@@ -0,0 +1,251 @@
+// Tests and benchmark for the hashing service
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "spooky-c.h"
+#include "hashsvc.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+#define BUFSIZE 8192
+static uint8_t buf[BUFSIZE];
+
+// request i hashes a piece of buf selected by i
+static inline void request(uint64_t i, const void **msg, size_t *len)
+{
+	// plenty of equal long lengths, so the batched x4 path gets used
+	if (i & 1)
+		*len = 192 + (i % 5) * 64;
+	else
+		*len = (i * 7) % 300;
+	*msg = buf + (i * 13) % (BUFSIZE - 512);
+}
+
+struct client_job
+{
+	struct hs_service *s;
+	int flags;
+	uint64_t nreq;
+	int bad;
+};
+
+static void check(struct client_job *j, struct hs_cqe *cqe, unsigned n)
+{
+	unsigned k;
+
+	for (k = 0; k < n; k++) {
+		const void *msg;
+		size_t len;
+		uint64_t h1 = cqe[k].user, h2 = ~cqe[k].user;
+
+		request(cqe[k].user, &msg, &len);
+		spooky_hash128(msg, len, &h1, &h2);
+		if (h1 != cqe[k].hash1 || h2 != cqe[k].hash2)
+			j->bad++;
+	}
+}
+
+static void *client_thread(void *arg)
+{
+	struct client_job *j = arg;
+	struct hs_client c;
+	struct hs_cqe cqe[32];
+	uint64_t i = 0, done = 0;
+
+	if (hs_client_init(&c, j->s, 32, j->flags) < 0) {
+		perror("hs_client_init");
+		j->bad++;
+		return NULL;
+	}
+	while (done < j->nreq) {
+		unsigned n;
+
+		while (i < j->nreq) {
+			const void *msg;
+			size_t len;
+
+			request(i, &msg, &len);
+			if (hs_submit(&c, msg, len, i, ~i, i) < 0)
+				break;
+			i++;
+		}
+		// the submission ring is shared and may be full of other
+		// clients' requests
+		if (i == done) {
+			sched_yield();
+			continue;
+		}
+		n = hs_wait(&c, cqe, 32);
+		check(j, cqe, n);
+		done += n;
+	}
+	hs_client_free(&c);
+	return NULL;
+}
+
+static void run(int nworkers, int nclients, int sflags, int cflags)
+{
+	struct hs_service s;
+	pthread_t tid[nclients];
+	struct client_job job[nclients];
+	int i;
+
+	if (hs_init(&s, nworkers, NULL, 64, sflags) < 0) {
+		perror("hs_init");
+		failures++;
+		return;
+	}
+	for (i = 0; i < nclients; i++) {
+		job[i].s = &s;
+		job[i].flags = cflags;
+		job[i].nreq = 20000;
+		job[i].bad = 0;
+		pthread_create(&tid[i], NULL, client_thread, &job[i]);
+	}
+	for (i = 0; i < nclients; i++) {
+		pthread_join(tid[i], NULL);
+		if (job[i].bad) {
+			printf("%d workers %d clients flags %d/%d: %d bad hashes\n",
+			       nworkers, nclients, sflags, cflags, job[i].bad);
+			failures++;
+		}
+	}
+	hs_free(&s);
+}
+
+void TestService()
+{
+	struct hs_service s;
+	struct hs_client c;
+	struct hs_cqe cqe[4];
+	int i;
+
+	printf("\ntesting hashing service ...\n");
+
+	for (i = 0; i < BUFSIZE; i++)
+		buf[i] = rand();
+
+	run(1, 1, 0, 0);
+	run(2, 3, 0, HS_EVENTFD);
+	run(1, 4, HS_POLL, 0);
+	run(3, 2, HS_POLL, HS_EVENTFD);
+
+	// a client cannot have more requests in flight than its ring holds
+	hs_init(&s, 1, NULL, 16, 0);
+	hs_client_init(&c, &s, 4, 0);
+	for (i = 0; i < 4; i++)
+		hs_submit(&c, buf, 100, 0, 0, i);
+	if (hs_submit(&c, buf, 100, 0, 0, 4) == 0 || errno != EAGAIN) {
+		printf("overcommitted completion ring not rejected\n");
+		failures++;
+	}
+	for (i = 0; i < 4; )
+		i += hs_wait(&c, cqe, 4);
+	if (hs_submit(&c, buf, 100, 0, 0, 5) < 0) {
+		printf("submission after reaping failed\n");
+		failures++;
+	}
+	hs_wait(&c, cqe, 4);
+	hs_client_free(&c);
+	hs_free(&s);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define NBENCH 1000000
+#define NLAT 20000
+static void bench(size_t len, int sflags, int cflags)
+{
+	static uint64_t lat[NLAT];
+	struct hs_service s;
+	struct hs_client c;
+	struct hs_cqe cqe[64];
+	uint64_t i, done, start, t;
+	uint64_t h1 = 0, h2 = 0;
+
+	// inline baseline
+	start = now_ns();
+	for (i = 0; i < NBENCH; i++)
+		spooky_hash128(buf + (i & 1023), len, &h1, &h2);
+	t = now_ns() - start;
+	printf("%5zu bytes inline:  %6.1f Mhashes/s  %6.0f ns/hash\n", len,
+	       NBENCH / (t / 1000.0), (double)t / NBENCH);
+
+	hs_init(&s, 1, NULL, 256, sflags);
+	hs_client_init(&c, &s, 256, cflags);
+
+	// throughput with a full pipeline
+	start = now_ns();
+	for (i = 0, done = 0; done < NBENCH; ) {
+		while (i < NBENCH &&
+		       hs_submit(&c, buf + (i & 1023), len, 0, 0, i) == 0)
+			i++;
+		done += hs_wait(&c, cqe, 64);
+	}
+	t = now_ns() - start;
+	printf("%5zu bytes service: %6.1f Mhashes/s  %6.0f ns/hash", len,
+	       NBENCH / (t / 1000.0), (double)t / NBENCH);
+
+	// latency of single requests
+	for (i = 0; i < NLAT; i++) {
+		start = now_ns();
+		hs_submit(&c, buf, len, 0, 0, i);
+		hs_wait(&c, cqe, 1);
+		lat[i] = now_ns() - start;
+	}
+	qsort(lat, NLAT, sizeof(uint64_t), cmp_u64);
+	printf("  latency p50 %"PRIu64" p99 %"PRIu64" ns\n",
+	       lat[NLAT / 2], lat[NLAT * 99 / 100]);
+
+	hs_client_free(&c);
+	hs_free(&s);
+}
+
+void DoTimingService()
+{
+	static const size_t lens[] = { 16, 64, 256, 4096 };
+	unsigned i;
+
+	printf("\ntesting time for %d hashes, 1 worker ...\n", NBENCH);
+	printf("polling worker, polling client\n");
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+		bench(lens[i], HS_POLL, 0);
+	printf("sleeping worker, eventfd client\n");
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+		bench(lens[i], 0, HS_EVENTFD);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestService();
+	if (argc > 1)
+		DoTimingService();
+
+	return failures != 0;
+}
@@ -0,0 +1,189 @@
+// Tests and benchmark for per-line hashes of newline delimited files
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spooky-c.h"
+#include "lines.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+// random lines of 0 to 400 characters, mostly short
+static void fill(char *buf, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size) {
+		size_t len = rand() % 8 ? rand() % 60 : rand() % 400;
+
+		while (len-- && i < size)
+			buf[i++] = 'a' + rand() % 26;
+		if (i < size)
+			buf[i++] = '\n';
+	}
+}
+
+static void check(const char *what, const char *data, size_t size,
+		  uint64_t seed, int nthreads)
+{
+	struct lines l;
+	size_t start = 0, i, n = 0;
+
+	if (lines_hash(&l, data, size, seed, nthreads) < 0) {
+		printf("%s: failed\n", what);
+		failures++;
+		return;
+	}
+	for (i = 0; i <= size; i++) {
+		uint64_t h1 = seed, h2 = seed;
+
+		if (i < size && data[i] != '\n')
+			continue;
+		if (i == size && start == size)
+			break;
+		if (n >= l.n || l.offset[n] != start) {
+			printf("%s: line %zu at the wrong offset\n", what, n);
+			failures++;
+			goto out;
+		}
+		if (i - start < SC_BUFSIZE)
+			spooky_shorthash(data + start, i - start, &h1, &h2);
+		else
+			h1 = spooky_hash64(data + start, i - start, seed);
+		if (l.hash[n] != h1) {
+			printf("%s: hash of line %zu wrong\n", what, n);
+			failures++;
+			goto out;
+		}
+		n++;
+		start = i + 1;
+	}
+	if (n != l.n) {
+		printf("%s: %lu lines, expected %zu\n", what,
+		       (unsigned long)l.n, n);
+		failures++;
+	}
+out:
+	lines_free(&l);
+}
+
+#define SIZE (1 << 20)
+void TestLines()
+{
+	char file[] = "/tmp/spooky-linesXXXXXX";
+	char *buf = malloc(SIZE);
+	struct lines l, l2;
+	FILE *f;
+	int th;
+
+	printf("\ntesting per-line hashes ...\n");
+
+	fill(buf, SIZE);
+	for (th = 1; th <= 7; th++)
+		check("random lines", buf, SIZE, th, th);
+	buf[SIZE - 1] = 'x';
+	check("no newline at the end", buf, SIZE, 0, 3);
+	memset(buf, '\n', 10000);
+	check("empty lines", buf, 10000, 0, 4);
+	memset(buf, 'y', 100000);
+	check("one long line", buf, 100000, 0, 4);
+	check("empty", buf, 0, 0, 2);
+	check("one byte", "\n", 1, 0, 2);
+
+	fill(buf, SIZE);
+	close(mkstemp(file));
+	f = fopen(file, "w");
+	fwrite(buf, 1, SIZE, f);
+	fclose(f);
+	if (lines_hash_file(&l, file, 0, 2) < 0 ||
+	    lines_hash(&l2, buf, SIZE, 0, 1) < 0 || l.n != l2.n ||
+	    memcmp(l.offset, l2.offset, l.n * sizeof(uint64_t)) ||
+	    memcmp(l.hash, l2.hash, l.n * sizeof(uint64_t))) {
+		printf("file hashed differently\n");
+		failures++;
+	}
+	lines_free(&l);
+	lines_free(&l2);
+	if (truncate(file, 0) < 0 || lines_hash_file(&l, file, 0, 2) < 0 ||
+	    l.n != 0) {
+		printf("empty file not hashed\n");
+		failures++;
+	}
+	lines_free(&l);
+	unlink(file);
+	free(buf);
+}
+
+#define BENCH (512 << 20)
+void DoTimingLines()
+{
+	char file[] = "/tmp/spooky-linesXXXXXX";
+	char *buf = malloc(BENCH), *line = NULL;
+	struct timespec ts, tp;
+	struct lines l;
+	size_t cap = 0;
+	ssize_t len;
+	uint64_t sum = 0;
+	double t;
+	FILE *f;
+	int th;
+
+	printf("\ntesting time for %d MB of lines ...\n", BENCH >> 20);
+
+	fill(buf, BENCH);
+	for (th = 1; th <= 4; th *= 2) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		lines_hash(&l, buf, BENCH, 0, th);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("%d threads: %.2lf GB/s, %.1lf ns per line\n", th,
+		       BENCH / t / 1e9, t * BILLION / l.n);
+		lines_free(&l);
+	}
+
+	// reading line by line, as we do now
+	close(mkstemp(file));
+	f = fopen(file, "w");
+	fwrite(buf, 1, BENCH, f);
+	fclose(f);
+	f = fopen(file, "r");
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	while ((len = getline(&line, &cap, f)) > 0) {
+		if (line[len - 1] == '\n')
+			len--;
+		sum += spooky_hash64(line, len, 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("getline: %.2lf GB/s (%lx)\n", BENCH / t / 1e9,
+	       (unsigned long)sum & 0xf);
+	fclose(f);
+	free(line);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	lines_hash_file(&l, file, 0, 1);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("mapped file, 1 thread: %.2lf GB/s\n", BENCH / t / 1e9);
+	lines_free(&l);
+	unlink(file);
+	free(buf);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestLines();
+	if (argc > 1)
+		DoTimingLines();
+
+	return failures != 0;
+}
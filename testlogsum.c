@@ -0,0 +1,260 @@
+// Tests and benchmark for running checksums of append-only files
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "logsum.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static void append(int fd, const unsigned char *buf, size_t len)
+{
+	if (write(fd, buf, len) != (ssize_t)len) {
+		printf("append failed\n");
+		failures++;
+	}
+}
+
+static void check(const char *what, const struct logsum_file *f,
+		  const unsigned char *data, uint64_t len)
+{
+	uint64_t h1, h2, e1 = 7, e2 = 11, i;
+
+	spooky_hash128(data, len, &e1, &e2);
+	if (logsum_digest(f, &h1, &h2) != len || h1 != e1 || h2 != e2) {
+		printf("%s: digest of %lu bytes wrong\n", what,
+		       (unsigned long)len);
+		failures++;
+		return;
+	}
+	for (i = 0; i < f->p.ncheckpoints; i++) {
+		uint64_t c = f->p.interval * (i + 1);
+
+		e1 = 7;
+		e2 = 11;
+		spooky_hash128(data, c, &e1, &e2);
+		if (logsum_digest_at(f, c, &h1, &h2) < 0 ||
+		    h1 != e1 || h2 != e2) {
+			printf("%s: checkpoint at %lu wrong\n", what,
+			       (unsigned long)c);
+			failures++;
+			return;
+		}
+	}
+	if (f->p.ncheckpoints != len / f->p.interval) {
+		printf("%s: %lu checkpoints\n", what,
+		       (unsigned long)f->p.ncheckpoints);
+		failures++;
+	}
+}
+
+#define MAXLEN 300000
+void TestLogsum()
+{
+	char log[] = "/tmp/spooky-logXXXXXX";
+	char state[] = "/tmp/spooky-logstateXXXXXX";
+	char rotated[sizeof(log) + 2];
+	unsigned char *data = malloc(MAXLEN);
+	struct logsum ls;
+	struct logsum_file *f;
+	uint64_t len = 0, i;
+	int fd;
+
+	printf("\ntesting running checksums of logs ...\n");
+
+	for (i = 0; i < MAXLEN; i++)
+		data[i] = rand();
+	fd = mkstemp(log);
+	close(mkstemp(state));
+	unlink(state);
+
+	logsum_init(&ls);
+	f = logsum_add(&ls, log, state, 7, 11, 1000);
+	if (!f) {
+		printf("logsum_add failed\n");
+		failures++;
+		goto out;
+	}
+
+	// appends of all sizes, some crossing several checkpoints
+	while (len < MAXLEN / 2) {
+		uint64_t n = rand() % (rand() % 4 ? 300 : 5000);
+
+		append(fd, data + len, n);
+		len += n;
+		if (logsum_poll(&ls, 1000) < 0) {
+			printf("poll failed\n");
+			failures++;
+		}
+		check("appending", f, data, len);
+	}
+	logsum_free(&ls);
+
+	// resume from the state file, hashing only the new bytes
+	append(fd, data + len, 12345);
+	len += 12345;
+	logsum_init(&ls);
+	f = logsum_add(&ls, log, state, 0, 0, 1);
+	if (!f || f->bytes_read != 12345) {
+		printf("restart did not resume\n");
+		failures++;
+		goto out;
+	}
+	check("resumed", f, data, len);
+
+	// truncation while tracked, then regrowth with other data
+	if (ftruncate(fd, 5000) < 0)
+		failures++;
+	lseek(fd, 5000, SEEK_SET);
+	for (i = 5000; i < 6000; i++)
+		data[i] ^= 1;
+	append(fd, data + 5000, 1000);
+	len = 6000;
+	logsum_poll(&ls, 1000);
+	check("truncated", f, data, len);
+	logsum_free(&ls);
+
+	// a replaced file is rehashed on restart
+	close(fd);
+	unlink(log);
+	fd = open(log, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	for (i = 0; i < 50000; i++)
+		data[i] = rand();
+	append(fd, data, 50000);
+	len = 50000;
+	logsum_init(&ls);
+	f = logsum_add(&ls, log, state, 0, 0, 1);
+	if (!f || f->bytes_read != len) {
+		printf("replaced file not rehashed\n");
+		failures++;
+		goto out;
+	}
+	check("replaced", f, data, len);
+
+	// deletion is reported
+	unlink(log);
+	logsum_poll(&ls, 1000);
+	if (!f->gone) {
+		printf("deletion not noticed\n");
+		failures++;
+	}
+
+	// a new file at the path is followed and hashed from the start
+	close(fd);
+	fd = open(log, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	for (i = 0; i < 3000; i++)
+		data[i] = rand();
+	append(fd, data, 3000);
+	len = 3000;
+	logsum_poll(&ls, 0);
+	if (f->gone) {
+		printf("recreated file not followed\n");
+		failures++;
+		goto out;
+	}
+	check("recreated", f, data, len);
+	append(fd, data + len, 2500);
+	len += 2500;
+	logsum_poll(&ls, 1000);
+	check("recreated appending", f, data, len);
+
+	// rotation by rename: the rest of the old file is hashed first
+	append(fd, data + len, 100);
+	snprintf(rotated, sizeof(rotated), "%s.1", log);
+	rename(log, rotated);
+	logsum_poll(&ls, 1000);
+	if (!f->gone) {
+		printf("rename not noticed\n");
+		failures++;
+	}
+	close(fd);
+	fd = open(log, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	for (i = 0; i < 4000; i++)
+		data[i] = rand();
+	append(fd, data, 4000);
+	len = 4000;
+	logsum_poll(&ls, 0);
+	check("rotated", f, data, len);
+	unlink(rotated);
+out:
+	logsum_free(&ls);
+	close(fd);
+	unlink(log);
+	unlink(state);
+	free(data);
+}
+
+#define BENCHLEN (64 << 20)
+#define NAPPEND 2000
+void DoTimingLogsum()
+{
+	char log[] = "/tmp/spooky-logXXXXXX";
+	char state[] = "/tmp/spooky-logstateXXXXXX";
+	unsigned char *data = malloc(BENCHLEN);
+	struct timespec ts, tp;
+	struct logsum ls;
+	struct logsum_file *f;
+	double inc = 0, full = 0;
+	uint64_t h1, h2, i;
+	int fd;
+
+	printf("\ntesting time for %d appends to a %d MB log ...\n",
+	       NAPPEND, BENCHLEN >> 20);
+
+	for (i = 0; i < BENCHLEN; i++)
+		data[i] = i * 131;
+	fd = mkstemp(log);
+	close(mkstemp(state));
+	unlink(state);
+	append(fd, data, BENCHLEN - NAPPEND * 256);
+	logsum_init(&ls);
+	f = logsum_add(&ls, log, state, 0, 0, 1 << 20);
+
+	for (i = 0; i < NAPPEND; i++) {
+		uint64_t len = BENCHLEN - (NAPPEND - i - 1) * 256;
+
+		append(fd, data + len - 256, 256);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		logsum_poll(&ls, 1000);
+		logsum_digest(f, &h1, &h2);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		inc += (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+
+		// every 100th append, time hashing the whole log instead
+		if (i % 100 == 0) {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			h1 = h2 = 0;
+			spooky_hash128(data, len, &h1, &h2);
+			clock_gettime(CLOCK_MONOTONIC, &tp);
+			full += (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		}
+	}
+	printf("incremental: %.2lf us per append\n", inc * 1e6 / NAPPEND);
+	printf("rehash from start: %.2lf us per append\n",
+	       full * 1e6 / (NAPPEND / 100));
+
+	logsum_free(&ls);
+	close(fd);
+	unlink(log);
+	unlink(state);
+	free(data);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestLogsum();
+	if (argc > 1)
+		DoTimingLogsum();
+
+	return failures != 0;
+}
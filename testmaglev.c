@@ -0,0 +1,166 @@
+// Tests and benchmark for Maglev lookup tables
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "maglev.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+#define SIZE 65537
+#define NB 1000
+
+static void add_backends(struct maglev *m, int n)
+{
+	char name[32];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "10.0.%d.%d:80", i / 256, i % 256);
+		if (maglev_add(m, name, strlen(name)) != i) {
+			printf("unexpected backend id\n");
+			failures++;
+		}
+	}
+}
+
+void TestMaglev()
+{
+	static int32_t before[SIZE];
+	static uint32_t count[NB];
+	struct maglev m;
+	uint32_t i, changed = 0, moved_to_removed = 0;
+	uint8_t sa[4] = { 192, 168, 0, 1 }, da[4] = { 10, 1, 2, 3 };
+
+	printf("\ntesting maglev tables ...\n");
+
+	if (maglev_init(&m, 65536) == 0) {
+		printf("non prime size accepted\n");
+		failures++;
+		maglev_free(&m);
+	}
+	maglev_init(&m, SIZE);
+	if (maglev_lookup(&m, 12345) != -1) {
+		printf("empty table returned a backend\n");
+		failures++;
+	}
+
+	// round robin population gives every backend floor or ceil of M/N
+	add_backends(&m, NB);
+	maglev_build(&m);
+	for (i = 0; i < SIZE; i++)
+		count[m.table[i]]++;
+	for (i = 0; i < NB; i++) {
+		if (count[i] != SIZE / NB && count[i] != SIZE / NB + 1) {
+			printf("backend %u has %u entries\n", i, count[i]);
+			failures++;
+			break;
+		}
+	}
+
+	// removing a backend should mostly move only its own entries
+	memcpy(before, m.table, sizeof(before));
+	maglev_remove(&m, 17);
+	maglev_build(&m);
+	for (i = 0; i < SIZE; i++) {
+		if (m.table[i] == 17)
+			moved_to_removed++;
+		else if (before[i] != 17 && before[i] != m.table[i])
+			changed++;
+	}
+	printf("removing 1 of %d backends moved %.2f%% of other entries\n",
+	       NB, 100.0 * changed / SIZE);
+	if (moved_to_removed || changed > SIZE / 50) {
+		printf("too much disruption: %u moved\n", changed);
+		failures++;
+	}
+
+	// adding it back reuses the id and restores the table
+	if (maglev_add(&m, "10.0.0.17:80", 12) != 17) {
+		printf("removed id not reused\n");
+		failures++;
+	}
+	maglev_build(&m);
+	if (memcmp(before, m.table, sizeof(before))) {
+		printf("table not restored\n");
+		failures++;
+	}
+
+	// flows spread over all backends
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < 200000; i++) {
+		uint64_t h = maglev_hash_tuple(sa, da, 4, i, 80, 6, 0);
+		int b = maglev_lookup(&m, h);
+
+		if (b < 0 || b >= NB) {
+			printf("bad lookup %d\n", b);
+			failures++;
+			break;
+		}
+		count[b]++;
+	}
+	for (i = 0; i < NB; i++) {
+		if (count[i] < 100 || count[i] > 300) {
+			printf("backend %u got %u of 200000 flows\n", i, count[i]);
+			failures++;
+			break;
+		}
+	}
+	maglev_free(&m);
+}
+
+void DoTimingMaglev()
+{
+	struct timespec ts, tp;
+	struct maglev m;
+	uint64_t i, sum = 0;
+	double t;
+	uint8_t sa[16] = { 0x20, 0x01 }, da[16] = { 0x20, 0x01, 0, 1 };
+
+	printf("\ntesting time for %d entries, %d backends ...\n", SIZE, NB);
+
+	maglev_init(&m, SIZE);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	add_backends(&m, NB);
+	maglev_build(&m);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("initial build: %.3lf ms\n", t * 1000);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < 100; i++) {
+		maglev_remove(&m, i);
+		maglev_build(&m);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("rebuild after a removal: %.3lf ms\n", t * 1000 / 100);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < 10000000; i++)
+		sum += maglev_lookup(&m,
+				     maglev_hash_tuple(sa, da, 16, i, i >> 16,
+						       17, 0));
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("IPv6 5-tuple hash and lookup: %.1lf ns (%lu)\n", t * 100,
+	       (unsigned long)sum);
+	maglev_free(&m);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestMaglev();
+	if (argc > 1)
+		DoTimingMaglev();
+
+	return failures != 0;
+}
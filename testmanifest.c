@@ -0,0 +1,197 @@
+// Tests and benchmark for piece hash manifests
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+
+#include "spooky-c.h"
+#include "manifest.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static void fail(const char *what)
+{
+	printf("%s\n", what);
+	failures++;
+}
+
+static int same(const struct manifest *a, const struct manifest *b)
+{
+	return a->bytes == b->bytes && !memcmp(a->h, b->h, a->bytes);
+}
+
+#define SIZE (1000 * 1000 + 17)
+#define PIECE 4096
+void TestManifest()
+{
+	char file[] = "/tmp/spooky-manifestXXXXXX";
+	char mfile[] = "/tmp/spooky-manifestXXXXXX";
+	uint8_t *data = malloc(SIZE);
+	struct manifest m, m2, m3;
+	struct manifest_header h;
+	uint64_t bad, off, next;
+	long n;
+	int i, fd;
+
+	printf("\ntesting piece hash manifests ...\n");
+
+	for (i = 0; i < SIZE; i++)
+		data[i] = rand();
+
+	// the result does not depend on the number of threads
+	manifest_build(&m, data, SIZE, PIECE, 7, 1);
+	manifest_build(&m2, data, SIZE, PIECE, 7, 3);
+	if (m.h->npieces != (SIZE + PIECE - 1) / PIECE || !same(&m, &m2))
+		fail("threaded build differs");
+	manifest_free(&m2);
+
+	// file build, write and reopen
+	fd = mkstemp(file);
+	if (fd < 0 || write(fd, data, SIZE) != SIZE)
+		fail("cannot write test file");
+	close(fd);
+	close(mkstemp(mfile));
+	if (manifest_build_file(&m2, file, PIECE, 7, 4) < 0 || !same(&m, &m2))
+		fail("file build differs");
+	if (manifest_write(&m2, mfile) < 0 ||
+	    manifest_open_file(&m3, mfile) < 0 || !same(&m, &m3))
+		fail("reopened manifest differs");
+	manifest_free(&m2);
+	manifest_free(&m3);
+
+	// a corrupted manifest fails the root digest
+	fd = open(mfile, O_WRONLY);
+	if (pwrite(fd, "x", 1, sizeof(struct manifest_header) + 100) != 1)
+		fail("cannot corrupt manifest");
+	close(fd);
+	if (manifest_open_file(&m3, mfile) == 0) {
+		fail("corrupted manifest accepted");
+		manifest_free(&m3);
+	}
+
+	// a header whose pieces would wrap the size around to its own
+	memset(&h, 0, sizeof(h));
+	h.magic = m.h->magic;
+	h.size = 1ULL << 60;
+	h.piece_size = 1;
+	h.npieces = 1ULL << 60;
+	// with the root of the zero bytes of pieces that would be hashed
+	h.root[0] = h.size;
+	h.root[1] = h.piece_size;
+	spooky_hash128(NULL, 0, &h.root[0], &h.root[1]);
+	fd = open(mfile, O_WRONLY | O_TRUNC);
+	if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+		fail("cannot write manifest header");
+	close(fd);
+	errno = 0;
+	if (manifest_open_file(&m3, mfile) == 0 || errno != EINVAL) {
+		fail("wrapping piece count accepted");
+		manifest_free(&m3);
+	}
+
+	// an empty file has a manifest without pieces, but is not one
+	if (truncate(file, 0) < 0 || truncate(mfile, 0) < 0)
+		fail("cannot truncate test files");
+	manifest_build(&m3, data, 0, PIECE, 7, 1);
+	if (manifest_build_file(&m2, file, PIECE, 7, 4) < 0 ||
+	    m2.h->npieces != 0 || !same(&m2, &m3))
+		fail("empty file build failed");
+	else
+		manifest_free(&m2);
+	manifest_free(&m3);
+	errno = 0;
+	if (manifest_open_file(&m3, mfile) == 0 || errno != EINVAL)
+		fail("empty manifest accepted");
+	unlink(file);
+	unlink(mfile);
+
+	// ranges of odd sizes arriving in order; the partial piece at the end
+	// of a range is checked together with the next range
+	for (off = 0, next = 0; off < SIZE; off += 10000) {
+		uint64_t end = off + 10000 > SIZE ? SIZE : off + 10000;
+
+		n = manifest_verify(&m, next * PIECE, data + next * PIECE,
+				    end - next * PIECE, &bad);
+		if (n < 0) {
+			fail("good range rejected");
+			break;
+		}
+		next += n;
+	}
+	if (next != m.h->npieces)
+		fail("not all pieces checked");
+
+	// pieces at the wrong offset, short pieces and flipped bits
+	if (manifest_check_piece(&m, 3, data + 3 * PIECE, PIECE) != 0 ||
+	    manifest_check_piece(&m, 4, data + 3 * PIECE, PIECE) == 0 ||
+	    manifest_check_piece(&m, 3, data + 3 * PIECE, PIECE - 1) == 0)
+		fail("piece check wrong");
+	if (manifest_check_piece(&m, m.h->npieces - 1,
+				 data + (m.h->npieces - 1) * PIECE,
+				 SIZE % PIECE) != 0)
+		fail("last piece rejected");
+	data[77 * PIECE + 5] ^= 1;
+	if (manifest_verify(&m, 70 * PIECE, data + 70 * PIECE, 10 * PIECE,
+			    &bad) != -1 || bad != 77)
+		fail("bad piece not found");
+	data[77 * PIECE + 5] ^= 1;
+	if (manifest_verify(&m, 100, data + 100, PIECE, &bad) != 0)
+		fail("range without a whole piece checked");
+
+	manifest_free(&m);
+	free(data);
+}
+
+#define NBENCH (1UL << 30)
+void DoTimingManifest()
+{
+	struct timespec ts, tp;
+	struct manifest m;
+	uint8_t *data = malloc(NBENCH);
+	uint64_t bad;
+	double t;
+	int th;
+
+	printf("\ntesting time for a %lu MB file, %d byte pieces ...\n",
+	       NBENCH >> 20, 1 << 20);
+	memset(data, 1, NBENCH);
+
+	for (th = 1; th <= 4; th *= 2) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		manifest_build(&m, data, NBENCH, 1 << 20, 0, th);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("build %d threads: %.2lf GB/s\n", th,
+		       NBENCH / t / BILLION);
+		manifest_free(&m);
+	}
+
+	manifest_build(&m, data, NBENCH, 1 << 20, 0, 1);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (manifest_verify(&m, 0, data, NBENCH, &bad) < 0)
+		fail("benchmark verify failed");
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("verify: %.2lf GB/s\n", NBENCH / t / BILLION);
+	manifest_free(&m);
+	free(data);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestManifest();
+	if (argc > 1)
+		DoTimingManifest();
+
+	return failures != 0;
+}
@@ -0,0 +1,232 @@
+// Tests and benchmark for order independent multiset hashes
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "spooky-c.h"
+#include "mset.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+#define NKEYS 100000
+static char keys[NKEYS][24];
+static const void *kp[NKEYS];
+static size_t lens[NKEYS];
+
+static void make_keys(size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		lens[i] = snprintf(keys[i], sizeof(keys[i]), "key-%zu-%d", i,
+				   rand() % 1000);
+		kp[i] = keys[i];
+	}
+}
+
+static void shuffle(size_t n)
+{
+	size_t i;
+
+	for (i = n - 1; i > 0; i--) {
+		size_t j = rand() % (i + 1);
+		const void *p = kp[i];
+		size_t l = lens[i];
+
+		kp[i] = kp[j];
+		lens[i] = lens[j];
+		kp[j] = p;
+		lens[j] = l;
+	}
+}
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failures++;
+	}
+}
+
+void TestMset()
+{
+	static uint64_t h[NKEYS][2];
+	struct mset a, b, c, empty;
+	size_t i;
+	int th;
+
+	printf("\ntesting multiset hashes ...\n");
+
+	srand(1);
+	make_keys(NKEYS);
+	mset_init(&a, 42);
+	mset_init(&empty, 42);
+	for (i = 0; i < NKEYS; i++)
+		mset_add(&a, kp[i], lens[i]);
+	expect("wrong count", a.n == NKEYS);
+
+	// any order, one by one or in batches, on any number of threads
+	shuffle(NKEYS);
+	for (th = 1; th <= 5; th++) {
+		mset_init(&b, 42);
+		mset_add_keys(&b, kp, lens, NKEYS, th);
+		expect("batch of keys differs", mset_equal(&a, &b));
+	}
+	for (i = 0; i < NKEYS; i++) {
+		h[i][0] = h[i][1] = 42;
+		spooky_hash128(kp[i], lens[i], &h[i][0], &h[i][1]);
+	}
+	mset_init(&b, 42);
+	mset_add_hashes(&b, h, NKEYS);
+	expect("batch of hashes differs", mset_equal(&a, &b));
+	mset_init(&b, 42);
+	mset_add_hashes(&b, h, 777);
+	mset_add_hashes(&b, h + 777, NKEYS - 777);
+	expect("split batch differs", mset_equal(&a, &b));
+
+	// carries out of the low word, and wrapping around
+	mset_init(&c, 0);
+	for (i = 0; i < 1000; i++) {
+		h[i][0] = ~0ULL - i;
+		h[i][1] = ~0ULL;
+	}
+	mset_add_hashes(&c, h, 1000);
+	mset_init(&b, 0);
+	for (i = 0; i < 1000; i++)
+		mset_add_hash(&b, h[i][0], h[i][1]);
+	expect("carries lost", mset_equal(&b, &c));
+	mset_remove_hashes(&c, h, 1000);
+	mset_init(&b, 0);
+	expect("hashes not removed", mset_equal(&b, &c));
+
+	// removing all elements gives the empty set
+	b = a;
+	for (i = 0; i < NKEYS; i += 2)
+		mset_remove(&b, kp[i], lens[i]);
+	expect("removed set equals full set", !mset_equal(&a, &b));
+	for (i = 1; i < NKEYS; i += 2)
+		mset_remove(&b, kp[i], lens[i]);
+	expect("empty set not empty", mset_equal(&b, &empty));
+	b = a;
+	mset_remove_keys(&b, kp, lens, NKEYS, 3);
+	expect("batch remove wrong", mset_equal(&b, &empty));
+
+	// it is a multiset: duplicates count
+	mset_init(&b, 42);
+	mset_add(&b, "x", 1);
+	mset_add(&b, "x", 1);
+	mset_init(&c, 42);
+	mset_add(&c, "x", 1);
+	expect("duplicate ignored", !mset_equal(&b, &c));
+
+	// the digest of a sum of sets is the sum of the digests
+	mset_init(&b, 42);
+	mset_init(&c, 42);
+	mset_add_keys(&b, kp, lens, NKEYS / 3, 2);
+	mset_add_keys(&c, kp + NKEYS / 3, lens + NKEYS / 3,
+		      NKEYS - NKEYS / 3, 2);
+	mset_merge(&b, &c);
+	expect("merge wrong", mset_equal(&a, &b));
+	mset_subtract(&b, &c);
+	mset_merge(&c, &b);
+	expect("subtract wrong", mset_equal(&a, &c));
+
+	mset_init(&b, 43);
+	mset_add_keys(&b, kp, lens, NKEYS, 1);
+	expect("seed ignored", !mset_equal(&a, &b));
+}
+
+static int cmp_key(const void *x, const void *y)
+{
+	const void *const *a = x, *const *b = y;
+
+	return strcmp(*a, *b);
+}
+
+void DoTimingMset()
+{
+	struct timespec ts, tp;
+	struct spooky_state st;
+	struct mset m;
+	uint64_t h1, h2;
+	double t;
+	size_t i;
+	int th;
+
+	printf("\ntesting time to digest %d keys ...\n", NKEYS);
+	make_keys(NKEYS);
+	shuffle(NKEYS);
+
+	// what we do now: sort and hash the sorted stream
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	qsort(kp, NKEYS, sizeof(kp[0]), cmp_key);
+	spooky_init(&st, 0, 0);
+	for (i = 0; i < NKEYS; i++)
+		spooky_update(&st, kp[i], strlen(kp[i]) + 1);
+	spooky_final(&st, &h1, &h2);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("sort and hash: %.1lf ns per key\n", t * BILLION / NKEYS);
+	for (i = 0; i < NKEYS; i++)
+		lens[i] = strlen(kp[i]);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	mset_init(&m, 0);
+	for (i = 0; i < NKEYS; i++)
+		mset_add(&m, kp[i], lens[i]);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("one at a time: %.1lf ns per key\n", t * BILLION / NKEYS);
+
+	for (th = 1; th <= 4; th *= 2) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		mset_init(&m, 0);
+		mset_add_keys(&m, kp, lens, NKEYS, th);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("batch, %d threads: %.1lf ns per key\n", th,
+		       t * BILLION / NKEYS);
+	}
+
+	{
+		static uint64_t h[NKEYS][2];
+		int r;
+
+		for (i = 0; i < NKEYS; i++)
+			h[i][0] = h[i][1] = i * 0x9e3779b97f4a7c15ULL;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		mset_init(&m, 0);
+		for (r = 0; r < 100; r++)
+			mset_add_hashes(&m, h, NKEYS);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("summing hashes: %.2lf ns per hash\n",
+		       t * BILLION / NKEYS / 100);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		mset_init(&m, 0);
+		for (r = 0; r < 100; r++)
+			for (i = 0; i < NKEYS; i++)
+				mset_add_hash(&m, h[i][0], h[i][1]);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("adding one at a time: %.2lf ns per hash (%lx)\n",
+		       t * BILLION / NKEYS / 100, (unsigned long)m.lo & 0xf);
+	}
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestMset();
+	if (argc > 1)
+		DoTimingMset();
+
+	return failures != 0;
+}
@@ -0,0 +1,233 @@
+// Tests and benchmark for the hash table for untrusted keys
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "spooky-c.h"
+#include "safetab.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static const uint64_t zero_seed[2] = { 0, 0 };
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failures++;
+	}
+}
+
+// n keys of KEYLEN bytes whose hash under the zero seed has bits lo to
+// hi - 1 clear, as an attacker who knows that seed would send: in a table
+// of up to 2^hi slots they all start in the first 2^lo slots, and linear
+// probing piles them up into one run
+#define KEYLEN 16
+static char *colliding_keys(size_t n, unsigned lo, unsigned hi)
+{
+	char *keys = malloc(n * KEYLEN);
+	uint64_t mask = (1ULL << hi) - (1ULL << lo), i = 0;
+	size_t found = 0;
+
+	while (found < n) {
+		char *k = keys + found * KEYLEN;
+		uint64_t h1 = 0, h2 = 0;
+
+		snprintf(k, KEYLEN, "k%014llx", (unsigned long long)i++);
+		spooky_hash128(k, KEYLEN, &h1, &h2);
+		if ((h1 & mask) == 0)
+			found++;
+	}
+	return keys;
+}
+
+static char *random_keys(size_t n)
+{
+	char *keys = malloc(n * KEYLEN);
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		snprintf(keys + i * KEYLEN, KEYLEN, "r%07x%07x",
+			 rand() & 0xfffffff, (unsigned)i);
+	return keys;
+}
+
+static void check_all(const char *what, const struct safetab *t,
+		      const char *keys, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		void *v;
+
+		if (!safetab_get(t, keys + i * KEYLEN, KEYLEN, &v) ||
+		    v != (void *)(keys + i * KEYLEN)) {
+			printf("%s: key %zu lost\n", what, i);
+			failures++;
+			return;
+		}
+	}
+	if (t->n != n) {
+		printf("%s: %zu keys, expected %zu\n", what, t->n, n);
+		failures++;
+	}
+}
+
+#define NKEYS 20000
+void TestSafetab()
+{
+	char *keys = random_keys(NKEYS), *bad = colliding_keys(2000, 6, 12);
+	struct safetab t, t2;
+	size_t i;
+	void *v;
+
+	printf("\ntesting hash table for untrusted keys ...\n");
+
+	expect("init failed", safetab_init(&t, 0, NULL, 0) == 0);
+	safetab_init(&t2, 0, NULL, 0);
+	expect("seeds not random", t.seed[0] != t2.seed[0] ||
+	       t.seed[1] != t2.seed[1]);
+	safetab_free(&t2);
+
+	for (i = 0; i < NKEYS; i++)
+		safetab_put(&t, keys + i * KEYLEN, KEYLEN, keys + i * KEYLEN);
+	check_all("random keys", &t, keys, NKEYS);
+	expect("random keys caused a reseed", t.nreseeds == 0);
+	expect("replace not reported",
+	       safetab_put(&t, keys, KEYLEN, keys) == 1 && t.n == NKEYS);
+	expect("empty key", safetab_put(&t, NULL, 0, &t) == 0 &&
+	       safetab_get(&t, "", 0, &v) && v == &t);
+	safetab_delete(&t, "", 0);
+
+	// delete every other key; the rest must stay reachable
+	for (i = 0; i < NKEYS; i += 2)
+		expect("delete failed",
+		       safetab_delete(&t, keys + i * KEYLEN, KEYLEN) == 1);
+	for (i = 0; i < NKEYS; i++) {
+		if (safetab_get(&t, keys + i * KEYLEN, KEYLEN, NULL) != (int)(i & 1)) {
+			printf("key %zu wrong after deletes\n", i);
+			failures++;
+			break;
+		}
+	}
+	expect("deleted twice", safetab_delete(&t, keys, KEYLEN) == 0);
+	safetab_free(&t);
+
+	// a flood under a known seed is noticed and rehashed away
+	safetab_init(&t, 0, zero_seed, SAFETAB_NO_RESEED);
+	for (i = 0; i < 2000; i++)
+		safetab_put(&t, bad + i * KEYLEN, KEYLEN, bad + i * KEYLEN);
+	check_all("flood, fixed seed", &t, bad, 2000);
+	expect("flood did not collide", t.max_probe > 1000);
+	safetab_free(&t);
+
+	safetab_init(&t, 0, zero_seed, 0);
+	for (i = 0; i < 2000; i++)
+		safetab_put(&t, bad + i * KEYLEN, KEYLEN, bad + i * KEYLEN);
+	check_all("flood, reseeded", &t, bad, 2000);
+	expect("flood not detected", t.nreseeds > 0 &&
+	       t.seed[0] | t.seed[1]);
+	expect("flood probed too long", t.max_probe <= t.limit + 1);
+	for (i = 0; i < 2000; i += 3)
+		safetab_delete(&t, bad + i * KEYLEN, KEYLEN);
+	for (i = 0; i < 2000; i++) {
+		if (safetab_get(&t, bad + i * KEYLEN, KEYLEN, NULL) != (i % 3 != 0)) {
+			printf("flood key %zu wrong after deletes\n", i);
+			failures++;
+			break;
+		}
+	}
+	safetab_free(&t);
+
+	// identical hashes can't be reseeded away, but still work
+	safetab_init(&t, 0, NULL, 0);
+	t.limit = 2;
+	for (i = 0; i < 50; i++)
+		safetab_put(&t, keys + i * KEYLEN, KEYLEN, keys + i * KEYLEN);
+	check_all("tiny limit", &t, keys, 50);
+	safetab_free(&t);
+
+	free(keys);
+	free(bad);
+}
+
+static double insert_time(const char *keys, size_t n, const uint64_t *seed,
+			  int flags, struct safetab *t)
+{
+	struct timespec ts, tp;
+	size_t i;
+
+	safetab_init(t, 0, seed, flags);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < n; i++)
+		safetab_put(t, keys + i * KEYLEN, KEYLEN, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return ((tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION) *
+		BILLION / n;
+}
+
+#define NBENCH 1000000
+#define NFLOOD 20000
+void DoTimingSafetab()
+{
+	char *keys = random_keys(NBENCH), *bad;
+	struct timespec ts, tp;
+	struct safetab t;
+	double ns;
+	size_t i, found = 0;
+
+	printf("\ntesting time for %d random keys ...\n", NBENCH);
+	ns = insert_time(keys, NBENCH, NULL, 0, &t);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < NBENCH; i++)
+		found += safetab_get(&t, keys + i * KEYLEN, KEYLEN, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	printf("insert %.0lf ns, lookup %.0lf ns, longest probe %u of %u, %lu reseeds\n",
+	       ns, ((tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION) *
+	       BILLION / NBENCH, t.max_probe, t.limit,
+	       (unsigned long)t.nreseeds + (found != NBENCH));
+	safetab_free(&t);
+	ns = insert_time(keys, NBENCH, zero_seed, SAFETAB_NO_RESEED, &t);
+	printf("fixed seed: insert %.0lf ns\n", ns);
+	safetab_free(&t);
+
+	printf("\ntesting time for %d keys colliding under the zero seed ...\n",
+	       NFLOOD);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	bad = colliding_keys(NFLOOD, 10, 16);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	printf("(finding them took %.1lf s)\n",
+	       (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION);
+	ns = insert_time(bad, NFLOOD, zero_seed, SAFETAB_NO_RESEED, &t);
+	printf("fixed zero seed: insert %.0lf ns, longest probe %u\n", ns,
+	       t.max_probe);
+	safetab_free(&t);
+	ns = insert_time(bad, NFLOOD, NULL, 0, &t);
+	printf("random seed: insert %.0lf ns, longest probe %u, %lu reseeds\n",
+	       ns, t.max_probe, (unsigned long)t.nreseeds);
+	safetab_free(&t);
+	ns = insert_time(bad, NFLOOD, zero_seed, 0, &t);
+	printf("leaked zero seed: insert %.0lf ns, %lu reseeds\n", ns,
+	       (unsigned long)t.nreseeds);
+	safetab_free(&t);
+
+	free(keys);
+	free(bad);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestSafetab();
+	if (argc > 1)
+		DoTimingSafetab();
+
+	return failures != 0;
+}
@@ -0,0 +1,241 @@
+// Tests and benchmark for the persistent shared hash table
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "shtab.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+// the value stored for key k by writer w
+static void value_of(uint64_t k, uint64_t w, uint64_t *val, uint32_t *vlen)
+{
+	uint32_t i;
+
+	*vlen = 8 + k % 5 * 8;
+	for (i = 0; i < *vlen / 8; i++)
+		val[i] = k * 1000 + w;
+}
+
+// every key present must have a complete value from one of the writers
+static uint64_t check_values(const struct shtab *t, uint64_t nkeys,
+			     uint64_t nwriters)
+{
+	uint64_t k, found = 0;
+
+	for (k = 0; k < nkeys; k++) {
+		const uint64_t *v;
+		uint64_t w, i;
+		uint32_t vlen;
+
+		v = shtab_get(t, &k, sizeof(k), &vlen);
+		if (!v)
+			continue;
+		found++;
+		w = v[0] - k * 1000;
+		if (vlen != 8 + k % 5 * 8 || w >= nwriters)
+			goto bad;
+		for (i = 1; i < vlen / 8; i++)
+			if (v[i] != v[0])
+				goto bad;
+		continue;
+bad:
+		printf("key %lu has a torn value\n", (unsigned long)k);
+		failures++;
+		break;
+	}
+	return found;
+}
+
+#define NKEYS 100000
+#define NPROC 4
+void TestShtab()
+{
+	char file[] = "/tmp/spooky-shtabXXXXXX";
+	uint64_t val[8], k, w;
+	struct shtab t, t2;
+	const uint64_t *v;
+	uint32_t vlen;
+	int i, status;
+	pid_t pid[NPROC];
+
+	printf("\ntesting the shared hash table ...\n");
+
+	close(mkstemp(file));
+	shtab_create_file(&t, file, 2 * NKEYS, 128 * NKEYS, 5);
+	for (k = 0; k < NKEYS; k++) {
+		value_of(k, 0, val, &vlen);
+		if (shtab_put(&t, &k, sizeof(k), val, vlen) != 0) {
+			printf("insert failed\n");
+			failures++;
+			break;
+		}
+	}
+	// replace odd keys, delete every third
+	for (k = 1; k < NKEYS; k += 2) {
+		value_of(k, 1, val, &vlen);
+		if (shtab_put(&t, &k, sizeof(k), val, vlen) != 1) {
+			printf("replace failed\n");
+			failures++;
+			break;
+		}
+	}
+	for (k = 0; k < NKEYS; k += 3)
+		shtab_delete(&t, &k, sizeof(k));
+	k = NKEYS;
+	if (shtab_delete(&t, &k, sizeof(k)) != 0 ||
+	    t.h->nitems != NKEYS - (NKEYS + 2) / 3) {
+		printf("delete accounting wrong\n");
+		failures++;
+	}
+
+	// a second mapping sees the same table
+	if (shtab_open_file(&t2, file) < 0) {
+		printf("reopen failed\n");
+		failures++;
+		goto out;
+	}
+	for (k = 0; k < NKEYS; k++) {
+		v = shtab_get(&t2, &k, sizeof(k), &vlen);
+		if ((k % 3 == 0) != (v == NULL) ||
+		    (v && v[0] != k * 1000 + (k & 1))) {
+			printf("key %lu wrong after reopen\n", (unsigned long)k);
+			failures++;
+			break;
+		}
+	}
+	shtab_free(&t2);
+	shtab_free(&t);
+
+	// several processes inserting the same keys at once
+	shtab_create_file(&t, file, 2 * NKEYS, 64 * NKEYS * NPROC, 5);
+	for (i = 0; i < NPROC; i++) {
+		pid[i] = fork();
+		if (pid[i] == 0) {
+			struct shtab c;
+
+			if (shtab_open_file(&c, file) < 0)
+				_exit(1);
+			for (k = 0; k < NKEYS; k++) {
+				uint64_t key = (k * 7919 + i * 101) % NKEYS;
+
+				value_of(key, i, val, &vlen);
+				if (shtab_put(&c, &key, sizeof(key), val, vlen) < 0)
+					_exit(1);
+			}
+			_exit(0);
+		}
+	}
+	for (i = 0; i < NPROC; i++) {
+		waitpid(pid[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			printf("writer process failed\n");
+			failures++;
+		}
+	}
+	if (check_values(&t, NKEYS, NPROC) != NKEYS || t.h->nitems != NKEYS) {
+		printf("concurrent inserts lost or duplicated keys\n");
+		failures++;
+	}
+	shtab_free(&t);
+
+	// a writer killed in the middle leaves a consistent table
+	shtab_create_file(&t, file, 4 * NKEYS, 64 * NKEYS * 40, 5);
+	pid[0] = fork();
+	if (pid[0] == 0) {
+		for (w = 0; ; w = (w + 1) % 30) {
+			for (k = 0; k < NKEYS; k++) {
+				value_of(k, w, val, &vlen);
+				if (shtab_put(&t, &k, sizeof(k), val, vlen) < 0)
+					_exit(0);
+			}
+		}
+	}
+	usleep(50000);
+	kill(pid[0], SIGKILL);
+	waitpid(pid[0], &status, 0);
+	shtab_free(&t);
+	if (shtab_open_file(&t, file) < 0) {
+		printf("reopen after kill failed\n");
+		failures++;
+		goto out;
+	}
+	check_values(&t, NKEYS, 30);
+	shtab_free(&t);
+out:
+	unlink(file);
+}
+
+#define NBENCH 5000000
+void DoTimingShtab()
+{
+	char file[] = "/dev/shm/spooky-shtabXXXXXX";
+	char big[] = "/tmp/spooky-shtabbigXXXXXX";
+	struct timespec ts, tp;
+	struct shtab t;
+	uint64_t k, sum = 0;
+	uint32_t vlen;
+	double s;
+
+	printf("\ntesting time for %d keys ...\n", NBENCH);
+
+	close(mkstemp(file));
+	shtab_create_file(&t, file, 2 * NBENCH, 40ULL * NBENCH, 0);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (k = 0; k < NBENCH; k++)
+		shtab_put(&t, &k, sizeof(k), &k, sizeof(k));
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	s = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("put: %.1lf ns\n", s * BILLION / NBENCH);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (k = 0; k < NBENCH; k++) {
+		const uint64_t *v = shtab_get(&t, &k, sizeof(k), &vlen);
+
+		sum += v ? *v : 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	s = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("get: %.1lf ns (%lu)\n", s * BILLION / NBENCH,
+	       (unsigned long)sum);
+	shtab_free(&t);
+	unlink(file);
+
+	// attaching does not depend on the table size
+	close(mkstemp(big));
+	if (shtab_create_file(&t, big, 1ULL << 32, 16ULL << 30, 0) < 0) {
+		printf("no room for a 50 GB table\n");
+	} else {
+		shtab_put(&t, "key", 3, "value", 5);
+		shtab_free(&t);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		shtab_open_file(&t, big);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		s = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("attach to a %.0lf GB table: %.3lf ms (%s)\n",
+		       t.size / 1e9, s * 1e3,
+		       shtab_get(&t, "key", 3, &vlen) ? "found" : "lost");
+		shtab_free(&t);
+	}
+	unlink(big);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestShtab();
+	if (argc > 1)
+		DoTimingShtab();
+
+	return failures != 0;
+}
@@ -9,6 +9,11 @@
 #include <stdint.h>
 #include <time.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include "spooky-c.h"
 
@@ -243,6 +248,60 @@ void TestResults()
 }
 #undef BUFSIZE
 
+// known answers for spooky_fasthash64, lengths 0, 8, ... 504
+#define BUFSIZE (512)
+void TestResultsFast64()
+{
+	static const uint64_t expected[BUFSIZE/8] = {
+		0x232706fc6bf50919, 0x65314472ee193982, 0x8d4789b8f274736c,
+		0x99906c52d0639e68, 0x8382f14fe5cfc8b6, 0xe17837629856c65f,
+		0x39abf3dd390e5fdc, 0x120a211f6f3266c6, 0xa9833e20069c8bb7,
+		0x79a2a1fadb381902, 0xe5ca2e1cf57efa5d, 0x956f0569accadce7,
+		0x37d30c651499b81a, 0x5aad043a6e02ce8f, 0x8327c811d6f6fb84,
+		0x4f348360f858dab8, 0xfd8efb8c94e948ec, 0xcb09045e9e170082,
+		0x38af3b2b3918f07c, 0x2b4145095e29e199, 0xb94b69b2f17cfa14,
+		0x631ebb1c029ef587, 0x8c8d0d9b90a6a680, 0x1b5131c3e806ce10,
+		0x8b83ddb354c4aa51, 0xedf57bc246ce4da9, 0x84b7120fe5593728,
+		0xef504833b2cad013, 0x763bb10f9e7437be, 0xa22b8f361dc28007,
+		0x3d6ebbe6837e0623, 0x1b00f209713b75c1, 0x55ce10d8ddaa2d63,
+		0x40d48c65b3901fd1, 0x917e5b3d7b4cc505, 0xfa98d7143dd19459,
+		0xf76a28cf2010b0bd, 0x41975317ebd2a6cf, 0xf329ef628ff33624,
+		0x801466b1a1b05080, 0xb9233eed4c863a3a, 0x8f3cc5e820d1f68c,
+		0x63c6e97e01edea4a, 0x071adbddb60ccdb0, 0x8b2453360db0e9e0,
+		0xef27bd5214162044, 0x94b185250e0b7a35, 0xa7ba14be605b3f1d,
+		0xb480bb612d1d73de, 0xcf3e5ef44662b296, 0x7ae7bdb21141f958,
+		0x0dd08dd45668b0aa, 0x96d6c5bcc5788bf6, 0x64cf478047f97484,
+		0x8fe71a710439a182, 0xf2b8fbb230d883ef, 0x7190448bfbd911c0,
+		0xd66e0518c7726ad6, 0x3b5537eaf78711f4, 0xc9a2cd49b2abe707,
+		0xa4a5830cb601bcc7, 0xa6b0a30cab2a1085, 0x7c5d1f00fff1d9ee,
+		0x5224ce0048a65749
+	};
+
+	uint8_t buf[BUFSIZE];
+	uint64_t saw;
+	int i;
+
+	printf("\ntesting fasthash64 results ...\n");
+
+	for (i=0; i<BUFSIZE; ++i)
+	{
+		buf[i] = i+128;
+	}
+	for (i=0; i<BUFSIZE/8; ++i)
+	{
+		saw = spooky_fasthash64(buf, i*8, 0);
+		if (saw != expected[i])
+		{
+			printf("%d: saw 0x%.16"PRIx64", expected 0x%.16"PRIx64"\n", i*8, saw, expected[i]);
+		}
+		if (i*8 < 192 && saw != spooky_hash64(buf, i*8, 0))
+		{
+			printf("%d: fasthash64 differs from hash64 for a short message\n", i*8);
+		}
+	}
+}
+#undef BUFSIZE
+
 #define NUMBUF (1<<10)
 #define BUFSIZE (1<<20)
 void DoTimingBig(int seed)
@@ -340,6 +399,7 @@ void DoTimingSmall(int seed)
 	}
 }
 #undef BUFSIZE
+#undef NUMITER
 
 #define BUFSIZE 1024
 void TestAlignment()
@@ -461,6 +521,85 @@ void TestDeltas(int seed)
 #undef TRIES
 #undef MEASURES
 
+// the same for the 64 bits of spooky_fasthash64, for the lengths where
+// it takes the long path with the shortened final mixing
+#define MINSIZE 192
+#define BUFSIZE 256
+#define TRIES 50
+#define MEASURES 6
+void TestDeltasFast64(int seed)
+{
+	int h, i, j, k, l, m;
+	struct random_vector *mv;
+
+	mv = (struct random_vector *)malloc(sizeof(struct random_vector));
+	random_init(mv, (uint64_t)seed);
+
+	printf("\nall 1 or 2 bit input deltas get %d tries to flip every fasthash64 output bit ...\n", TRIES);
+
+	for (h=MINSIZE; h<BUFSIZE; ++h)
+	{
+		int maxk = 0;
+		for (i=0; i<h*8; ++i)
+		{
+			for (j=0; j<=i; ++j)
+			{
+				uint64_t measure[MEASURES];
+				uint64_t counter[MEASURES];
+				for (m=0; m<MEASURES; ++m)
+				{
+					counter[m] = 0;
+				}
+
+				for (k=0; k<TRIES; ++k)
+				{
+					uint8_t buf1[BUFSIZE];
+					uint8_t buf2[BUFSIZE];
+					uint64_t hseed = random_value(mv);
+					int done = 1;
+					for (l=0; l<h; ++l)
+					{
+						buf1[l] = buf2[l] = random_value(mv);
+					}
+					buf1[i/8] ^= (1 << (i%8));
+					if (j != i)
+					{
+						buf1[j/8] ^= (1 << (j%8));
+					}
+					measure[0] = spooky_fasthash64(buf1, h, hseed);
+					measure[1] = spooky_fasthash64(buf2, h, hseed);
+					measure[2] = measure[0] ^ measure[1];
+					measure[3] = ~(measure[0] ^ measure[1]);
+					measure[4] = measure[0] - measure[1];
+					measure[4] ^= (measure[4]>>1);
+					measure[5] = measure[0] + measure[1];
+					measure[5] ^= (measure[4]>>1);
+					for (m=0; m<MEASURES; ++m)
+					{
+						counter[m] |= measure[m];
+						if (~counter[m]) done = 0;
+					}
+					if (done) break;
+				}
+				if (k == TRIES)
+				{
+					printf("failed %d %d %d\n", h, i, j);
+				}
+				else if (k > maxk)
+				{
+					maxk = k;
+				}
+			}
+		}
+		printf("passed for buffer size %d  max %d\n", h, maxk);
+	}
+	free(mv);
+}
+#undef MINSIZE
+#undef BUFSIZE
+#undef TRIES
+#undef MEASURES
+
 // test that hashing pieces has the same behavior as hashing the whole
 #define BUFSIZE 1024
 void TestPieces()
@@ -523,16 +662,505 @@ void TestPieces()
 }
 #undef BUFSIZE
 
+// spooky_hash128 and spooky_init/update/final against the values of
+// Bob's C++ SpookyV2, across the short/long boundary and partial blocks
+void TestVectors()
+{
+	static const struct
+	{
+		size_t length;
+		uint64_t hash1, hash2;
+	} expected[] = {
+		{    0, 0x796a9114ad323301ULL, 0x7e9250a12f6b5879ULL },
+		{    1, 0xb0f3babc07dda2beULL, 0xa4dbf921389ba1eaULL },
+		{   15, 0x3c9557ce9d280d46ULL, 0x560623afb277fe04ULL },
+		{   16, 0xea0b15a353ebb756ULL, 0x71be50842e8c30fcULL },
+		{   31, 0xa87d0649d61cc5bbULL, 0x883b20dfea9772d3ULL },
+		{   32, 0xa236e3c9418e7419ULL, 0x5e1a57818c98a519ULL },
+		{   95, 0xa655cdd6ba364fd6ULL, 0x70d631f3dd0068e7ULL },
+		{   96, 0x849f1ede17f70dbcULL, 0x2c42f974e3e5dbf0ULL },
+		{  191, 0x545d1abff622d4a0ULL, 0xcce4c556161835d5ULL },
+		{  192, 0xde229e300d3c7ffbULL, 0x1a9b83f547365470ULL },
+		{  193, 0x00370a2bfa9da1daULL, 0x041ddceccf2441abULL },
+		{  200, 0x1bd84100072d2091ULL, 0x3c2b478ac7e9284aULL },
+		{  287, 0x95d2c0763a9027d3ULL, 0x8932e7a44163626fULL },
+		{  288, 0xa034bf60e012ad49ULL, 0x4221eb23de9e3058ULL },
+		{ 1000, 0xf02cd634f69aeeefULL, 0x533cb049d46f9978ULL },
+		{ 4096, 0xd77a56d4bf2ddabeULL, 0x6d085407acdb22deULL },
+	};
+	uint8_t buf[4096];
+	struct spooky_state state;
+	uint64_t a, b, c, d;
+	size_t i, k, len;
+
+	printf("\ntesting vectors ...\n");
+
+	for (i=0; i<sizeof(buf); ++i)
+	{
+		buf[i] = i*7+3;
+	}
+	for (k=0; k<sizeof(expected)/sizeof(expected[0]); ++k)
+	{
+		len = expected[k].length;
+		a = k;
+		b = ~(uint64_t)k;
+		spooky_hash128(buf, len, &a, &b);
+		spooky_init(&state, k, ~(uint64_t)k);
+		spooky_update(&state, buf, len/3);
+		spooky_update(&state, buf + len/3, len - len/3);
+		spooky_final(&state, &c, &d);
+		if (a != expected[k].hash1 || b != expected[k].hash2)
+		{
+			printf("vector %zu: saw %.16"PRIx64" %.16"PRIx64"\n", len, a, b);
+		}
+		if (c != expected[k].hash1 || d != expected[k].hash2)
+		{
+			printf("vector %zu final: saw %.16"PRIx64" %.16"PRIx64"\n", len, c, d);
+		}
+	}
+}
+
+// test that hashing four messages at once matches hashing them one by one
+#define BUFSIZE 1024
+void TestX4()
+{
+	uint8_t buf[4][BUFSIZE+3];
+	int i, k;
+
+	printf("\ntesting x4 ...\n");
+
+	for (k=0; k<4; ++k)
+	{
+		for (i=0; i<BUFSIZE+3; ++i)
+		{
+			buf[k][i] = i*(k+3);
+		}
+	}
+	for (i=0; i<BUFSIZE; ++i)
+	{
+		const void *msg[4];
+		uint64_t h1[4], h2[4];
+		for (k=0; k<4; ++k)
+		{
+			msg[k] = buf[k] + k;
+			h1[k] = k;
+			h2[k] = i;
+		}
+		spooky_hash128_x4(msg, i, h1, h2);
+		for (k=0; k<4; ++k)
+		{
+			uint64_t a = k, b = i;
+			spooky_hash128(msg[k], i, &a, &b);
+			if (a != h1[k] || b != h2[k])
+			{
+				printf("x4 mismatch %d %d: %.16"PRIx64" %.16"PRIx64"\n", i, k, a, h1[k]);
+			}
+		}
+	}
+}
+#undef BUFSIZE
+
+// test that the folding variants match hashing a folded copy
+#define BUFSIZE 600
+static size_t fold_copy(uint8_t *out, const uint8_t *in, size_t len, int flags)
+{
+	size_t i, n = 0;
+
+	if (flags & SPOOKY_FOLD_TRIM)
+	{
+		while (len > 0 && strchr(" \t\r\n", in[0]) && in[0])
+		{
+			in++;
+			len--;
+		}
+		while (len > 0 && strchr(" \t\r\n", in[len-1]) && in[len-1])
+			len--;
+	}
+	if ((flags & SPOOKY_FOLD_DOT) && len > 0 && in[len-1] == '.')
+		len--;
+	for (i=0; i<len; ++i)
+	{
+		uint8_t c = in[i];
+		if ((flags & SPOOKY_FOLD_CASE) && c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		out[n++] = c;
+	}
+	return n;
+}
+
+void TestFold()
+{
+	static const char pad[] = " \t.A\r\n";
+	uint8_t buf[BUFSIZE+8], copy[BUFSIZE+8];
+	int i, j, flags;
+
+	printf("\ntesting fold ...\n");
+
+	srand(1);
+	for (i=0; i<BUFSIZE; ++i)
+	{
+		for (flags=0; flags<8; ++flags)
+		{
+			int align = rand() % 8;
+			uint64_t a = i, b = flags, c = i, d = flags;
+			size_t n;
+
+			for (j=0; j<i; ++j)
+			{
+				// mostly letters and blanks, so trimming has something to do
+				int r = rand();
+				if (r % 4 == 0)
+					buf[align+j] = r >> 8;
+				else if (r % 4 == 1)
+					buf[align+j] = pad[(r >> 8) % 6];
+				else
+					buf[align+j] = '@' + (r >> 8) % 28;
+			}
+			n = fold_copy(copy, buf+align, i, flags);
+			spooky_hash128_fold(buf+align, i, &a, &b, flags);
+			spooky_hash128(copy, n, &c, &d);
+			if (a != c || b != d)
+			{
+				printf("fold mismatch %d %d: %.16"PRIx64" %.16"PRIx64"\n", i, flags, a, c);
+			}
+			if (spooky_hash64_fold(buf+align, i, i, flags) !=
+			    spooky_hash64(copy, n, i))
+			{
+				printf("fold64 mismatch %d %d\n", i, flags);
+			}
+		}
+	}
+	if (spooky_hash64_fold("  Example.COM.\n", 15, 0, 7) !=
+	    spooky_hash64("example.com", 11, 0))
+	{
+		printf("fold of a host name failed\n");
+	}
+}
+#undef BUFSIZE
+
+// test that hashing C strings matches strlen and hash, including strings
+// that end right before an unmapped page
+#define BUFSIZE 600
+void TestCstr()
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	char *page = mmap(NULL, 2*pagesize, PROT_READ|PROT_WRITE,
+			  MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	char buf[BUFSIZE+64];
+	int i, align;
+
+	printf("\ntesting cstr ...\n");
+
+	if (page == MAP_FAILED || mprotect(page + pagesize, pagesize, PROT_NONE))
+	{
+		printf("cannot map a guard page\n");
+		return;
+	}
+	for (i=0; i<BUFSIZE; ++i)
+	{
+		for (align=0; align<32; ++align)
+		{
+			char *str = buf + align;
+			uint64_t a = i, b = align, c = i, d = align;
+			size_t len = 0;
+
+			memset(str, 'a' + (i+align) % 26, i);
+			str[i] = 0;
+			str[i+1] = 0x55;
+			spooky_hash128_cstr(str, &a, &b, &len);
+			spooky_hash128(str, i, &c, &d);
+			if (a != c || b != d || len != (size_t)i)
+			{
+				printf("cstr mismatch %d %d: %.16"PRIx64" %.16"PRIx64"\n", i, align, a, c);
+			}
+			if (i < pagesize)
+			{
+				// the terminator is the last byte of the page
+				str = page + pagesize - i - 1;
+				memcpy(str, buf + align, i + 1);
+				if (spooky_hash64_cstr(str, i, NULL) != spooky_hash64(str, i, i))
+				{
+					printf("cstr at a page end mismatch %d\n", i);
+				}
+			}
+		}
+	}
+	munmap(page, 2*pagesize);
+}
+#undef BUFSIZE
+
+// compare hashing C strings in one pass with strlen and then hashing,
+// over a table of strings of random lengths up to a limit
+#define NUMSTR 4096
+#define NUMITER 2000
+void DoTimingCstr(int seed)
+{
+	static const int lens[] = { 8, 16, 32, 64, 160 };
+	static char pool[NUMSTR][168];
+	struct timespec ts, tp;
+	size_t k;
+	int i, j;
+
+	printf("\ntesting timing of hashing %d C strings %d times ...\n", NUMSTR, NUMITER);
+
+	srand(seed);
+	for (k=0; k<sizeof(lens)/sizeof(lens[0]); ++k)
+	{
+		uint64_t h = 0, h2 = 0;
+		double t, t2;
+
+		for (i=0; i<NUMSTR; ++i)
+		{
+			int len = rand() % lens[k];
+			memset(pool[i], 'a' + i % 26, len);
+			pool[i][len] = 0;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		for (j=0; j<NUMITER; ++j)
+			for (i=0; i<NUMSTR; ++i)
+				h ^= spooky_hash64(pool[i], strlen(pool[i]), j);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		for (j=0; j<NUMITER; ++j)
+			for (i=0; i<NUMSTR; ++i)
+				h2 ^= spooky_hash64_cstr(pool[i], j, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t2 = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("up to %d bytes: strlen+hash %.1lf ns, cstr %.1lf ns%s\n",
+		       lens[k] - 1, t * BILLION / NUMITER / NUMSTR,
+		       t2 * BILLION / NUMITER / NUMSTR,
+		       h == h2 ? "" : " (different hashes)");
+	}
+}
+#undef NUMITER
+#undef NUMSTR
+
+// test that short keys hash the same at the end of a page, where the tail
+// can't be read with a load past the key, as anywhere else
+void TestShortTail()
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	uint8_t *page = mmap(NULL, 2*pagesize, PROT_READ|PROT_WRITE,
+			     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	uint8_t buf[64];
+	int i, align;
+
+	printf("\ntesting short tails ...\n");
+
+	if (page == MAP_FAILED || mprotect(page + pagesize, pagesize, PROT_NONE))
+	{
+		printf("cannot map a guard page\n");
+		return;
+	}
+	for (i=0; i<64; ++i)
+	{
+		buf[i] = i*7 + 1;
+	}
+	for (i=0; i<64; ++i)
+	{
+		for (align=0; align<32; ++align)
+		{
+			uint8_t *end = page + pagesize - i;
+			uint64_t a = i, b = align, c = i, d = align;
+
+			memcpy(end, buf, i);
+			memcpy(page + align, buf, i);
+			spooky_shorthash(end, i, &a, &b);
+			spooky_shorthash(page + align, i, &c, &d);
+			if (a != c || b != d)
+			{
+				printf("short tail mismatch %d %d: %.16"PRIx64" %.16"PRIx64"\n", i, align, a, c);
+			}
+		}
+	}
+	munmap(page, 2*pagesize);
+}
+
+// time short keys of random lengths, which defeat the branch predictor
+// when the tail is handled case by case, against the same keys sorted by
+// length
+#define NUMKEYS 4096
+#define NUMITER 2000
+void DoTimingShortTail(int seed)
+{
+	static const int maxlen[] = { 16, 32, 64 };
+	static uint8_t buf[NUMKEYS + 64];
+	static uint16_t len[NUMKEYS], off[NUMKEYS];
+	struct timespec ts, tp;
+	size_t k;
+	int i, j, sorted;
+
+	printf("\ntesting timing of hashing %d short keys of random length %d times ...\n", NUMKEYS, NUMITER);
+
+	srand(seed);
+	for (i=0; i<NUMKEYS + 64; ++i)
+	{
+		buf[i] = rand();
+	}
+	for (k=0; k<sizeof(maxlen)/sizeof(maxlen[0]); ++k)
+	{
+		for (sorted=0; sorted<2; ++sorted)
+		{
+			uint64_t h = 0;
+			double t;
+
+			for (i=0; i<NUMKEYS; ++i)
+			{
+				len[i] = sorted ? i * maxlen[k] / NUMKEYS : rand() % maxlen[k];
+				off[i] = rand() % NUMKEYS;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			for (j=0; j<NUMITER; ++j)
+			{
+				for (i=0; i<NUMKEYS; ++i)
+				{
+					uint64_t h1 = j, h2 = j;
+					spooky_shorthash(buf + off[i], len[i], &h1, &h2);
+					h ^= h1;
+				}
+			}
+			clock_gettime(CLOCK_MONOTONIC, &tp);
+			t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+			printf("0 to %d bytes, %s: %.2lf ns per key (%x)\n", maxlen[k] - 1,
+			       sorted ? "sorted" : "random", t * BILLION / NUMITER / NUMKEYS,
+			       (unsigned)(h & 0xf));
+		}
+	}
+}
+#undef NUMITER
+#undef NUMKEYS
+
+// test that the integer array kernels match spooky_hash64 of each integer,
+// for counts that end in every position of a vector
+#define NUMWORDS 67
+void TestWords()
+{
+	uint64_t v64[NUMWORDS + 1], out[NUMWORDS];
+	uint32_t v32[NUMWORDS + 1];
+	int i, n, off;
+
+	printf("\ntesting integer arrays ...\n");
+
+	for (i=0; i<NUMWORDS+1; ++i)
+	{
+		v64[i] = (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+		v32[i] = (uint32_t)(v64[i] >> 17);
+	}
+	v64[3] = 0;
+	v64[4] = ~(uint64_t)0;
+	for (n=0; n<=NUMWORDS-1; ++n)
+	{
+		for (off=0; off<2; ++off)
+		{
+			spooky_hash64_u64(v64 + off, n, n, out);
+			for (i=0; i<n; ++i)
+			{
+				uint64_t h = spooky_hash64(&v64[off+i], 8, n);
+				if (out[i] != h)
+				{
+					printf("u64 mismatch %d %d: %.16"PRIx64" %.16"PRIx64"\n", n, i, h, out[i]);
+				}
+			}
+			spooky_hash64_u32(v32 + off, n, n, out);
+			for (i=0; i<n; ++i)
+			{
+				uint64_t h = spooky_hash64(&v32[off+i], 4, n);
+				if (out[i] != h)
+				{
+					printf("u32 mismatch %d %d: %.16"PRIx64" %.16"PRIx64"\n", n, i, h, out[i]);
+				}
+			}
+		}
+	}
+}
+#undef NUMWORDS
+
+static inline uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// throughput of the integer array kernels against one spooky_hash64 call
+// per integer, in hashes per (TSC) cycle
+#define NUMWORDS 4096
+#define NUMITER 5000
+void DoTimingWords(int seed)
+{
+	static uint64_t v64[NUMWORDS], out[NUMWORDS];
+	static uint32_t v32[NUMWORDS];
+	struct timespec ts, tp;
+	uint64_t c0, c1, h = 0;
+	double t[3], c[3];
+	int i, j, k;
+
+	printf("\ntesting timing of hashing %d integers %d times ...\n", NUMWORDS, NUMITER);
+
+	for (i=0; i<NUMWORDS; ++i)
+	{
+		v64[i] = i + seed;
+		v32[i] = i + seed;
+	}
+	for (k=0; k<3; ++k)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		c0 = cycles();
+		for (j=0; j<NUMITER; ++j)
+		{
+			if (k == 0)
+			{
+				for (i=0; i<NUMWORDS; ++i)
+					out[i] = spooky_hash64(&v64[i], 8, j);
+			}
+			else if (k == 1)
+				spooky_hash64_u64(v64, NUMWORDS, j, out);
+			else
+				spooky_hash64_u32(v32, NUMWORDS, j, out);
+			h ^= out[j % NUMWORDS];
+		}
+		c1 = cycles();
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t[k] = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		c[k] = (double)(c1 - c0);
+	}
+	for (k=0; k<3; ++k)
+	{
+		static const char *name[] = { "spooky_hash64    ", "spooky_hash64_u64", "spooky_hash64_u32" };
+		double n = (double)NUMWORDS * NUMITER;
+
+		printf("%s: %.2lf ns per hash, %.3lf hashes per cycle\n", name[k],
+		       t[k] * BILLION / n, c[k] > 0 ? n / c[k] : 0.0);
+	}
+	printf("(%x)\n", (unsigned)(h & 0xf));
+}
+#undef NUMITER
+#undef NUMWORDS
+
 int main(int argc, const char **argv)
 {
 	(void) argv;
 
 	TestResults();
+	TestResultsFast64();
 	TestAlignment();
 	TestPieces();
+	TestVectors();
+	TestX4();
+	TestFold();
+	TestCstr();
+	TestShortTail();
+	TestWords();
 	DoTimingBig(argc);
 	DoTimingSmall(argc);
+	DoTimingCstr(argc);
+	DoTimingShortTail(argc);
+	DoTimingWords(argc);
 	TestDeltas(argc);
+	TestDeltasFast64(argc);
 
 	return 0;
 }
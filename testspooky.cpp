@@ -476,11 +476,66 @@ void TestPieces()
 }
 #undef BUFSIZE
 
+// test that the compile time length templates match the plain calls
+template <size_t N>
+static void CheckFixed(const char *buf)
+{
+    uint64 a=1, b=2, c=1, d=2, e, f;
+
+    SpookyHash::Hash128(buf, N, &a, &b);
+    SpookyHash::Hash128<N>(buf, &c, &d);
+    SpookyHash::Hash128<N, 1, 2>(buf, &e, &f);
+    if (a != c || b != d)
+    {
+        printf("Hash128<%d> wrong: %.16llx %.16llx\n", (int)N, a, c);
+    }
+    if (a != e || b != f)
+    {
+        printf("Hash128<%d, 1, 2> wrong: %.16llx %.16llx\n", (int)N, a, e);
+    }
+    if (SpookyHash::Hash64<N>(buf, 3) != SpookyHash::Hash64(buf, N, 3) ||
+        SpookyHash::Hash64<N, 3>(buf) != SpookyHash::Hash64(buf, N, 3))
+    {
+        printf("Hash64<%d> wrong\n", (int)N);
+    }
+}
+
+// lengths around the 16 and 32 byte steps of the short hash, the 192 byte
+// switch to the long hash, its 96 byte blocks, and the longest unrolled
+// message
+#define BUFSIZE 2048
+void TestFixed()
+{
+    printf("\ntesting fixed lengths ...\n");
+    static char buf[BUFSIZE+1];
+    for (int i=0; i<BUFSIZE+1; ++i)
+    {
+        buf[i] = (char)(i*7 + 3);
+    }
+    for (int k=0; k<2; ++k)
+    {
+        const char *p = buf + k;    // and misaligned
+
+        CheckFixed<0>(p);    CheckFixed<1>(p);    CheckFixed<7>(p);
+        CheckFixed<8>(p);    CheckFixed<9>(p);    CheckFixed<15>(p);
+        CheckFixed<16>(p);   CheckFixed<17>(p);   CheckFixed<31>(p);
+        CheckFixed<32>(p);   CheckFixed<33>(p);   CheckFixed<47>(p);
+        CheckFixed<48>(p);   CheckFixed<63>(p);   CheckFixed<64>(p);
+        CheckFixed<95>(p);   CheckFixed<96>(p);   CheckFixed<97>(p);
+        CheckFixed<191>(p);  CheckFixed<192>(p);  CheckFixed<193>(p);
+        CheckFixed<287>(p);  CheckFixed<288>(p);  CheckFixed<289>(p);
+        CheckFixed<1000>(p); CheckFixed<1535>(p); CheckFixed<1536>(p);
+        CheckFixed<1537>(p); CheckFixed<1632>(p); CheckFixed<2048>(p);
+    }
+}
+#undef BUFSIZE
+
 int main(int argc, const char **argv)
 {
     TestResults();
     TestAlignment();
     TestPieces();
+    TestFixed();
     DoTimingBig(argc);
     DoTimingSmall(argc);
     TestDeltas(argc);
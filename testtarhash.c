@@ -0,0 +1,309 @@
+// Tests and benchmark for per-member hashes of tar archives
+//
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "spooky-c.h"
+#include "tarhash.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failures++;
+	}
+}
+
+// store the size field of a header, in base-256 as GNU tar does for
+// sizes too big for octal, and update the checksum
+static void set_size(unsigned char *h, uint64_t size, int base256)
+{
+	unsigned sum = 0;
+	int i;
+
+	if (base256) {
+		memset(h + 124, 0, 12);
+		h[124] = 0x80;
+		for (i = 0; i < 8; i++)
+			h[135 - i] = size >> (8 * i);
+	} else {
+		snprintf((char *)h + 124, 12, "%011llo", (unsigned long long)size);
+	}
+	memset(h + 148, ' ', 8);
+	for (i = 0; i < 512; i++)
+		sum += h[i];
+	snprintf((char *)h + 148, 8, "%06o", sum);
+}
+
+// append a ustar header for a member and its data at off, returning the
+// offset after it
+static size_t add(unsigned char *buf, size_t off, const char *name,
+		  const char *prefix, char type, const void *data,
+		  uint64_t size)
+{
+	unsigned char *h = buf + off;
+
+	memset(h, 0, 512);
+	strncpy((char *)h, name, 100);
+	memcpy(h + 100, "0000644", 7);
+	memcpy(h + 108, "0001750", 7);
+	memcpy(h + 116, "0001750", 7);
+	memcpy(h + 136, "14371573640", 11);
+	h[156] = type;
+	memcpy(h + 257, "ustar", 6);
+	memcpy(h + 263, "00", 2);
+	if (prefix)
+		strncpy((char *)h + 345, prefix, 155);
+	set_size(h, size, 0);
+	off += 512;
+	if (type >= '1' && type <= '6')
+		return off;
+	memcpy(buf + off, data, size);
+	memset(buf + off + size, 0, (512 - size % 512) % 512);
+	return off + (size + 511) / 512 * 512;
+}
+
+static size_t finish(unsigned char *buf, size_t off)
+{
+	memset(buf + off, 0, 1024);
+	return off + 1024;
+}
+
+static int member_ok(const struct tarhash *t, size_t i, const char *name,
+		     char type, const void *data, uint64_t size)
+{
+	uint64_t h1 = t->seed, h2 = t->seed;
+
+	spooky_hash128(data, size, &h1, &h2);
+	if (i >= t->n || strcmp(t->m[i].name, name) != 0 ||
+	    t->m[i].type != type || t->m[i].size != size ||
+	    t->m[i].hash[0] != h1 || t->m[i].hash[1] != h2) {
+		printf("member %zu (%s) wrong\n", i, name);
+		failures++;
+		return 0;
+	}
+	return 1;
+}
+
+#define BUF (4 << 20)
+void TestTarhash()
+{
+	unsigned char *buf = calloc(BUF, 1), *data = malloc(1 << 20);
+	char long_name[301], pax[600], file[] = "/tmp/spooky-tarXXXXXX";
+	struct tarhash t, t2;
+	size_t off = 0, hoff, size, i, lines;
+	FILE *f;
+	int th, c;
+
+	printf("\ntesting tar member hashes ...\n");
+
+	for (i = 0; i < 1 << 20; i++)
+		data[i] = rand();
+	memset(long_name, 'x', 300);
+	long_name[300] = 0;
+	snprintf(pax, sizeof(pax), "%d path=pax/name\n%d size=5000\n",
+		 (int)strlen(" path=pax/name\n") + 2,
+		 (int)strlen(" size=5000\n") + 2);
+
+	off = add(buf, off, "empty", NULL, '0', data, 0);
+	off = add(buf, off, "small", NULL, '0', data, 17);
+	off = add(buf, off, "dir/", NULL, '5', NULL, 0);
+	off = add(buf, off, "big", "dir", '0', data, 1 << 20);
+	off = add(buf, off, "link", NULL, '2', NULL, 0);
+	off = add(buf, off, "././@LongLink", NULL, 'L', long_name, 301);
+	off = add(buf, off, "truncated", NULL, '0', data + 1, 511);
+	off = add(buf, off, "PaxHeaders/x", NULL, 'x', pax, strlen(pax));
+	// the pax size replaces the one in the header
+	hoff = off;
+	off = add(buf, off, "ignored", NULL, '0', data + 2, 5000);
+	set_size(buf + hoff, 0, 0);
+	size = finish(buf, off);
+
+	expect("valid archive rejected", tarhash_build(&t, buf, size, 3, 1) == 0);
+	expect("wrong number of members", t.n == 7);
+	member_ok(&t, 0, "empty", '0', data, 0);
+	member_ok(&t, 1, "small", '0', data, 17);
+	member_ok(&t, 2, "dir/", '5', NULL, 0);
+	member_ok(&t, 3, "dir/big", '0', data, 1 << 20);
+	member_ok(&t, 4, "link", '2', NULL, 0);
+	member_ok(&t, 5, long_name, '0', data + 1, 511);
+	member_ok(&t, 6, "pax/name", '0', data + 2, 5000);
+
+	// the result doesn't depend on the number of threads
+	for (th = 2; th <= 8; th *= 2) {
+		tarhash_build(&t2, buf, size, 3, th);
+		expect("threaded digest differs", t2.n == t.n &&
+		       t2.digest[0] == t.digest[0] &&
+		       t2.digest[1] == t.digest[1] &&
+		       t2.m[3].hash[0] == t.m[3].hash[0]);
+		tarhash_free(&t2);
+	}
+
+	// and does depend on names, contents and the seed
+	tarhash_build(&t2, buf, size, 4, 1);
+	expect("seed ignored", t2.digest[0] != t.digest[0]);
+	tarhash_free(&t2);
+	buf[t.m[1].offset + 3] ^= 1;
+	tarhash_build(&t2, buf, size, 3, 1);
+	expect("changed data not noticed", t2.digest[0] != t.digest[0] &&
+	       t2.m[1].hash[0] != t.m[1].hash[0] &&
+	       t2.m[3].hash[0] == t.m[3].hash[0]);
+	tarhash_free(&t2);
+	buf[t.m[1].offset + 3] ^= 1;
+
+	// one zero block or none is also an end
+	expect("missing end rejected", tarhash_build(&t2, buf, off, 3, 2) == 0 &&
+	       t2.digest[0] == t.digest[0]);
+	tarhash_free(&t2);
+
+	// file input and the written manifest
+	c = mkstemp(file);
+	expect("cannot write test file", c >= 0 && write(c, buf, size) ==
+	       (ssize_t)size);
+	close(c);
+	expect("file build failed", tarhash_build_file(&t2, file, 3, 2) == 0 &&
+	       t2.digest[0] == t.digest[0]);
+	tarhash_free(&t2);
+	f = fopen(file, "w+");
+	t.m[0].name[0] = '\n';
+	tarhash_write(&t, f);
+	rewind(f);
+	for (lines = 0; (c = getc(f)) != EOF;)
+		lines += c == '\n';
+	fclose(f);
+	expect("wrong number of manifest lines", lines == t.n + 1);
+	// an empty file is an archive without members, as for tar
+	expect("empty file rejected", truncate(file, 0) == 0 &&
+	       tarhash_build_file(&t2, file, 3, 2) == 0 && t2.n == 0);
+	tarhash_free(&t2);
+	unlink(file);
+
+	// broken archives
+	buf[t.m[1].offset - 512] ^= 1;
+	errno = 0;
+	expect("bad checksum accepted", tarhash_build(&t2, buf, size, 3, 1) < 0 &&
+	       errno == EINVAL);
+	buf[t.m[1].offset - 512] ^= 1;
+	expect("truncated member accepted",
+	       tarhash_build(&t2, buf, t.m[3].offset + 1000, 3, 1) < 0);
+	tarhash_free(&t);
+
+	// sizes too big for octal fields
+	add(buf, 0, "huge", NULL, '0', data, 20);
+	set_size(buf, 1ULL << 34, 1);
+	expect("huge member accepted", tarhash_build(&t2, buf, 1024, 3, 1) < 0);
+	set_size(buf, 20, 1);
+	expect("base-256 size not read", tarhash_build(&t2, buf, 1024, 3, 1) == 0 &&
+	       t2.n == 1 && t2.m[0].size == 20);
+	tarhash_free(&t2);
+
+	// old GNU headers have "ustar  " and no prefix, whatever is at 345
+	add(buf, 0, "gnu", "atime", '0', data, 20);
+	memcpy(buf + 257, "ustar  ", 8);
+	set_size(buf, 20, 0);
+	expect("old GNU header given a prefix",
+	       tarhash_build(&t2, buf, 1024, 3, 1) == 0 && t2.n == 1 &&
+	       strcmp(t2.m[0].name, "gnu") == 0);
+	tarhash_free(&t2);
+
+	free(buf);
+	free(data);
+}
+
+#define NBENCH_BYTES (256 << 20)
+void DoTimingTarhash()
+{
+	char file[] = "/tmp/spooky-tarXXXXXX", dir[] = "/tmp/spooky-untarXXXXXX";
+	unsigned char *buf = malloc(NBENCH_BYTES + (64 << 20));
+	unsigned char *data = malloc(4 << 20);
+	struct timespec ts, tp;
+	struct tarhash t;
+	size_t off = 0, i, n = 0;
+	double tm;
+	int th, fd;
+
+	for (i = 0; i < 4 << 20; i++)
+		data[i] = rand();
+	// mostly small files, most of the bytes in a few large ones
+	while (off < NBENCH_BYTES) {
+		char name[32];
+		size_t len = rand() % 8 ? rand() % 16384 : rand() % (4 << 20);
+
+		snprintf(name, sizeof(name), "file%zu", n++);
+		off = add(buf, off, name, NULL, '0', data, len);
+	}
+	off = finish(buf, off);
+	fd = mkstemp(file);
+	if (write(fd, buf, off) != (ssize_t)off)
+		printf("cannot write %s\n", file);
+	close(fd);
+
+	printf("\ntesting time to hash %zu members, %zu MB ...\n", n, off >> 20);
+	for (th = 1; th <= 4; th *= 2) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		tarhash_build_file(&t, file, 0, th);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		tm = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("in place, %d threads: %.3lf s, %.0lf MB/s\n", th, tm,
+		       off / tm / (1 << 20));
+		if (th < 4)
+			tarhash_free(&t);
+	}
+
+	// what it replaces: write every member to a file, then hash the file
+	mkdtemp(dir);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < t.n; i++) {
+		char path[64];
+
+		snprintf(path, sizeof(path), "%s/%zu", dir, i);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (write(fd, buf + t.m[i].offset, t.m[i].size) < 0)
+			printf("cannot write %s\n", path);
+		close(fd);
+	}
+	for (i = 0; i < t.n; i++) {
+		char path[64];
+		uint64_t h1 = 0, h2 = 0;
+		ssize_t got;
+
+		snprintf(path, sizeof(path), "%s/%zu", dir, i);
+		fd = open(path, O_RDONLY);
+		got = read(fd, data, 4 << 20);
+		spooky_hash128(data, got > 0 ? got : 0, &h1, &h2);
+		close(fd);
+		unlink(path);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	tm = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+	printf("extract and hash: %.3lf s, %.0lf MB/s\n", tm,
+	       off / tm / (1 << 20));
+	rmdir(dir);
+	unlink(file);
+	tarhash_free(&t);
+	free(buf);
+	free(data);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestTarhash();
+	if (argc > 1)
+		DoTimingTarhash();
+
+	return failures != 0;
+}
@@ -0,0 +1,298 @@
+// Tests and benchmark for theta sketches
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "spooky-c.h"
+#include "theta.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failures++;
+	}
+}
+
+// the sketch of the keys lo..hi-1, 8 byte integers
+static void sketch_range(struct theta_compact *c, uint32_t k, uint64_t lo,
+			 uint64_t hi, uint64_t seed)
+{
+	struct theta_sketch s;
+	uint64_t i;
+
+	theta_init(&s, k, seed);
+	for (i = lo; i < hi; i++)
+		theta_update(&s, &i, sizeof(i));
+	theta_compact(c, &s);
+	theta_free(&s);
+}
+
+static int same(const struct theta_compact *a, const struct theta_compact *b)
+{
+	return a->theta == b->theta && a->n == b->n &&
+	       memcmp(a->h, b->h, a->n * sizeof(uint64_t)) == 0;
+}
+
+// estimate within tol of want, as a fraction of scale
+static void check_estimate(const char *what, double est, double want,
+			   double scale, double tol)
+{
+	if (fabs(est - want) > tol * scale) {
+		printf("%s: estimated %.0lf, expected %.0lf\n", what, est, want);
+		failures++;
+	}
+}
+
+#define NKEYS 1000000
+void TestTheta()
+{
+	static uint64_t hashes[NKEYS];
+	static uint64_t keys[NKEYS];
+	static const void *ptr[NKEYS];
+	static size_t lens[NKEYS];
+	struct theta_sketch s, t;
+	struct theta_compact a, b, c, d, v;
+	double lo, hi;
+	uint64_t i;
+	char *buf;
+
+	printf("\ntesting theta sketches ...\n");
+
+	// below k everything is kept and counted exactly
+	theta_init(&s, 4096, 0);
+	for (i = 0; i < 3000; i++) {
+		theta_update(&s, &i, sizeof(i));
+		theta_update(&s, &i, sizeof(i));
+	}
+	expect("small set not exact", theta_sketch_estimate(&s) == 3000);
+	theta_compact(&a, &s);
+	expect("small compact not exact", theta_estimate(&a) == 3000);
+	theta_bounds(&a, 2, &lo, &hi);
+	expect("exact bounds not tight", lo == 3000 && hi == 3000);
+	theta_compact_free(&a);
+	theta_free(&s);
+
+	// large sets within a few standard errors, 1/sqrt(4096) = 1.6%
+	theta_init(&s, 4096, 0);
+	for (i = 0; i < NKEYS; i++) {
+		keys[i] = i;
+		ptr[i] = &keys[i];
+		lens[i] = sizeof(keys[i]);
+		hashes[i] = spooky_hash64(&keys[i], sizeof(keys[i]), 0);
+		theta_update(&s, &keys[i], sizeof(keys[i]));
+	}
+	check_estimate("1M keys", theta_sketch_estimate(&s), NKEYS, NKEYS, 0.05);
+	theta_compact(&a, &s);
+	expect("compact too big", a.n <= 2 * 4096 && a.n >= 4096);
+	check_estimate("1M keys compact", theta_estimate(&a), NKEYS, NKEYS, 0.05);
+	theta_bounds(&a, 3, &lo, &hi);
+	expect("bounds miss the true size", lo < NKEYS && NKEYS < hi);
+	expect("bounds too wide", hi - lo < 0.2 * NKEYS);
+	theta_free(&s);
+
+	// batches give the same sketch as single updates
+	theta_init(&s, 4096, 0);
+	theta_update_batch(&s, ptr, lens, NKEYS);
+	theta_compact(&b, &s);
+	expect("batch update differs", same(&a, &b));
+	theta_compact_free(&b);
+	theta_free(&s);
+	theta_init(&s, 4096, 0);
+	theta_update_hashes(&s, hashes, 1001);
+	theta_update_hashes(&s, hashes + 1001, NKEYS - 1001);
+	theta_compact(&b, &s);
+	expect("hash update differs", same(&a, &b));
+	theta_compact_free(&b);
+	theta_free(&s);
+
+	// serialized sketches are used in place
+	buf = malloc(theta_serialized_size(&a));
+	theta_serialize(&a, buf);
+	expect("view failed",
+	       theta_view(&v, buf, theta_serialized_size(&a)) == 0);
+	expect("view differs", same(&a, &v) && v.k == a.k && v.seed == a.seed);
+	expect("short buffer accepted",
+	       theta_view(&v, buf, theta_serialized_size(&a) - 8) < 0);
+	buf[0] ^= 1;
+	expect("bad magic accepted",
+	       theta_view(&v, buf, theta_serialized_size(&a)) < 0);
+	free(buf);
+	theta_compact_free(&a);
+
+	// set operations of overlapping ranges: a = [0, 600k), b = [400k, 1M)
+	sketch_range(&a, 4096, 0, 600000, 0);
+	sketch_range(&b, 4096, 400000, NKEYS, 0);
+	expect("union failed", theta_union(&c, &a, &b) == 0);
+	check_estimate("union", theta_estimate(&c), NKEYS, NKEYS, 0.05);
+	expect("union bigger than k", c.n <= 4096);
+	theta_compact_free(&c);
+	expect("intersection failed", theta_intersect(&c, &a, &b) == 0);
+	check_estimate("intersection", theta_estimate(&c), 200000, NKEYS, 0.05);
+	theta_compact_free(&c);
+	expect("difference failed", theta_difference(&c, &a, &b) == 0);
+	check_estimate("difference", theta_estimate(&c), 400000, NKEYS, 0.05);
+
+	// results compose: (a - b) + (a & b) is a
+	theta_intersect(&d, &a, &b);
+	theta_compact_free(&b);
+	expect("union of parts failed", theta_union(&b, &c, &d) == 0);
+	check_estimate("union of parts", theta_estimate(&b), 600000, NKEYS,
+		       0.05);
+	theta_compact_free(&b);
+	theta_compact_free(&c);
+	theta_compact_free(&d);
+
+	// disjoint and identical sets
+	sketch_range(&b, 4096, 0, 600000, 0);
+	theta_difference(&c, &a, &b);
+	expect("difference of equal sets", c.n == 0);
+	theta_compact_free(&c);
+	theta_intersect(&c, &a, &b);
+	expect("intersection of equal sets", same(&a, &c));
+	theta_compact_free(&c);
+	theta_compact_free(&b);
+	sketch_range(&b, 4096, 600000, NKEYS, 0);
+	theta_intersect(&c, &a, &b);
+	expect("intersection of disjoint sets", c.n == 0);
+	theta_compact_free(&c);
+	theta_compact_free(&b);
+
+	// exact sketches stay exact under union
+	sketch_range(&b, 4096, 0, 1000, 0);
+	sketch_range(&d, 4096, 500, 2000, 0);
+	theta_union(&c, &b, &d);
+	expect("exact union not exact", theta_estimate(&c) == 2000);
+	theta_compact_free(&c);
+	theta_compact_free(&d);
+
+	// sketches of different seeds can't be combined
+	sketch_range(&d, 4096, 0, 1000, 1);
+	expect("seed mismatch accepted", theta_union(&c, &b, &d) < 0);
+	expect("seed mismatch accepted", theta_intersect(&c, &b, &d) < 0);
+	theta_compact_free(&d);
+	theta_compact_free(&b);
+	theta_compact_free(&a);
+
+	// a smaller k has the larger error, and unions take the smaller k
+	theta_init(&s, 64, 0);
+	theta_init(&t, 4096, 0);
+	for (i = 0; i < 100000; i++) {
+		theta_update(&s, &i, sizeof(i));
+		theta_update(&t, &i, sizeof(i));
+	}
+	theta_compact(&a, &s);
+	theta_compact(&b, &t);
+	check_estimate("k = 64", theta_estimate(&a), 100000, 100000, 0.5);
+	theta_union(&c, &a, &b);
+	expect("union kept the larger k", c.k == 64 && c.n <= 64);
+	theta_compact_free(&a);
+	theta_compact_free(&b);
+	theta_compact_free(&c);
+	theta_free(&s);
+	theta_free(&t);
+	expect("k = 0 accepted", theta_init(&s, 0, 0) < 0);
+}
+
+#define NBENCH 10000000
+void DoTimingTheta()
+{
+	uint64_t *keys = malloc(NBENCH * sizeof(uint64_t));
+	uint64_t *hashes = malloc(NBENCH * sizeof(uint64_t));
+	const void **ptr = malloc(NBENCH * sizeof(void *));
+	size_t *lens = malloc(NBENCH * sizeof(size_t));
+	struct theta_compact a, b, c;
+	struct timespec ts, tp;
+	struct theta_sketch s;
+	double t;
+	size_t i;
+	int k;
+
+	printf("\ntesting time to sketch %d keys ...\n", NBENCH);
+	for (i = 0; i < NBENCH; i++) {
+		keys[i] = i;
+		ptr[i] = &keys[i];
+		lens[i] = sizeof(keys[i]);
+		hashes[i] = spooky_hash64(&keys[i], sizeof(keys[i]), 0);
+	}
+
+	for (k = 1024; k <= 65536; k *= 8) {
+		theta_init(&s, k, 0);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		for (i = 0; i < NBENCH; i++)
+			theta_update(&s, &keys[i], sizeof(keys[i]));
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("k %5d, one key at a time: %.2lf ns per key\n", k,
+		       t * BILLION / NBENCH);
+		theta_free(&s);
+
+		theta_init(&s, k, 0);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		theta_update_batch(&s, ptr, lens, NBENCH);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("k %5d, batches of keys: %.2lf ns per key\n", k,
+		       t * BILLION / NBENCH);
+		theta_free(&s);
+
+		theta_init(&s, k, 0);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		for (i = 0; i < NBENCH; i++)
+			theta_update_hash(&s, hashes[i]);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("k %5d, one hash at a time: %.2lf ns per hash\n", k,
+		       t * BILLION / NBENCH);
+		theta_free(&s);
+
+		theta_init(&s, k, 0);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		theta_update_hashes(&s, hashes, NBENCH);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("k %5d, batches of hashes: %.2lf ns per hash\n", k,
+		       t * BILLION / NBENCH);
+		theta_free(&s);
+
+		sketch_range(&a, k, 0, NBENCH / 2, 0);
+		sketch_range(&b, k, NBENCH / 4, NBENCH, 0);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		for (i = 0; i < 100; i++) {
+			theta_union(&c, &a, &b);
+			theta_compact_free(&c);
+			theta_intersect(&c, &a, &b);
+			theta_compact_free(&c);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		t = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / BILLION;
+		printf("k %5d, union and intersection: %.2lf us\n", k,
+		       t * 1E6 / 100);
+		theta_compact_free(&a);
+		theta_compact_free(&b);
+	}
+	free(keys);
+	free(hashes);
+	free(ptr);
+	free(lens);
+}
+
+int main(int argc, const char **argv)
+{
+	(void) argv;
+
+	TestTheta();
+	if (argc > 1)
+		DoTimingTheta();
+
+	return failures != 0;
+}
@@ -0,0 +1,184 @@
+// Tests and benchmark for replaying hash call traces
+//
+// With an argument that names a trace file the benchmark replays that
+// trace, otherwise a synthetic mix of 7, 23 and 300 byte keys at random
+// alignments.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spooky-c.h"
+#include "trace.h"
+
+#define BILLION 1E9
+
+static int failures;
+
+static const char sample[] =
+	"# len align api seed\n"
+	"7 3 hash64 0\n"
+	"\n"
+	"23 0 hash128 12345\n"
+	"  300 17 shorthash r\n"
+	"0 63 hash32 0x10\n"
+	"200 8 fasthash64 9\n";
+
+void TestTrace()
+{
+	char file[] = "/tmp/spooky-traceXXXXXX";
+	struct trace t, t2;
+	struct trace_result r, r2;
+	FILE *f;
+	size_t i;
+	int api;
+
+	printf("\ntesting hash call traces ...\n");
+
+	trace_init(&t);
+	f = fmemopen((void *)sample, sizeof(sample) - 1, "r");
+	if (trace_read(&t, f) != 0 || t.n != 5 || t.maxlen != 300 ||
+	    t.e[0].len != 7 || t.e[0].align != 3 || t.e[0].api != TRACE_HASH64 ||
+	    t.e[1].seed != 12345 || t.e[2].flags != TRACE_RANDOM_SEED ||
+	    t.e[3].seed != 16 || t.e[4].api != TRACE_FASTHASH64) {
+		printf("trace not parsed right\n");
+		failures++;
+	}
+	fclose(f);
+
+	f = fmemopen("7 3 hash64 0\n7 64 hash64 0\n", 26, "r");
+	trace_init(&t2);
+	if (trace_read(&t2, f) != 2) {
+		printf("bad alignment not reported\n");
+		failures++;
+	}
+	fclose(f);
+	trace_free(&t2);
+
+	// written entries read back the same
+	close(mkstemp(file));
+	f = fopen(file, "w");
+	for (i = 0; i < t.n; i++)
+		trace_write_entry(f, &t.e[i]);
+	fclose(f);
+	f = fopen(file, "r");
+	trace_init(&t2);
+	if (trace_read(&t2, f) != 0 || t2.n != t.n ||
+	    memcmp(t.e, t2.e, t.n * sizeof(struct trace_entry))) {
+		printf("trace did not round trip\n");
+		failures++;
+	}
+	fclose(f);
+	unlink(file);
+	trace_free(&t2);
+
+	// replays are repeatable and do the calls they claim to do
+	for (api = TRACE_RECORDED; api < TRACE_NAPI; api++) {
+		trace_replay(&t, api, 1, &r);
+		trace_replay(&t, api, 3, &r2);
+		if (r.calls != 5 || r.bytes != 530 || r2.check != r.check) {
+			printf("replay of %s wrong\n", trace_api_name(api));
+			failures++;
+		}
+	}
+	t.n = 1;
+	trace_replay(&t, TRACE_RECORDED, 1, &r);
+	{
+		// the first key sits at offset 3 of the replay buffer
+		unsigned char key[7];
+
+		for (i = 0; i < 7; i++)
+			key[i] = (i + 3) * 131 + ((i + 3) >> 8);
+		if (r.check != spooky_hash64(key, 7, 0)) {
+			printf("replayed hash wrong\n");
+			failures++;
+		}
+	}
+	trace_free(&t);
+}
+
+static int cmp_len(const void *a, const void *b)
+{
+	const struct trace_entry *x = a, *y = b;
+
+	return (x->len > y->len) - (x->len < y->len);
+}
+
+static void report(const char *what, const struct trace_result *r)
+{
+	printf("%-11s %6.1lf ns/call %6.2lf GB/s", what,
+	       r->seconds * BILLION / r->calls, r->bytes / r->seconds / 1e9);
+	if (r->cycles >= 0)
+		printf(" %6.1lf cycles/call %5.3lf mispredicts/call",
+		       (double)r->cycles / r->calls,
+		       (double)r->branch_misses / r->calls);
+	printf("\n");
+}
+
+#define NCALLS 1000000
+void DoTimingTrace(const char *file)
+{
+	struct trace_result r;
+	struct trace t;
+	FILE *f;
+	int api;
+
+	trace_init(&t);
+	f = file ? fopen(file, "r") : NULL;
+	if (f) {
+		long bad = trace_read(&t, f);
+
+		fclose(f);
+		if (bad) {
+			printf("%s:%ld: bad trace line\n", file, bad);
+			trace_free(&t);
+			return;
+		}
+		printf("\nreplaying %zu calls from %s ...\n", t.n, file);
+	} else {
+		static const uint32_t lens[3] = { 7, 23, 300 };
+		struct trace_entry e;
+		size_t i;
+
+		srand(1);
+		memset(&e, 0, sizeof(e));
+		for (i = 0; i < NCALLS; i++) {
+			e.len = lens[rand() % 3];
+			e.align = rand() % 64;
+			e.api = TRACE_HASH64;
+			trace_add(&t, &e);
+		}
+		printf("\nreplaying %d calls of 7, 23 and 300 bytes at random alignments ...\n",
+		       NCALLS);
+	}
+	if (t.n == 0) {
+		trace_free(&t);
+		return;
+	}
+
+	for (api = TRACE_RECORDED; api < TRACE_NAPI; api++) {
+		trace_replay(&t, api, 10, &r);
+		report(trace_api_name(api), &r);
+	}
+
+	// the same calls grouped by length, which the predictor learns
+	qsort(t.e, t.n, sizeof(struct trace_entry), cmp_len);
+	trace_replay(&t, TRACE_HASH64, 10, &r);
+	report("sorted", &r);
+	if (r.cycles < 0)
+		printf("(no access to the performance counters)\n");
+	trace_free(&t);
+}
+
+int main(int argc, const char **argv)
+{
+	TestTrace();
+	if (argc > 1)
+		DoTimingTrace(argv[1]);
+
+	return failures != 0;
+}
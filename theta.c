@@ -0,0 +1,375 @@
+// Theta sketches for set operation estimates
+//
+// theta is exclusive: a sketch holds the hashes h with 0 < h < theta,
+// and a fresh sketch starts at theta = 2^64 - 1, which counts as all of
+// them.  The set is sized for 2k hashes at half load; rebuilding it when
+// full keeps the k smallest with a quickselect, so the work per rebuild is
+// linear and happens once every k new samples.
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "spooky-c.h"
+#include "theta.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_FILTER_AVX2 1
+#endif
+
+#define THETA_MAGIC 0x31617468796b6f6fULL	// "ookyhta1"
+#define THETA_MAX UINT64_MAX
+#define BATCH 256
+
+static const double two64 = 18446744073709551616.0;
+
+int theta_init(struct theta_sketch *s, uint32_t k, uint64_t seed)
+{
+	size_t nslots = 16;
+
+	memset(s, 0, sizeof(*s));
+	if (k < 1)
+		return -1;
+	while (nslots < 4 * (size_t)k)
+		nslots *= 2;
+	// the slots, then room for rebuild to gather 2k + 1 hashes
+	s->slot = calloc(nslots + 2 * (size_t)k + 1, sizeof(uint64_t));
+	if (!s->slot)
+		return -1;
+	s->mask = nslots - 1;
+	s->k = k;
+	s->seed = seed;
+	s->theta = THETA_MAX;
+	return 0;
+}
+
+void theta_free(struct theta_sketch *s)
+{
+	free(s->slot);
+	memset(s, 0, sizeof(*s));
+}
+
+static void swap(uint64_t *a, uint64_t *b)
+{
+	uint64_t t = *a;
+
+	*a = *b;
+	*b = t;
+}
+
+// reorder v so that v[k] is the value that would be there if v were
+// sorted, with all smaller values before it
+static void select_kth(uint64_t *v, size_t n, size_t k)
+{
+	size_t lo = 0, hi = n;
+
+	while (hi - lo > 1) {
+		uint64_t pivot = v[lo + (hi - lo) / 2];
+		size_t lt = lo, i = lo, gt = hi;
+
+		// [lo, lt) < pivot, [lt, gt) == pivot, [gt, hi) > pivot
+		while (i < gt) {
+			if (v[i] < pivot)
+				swap(&v[lt++], &v[i++]);
+			else if (v[i] > pivot)
+				swap(&v[i], &v[--gt]);
+			else
+				i++;
+		}
+		if (k < lt)
+			hi = lt;
+		else if (k >= gt)
+			lo = gt;
+		else
+			return;
+	}
+}
+
+static void set_insert(struct theta_sketch *s, uint64_t h)
+{
+	size_t i;
+
+	for (i = h & s->mask; s->slot[i]; i = (i + 1) & s->mask)
+		if (s->slot[i] == h)
+			return;
+	s->slot[i] = h;
+	s->n++;
+}
+
+// keep the k smallest hashes and lower theta to the next one
+static void rebuild(struct theta_sketch *s)
+{
+	uint64_t *v = s->slot + s->mask + 1;
+	size_t i, n = 0;
+
+	for (i = 0; i <= s->mask; i++)
+		if (s->slot[i])
+			v[n++] = s->slot[i];
+	select_kth(v, n, s->k);
+	s->theta = v[s->k];
+	memset(s->slot, 0, (s->mask + 1) * sizeof(uint64_t));
+	s->n = 0;
+	for (i = 0; i < s->k; i++)
+		set_insert(s, v[i]);
+}
+
+void theta_update_hash(struct theta_sketch *s, uint64_t h)
+{
+	if (h == 0 || h >= s->theta)
+		return;
+	set_insert(s, h);
+	if (s->n > 2 * (size_t)s->k)
+		rebuild(s);
+}
+
+void theta_update(struct theta_sketch *s, const void *key, size_t len)
+{
+	theta_update_hash(s, spooky_hash64(key, len, s->seed));
+}
+
+#ifdef HAVE_FILTER_AVX2
+// the hashes below theta, packed to the front of h; returns their number
+__attribute__((target("avx2")))
+static size_t filter_avx2(uint64_t *h, size_t n, uint64_t theta)
+{
+	const __m256i sign = _mm256_set1_epi64x(0x8000000000000000LL);
+	__m256i t = _mm256_xor_si256(_mm256_set1_epi64x(theta), sign);
+	size_t i, out = 0;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(h + i));
+		// h < theta as unsigned is theta > h with both signs flipped
+		__m256i lt = _mm256_cmpgt_epi64(t, _mm256_xor_si256(v, sign));
+		int m = _mm256_movemask_pd(_mm256_castsi256_pd(lt));
+
+		while (m) {
+			int b = __builtin_ctz(m);
+
+			h[out++] = h[i + b];
+			m &= m - 1;
+		}
+	}
+	for (; i < n; i++)
+		if (h[i] < theta)
+			h[out++] = h[i];
+	return out;
+}
+#endif
+
+static size_t filter(uint64_t *h, size_t n, uint64_t theta)
+{
+	size_t i, out = 0;
+
+#ifdef HAVE_FILTER_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return filter_avx2(h, n, theta);
+#endif
+	for (i = 0; i < n; i++)
+		if (h[i] < theta)
+			h[out++] = h[i];
+	return out;
+}
+
+static void update_filtered(struct theta_sketch *s, uint64_t *h, size_t n)
+{
+	size_t i;
+
+	// theta may drop during the loop, which theta_update_hash checks
+	n = filter(h, n, s->theta);
+	for (i = 0; i < n; i++)
+		theta_update_hash(s, h[i]);
+}
+
+void theta_update_hashes(struct theta_sketch *s, const uint64_t *h, size_t n)
+{
+	uint64_t buf[BATCH];
+	size_t i;
+
+	for (i = 0; i < n; i += BATCH) {
+		size_t m = n - i < BATCH ? n - i : BATCH;
+
+		memcpy(buf, h + i, m * sizeof(uint64_t));
+		update_filtered(s, buf, m);
+	}
+}
+
+void theta_update_batch(struct theta_sketch *s, const void *const *keys,
+			const size_t *lens, size_t n)
+{
+	uint64_t buf[BATCH];
+	size_t i, k;
+
+	for (i = 0; i < n; i += BATCH) {
+		size_t m = n - i < BATCH ? n - i : BATCH;
+
+		for (k = 0; k < m; k++)
+			buf[k] = spooky_hash64(keys[i + k], lens[i + k], s->seed);
+		update_filtered(s, buf, m);
+	}
+}
+
+double theta_sketch_estimate(const struct theta_sketch *s)
+{
+	if (s->theta == THETA_MAX)
+		return s->n;
+	return s->n / (s->theta / two64);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+static int alloc_compact(struct theta_compact *c, uint64_t k, uint64_t seed,
+			 size_t n)
+{
+	memset(c, 0, sizeof(*c));
+	c->owned = malloc((n ? n : 1) * sizeof(uint64_t));
+	if (!c->owned)
+		return -1;
+	c->h = c->owned;
+	c->k = k;
+	c->seed = seed;
+	return 0;
+}
+
+int theta_compact(struct theta_compact *c, const struct theta_sketch *s)
+{
+	size_t i;
+
+	if (alloc_compact(c, s->k, s->seed, s->n) < 0)
+		return -1;
+	for (i = 0; i <= s->mask; i++)
+		if (s->slot[i])
+			c->owned[c->n++] = s->slot[i];
+	qsort(c->owned, c->n, sizeof(uint64_t), cmp_u64);
+	c->theta = s->theta;
+	return 0;
+}
+
+void theta_compact_free(struct theta_compact *c)
+{
+	free(c->owned);
+	memset(c, 0, sizeof(*c));
+}
+
+double theta_estimate(const struct theta_compact *c)
+{
+	if (c->theta == THETA_MAX)
+		return c->n;
+	return c->n / (c->theta / two64);
+}
+
+void theta_bounds(const struct theta_compact *c, double stddevs, double *lo,
+		  double *hi)
+{
+	double p = c->theta == THETA_MAX ? 1.0 : c->theta / two64;
+	// the number of samples is binomial with p the sampled fraction
+	double sd = sqrt(c->n * (1.0 - p)) / p;
+	double est = theta_estimate(c);
+
+	*lo = est - stddevs * sd < c->n ? c->n : est - stddevs * sd;
+	*hi = est + stddevs * sd;
+}
+
+size_t theta_serialized_size(const struct theta_compact *c)
+{
+	return sizeof(struct theta_header) + c->n * sizeof(uint64_t);
+}
+
+void theta_serialize(const struct theta_compact *c, void *buf)
+{
+	struct theta_header h;
+
+	h.magic = THETA_MAGIC;
+	h.k = c->k;
+	h.seed = c->seed;
+	h.theta = c->theta;
+	h.n = c->n;
+	memcpy(buf, &h, sizeof(h));
+	memcpy((char *)buf + sizeof(h), c->h, c->n * sizeof(uint64_t));
+}
+
+int theta_view(struct theta_compact *c, const void *buf, size_t size)
+{
+	const struct theta_header *h = buf;
+
+	memset(c, 0, sizeof(*c));
+	if (size < sizeof(*h) || h->magic != THETA_MAGIC ||
+	    h->n > (size - sizeof(*h)) / sizeof(uint64_t) ||
+	    size != sizeof(*h) + h->n * sizeof(uint64_t))
+		return -1;
+	c->k = h->k;
+	c->seed = h->seed;
+	c->theta = h->theta;
+	c->n = h->n;
+	c->h = (const uint64_t *)(h + 1);
+	return 0;
+}
+
+int theta_union(struct theta_compact *dst, const struct theta_compact *a,
+		const struct theta_compact *b)
+{
+	uint64_t theta = a->theta < b->theta ? a->theta : b->theta;
+	uint64_t k = a->k < b->k ? a->k : b->k;
+	size_t i = 0, j = 0, max = a->n + b->n < k + 1 ? a->n + b->n : k + 1;
+
+	if (a->seed != b->seed || alloc_compact(dst, k, a->seed, max) < 0)
+		return -1;
+	// merge below the smaller theta, dropping duplicates, until there
+	// is one more than k
+	while ((i < a->n || j < b->n) && dst->n < max) {
+		uint64_t v;
+
+		if (j == b->n || (i < a->n && a->h[i] < b->h[j]))
+			v = a->h[i++];
+		else if (i == a->n || b->h[j] < a->h[i])
+			v = b->h[j++];
+		else
+			v = a->h[i++], j++;
+		if (v >= theta)
+			break;
+		dst->owned[dst->n++] = v;
+	}
+	// keep at most k, as a sketch of size k would
+	if (dst->n > k) {
+		theta = dst->owned[k];
+		dst->n = k;
+	}
+	dst->theta = theta;
+	return 0;
+}
+
+// the hashes of a below theta that are, or are not, in b
+static int match(struct theta_compact *dst, const struct theta_compact *a,
+		 const struct theta_compact *b, int keep_common)
+{
+	uint64_t theta = a->theta < b->theta ? a->theta : b->theta;
+	size_t i, j = 0;
+
+	if (a->seed != b->seed ||
+	    alloc_compact(dst, a->k > b->k ? a->k : b->k, a->seed, a->n) < 0)
+		return -1;
+	for (i = 0; i < a->n && a->h[i] < theta; i++) {
+		while (j < b->n && b->h[j] < a->h[i])
+			j++;
+		if ((j < b->n && b->h[j] == a->h[i]) == keep_common)
+			dst->owned[dst->n++] = a->h[i];
+	}
+	dst->theta = theta;
+	return 0;
+}
+
+int theta_intersect(struct theta_compact *dst, const struct theta_compact *a,
+		    const struct theta_compact *b)
+{
+	return match(dst, a, b, 1);
+}
+
+int theta_difference(struct theta_compact *dst, const struct theta_compact *a,
+		     const struct theta_compact *b)
+{
+	return match(dst, a, b, 0);
+}
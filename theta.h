@@ -0,0 +1,86 @@
+// Theta sketches for set operation estimates
+//
+// A theta (KMV, bottom-k) sketch of a set keeps the k smallest distinct
+// spooky_hash64 values of its keys below a threshold theta.  The hashes
+// are uniform, so the fraction theta / 2^64 of all hashes is sampled and
+// the set has about n / (theta / 2^64) keys.  Unlike HyperLogLog, the
+// samples of two sketches can be compared with each other, which gives
+// the size of unions, intersections and differences: take the smaller
+// theta and count the matching hashes below it.  The relative standard
+// error of an estimate is about 1/sqrt(k) of the union of the inputs, so
+// small intersections of large sets are estimated poorly by any sketch.
+//
+// An updatable sketch keeps its hashes in an open addressing set of up to
+// 2k entries; when it fills up, theta drops to the (k+1)-th smallest hash
+// and the larger ones are thrown away.  Batches of keys are hashed first,
+// and those at or above theta are dropped with AVX2 compares four at a
+// time before any of them touches the set, which after the first few
+// thousand keys is nearly all of them.
+//
+// A compact sketch is the sorted array of hashes with its theta, and is
+// what set operations take and produce.  Its serialized form is a header
+// followed by that array, in native (little) endian, and can be used
+// directly from a buffer or a file mapping.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct theta_sketch
+{
+	uint64_t seed;
+	uint32_t k;
+	uint64_t theta;
+	uint64_t *slot;		// 0 marks an empty slot
+	size_t mask;
+	size_t n;
+};
+
+struct theta_header
+{
+	uint64_t magic;
+	uint64_t k;
+	uint64_t seed;
+	uint64_t theta;
+	uint64_t n;
+};
+
+struct theta_compact
+{
+	uint64_t k;
+	uint64_t seed;
+	uint64_t theta;
+	uint64_t n;
+	const uint64_t *h;	// sorted ascending
+	uint64_t *owned;	// h when it was allocated
+};
+
+int theta_init(struct theta_sketch *s, uint32_t k, uint64_t seed);
+void theta_free(struct theta_sketch *s);
+void theta_update(struct theta_sketch *s, const void *key, size_t len);
+void theta_update_hash(struct theta_sketch *s, uint64_t h);
+void theta_update_batch(struct theta_sketch *s, const void *const *keys,
+			const size_t *lens, size_t n);
+void theta_update_hashes(struct theta_sketch *s, const uint64_t *h, size_t n);
+double theta_sketch_estimate(const struct theta_sketch *s);
+
+int theta_compact(struct theta_compact *c, const struct theta_sketch *s);
+void theta_compact_free(struct theta_compact *c);
+double theta_estimate(const struct theta_compact *c);
+// bounds of the estimate, about stddevs standard deviations wide
+void theta_bounds(const struct theta_compact *c, double stddevs, double *lo,
+		  double *hi);
+
+size_t theta_serialized_size(const struct theta_compact *c);
+void theta_serialize(const struct theta_compact *c, void *buf);
+// c points into buf, which must stay valid and 8 byte aligned
+int theta_view(struct theta_compact *c, const void *buf, size_t size);
+
+// all return -1 when the seeds differ or memory runs out
+int theta_union(struct theta_compact *dst, const struct theta_compact *a,
+		const struct theta_compact *b);
+int theta_intersect(struct theta_compact *dst, const struct theta_compact *a,
+		    const struct theta_compact *b);
+// a and not b
+int theta_difference(struct theta_compact *dst, const struct theta_compact *a,
+		     const struct theta_compact *b);
@@ -0,0 +1,240 @@
+// Replaying recorded hash call traces
+//
+// Before timing, every call is turned into a pointer, length, api and
+// seed, so the timed loop does nothing but the calls.  Keys are spread
+// over 64 buffers that together stay in the cache, since a trace does
+// not say where the keys came from.
+
+#define _GNU_SOURCE 1
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "spooky-c.h"
+#include "trace.h"
+
+#define NBUF 64
+
+static const char *names[TRACE_NAPI] = {
+	"hash128", "hash64", "hash32", "shorthash", "fasthash64"
+};
+
+struct call
+{
+	const void *msg;
+	uint32_t len;
+	uint32_t api;
+	uint64_t seed;
+};
+
+void trace_init(struct trace *t)
+{
+	memset(t, 0, sizeof(*t));
+}
+
+void trace_free(struct trace *t)
+{
+	free(t->e);
+	trace_init(t);
+}
+
+int trace_add(struct trace *t, const struct trace_entry *e)
+{
+	if (e->api >= TRACE_NAPI || e->align >= 64)
+		return -1;
+	if (t->n == t->cap) {
+		size_t cap = t->cap ? 2 * t->cap : 1024;
+		struct trace_entry *n = realloc(t->e, cap * sizeof(*n));
+
+		if (!n)
+			return -1;
+		t->e = n;
+		t->cap = cap;
+	}
+	t->e[t->n++] = *e;
+	if (e->len > t->maxlen)
+		t->maxlen = e->len;
+	return 0;
+}
+
+const char *trace_api_name(int api)
+{
+	if (api == TRACE_RECORDED)
+		return "recorded";
+	return api >= 0 && api < TRACE_NAPI ? names[api] : "?";
+}
+
+long trace_read(struct trace *t, FILE *f)
+{
+	char line[256], api[32], seed[32];
+	long lineno = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		struct trace_entry e;
+		unsigned long len, align;
+		char *p = line + strspn(line, " \t");
+		int i;
+
+		lineno++;
+		if (*p == '#' || *p == '\n' || *p == 0)
+			continue;
+		if (sscanf(p, "%lu %lu %31s %31s", &len, &align, api, seed) != 4 ||
+		    len > UINT32_MAX || align >= 64)
+			return lineno;
+		memset(&e, 0, sizeof(e));
+		e.len = len;
+		e.align = align;
+		for (i = 0; i < TRACE_NAPI; i++)
+			if (strcmp(api, names[i]) == 0)
+				break;
+		if (i == TRACE_NAPI)
+			return lineno;
+		e.api = i;
+		if (strcmp(seed, "r") == 0) {
+			e.flags = TRACE_RANDOM_SEED;
+		} else {
+			char *end;
+
+			e.seed = strtoull(seed, &end, 0);
+			if (*end)
+				return lineno;
+		}
+		if (trace_add(t, &e) < 0)
+			return lineno;
+	}
+	return 0;
+}
+
+int trace_write_entry(FILE *f, const struct trace_entry *e)
+{
+	if (e->flags & TRACE_RANDOM_SEED)
+		return fprintf(f, "%u %u %s r\n", e->len, e->align,
+			       names[e->api]) < 0 ? -1 : 0;
+	return fprintf(f, "%u %u %s %llu\n", e->len, e->align, names[e->api],
+		       (unsigned long long)e->seed) < 0 ? -1 : 0;
+}
+
+static int counter_open(uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static int64_t counter_read(int fd)
+{
+	int64_t v;
+
+	if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v))
+		return -1;
+	return v;
+}
+
+static uint64_t run(const struct call *c, size_t n, int reps)
+{
+	uint64_t check = 0, h1, h2;
+	size_t i;
+	int r;
+
+	for (r = 0; r < reps; r++) {
+		for (i = 0; i < n; i++) {
+			switch (c[i].api) {
+			case TRACE_HASH128:
+				h1 = h2 = c[i].seed;
+				spooky_hash128(c[i].msg, c[i].len, &h1, &h2);
+				check ^= h1 ^ h2;
+				break;
+			case TRACE_HASH64:
+				check ^= spooky_hash64(c[i].msg, c[i].len,
+						       c[i].seed);
+				break;
+			case TRACE_HASH32:
+				check ^= spooky_hash32(c[i].msg, c[i].len,
+						       c[i].seed);
+				break;
+			case TRACE_SHORTHASH:
+				h1 = h2 = c[i].seed;
+				spooky_shorthash(c[i].msg, c[i].len, &h1, &h2);
+				check ^= h1 ^ h2;
+				break;
+			case TRACE_FASTHASH64:
+				check ^= spooky_fasthash64(c[i].msg, c[i].len,
+							   c[i].seed);
+				break;
+			}
+		}
+	}
+	return check;
+}
+
+int trace_replay(const struct trace *t, int api, int reps,
+		 struct trace_result *r)
+{
+	size_t stride = (t->maxlen + 127) & ~63UL, i;
+	struct call *c = malloc((t->n ? t->n : 1) * sizeof(struct call));
+	unsigned char *buf = malloc(NBUF * stride);
+	struct timespec ts, tp;
+	uint64_t rnd = 0x9e3779b97f4a7c15ULL;
+	int cyc, mis;
+
+	if (!c || !buf || api < TRACE_RECORDED || api >= TRACE_NAPI) {
+		free(c);
+		free(buf);
+		return -1;
+	}
+	for (i = 0; i < NBUF * stride; i++)
+		buf[i] = i * 131 + (i >> 8);
+	memset(r, 0, sizeof(*r));
+	for (i = 0; i < t->n; i++) {
+		const struct trace_entry *e = &t->e[i];
+
+		c[i].msg = buf + (i % NBUF) * stride + e->align;
+		c[i].len = e->len;
+		c[i].api = api == TRACE_RECORDED ? e->api : api;
+		if (e->flags & TRACE_RANDOM_SEED) {
+			// xorshift, so replays are repeatable
+			rnd ^= rnd << 13;
+			rnd ^= rnd >> 7;
+			rnd ^= rnd << 17;
+			c[i].seed = rnd;
+		} else {
+			c[i].seed = e->seed;
+		}
+		r->bytes += e->len;
+	}
+	r->calls = t->n * reps;
+	r->bytes *= reps;
+
+	// warm up the caches and the predictor tables alike
+	run(c, t->n, 1);
+
+	cyc = counter_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+	mis = cyc < 0 ? -1 : counter_open(PERF_COUNT_HW_BRANCH_MISSES, cyc);
+	if (cyc >= 0)
+		ioctl(cyc, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	r->check = run(c, t->n, reps);
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	if (cyc >= 0)
+		ioctl(cyc, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	r->seconds = (tp.tv_sec - ts.tv_sec) + (tp.tv_nsec - ts.tv_nsec) / 1E9;
+	r->cycles = counter_read(cyc);
+	r->branch_misses = counter_read(mis);
+	if (mis >= 0)
+		close(mis);
+	if (cyc >= 0)
+		close(cyc);
+	free(buf);
+	free(c);
+	return 0;
+}
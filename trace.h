@@ -0,0 +1,80 @@
+// Replaying recorded hash call traces
+//
+// Benchmarks over power of two lengths at one alignment let the branch
+// predictor learn the remainder handling perfectly, which real callers
+// with a mix of key lengths never do.  A trace records the calls a
+// program actually made and can be replayed against each of the hash
+// functions, with the time and, where the kernel lets us read the
+// performance counters, the branch mispredictions and cycles per call.
+//
+// A trace is a text file with one call per line:
+//
+//	<length> <alignment> <api> <seed>
+//
+// alignment is the address of the key modulo 64, api one of hash128,
+// hash64, hash32, shorthash and fasthash64, and seed a number or r for a
+// fresh random seed per call.  Empty lines and lines starting with # are
+// ignored.  A capture shim only needs to print these four fields around
+// the hash calls of the program being measured; trace_write_entry does
+// exactly that.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+enum
+{
+	TRACE_HASH128,
+	TRACE_HASH64,
+	TRACE_HASH32,
+	TRACE_SHORTHASH,
+	TRACE_FASTHASH64,
+	TRACE_NAPI,
+	TRACE_RECORDED = -1	// trace_replay: the api of each call
+};
+
+#define TRACE_RANDOM_SEED	1	// trace_entry flags
+
+struct trace_entry
+{
+	uint32_t len;
+	uint8_t align;
+	uint8_t api;
+	uint16_t flags;
+	uint64_t seed;
+};
+
+struct trace
+{
+	struct trace_entry *e;
+	size_t n;
+	size_t cap;
+	size_t maxlen;
+};
+
+struct trace_result
+{
+	uint64_t calls;
+	uint64_t bytes;
+	double seconds;
+	int64_t cycles;		// -1 when the counters are not available
+	int64_t branch_misses;
+	uint64_t check;		// xor of all hashes
+};
+
+void trace_init(struct trace *t);
+void trace_free(struct trace *t);
+int trace_add(struct trace *t, const struct trace_entry *e);
+
+// Append the calls in f.  Returns 0, or the number of the first line
+// that could not be parsed.
+long trace_read(struct trace *t, FILE *f);
+int trace_write_entry(FILE *f, const struct trace_entry *e);
+
+const char *trace_api_name(int api);
+
+// Replay the trace reps times, every call with api or, for
+// TRACE_RECORDED, with the api it was recorded with.
+int trace_replay(const struct trace *t, int api, int reps,
+		 struct trace_result *r);
@@ -0,0 +1,51 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "util.h"
+
+void run_jobs(void *job, size_t size, int n, void *(*fn)(void *))
+{
+	pthread_t tid[n];
+	int started[n], i;
+
+	for (i = 1; i < n; i++)
+		started[i] = !pthread_create(&tid[i], NULL, fn,
+					     (char *)job + i * size);
+	fn(job);
+	for (i = 1; i < n; i++) {
+		if (started[i])
+			pthread_join(tid[i], NULL);
+		else
+			fn((char *)job + i * size);
+	}
+}
+
+size_t after_newline(const char *data, size_t size, size_t pos)
+{
+	const char *nl;
+
+	if (pos == 0 || pos >= size)
+		return pos < size ? pos : size;
+	nl = memchr(data + pos - 1, '\n', size - pos + 1);
+	return nl ? (size_t)(nl - data) + 1 : size;
+}
+
+int write_all(int fd, const void *buf, size_t len, uint64_t off)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = pwrite(fd, p, len, off);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
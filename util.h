@@ -0,0 +1,16 @@
+// Helpers shared by the modules that split work over threads and files
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Run fn on n jobs of size bytes each, the first on the calling thread.
+// A job whose thread cannot be started runs on the caller afterwards.
+// With size 0 all n threads get the same job.
+void run_jobs(void *job, size_t size, int n, void *(*fn)(void *));
+
+// the first position after the newline at or after pos
+size_t after_newline(const char *data, size_t size, size_t pos);
+
+// pwrite all of buf at off, retrying short writes
+int write_all(int fd, const void *buf, size_t len, uint64_t off);